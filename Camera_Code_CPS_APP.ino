@@ -1,375 +1,619 @@
-/*
- * ESP-32 Camera Module Code for the CPS Human in the loop project. 
- * The camera module has the following functions
- * 1. Take images periodically and store them in the SD card
- * 2. Communicate with the phone (Android app) using Bluetooth. 
- * 3. Transmit images saved in the SD card to the phone over Bluetooth.
- * 4. Send and receive other information to/from phone over Bluetooth.
- * 5. Remain in the deep sleep mode unless work is to be done.
- * 6. Maintain a RTC for time keeping. Query time over internet maybe at each reset.
- */
-
-
-// camera can send upto 5 Kilo Bytes, but in the phone side we can recieve at once 1058 bytes. 
-// The implementation of the input stream read is the problem. 
-// for now lets send 1Kb at one time.
- 
-#include "Arduino.h"
-#include "soc/soc.h"           // Disable brownout problems
-#include "soc/rtc_cntl_reg.h"  // Disable brownout problems
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "FS.h"
-#include "esp_log.h"
-
-#include "utils.h"
-#include "camera.h"
-#include "sd_card.h"
-#include "bluetooth.h"
-#include "bluetooth_comm.h"
-#include "time_manager.h"
-#include "driver/rtc_io.h"
-#include "esp_bt_main.h"
-#include "esp_bt_device.h"
-#include"esp_gap_bt_api.h"
-
-#define TIME_TO_SLEEP  5 * 60        /* Time ESP32 will go to sleep (in seconds) */
-
-#define VERSION "0.2"
-
-// THE SYSTEM RESTARTS AFTER 5 FAILED IMAGE TRANSFER.
-RTC_DATA_ATTR int failedBTConnections = 0;
-
-// Variable for the Bluetooth
-Bluetooth my_bluetooth;
-BluetoothCommunication my_bluetooth_comm;
-
-// Phone Bluetooth MAC address
-// TODO: Need to make this configurable. But how?
-uint8_t btServerAddress[6] = {0x18, 0x4e, 0x16, 0x81, 0x8a, 0x4f};
-
-// Deep sleep semaphore
-static SemaphoreHandle_t deep_sleep_semaphore = NULL;
-
-// variable for BT MAC address
-char bda_str[18];
-
-/**
- * We will have two tasks. 
- * 1. One task to take pictures and save the pictures to SD card. 
- * 2. Second task to connect to phone via Bluetooth and transmit images in the SD card.
- * 
- * To schedule a task, we need a function that contains the code we want to run and then 
- * create a task that calls this function. 
- */
-
-/**
- * Task to take pictures and save the pictures in the SD card
- */
-void camera_task(void * params) {
-  debug("camera task started!");
-
-  // before taking picture, ask the phone for the current time.
-  // we need this for the name of image.
-  my_bluetooth.take_bluetooth_serial_mutex(); 
-  my_bluetooth_comm.request_for_time(&my_bluetooth);
-  my_bluetooth.release_bluetooth_serial_mutex();
-
-  // strucutre that holds the camera data
-  camera_fb_t * fb = NULL;
-  fb = take_picture();
-  Serial.printf("camera_task: camera buf len %d\n", fb->len);
-
-  // if we have a picture, try to store it in the SD card.
-  acquire_sd_mmc();
-  if(!save_image_to_sd_card(SD_MMC, fb)) {
-    debug("camera_task: failed to save image to card");
-  }
-  release_sd_mmc();
-
-  // return the frame buffer back to the driver for reuse
-  esp_camera_fb_return(fb);
-
-  for(;;) {
-    // wait for the semaphore for deep sleep
-    if(xSemaphoreTake(deep_sleep_semaphore, portMAX_DELAY) == pdTRUE){
-      Serial.println("camera_task: obtained sleep semaphore. going to sleep....");
-
-      // go to deep sleep
-      go_to_deep_sleep(TIME_TO_SLEEP);
-    }
-  }
-}
-
-
-/**
- * Task to connect to phone via Bluetooth and send pictures stored in the SD card.
- */
-void bluetooth_task(void * params) {
-  debug("bluetooth task started!");
-
-  for(;;) {
-    // check whether we have connection or not
-    if(my_bluetooth.get_bt_connection_status() != BLUETOOTH_CONNECTED) {
-      my_bluetooth.bt_reconnect();
-    }
-
-    // // send the data untill done or transmit fixed number of images.
-    acquire_sd_mmc();
-    my_bluetooth.take_bluetooth_serial_mutex();
-    if(my_bluetooth_comm.send_next_image(&my_bluetooth, SD_MMC) == false) {
-      ++failedBTConnections;
-      if(failedBTConnections == 5) {
-        fflush(stdout);
-        esp_restart();
-      }
-    }
-    my_bluetooth.release_bluetooth_serial_mutex();
-    release_sd_mmc();
-
-    // give the Semaphore so that the camera can be put to sleep.
-    xSemaphoreGive(deep_sleep_semaphore);
-
-    // delete the task.
-    Serial.println("bluetooth_task: deleting bluetooth task");
-    vTaskDelete(NULL);
-  }
-}
-
-// Print the Bluetooth MAC address of the device
-char *bda2str(const uint8_t* bda, char *str, size_t size)
-{
-  if (bda == NULL || str == NULL || size < 18) {
-    return NULL;
-  }
-  sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x",
-          bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
-  return str;
-}
-
-// Setup Part
-void setup() {
-  // esp_log_level_set("ESP", ESP_LOG_DEBUG); // no effect on logging.
-
-  // Disable brownout detector
-  WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0); 
-
-  // turn on the LED1 to show camera is powered on
-  pinMode(33, OUTPUT);
-  digitalWrite(33, LOW);
-  
-  // Start the serial communication
-  Serial.begin(115200);
-  debug("setup: configuring services");
-  Serial.print("EPSL camera firmware version ");
-  Serial.println(VERSION);
-  
-  // register Bluetooth callback for status update
-  my_bluetooth.set_status_callback(bt_status_callback);   // THIS NEEDS TO BE HERE FOR PROPER CALLBACKS
-  
-  // initialize the Bluetooth
-  if(!my_bluetooth.init_bluetooth(btServerAddress))
-  {
-    Serial.println("setup: bluetooth init failed");
-    // go to deep sleep
-    go_to_deep_sleep(TIME_TO_SLEEP);
-  }
-
-  // print Bluetooth MAC address
-  Serial.print("BT MAC Addr: "); 
-  Serial.println(bda2str(esp_bt_dev_get_address(), bda_str, 18));
-  
-  // register the bluetooth callback for on receive 
-  my_bluetooth.set_on_receive_data_callback(bt_data_received_callback);
-
-  // initialize the camera module
-  if (init_camera() != ESP_OK) {
-    Serial.println("setup: camera init failed");
-    // go to deep sleep
-    go_to_deep_sleep(TIME_TO_SLEEP);
-  }
-  
-  // Turn off the on board LED
-  turn_off_camera_flash();
-
-  // initialize the SD module
-  if(!init_sd_card()) {
-    Serial.println("setup: sd card init failed");
-    // go to deep sleep
-    go_to_deep_sleep(TIME_TO_SLEEP);
-  }
-
-  // create the deep sleep semaphore
-  if(deep_sleep_semaphore == NULL){
-    deep_sleep_semaphore = xSemaphoreCreateBinary();
-    xSemaphoreTake(deep_sleep_semaphore, 0);
-  }
-
-  // Schedule the tasks. 
-  xTaskCreate(camera_task, "take pictue and save to sd card", 4096, NULL, 5, NULL);
-  xTaskCreate(bluetooth_task, "connect to phone and send data", 4096, NULL, 1, NULL);
-  // xTaskCreate(main_task, "task to take pic, save, and transmit", 8182, NULL, 1, NULL);
-}
-
-
-// Loop part of the code. 
-void loop() {
-  // uint8_t buffer [1024];
-  // my_bluetooth_comm.send_data(&my_bluetooth, BT_RESPONSE, RESPONSE_FOR_OTHER_DATA, buffer, 1024);
-  // Serial.println("\n\n********************************\n\n");
-  // delay(1000 * 30);
-  delay(portMAX_DELAY);
-}
-
-
-/*
- * Callback which receives the data from the input stream of Bluetooth
- */
-void bt_data_received_callback(const uint8_t * buff, size_t len) {
-    uint8_t totalBytes = int(len);
-    if((buff != NULL) && (totalBytes > 0)){
-      // Serial.printf("bt_data_received_callback: data length: %d\n", totalBytes);
-      my_bluetooth.copy_received_data(buff, totalBytes);
-    }
-}
-
-/*
- * Callback function for the Bluetooth stack. We can monitor the Bluetooth status from 
- * here.
- */
-void bt_status_callback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
-  // debug(getSPP_CB_EventDes(event));
-  
-  switch(event) {
-    case ESP_SPP_OPEN_EVT:  // camera is connected to the phone
-      Serial.println("cb: camera connected to phone");
-      my_bluetooth.set_bt_connection_status(BLUETOOTH_CONNECTED);
-      break;
-
-    case ESP_SPP_CLOSE_EVT: // camera is disconnected from the phone
-      Serial.println("cb: camera disconnected from phone");
-      my_bluetooth.set_bt_connection_status(BLUETOOTH_DISCONNECTED);
-
-    //   Serial.printf("cb: %d\n", param->close.async ? 1 : 0);
-
-      // do we reconnect or what
-      break;
-      
-    case ESP_SPP_START_EVT: // camera as the Bluetooth server
-      Serial.println("cb: camera as server");
-      break;
-      
-    case ESP_SPP_CL_INIT_EVT: // camera started the connection to the phone
-      Serial.println("cb: camera connecting to phone");
-      my_bluetooth.set_bt_connection_status(BLUETOOTH_CONNECTING);
-      break;
-      
-    case ESP_SPP_SRV_OPEN_EVT: // camera as server has accepted an incoming connection
-      Serial.println("cb: camera as server has a connection");
-      break;
-      
-   case ESP_SPP_SRV_STOP_EVT: // camera as server has lost a connection
-     Serial.println("cb: camera as server has lost a connection");
-     break;
-      
-    case ESP_SPP_DATA_IND_EVT: // data is received over Bluetooth
-      Serial.printf("\ncb: camera has received data on BT %d\n", param->data_ind.len);
-      // Serial.printf("# bytes received %d\n", param->data_ind.len);
-      break;
-      
-    case ESP_SPP_WRITE_EVT: // data write over Bluetooth is completed
-      Serial.printf("cb: camera has written data on BT %d\n", param->write.len);
-      // Serial.printf("# bytes written %d\n", param->write.len);
-      my_bluetooth_comm.give_data_semaphore();
-      break;
-      
-    case ESP_SPP_CONG_EVT: // congestion status of Bluetooth has changed
-      Serial.println("cb: camera BT congestion status changed");
-      break;
-
-    default:
-      debug("cb: other event");
-      break;
-  }
-}
-
-/*
- * Get text description of the SPP callback event.
- */
-const char * getSPP_CB_EventDes(esp_spp_cb_event_t st) {
-  switch(st){
-    case ESP_SPP_INIT_EVT:
-      return "ESP_SPP_INIT_EVT: SPP is inited";
-    
-   case ESP_SPP_UNINIT_EVT:
-     return "ESP_SPP_UNINIT_EVT: SPP is uninited";
-      
-    case ESP_SPP_DISCOVERY_COMP_EVT:
-      return "ESP_SPP_DISCOVERY_COMP_EVT: SDP discovery complete";
-      
-    case ESP_SPP_OPEN_EVT:
-      return "ESP_SPP_OPEN_EVT: SPP Client connection open";
-      
-    case ESP_SPP_CLOSE_EVT:
-      return "ESP_SPP_CLOSE_EVT: SPP connection closed";
-      
-    case ESP_SPP_START_EVT:
-      return "ESP_SPP_START_EVT: SPP server started";
-      
-    case ESP_SPP_CL_INIT_EVT:
-      return "ESP_SPP_CL_INIT_EVT: SPP client initiated a connection";
-      
-    case ESP_SPP_DATA_IND_EVT:
-      return "ESP_SPP_DATA_IND_EVT: SPP connection received data";
-      
-    case ESP_SPP_CONG_EVT:
-      return "ESP_SPP_CONG_EVT: SPP connection congestion status changed";
-      
-    case ESP_SPP_WRITE_EVT:
-      return "ESP_SPP_WRITE_EVT: SPP write operation completes";
-      
-    case ESP_SPP_SRV_OPEN_EVT:
-      return "ESP_SPP_SRV_OPEN_EVT: SPP Server connection open";
-      
-   case ESP_SPP_SRV_STOP_EVT:
-     return "ESP_SPP_SRV_STOP_EVT: SPP server stopped";
-
-    default:
-      return "invalid";
-    
-  }
-}
-
-/*
- * Get text description of the SPP status enum.
- */
-const char * getSPP_StatusDes(esp_spp_status_t st) {
-  switch(st){
-    case ESP_SPP_SUCCESS:
-      return "ESP_SPP_SUCCESS: Successful operation";
-      
-    case ESP_SPP_FAILURE:
-      return "ESP_SPP_FAILURE: Generic failure";
-      
-    case ESP_SPP_BUSY:
-      return "ESP_SPP_BUSY: Temporarily can not handle this request";
-      
-    case ESP_SPP_NO_DATA:
-      return "ESP_SPP_NO_DATA: no data";
-      
-    case ESP_SPP_NO_RESOURCE:
-      return "ESP_SPP_NO_RESOURCE: No more resource";
-      
-    case ESP_SPP_NEED_INIT:
-      return "ESP_SPP_NEED_INIT: SPP module shall init first";
-      
-    case ESP_SPP_NEED_DEINIT:
-      return "ESP_SPP_NEED_DEINIT: SPP module shall deinit first";
-      
-    case ESP_SPP_NO_CONNECTION:
-      return "ESP_SPP_NO_CONNECTION: connection may have been closed";
-
-    default:
-      return "invalid";
-  }
-}
+/*
+ * ESP-32 Camera Module Code for the CPS Human in the loop project. 
+ * The camera module has the following functions
+ * 1. Take images periodically and store them in the SD card
+ * 2. Communicate with the phone (Android app) using Bluetooth. 
+ * 3. Transmit images saved in the SD card to the phone over Bluetooth.
+ * 4. Send and receive other information to/from phone over Bluetooth.
+ * 5. Remain in the deep sleep mode unless work is to be done.
+ * 6. Maintain a RTC for time keeping. Query time over internet maybe at each reset.
+ */
+
+
+// camera can send upto 5 Kilo Bytes, but in the phone side we can recieve at once 1058 bytes. 
+// The implementation of the input stream read is the problem. 
+// for now lets send 1Kb at one time.
+ 
+#include "Arduino.h"
+#include "soc/soc.h"           // Disable brownout problems
+#include "soc/rtc_cntl_reg.h"  // Disable brownout problems
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "FS.h"
+#include "esp_log.h"
+
+#include "utils.h"
+#include "camera.h"
+#include "sd_card.h"
+#include "bluetooth.h"
+#include "bluetooth_comm.h"
+#include "time_manager.h"
+#include "metrics.h"
+#include "kv_store.h"
+#include "device_config.h"
+#include "peer_table.h"
+#include "mem_pool.h"
+#include "resource_monitor.h"
+#include "energy.h"
+#include "power.h"
+#include "wake_source.h"
+#include "wake_budget.h"
+#include "driver/rtc_io.h"
+#include "esp_bt_main.h"
+#include "esp_bt_device.h"
+#include"esp_gap_bt_api.h"
+
+#define VERSION "0.2"
+
+// task stacks in bytes, the resource monitor reports how much of them is used
+#define CAMERA_TASK_STACK_SIZE 4096
+#define BLUETOOTH_TASK_STACK_SIZE 4096
+// setup() runs in the Arduino loop task
+#define SETUP_TASK_STACK_SIZE 8192
+
+// Task topology. The Bluetooth controller and the Bluedroid host run on core 0, so the radio and
+// protocol task joins them there, and capture, JPEG handling and SD writes get core 1 (the core
+// setup() and the camera driver interrupt run on). Set TASK_PINNING_ENABLED to 0 to let the
+// scheduler place the tasks freely and compare the latency histograms of the metrics.
+#ifndef TASK_PINNING_ENABLED
+#define TASK_PINNING_ENABLED 1
+#endif
+#define RADIO_TASK_CORE 0
+#define CAPTURE_TASK_CORE 1
+#ifndef CAMERA_TASK_PRIORITY
+#define CAMERA_TASK_PRIORITY 5
+#endif
+#ifndef BLUETOOTH_TASK_PRIORITY
+#define BLUETOOTH_TASK_PRIORITY 1
+#endif
+
+// Variable for the Bluetooth
+Bluetooth my_bluetooth;
+BluetoothCommunication my_bluetooth_comm;
+
+// Deep sleep semaphore
+static SemaphoreHandle_t deep_sleep_semaphore = NULL;
+
+// variable for BT MAC address
+char bda_str[18];
+
+// set when setup() already took and stored the picture of an external trigger, the camera task skips its capture
+static bool event_captured = false;
+
+/**
+ * Save a picture in the SD card, followed by its preview, and give the frame buffer back to the driver.
+ * @param: camera_fb_t * frame buffer, NULL if the capture failed
+ * @param: _image_priority_t upload priority of the image
+ * @param: uint32_t millis() at the capture request, the capture latency counts from it
+ */
+void store_picture(camera_fb_t * fb, _image_priority_t priority, uint32_t capture_started) {
+  if(fb == NULL) {
+    metrics_image_dropped();
+    return;
+  }
+  LOG_D(LOG_MODULE_CAMERA, "store_picture: camera buf len %d", fb->len);
+
+  // if we have a picture, try to store it in the SD card.
+  uint32_t image_id = 0;
+  acquire_sd_mmc();
+  energy_begin(ENERGY_SD_WRITE);
+  bool saved = save_image_to_sd_card(SD_MMC, fb, priority, &image_id);
+  energy_end(ENERGY_SD_WRITE);
+  if(saved) {
+    metrics_image_captured();
+    metrics_capture_latency(millis() - capture_started);
+    LOG_I(LOG_MODULE_CAMERA, "store_picture: image saved %u ms after the capture request on core %d",
+      millis() - capture_started, xPortGetCoreID());
+  } else {
+    LOG_W(LOG_MODULE_CAMERA, "store_picture: failed to save image to card");
+    metrics_image_dropped();
+  }
+  release_sd_mmc();
+
+  // return the frame buffer back to the driver for reuse
+  esp_camera_fb_return(fb);
+
+#if CAMERA_PREVIEW_ENABLED
+  // a small preview the phone can show long before the full image has arrived
+  if(saved) {
+    energy_begin(ENERGY_CAMERA);
+    camera_fb_t * preview = take_preview();
+    energy_end(ENERGY_CAMERA);
+    if(preview != NULL) {
+      acquire_sd_mmc();
+      energy_begin(ENERGY_SD_WRITE);
+      save_preview_to_sd_card(SD_MMC, image_id, preview);
+      energy_end(ENERGY_SD_WRITE);
+      release_sd_mmc();
+      esp_camera_fb_return(preview);
+    }
+  }
+#endif
+}
+
+/**
+ * We will have two tasks. 
+ * 1. One task to take pictures and save the pictures to SD card. 
+ * 2. Second task to connect to phone via Bluetooth and transmit images in the SD card.
+ * 
+ * To schedule a task, we need a function that contains the code we want to run and then 
+ * create a task that calls this function. 
+ */
+
+/**
+ * Task to take pictures and save the pictures in the SD card
+ */
+void camera_task(void * params) {
+  debug("camera task started!");
+  resource_monitor_register_task(RESOURCE_TASK_CAMERA, CAMERA_TASK_STACK_SIZE);
+
+  // before taking picture, ask the phone for the current time.
+  // we need this for the name of image. past the capture deadline the RTC time is used as it is.
+  my_bluetooth.take_bluetooth_serial_mutex(); 
+  if(!wake_budget_expired(WAKE_PHASE_CAPTURE)) {
+    my_bluetooth_comm.request_for_time(&my_bluetooth);
+  }
+  my_bluetooth.release_bluetooth_serial_mutex();
+
+  // capture and SD writes are CPU bound, run them at the full clock
+  power_acquire_performance();
+
+  // the picture of a trigger wake is already in the SD card
+  if(!event_captured) {
+    uint32_t capture_started = millis();
+    energy_begin(ENERGY_CAMERA);
+    camera_fb_t * fb = take_picture();
+    energy_end(ENERGY_CAMERA);
+    store_picture(fb, IMAGE_PRIORITY_NORMAL, capture_started);
+  }
+  power_release_performance();
+  resource_monitor_sample(RESOURCE_POINT_AFTER_CAPTURE);
+
+  for(;;) {
+    // wait for the semaphore for deep sleep
+    if(xSemaphoreTake(deep_sleep_semaphore, portMAX_DELAY) == pdTRUE){
+      Serial.println("camera_task: obtained sleep semaphore. going to sleep....");
+      resource_monitor_sample(RESOURCE_POINT_BEFORE_SLEEP);
+
+      // go to deep sleep
+      go_to_deep_sleep(device_config_get()->sleep_seconds);
+    }
+  }
+}
+
+
+/**
+ * Task to connect to phone via Bluetooth and send pictures stored in the SD card.
+ */
+void bluetooth_task(void * params) {
+  debug("bluetooth task started!");
+  resource_monitor_register_task(RESOURCE_TASK_BLUETOOTH, BLUETOOTH_TASK_STACK_SIZE);
+
+  for(;;) {
+    // check whether we have connection or not. if no phone answered before the deadline, give up and sleep.
+    bool connected = (my_bluetooth.get_bt_connection_status() == BLUETOOTH_CONNECTED);
+    if(!connected && my_bluetooth.get_connect_state() != BT_CONNECT_GAVE_UP) {
+      energy_begin(ENERGY_RADIO_CONNECTING);
+      connected = my_bluetooth.bt_reconnect();
+      energy_end(ENERGY_RADIO_CONNECTING);
+    }
+
+    if(connected) {
+      energy_begin(ENERGY_RADIO_TRANSFER);
+      my_bluetooth.take_bluetooth_serial_mutex();
+      my_bluetooth_comm.negotiate_capabilities(&my_bluetooth);
+
+      // the small, high value transfers go first in case the link drops during the image upload.
+      // once per session upload the metrics snapshot to the phone
+      bool sync = !wake_budget_expired(WAKE_PHASE_SYNC);
+      uint8_t metrics_snapshot[METRICS_SNAPSHOT_SIZE];
+      uint16_t snapshot_length = sync ? metrics_serialize(metrics_snapshot, sizeof(metrics_snapshot)) : 0;
+      if(snapshot_length > 0) {
+        if(!my_bluetooth_comm.send_data(&my_bluetooth, BT_DATA, OTHER_DATA, metrics_snapshot, snapshot_length)) {
+          LOG_W(LOG_MODULE_COMM, "bluetooth_task: failed to send metrics");
+        }
+      }
+
+      // and the stack and heap high water marks
+      uint8_t resource_snapshot[RESOURCE_SNAPSHOT_SIZE];
+      snapshot_length = sync ? resource_monitor_serialize(resource_snapshot, sizeof(resource_snapshot)) : 0;
+      if(snapshot_length > 0) {
+        if(!my_bluetooth_comm.send_data(&my_bluetooth, BT_DATA, OTHER_DATA, resource_snapshot, snapshot_length)) {
+          LOG_W(LOG_MODULE_COMM, "bluetooth_task: failed to send resource marks");
+        }
+      }
+
+      // ask for a new configuration, it is applied on the next wake
+      if(sync) {
+        my_bluetooth_comm.request_for_config(&my_bluetooth);
+      }
+
+      // the image index orders the upload queue by priority class and age. upload until the queue is
+      // empty or the upload deadline, between two images the camera task may use Bluetooth and the SD card
+      uint32_t images_sent = 0;
+      bool sent = true;
+      while(sent) {
+        acquire_sd_mmc();
+        sent = my_bluetooth_comm.send_next_image(&my_bluetooth, SD_MMC);
+        release_sd_mmc();
+        my_bluetooth.release_bluetooth_serial_mutex();
+        if(sent) {
+          images_sent++;
+          delay_ms(10);
+          my_bluetooth.take_bluetooth_serial_mutex();
+        }
+      }
+      LOG_I(LOG_MODULE_COMM, "bluetooth_task: %u images sent, %u ms of the upload budget left", images_sent,
+        wake_budget_remaining_ms(WAKE_PHASE_UPLOAD));
+    } else {
+      LOG_W(LOG_MODULE_COMM, "bluetooth_task: no phone available, images stay in the SD card");
+    }
+
+    energy_end(ENERGY_RADIO_TRANSFER);
+    resource_monitor_sample(RESOURCE_POINT_BEFORE_SLEEP);
+
+    // give the Semaphore so that the camera can be put to sleep.
+    xSemaphoreGive(deep_sleep_semaphore);
+
+    // delete the task.
+    LOG_D(LOG_MODULE_COMM, "bluetooth_task: deleting bluetooth task");
+    vTaskDelete(NULL);
+  }
+}
+
+// Print the Bluetooth MAC address of the device
+char *bda2str(const uint8_t* bda, char *str, size_t size)
+{
+  if (bda == NULL || str == NULL || size < 18) {
+    return NULL;
+  }
+  sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x",
+          bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+  return str;
+}
+
+/**
+ * Initialize the camera with the stored configuration, once per wake.
+ * @return: boolean
+ */
+bool setup_camera() {
+  static bool camera_ready = false;
+  if(camera_ready) {
+    return true;
+  }
+
+  const _device_config_t * config = device_config_get();
+  if (init_camera((framesize_t)config->frame_size, config->jpeg_quality) != ESP_OK) {
+    LOG_E(LOG_MODULE_CAMERA, "setup_camera: camera init failed");
+    return false;
+  }
+
+  // read out only the region of interest, everything after the sensor shrinks with it
+  if(config->roi_width != 0) {
+    camera_set_roi(config->roi_x, config->roi_y, config->roi_width, config->roi_height, (framesize_t)config->frame_size);
+  }
+  camera_ready = true;
+  return true;
+}
+
+/**
+ * Initialize the SD card and the image index, once per wake.
+ * @return: boolean
+ */
+bool setup_sd_card() {
+  static bool sd_ready = false;
+  if(!sd_ready) {
+    sd_ready = init_sd_card();
+  }
+  return sd_ready;
+}
+
+/**
+ * Take and store the picture of a trigger wake before Bluetooth and the rest of the services are
+ * started. The capture latency counts from the wake to the image in the SD card.
+ */
+void capture_event_image() {
+  kv_init();
+  device_config_load();
+  // the SD card takes its DMA write buffer from the pools, which want the internal RAM before the camera driver
+  mem_pool_init();
+
+  camera_fb_t * fb = NULL;
+  energy_begin(ENERGY_CAMERA);
+  if(setup_camera()) {
+    fb = take_settled_picture();
+  }
+  energy_end(ENERGY_CAMERA);
+
+  if(fb != NULL && !setup_sd_card()) {
+    esp_camera_fb_return(fb);
+    fb = NULL;
+  }
+  store_picture(fb, IMAGE_PRIORITY_HIGH, 0);
+  event_captured = true;
+}
+
+// Setup Part
+void setup() {
+  // esp_log_level_set("ESP", ESP_LOG_DEBUG); // no effect on logging.
+
+  // Disable brownout detector
+  WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0); 
+
+  // turn on the LED1 to show camera is powered on
+  pinMode(33, OUTPUT);
+  digitalWrite(33, LOW);
+  
+  // Start the serial communication
+  Serial.begin(115200);
+  log_init();
+  debug("setup: configuring services");
+  Serial.print("EPSL camera firmware version ");
+  Serial.println(VERSION);
+
+  // an external trigger wants its picture now, everything else is started after the capture
+  wake_source_init();
+  // count the wake cycle first, a trigger wake captures before the rest of setup
+  metrics_begin_wake();
+  energy_begin_wake();
+  if(wake_source_is_event()) {
+    capture_event_image();
+  }
+  wake_source_print();
+
+  // allocate the buffer pools before the Bluetooth stack and the camera driver take the internal RAM
+  if(!mem_pool_init()) {
+    LOG_E(LOG_MODULE_MAIN, "setup: memory pool init failed");
+  }
+
+  // scale the clock down and light sleep whenever all tasks wait
+  power_init();
+
+  // open the persistent key-value store
+  if(!kv_init()) {
+    LOG_E(LOG_MODULE_MAIN, "setup: key-value store init failed");
+  }
+
+  // load the configuration the phone sent in a previous wake
+  device_config_load();
+  device_config_print();
+
+  // the configured phones are always peers
+  peer_table_load();
+  const _device_config_t * config = device_config_get();
+  peer_table_add(config->phone_mac);
+  for(uint8_t i = 0; i < config->extra_phone_count; ++i) {
+    peer_table_add(config->extra_phones[i]);
+  }
+
+  // show the metrics carried over from previous wakes
+  metrics_print();
+
+  // whatever happens from here on, the wake ends at the housekeeping deadline
+  wake_budget_start(device_config_get()->sleep_seconds);
+  
+  // register Bluetooth callback for status update
+  my_bluetooth.set_status_callback(bt_status_callback);   // THIS NEEDS TO BE HERE FOR PROPER CALLBACKS
+  
+  // initialize the Bluetooth
+  energy_begin(ENERGY_RADIO_CONNECTING);
+  bool bt_connected = my_bluetooth.init_bluetooth();
+  energy_end(ENERGY_RADIO_CONNECTING);
+  power_enable_bt_modem_sleep();
+  if(!bt_connected)
+  {
+    // keep capturing, the images are uploaded when a phone is around
+    LOG_W(LOG_MODULE_BT, "setup: no phone connected");
+  }
+
+  // print Bluetooth MAC address
+  Serial.print("BT MAC Addr: "); 
+  Serial.println(bda2str(esp_bt_dev_get_address(), bda_str, 18));
+  
+  // register the bluetooth callback for on receive 
+  my_bluetooth.set_on_receive_data_callback(bt_data_received_callback);
+
+  // initialize the camera module, unless a trigger wake already did
+  if (!setup_camera()) {
+    Serial.println("setup: camera init failed");
+    // go to deep sleep
+    go_to_deep_sleep(device_config_get()->sleep_seconds);
+  }
+  
+  // Turn off the on board LED
+  turn_off_camera_flash();
+
+  // initialize the SD module, unless a trigger wake already did
+  if(!setup_sd_card()) {
+    Serial.println("setup: sd card init failed");
+    // go to deep sleep
+    go_to_deep_sleep(device_config_get()->sleep_seconds);
+  }
+
+  // create the deep sleep semaphore
+  if(deep_sleep_semaphore == NULL){
+    deep_sleep_semaphore = xSemaphoreCreateBinary();
+    xSemaphoreTake(deep_sleep_semaphore, 0);
+  }
+
+  resource_monitor_register_task(RESOURCE_TASK_SETUP, SETUP_TASK_STACK_SIZE);
+  resource_monitor_sample(RESOURCE_POINT_SETUP);
+
+  // Schedule the tasks. 
+#if TASK_PINNING_ENABLED
+  xTaskCreatePinnedToCore(camera_task, "take pictue and save to sd card", CAMERA_TASK_STACK_SIZE, NULL,
+    CAMERA_TASK_PRIORITY, NULL, CAPTURE_TASK_CORE);
+  xTaskCreatePinnedToCore(bluetooth_task, "connect to phone and send data", BLUETOOTH_TASK_STACK_SIZE, NULL,
+    BLUETOOTH_TASK_PRIORITY, NULL, RADIO_TASK_CORE);
+#else
+  xTaskCreate(camera_task, "take pictue and save to sd card", CAMERA_TASK_STACK_SIZE, NULL, CAMERA_TASK_PRIORITY, NULL);
+  xTaskCreate(bluetooth_task, "connect to phone and send data", BLUETOOTH_TASK_STACK_SIZE, NULL,
+    BLUETOOTH_TASK_PRIORITY, NULL);
+#endif
+  // xTaskCreate(main_task, "task to take pic, save, and transmit", 8182, NULL, 1, NULL);
+}
+
+
+// Loop part of the code. 
+void loop() {
+  // uint8_t buffer [1024];
+  // my_bluetooth_comm.send_data(&my_bluetooth, BT_RESPONSE, RESPONSE_FOR_OTHER_DATA, buffer, 1024);
+  // Serial.println("\n\n********************************\n\n");
+  // delay(1000 * 30);
+  delay(portMAX_DELAY);
+}
+
+
+/*
+ * Callback which receives the data from the input stream of Bluetooth
+ */
+void bt_data_received_callback(const uint8_t * buff, size_t len) {
+    // frames are up to MAX_LENGTH bytes, a uint8_t length would cut them at 255
+    uint16_t totalBytes = len > MAX_LENGTH ? MAX_LENGTH : (uint16_t)len;
+    if((buff != NULL) && (totalBytes > 0)){
+      // Serial.printf("bt_data_received_callback: data length: %d\n", totalBytes);
+      my_bluetooth.copy_received_data(buff, totalBytes);
+    }
+}
+
+/*
+ * Callback function for the Bluetooth stack. We can monitor the Bluetooth status from 
+ * here.
+ */
+void bt_status_callback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
+  // debug(getSPP_CB_EventDes(event));
+  
+  switch(event) {
+    case ESP_SPP_OPEN_EVT:  // camera is connected to the phone
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_INFO, "cb: camera connected to phone", 0, 0);
+      my_bluetooth.on_spp_event(event, param);
+      break;
+
+    case ESP_SPP_CLOSE_EVT: // camera is disconnected from the phone
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_INFO, "cb: camera disconnected from phone", 0, 0);
+      my_bluetooth.on_spp_event(event, param);
+
+    //   Serial.printf("cb: %d\n", param->close.async ? 1 : 0);
+
+      // do we reconnect or what
+      break;
+      
+    case ESP_SPP_START_EVT: // camera as the Bluetooth server
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera as server", 0, 0);
+      break;
+      
+    case ESP_SPP_CL_INIT_EVT: // camera started the connection to the phone
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_INFO, "cb: camera connecting to phone", 0, 0);
+      my_bluetooth.on_spp_event(event, param);
+      break;
+      
+    case ESP_SPP_SRV_OPEN_EVT: // camera as server has accepted an incoming connection
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera as server has a connection", 0, 0);
+      break;
+      
+   case ESP_SPP_SRV_STOP_EVT: // camera as server has lost a connection
+     LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera as server has lost a connection", 0, 0);
+     break;
+      
+    case ESP_SPP_DATA_IND_EVT: // data is received over Bluetooth
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera has received data on BT %u", param->data_ind.len, 0);
+      // Serial.printf("# bytes received %d\n", param->data_ind.len);
+      break;
+      
+    case ESP_SPP_WRITE_EVT: // data write over Bluetooth is completed
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera has written data on BT %u", param->write.len, 0);
+      // Serial.printf("# bytes written %d\n", param->write.len);
+      my_bluetooth.on_spp_event(event, param);
+      break;
+      
+    case ESP_SPP_CONG_EVT: // congestion status of Bluetooth has changed
+      LOG_EVENT(LOG_MODULE_BT, LOG_LEVEL_DEBUG, "cb: camera BT congestion status changed %u", param->cong.cong, 0);
+      my_bluetooth.on_spp_event(event, param);
+      break;
+
+    default:
+      debug("cb: other event");
+      break;
+  }
+}
+
+/*
+ * Get text description of the SPP callback event.
+ */
+const char * getSPP_CB_EventDes(esp_spp_cb_event_t st) {
+  switch(st){
+    case ESP_SPP_INIT_EVT:
+      return "ESP_SPP_INIT_EVT: SPP is inited";
+    
+   case ESP_SPP_UNINIT_EVT:
+     return "ESP_SPP_UNINIT_EVT: SPP is uninited";
+      
+    case ESP_SPP_DISCOVERY_COMP_EVT:
+      return "ESP_SPP_DISCOVERY_COMP_EVT: SDP discovery complete";
+      
+    case ESP_SPP_OPEN_EVT:
+      return "ESP_SPP_OPEN_EVT: SPP Client connection open";
+      
+    case ESP_SPP_CLOSE_EVT:
+      return "ESP_SPP_CLOSE_EVT: SPP connection closed";
+      
+    case ESP_SPP_START_EVT:
+      return "ESP_SPP_START_EVT: SPP server started";
+      
+    case ESP_SPP_CL_INIT_EVT:
+      return "ESP_SPP_CL_INIT_EVT: SPP client initiated a connection";
+      
+    case ESP_SPP_DATA_IND_EVT:
+      return "ESP_SPP_DATA_IND_EVT: SPP connection received data";
+      
+    case ESP_SPP_CONG_EVT:
+      return "ESP_SPP_CONG_EVT: SPP connection congestion status changed";
+      
+    case ESP_SPP_WRITE_EVT:
+      return "ESP_SPP_WRITE_EVT: SPP write operation completes";
+      
+    case ESP_SPP_SRV_OPEN_EVT:
+      return "ESP_SPP_SRV_OPEN_EVT: SPP Server connection open";
+      
+   case ESP_SPP_SRV_STOP_EVT:
+     return "ESP_SPP_SRV_STOP_EVT: SPP server stopped";
+
+    default:
+      return "invalid";
+    
+  }
+}
+
+/*
+ * Get text description of the SPP status enum.
+ */
+const char * getSPP_StatusDes(esp_spp_status_t st) {
+  switch(st){
+    case ESP_SPP_SUCCESS:
+      return "ESP_SPP_SUCCESS: Successful operation";
+      
+    case ESP_SPP_FAILURE:
+      return "ESP_SPP_FAILURE: Generic failure";
+      
+    case ESP_SPP_BUSY:
+      return "ESP_SPP_BUSY: Temporarily can not handle this request";
+      
+    case ESP_SPP_NO_DATA:
+      return "ESP_SPP_NO_DATA: no data";
+      
+    case ESP_SPP_NO_RESOURCE:
+      return "ESP_SPP_NO_RESOURCE: No more resource";
+      
+    case ESP_SPP_NEED_INIT:
+      return "ESP_SPP_NEED_INIT: SPP module shall init first";
+      
+    case ESP_SPP_NEED_DEINIT:
+      return "ESP_SPP_NEED_DEINIT: SPP module shall deinit first";
+      
+    case ESP_SPP_NO_CONNECTION:
+      return "ESP_SPP_NO_CONNECTION: connection may have been closed";
+
+    default:
+      return "invalid";
+  }
+}
@@ -1,261 +1,744 @@
-#include "bluetooth.h"
-#include "utils.h"
-
-// const String btDeviceName = "cameraModule"; 
-// String MACadd = "C4:50:06:83:F4:7E";
-// uint8_t btServerAddress[6]  = {0xC4, 0x50, 0x06, 0x83, 0xF4, 0x7E};
-// String btServerName = "SAMSUMG-S4";
-// bool btConnectionFlag = false;
-
-/**
- * Constructor for the Bluetooth class. 
- * @param: uint8_t pointer of the server MAC address.
- */
-Bluetooth::Bluetooth() {
-    _bt_device_name = "cameraModule";
-    _bt_connection_flag = BLUETOOTH_NONE;
-
-    debug("Bluetooth: creating rcv data semaphore and mutex");
-    if(_receive_data_Semaphore == NULL){
-        _receive_data_Semaphore = xSemaphoreCreateBinary();
-        xSemaphoreTake(_receive_data_Semaphore, 0);
-    }
-
-    if(_receive_data_mutex == NULL){
-        _receive_data_mutex = xSemaphoreCreateMutex();
-    }
-    // xSemaphoreTake(_receive_data_mutex, 0);
-
-    debug("Bluetooth: create the bluetooth serial mutex");
-    if(_bluetooth_serial_mutex == NULL) {
-        _bluetooth_serial_mutex = xSemaphoreCreateMutex();
-    }
-    // xSemaphoreTake(_bluetooth_serial_mutex, 0);
-}
-
-/**
- * Destructor for the Bluetooth class
- */
-Bluetooth::~Bluetooth() {
-    un_set_callbacks();
-    _bt_serial.end();
-    _bt_connection_flag = BLUETOOTH_DISCONNECTED;
-    vSemaphoreDelete(_receive_data_Semaphore);
-    _receive_data_Semaphore = NULL;
-
-    vSemaphoreDelete(_receive_data_mutex);
-    _receive_data_mutex = NULL;
-
-    vSemaphoreDelete(_bluetooth_serial_mutex);
-    _bluetooth_serial_mutex = NULL;
-}
-
-/**
- * Reset the Bluetooth module.
- */
-void Bluetooth::de_init_bluetooth(){
-    un_set_callbacks();
-    _bt_serial.end();
-    _bt_connection_flag = BLUETOOTH_DISCONNECTED;
-}
-
-/**
- * Initialize the Bluetooth module
- */
-bool Bluetooth::init_bluetooth(uint8_t mac[6]) {
-
-    if (!set_server_mac(mac)) {
-        // raise an error
-        Serial.println("init_bluetooth: no server MAC");
-        return false;
-    }
-
-    // initialize the Bluetooth and set the callback
-    _bt_serial.enableSSP();
-    _bt_serial.begin(_bt_device_name, true);
-    bool status = _bt_serial.connect(mac);
-
-    // check if we are connected or not. if not try again.
-   if(status) {
-       Serial.println("init_bluetooth: connected");
-       return true;
-   }else {
-       while(!_bt_serial.connected(1000)) {
-           Serial.println("init_bluetooth: failed to connect"); 
-       }
-   }
-    
-    return true;
-}
-
-/**
- * Register the Bluetooth status callback.
- */
-void Bluetooth::set_status_callback(esp_spp_cb_t * callback) {
-    _bt_serial.register_callback(callback);
-}
-
-/**
- * Register the Bluetooth on data receive callback.
- */
-void Bluetooth::set_on_receive_data_callback(BluetoothSerialDataCb callback){
-    _bt_serial.onData(callback);
-}
-
-/**
- * Unregister the Bluetooth callbacks.
- */
-void Bluetooth::un_set_callbacks() {
-    _bt_serial.register_callback(NULL);
-    _bt_serial.onData(NULL);
-}
-
-/**
- * Set server mac address.
- */
-bool Bluetooth::set_server_mac(uint8_t mac[6]) {
-    if (mac != NULL) {
-        for(int i=0; i<6; ++i){
-            _bt_server_mac[i] = mac[i];
-        }
-        return true;
-    } 
-    return false;
-}
-
-/**
- * Get Bluetooth device name.
- */
-String Bluetooth::get_bt_device_name() {
-    return _bt_device_name;
-}
-
-/**
- * Get the Bluetooth connection state. 
- */
-_bluetooth_status_ Bluetooth::get_bt_connection_status() {
-    return _bt_connection_flag;
-}
-
-/**
- * Set the Bluetooth connection flag.
- */
-void Bluetooth::set_bt_connection_status(_bluetooth_status_ status) {
-    Serial.printf("set_bt_connection_status: %s\n", _bluetooth_status_as_string(status));
-    _bt_connection_flag = status;
-}
-
-/*
- * Send the data in the buffer to the output stream of Bluetooth
- */
-int Bluetooth::bt_write_data(const uint8_t * buff, int len) {
-  if((buff != NULL) && (len > 0)){
-    // pass the data over to the output stream of Bluetooth
-    debug("bt_write_data: sending ...");
-    return _bt_serial.write(buff, len);
-  }
-
-  // if not return failed status
-  Serial.println("bt_write_data: failed");
-  return STATUS_NOT_OK;
-}
-
-/**
- * Reconnect to the server.
- */
-void Bluetooth::bt_reconnect() {
-    if (_bt_serial.hasClient() == 0) {
-        // camera is not connected to any device
-        debug("bt_reconnect: reconnecting");
-        _bt_serial.connect();   // the same MAC address is used for reconnection
-    }
-}
-
-
-/**
- * Get the Bluetooth connection status as string.
- */
-const char * Bluetooth::_bluetooth_status_as_string(_bluetooth_status_ st) {
-    switch(st) {
-        case BLUETOOTH_NONE:
-            return "BLUETOOTH_NONE";
-        
-        case BLUETOOTH_CONNECTING: 
-            return "BLUETOOTH_CONNECTING";
-
-        case BLUETOOTH_CONNECTED:
-            return "BLUETOOTH_CONNECTED";
-
-        case BLUETOOTH_DISCONNECTED:
-            return "BLUETOOTH_DISCONNECTED";
-        
-        default:
-            return "UNKNOWN";
-    }
-}
-
-bool Bluetooth::take_rcv_data_semaphore() {
-    if(xSemaphoreTake(_receive_data_Semaphore, ( TickType_t ) 1000) == pdTRUE){
-        return true;
-    }
-
-    Serial.println("take_rcv_data_semaphore: failed");
-    return false;
-}
-
-/**
- * Release the receive data mutex.
- */
-void Bluetooth::give_rcv_data_mutex(){
-    // debug("give_rcv_data_mutex");
-    xSemaphoreGive(_receive_data_mutex);
-}
-
-/**
- * Copy the data received from the Bluetooth in the receive buffer.
- * @param: const uint8_t * buff
- * @param: uint8_t len
- */
-void Bluetooth::copy_received_data(const uint8_t * buff, uint16_t len) {
-    // we may need mutex to protect the receive data buffer to be free before writing into it.
-    xSemaphoreTake(_receive_data_mutex, ( TickType_t ) 50);
-    memcpy(_read_buffer, buff, len);
-    _receive_length = len;
-    xSemaphoreGive(_receive_data_mutex);
-
-    // give the Semaphore for any process waiting on the receive data.
-    xSemaphoreGive(_receive_data_Semaphore);
-    // debug("copy_received_data: mutex released, and semaphore given");
-}
-
-/**
- * Get the first byte from the receive buffer.
- * @return uint8_t
- */
-uint8_t * Bluetooth::get_recv_buffer() {
-    xSemaphoreTake(_receive_data_mutex, ( TickType_t ) 5);
-    return _read_buffer;
-}
-
-/**
- * Get the received data length on Bluetooth.
- * @return uint16_t
- */
-uint16_t Bluetooth::get_recv_buffer_length() {
-    return _receive_length;
-}
-
-/**
- * Take the Bluetooth serial mutex. We need this for sequential operation of the Bluetooth.
- * When one operation is going on with the Bluetooth, another operation must wait untils it finishes.
- */
-void Bluetooth::take_bluetooth_serial_mutex() {
-    xSemaphoreTake(_bluetooth_serial_mutex, portMAX_DELAY);
-}
-
-/**
- * Release the Bluetooth serial mutex.
- */
-void Bluetooth::release_bluetooth_serial_mutex() {
-    xSemaphoreGive(_bluetooth_serial_mutex);
+#include "bluetooth.h"
+#include "utils.h"
+#include "metrics.h"
+#include "peer_table.h"
+
+// const String btDeviceName = "cameraModule"; 
+// String MACadd = "C4:50:06:83:F4:7E";
+// uint8_t btServerAddress[6]  = {0xC4, 0x50, 0x06, 0x83, 0xF4, 0x7E};
+// String btServerName = "SAMSUMG-S4";
+// bool btConnectionFlag = false;
+
+/**
+ * Constructor for the Bluetooth class. 
+ * @param: uint8_t pointer of the server MAC address.
+ */
+Bluetooth::Bluetooth() {
+    _bt_device_name = "cameraModule";
+    _bt_connection_flag = BLUETOOTH_NONE;
+    _connect_state = BT_CONNECT_IDLE;
+
+    LOG_D(LOG_MODULE_BT, "Bluetooth: creating rcv data semaphore and mutex");
+    if(_receive_data_Semaphore == NULL){
+        _receive_data_Semaphore = xSemaphoreCreateBinary();
+        xSemaphoreTake(_receive_data_Semaphore, 0);
+    }
+
+    if(_receive_data_mutex == NULL){
+        _receive_data_mutex = xSemaphoreCreateMutex();
+    }
+    // xSemaphoreTake(_receive_data_mutex, 0);
+
+    if(_connection_event_semaphore == NULL) {
+        _connection_event_semaphore = xSemaphoreCreateBinary();
+    }
+
+    if(_flow_semaphore == NULL) {
+        _flow_semaphore = xSemaphoreCreateBinary();
+    }
+    memset(_tx_frames, 0, sizeof(_tx_frames));
+
+    LOG_D(LOG_MODULE_BT, "Bluetooth: create the bluetooth serial mutex");
+    if(_bluetooth_serial_mutex == NULL) {
+        _bluetooth_serial_mutex = xSemaphoreCreateMutex();
+    }
+    // xSemaphoreTake(_bluetooth_serial_mutex, 0);
+}
+
+/**
+ * Destructor for the Bluetooth class
+ */
+Bluetooth::~Bluetooth() {
+    un_set_callbacks();
+    _bt_serial.end();
+    _bt_connection_flag = BLUETOOTH_DISCONNECTED;
+    vSemaphoreDelete(_receive_data_Semaphore);
+    _receive_data_Semaphore = NULL;
+
+    vSemaphoreDelete(_receive_data_mutex);
+    _receive_data_mutex = NULL;
+
+    vSemaphoreDelete(_bluetooth_serial_mutex);
+    _bluetooth_serial_mutex = NULL;
+
+    vSemaphoreDelete(_connection_event_semaphore);
+    _connection_event_semaphore = NULL;
+
+    vSemaphoreDelete(_flow_semaphore);
+    _flow_semaphore = NULL;
+}
+
+/**
+ * Reset the Bluetooth module.
+ */
+void Bluetooth::de_init_bluetooth(){
+    un_set_callbacks();
+    _bt_serial.end();
+    _bt_connection_flag = BLUETOOTH_DISCONNECTED;
+}
+
+/**
+ * Initialize the Bluetooth module and connect to the best available phone of the peer table.
+ */
+bool Bluetooth::init_bluetooth() {
+    // initialize the Bluetooth as master, the phones are the servers
+    _bt_serial.enableSSP();
+    if(!_bt_serial.begin(_bt_device_name, true)) {
+        LOG_E(LOG_MODULE_BT, "init_bluetooth: failed to start bluetooth");
+        // there is no stack to reconnect with, bluetooth_task must not spend the wake retrying
+        _connect_state = BT_CONNECT_GAVE_UP;
+        return false;
+    }
+
+    // an absent phone fails the page after this long instead of the controller default of 5.12 s
+    uint32_t page_slots = std::min(BT_PEER_CONNECT_TIMEOUT_MS * 1000 / BT_PAGE_SLOT_US, (uint32_t)0xFFFF);
+    if(esp_bt_gap_set_page_timeout((uint16_t)page_slots) != ESP_OK) {
+        LOG_W(LOG_MODULE_BT, "init_bluetooth: failed to set the page timeout");
+    }
+
+    return connect_with_backoff(BT_CONNECT_DEADLINE_MS);
+}
+
+/**
+ * Connect to one phone. connect() blocks for the page and the service discovery, the page is bounded
+ * by the page timeout set in init_bluetooth. A late open event is then awaited only for what is left
+ * of timeout_ms, so a refused or absent phone costs about timeout_ms.
+ * @param: uint8_t phone MAC address
+ * @param: uint32_t timeout in milliseconds
+ * @return: boolean
+ */
+bool Bluetooth::connect_peer(const uint8_t mac[6], uint32_t timeout_ms) {
+    if (!set_server_mac(mac)) {
+        // raise an error
+        LOG_E(LOG_MODULE_BT, "connect_peer: no server MAC");
+        return false;
+    }
+
+    LOG_I(LOG_MODULE_BT, "connect_peer: connecting to %02x:%02x:%02x:%02x:%02x:%02x",
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    // forget events of earlier attempts
+    xSemaphoreTake(_connection_event_semaphore, 0);
+
+    // connect() returns once the link is open or the core gives up, the link can still open after it
+    // returns so wait for the open or close event from the status callback, within the same timeout.
+    uint32_t started = millis();
+    if(_bt_serial.connect(_bt_server_mac)) {
+        LOG_I(LOG_MODULE_BT, "connect_peer: connected");
+        return true;
+    }
+
+    uint32_t elapsed = millis() - started;
+    uint32_t wait_ms = elapsed < timeout_ms ? timeout_ms - elapsed : 0;
+    if(elapsed > timeout_ms) {
+        LOG_W(LOG_MODULE_BT, "connect_peer: connect blocked %u ms, over the %u ms timeout", elapsed, timeout_ms);
+    }
+    if(xSemaphoreTake(_connection_event_semaphore, pdMS_TO_TICKS(wait_ms)) == pdTRUE &&
+        _bt_connection_flag == BLUETOOTH_CONNECTED) {
+        LOG_I(LOG_MODULE_BT, "connect_peer: connected");
+        return true;
+    }
+
+    LOG_W(LOG_MODULE_BT, "connect_peer: failed to connect");
+    _bt_serial.disconnect();
+    return false;
+}
+
+/**
+ * Connection state machine. Tries the phones of the peer table in order of expected upload rate,
+ * backs off exponentially after each round and gives up at the deadline, so a missing phone costs
+ * a bounded amount of radio time. The peer table counts only the first failure of a phone per wake. Open and close events from the SPP callback end the waits early.
+ * @param: uint32_t deadline in milliseconds from now
+ * @return: boolean, false means give up and sleep
+ */
+bool Bluetooth::connect_with_backoff(uint32_t deadline_ms) {
+    uint32_t started = millis();
+    uint32_t backoff = BT_BACKOFF_BASE_MS;
+    uint8_t order[PEER_TABLE_MAX];
+    uint8_t count = peer_table_connection_order(order);
+    uint8_t attempt = 0;
+
+    if(count == 0) {
+        LOG_E(LOG_MODULE_BT, "connect_with_backoff: no phone in the peer table");
+        _connect_state = BT_CONNECT_GAVE_UP;
+        return false;
+    }
+
+    _connect_state = BT_CONNECT_ATTEMPTING;
+    for(;;) {
+        if(_bt_connection_flag == BLUETOOTH_CONNECTED) {
+            _connect_state = BT_CONNECT_CONNECTED;
+            return true;
+        }
+
+        uint32_t elapsed = millis() - started;
+        if(elapsed + BT_MIN_ATTEMPT_MS > deadline_ms) {
+            break;
+        }
+        uint32_t remaining = deadline_ms - elapsed;
+
+        switch(_connect_state) {
+            case BT_CONNECT_ATTEMPTING: {
+                const _peer_t * peer = peer_table_get(order[attempt % count]);
+                attempt++;
+
+                if(connect_peer(peer->mac, std::min(BT_PEER_CONNECT_TIMEOUT_MS, remaining))) {
+                    peer_table_connected(peer->mac);
+                    _connect_state = BT_CONNECT_CONNECTED;
+                    return true;
+                }
+                peer_table_connect_failed(peer->mac);
+
+                // every phone failed this round, back off before the next one
+                if(attempt % count == 0) {
+                    _connect_state = BT_CONNECT_BACKOFF;
+                }
+                break;
+            }
+
+            case BT_CONNECT_BACKOFF:
+                LOG_I(LOG_MODULE_BT, "connect_with_backoff: backing off %u ms", backoff);
+                // a late open event ends the back off early
+                xSemaphoreTake(_connection_event_semaphore, pdMS_TO_TICKS(std::min(backoff, remaining)));
+                backoff = std::min(backoff * 2, BT_BACKOFF_MAX_MS);
+                _connect_state = BT_CONNECT_ATTEMPTING;
+                break;
+
+            default:
+                _connect_state = BT_CONNECT_ATTEMPTING;
+                break;
+        }
+    }
+
+    LOG_W(LOG_MODULE_BT, "connect_with_backoff: giving up after %u ms", millis() - started);
+    _connect_state = BT_CONNECT_GAVE_UP;
+    return false;
+}
+
+/**
+ * Get the state of the connection state machine.
+ * @return: _bt_connect_state_t
+ */
+_bt_connect_state_t Bluetooth::get_connect_state() {
+    return _connect_state;
+}
+
+/**
+ * Feed an SPP event from the status callback into the connection state machine and the flow control.
+ * @param: esp_spp_cb_event_t event
+ * @param: esp_spp_cb_param_t * event parameters
+ */
+void Bluetooth::on_spp_event(esp_spp_cb_event_t event, esp_spp_cb_param_t * param) {
+    switch(event) {
+        case ESP_SPP_CL_INIT_EVT:
+            _bt_connection_flag = BLUETOOTH_CONNECTING;
+            break;
+
+        case ESP_SPP_OPEN_EVT:
+            _reset_flow_control();
+            _bt_connection_flag = BLUETOOTH_CONNECTED;
+            xSemaphoreGive(_connection_event_semaphore);
+            break;
+
+        case ESP_SPP_CLOSE_EVT:
+            _bt_connection_flag = BLUETOOTH_DISCONNECTED;
+            if(_connect_state == BT_CONNECT_CONNECTED) {
+                _connect_state = BT_CONNECT_IDLE;
+            }
+            xSemaphoreGive(_connection_event_semaphore);
+
+            // nothing more will complete, release any writer waiting for the window
+            _reset_flow_control();
+            break;
+
+        case ESP_SPP_WRITE_EVT:
+            _congested = param->write.cong;
+            _on_write_complete(param->write.len, param->write.status == ESP_SPP_SUCCESS);
+            break;
+
+        case ESP_SPP_CONG_EVT:
+            _congested = param->cong.cong;
+            if(!_congested) {
+                xSemaphoreGive(_flow_semaphore);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    bt_tx_complete_cb_t callback;
+    void * context;
+    uint32_t id;
+    uint32_t written;
+    bool success;
+}_bt_tx_completion_t;
+
+/**
+ * Finish a frame and record its completion, the callback is called once the flow control lock is released.
+ */
+static void _finish_tx_frame(_bt_tx_frame_t * frame, bool success, uint32_t completed_bytes,
+    _bt_tx_completion_t * completion) {
+    uint32_t start = frame->end - frame->length;
+    uint32_t written = (int32_t)(completed_bytes - start) > 0 ? completed_bytes - start : 0;
+
+    frame->state = success ? BT_TX_DONE : BT_TX_FAILED;
+    completion->callback = frame->callback;
+    completion->context = frame->context;
+    completion->id = frame->id;
+    completion->written = std::min(written, frame->length);
+    completion->success = success;
+}
+
+/**
+ * Call the completion callbacks of finished frames.
+ */
+static void _notify_tx_completions(const _bt_tx_completion_t * completions, uint8_t count) {
+    for(uint8_t i = 0; i < count; ++i) {
+        if(completions[i].callback != NULL) {
+            completions[i].callback(completions[i].id, completions[i].written, completions[i].success,
+                completions[i].context);
+        }
+    }
+}
+
+/**
+ * Account a write completion, complete the frames it finishes and resize the transmit window from
+ * the completion rate.
+ * @param: uint32_t bytes completed
+ * @param: boolean, false if the stack reported a failed write
+ */
+void Bluetooth::_on_write_complete(uint32_t length, bool success) {
+    uint32_t now = millis();
+    _bt_tx_completion_t completions[BT_TX_QUEUE_DEPTH];
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&_flow_mux);
+    uint32_t outstanding = _tx_submitted_bytes - _tx_completed_bytes;
+    _tx_completed_bytes += std::min(length, outstanding);
+
+    // the stack writes in submission order, every frame ending within the completed bytes is done
+    while(_tx_oldest_id != _tx_next_id) {
+        _bt_tx_frame_t * frame = &_tx_frames[_tx_oldest_id % BT_TX_QUEUE_DEPTH];
+        if(frame->state == BT_TX_PENDING) {
+            if((int32_t)(_tx_completed_bytes - frame->end) < 0) {
+                break;
+            }
+            _finish_tx_frame(frame, success, _tx_completed_bytes, &completions[count++]);
+        }
+        _tx_oldest_id++;
+    }
+
+    // keep about BT_TX_TARGET_DELAY_MS worth of data at the observed completion rate in flight
+    _rate_bytes += length;
+    uint32_t interval = now - _rate_started_ms;
+    if(interval >= BT_TX_RATE_INTERVAL_MS) {
+        uint32_t window = _rate_bytes * BT_TX_TARGET_DELAY_MS / interval;
+        _tx_window = std::max(BT_TX_MIN_WINDOW, std::min(window, BT_TX_MAX_WINDOW));
+        _rate_bytes = 0;
+        _rate_started_ms = now;
+    }
+    portEXIT_CRITICAL(&_flow_mux);
+
+    _notify_tx_completions(completions, count);
+    xSemaphoreGive(_flow_semaphore);
+}
+
+/**
+ * Forget the flow control state of the last connection and fail the frames still in flight.
+ */
+void Bluetooth::_reset_flow_control() {
+    _bt_tx_completion_t completions[BT_TX_QUEUE_DEPTH];
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&_flow_mux);
+    for(; _tx_oldest_id != _tx_next_id; _tx_oldest_id++) {
+        _bt_tx_frame_t * frame = &_tx_frames[_tx_oldest_id % BT_TX_QUEUE_DEPTH];
+        if(frame->state == BT_TX_PENDING) {
+            _finish_tx_frame(frame, false, _tx_completed_bytes, &completions[count++]);
+        }
+    }
+    _tx_completed_bytes = _tx_submitted_bytes;
+    _congested = false;
+    _tx_window = BT_TX_MIN_WINDOW;
+    _rate_bytes = 0;
+    _rate_started_ms = millis();
+    portEXIT_CRITICAL(&_flow_mux);
+
+    if(count > 0) {
+        LOG_W(LOG_MODULE_BT, "_reset_flow_control: %d frames failed", count);
+    }
+    _notify_tx_completions(completions, count);
+    xSemaphoreGive(_flow_semaphore);
+}
+
+/**
+ * Wait until the stack is not congested, the frame fits in the transmit window and a queue slot is
+ * free, then reserve the slot.
+ * @param: uint32_t frame length
+ * @return: _bt_tx_frame_t * reserved slot, NULL on timeout
+ */
+_bt_tx_frame_t * Bluetooth::_reserve_tx_frame(uint32_t length) {
+    uint32_t started = millis();
+
+    for(;;) {
+        _bt_tx_frame_t * frame = NULL;
+
+        portENTER_CRITICAL(&_flow_mux);
+        // a frame larger than the window is let through once nothing else is in flight
+        uint32_t outstanding = _tx_submitted_bytes - _tx_completed_bytes;
+        bool fits = !_congested && (_tx_next_id - _tx_oldest_id) < BT_TX_QUEUE_DEPTH &&
+            (outstanding == 0 || outstanding + length <= _tx_window);
+        if(fits) {
+            frame = &_tx_frames[_tx_next_id % BT_TX_QUEUE_DEPTH];
+            frame->id = _tx_next_id++;
+            frame->length = length;
+            frame->end = _tx_submitted_bytes + length;
+            frame->callback = NULL;
+            frame->context = NULL;
+            frame->state = BT_TX_PENDING;
+            _tx_submitted_bytes += length;
+        }
+        portEXIT_CRITICAL(&_flow_mux);
+
+        if(frame != NULL) {
+            return frame;
+        }
+
+        uint32_t elapsed = millis() - started;
+        if(elapsed >= BT_TX_WINDOW_TIMEOUT_MS) {
+            break;
+        }
+
+        // woken by a write completion or the end of the congestion
+        xSemaphoreTake(_flow_semaphore, pdMS_TO_TICKS(BT_TX_WINDOW_TIMEOUT_MS - elapsed));
+    }
+
+    LOG_W(LOG_MODULE_BT, "_reserve_tx_frame: timeout, congested %d, outstanding %u, frames %d", _congested,
+        get_outstanding_bytes(), get_frames_in_flight());
+    if(!_congested) {
+        // completions were lost, do not let the accounting block every later write
+        _reset_flow_control();
+    }
+    return NULL;
+}
+
+/**
+ * Get the SPP congestion state.
+ * @return: boolean
+ */
+bool Bluetooth::is_congested() {
+    return _congested;
+}
+
+/**
+ * Get the number of bytes handed to the stack and not yet written.
+ * @return: uint32_t
+ */
+uint32_t Bluetooth::get_outstanding_bytes() {
+    portENTER_CRITICAL(&_flow_mux);
+    uint32_t outstanding = _tx_submitted_bytes - _tx_completed_bytes;
+    portEXIT_CRITICAL(&_flow_mux);
+    return outstanding;
+}
+
+/**
+ * Get the number of submitted frames waiting for their completion.
+ * @return: uint8_t
+ */
+uint8_t Bluetooth::get_frames_in_flight() {
+    uint8_t count = 0;
+    portENTER_CRITICAL(&_flow_mux);
+    for(uint32_t id = _tx_oldest_id; id != _tx_next_id; ++id) {
+        if(_tx_frames[id % BT_TX_QUEUE_DEPTH].state == BT_TX_PENDING) {
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&_flow_mux);
+    return count;
+}
+
+/**
+ * Get the current transmit window.
+ * @return: uint32_t bytes
+ */
+uint32_t Bluetooth::get_tx_window() {
+    return _tx_window;
+}
+
+/**
+ * Get the MAC address of the phone the camera is connected or connecting to.
+ * @return: const uint8_t *
+ */
+const uint8_t * Bluetooth::get_server_mac() {
+    return _bt_server_mac;
+}
+
+/**
+ * Register the Bluetooth status callback.
+ */
+void Bluetooth::set_status_callback(esp_spp_cb_t * callback) {
+    _bt_serial.register_callback(callback);
+}
+
+/**
+ * Register the Bluetooth on data receive callback.
+ */
+void Bluetooth::set_on_receive_data_callback(BluetoothSerialDataCb callback){
+    _bt_serial.onData(callback);
+}
+
+/**
+ * Unregister the Bluetooth callbacks.
+ */
+void Bluetooth::un_set_callbacks() {
+    _bt_serial.register_callback(NULL);
+    _bt_serial.onData(NULL);
+}
+
+/**
+ * Set server mac address.
+ */
+bool Bluetooth::set_server_mac(const uint8_t mac[6]) {
+    if (mac != NULL) {
+        for(int i=0; i<6; ++i){
+            _bt_server_mac[i] = mac[i];
+        }
+        return true;
+    } 
+    return false;
+}
+
+/**
+ * Get Bluetooth device name.
+ */
+String Bluetooth::get_bt_device_name() {
+    return _bt_device_name;
+}
+
+/**
+ * Get the Bluetooth connection state. 
+ */
+_bluetooth_status_ Bluetooth::get_bt_connection_status() {
+    return _bt_connection_flag;
+}
+
+/**
+ * Set the Bluetooth connection flag.
+ */
+void Bluetooth::set_bt_connection_status(_bluetooth_status_ status) {
+    LOG_I(LOG_MODULE_BT, "set_bt_connection_status: %s", _bluetooth_status_as_string(status));
+    _bt_connection_flag = status;
+}
+
+/**
+ * Queue a frame for transmission without waiting for it to be written. The completions are matched
+ * to the frames by byte count, so frames must be submitted from one task at a time; the callers hold
+ * the Bluetooth serial mutex.
+ * @param: const uint8_t * frame
+ * @param: uint32_t frame length
+ * @param: bt_tx_complete_cb_t completion callback, may be NULL
+ * @param: void * callback context
+ * @return: uint32_t frame id, 0 if the frame was not queued
+ */
+uint32_t Bluetooth::submit_frame(const uint8_t * buff, uint32_t len, bt_tx_complete_cb_t callback, void * context) {
+  if((buff == NULL) || (len == 0)) {
+    LOG_E(LOG_MODULE_BT, "submit_frame: invalid frame");
+    return 0;
+  }
+
+  // pause while the stack is congested or enough data is in flight
+  _bt_tx_frame_t * frame = _reserve_tx_frame(len);
+  if(frame == NULL) {
+    return 0;
+  }
+  frame->callback = callback;
+  frame->context = context;
+  uint32_t frame_id = frame->id;
+
+  // BluetoothSerial copies the data into its transmit queue
+  LOG_D(LOG_MODULE_BT, "submit_frame: sending ...");
+  int written = _bt_serial.write(buff, len);
+  if(written < (int)len) {
+    // the part that was not queued will never complete
+    uint32_t queued = written > 0 ? written : 0;
+    _bt_tx_completion_t completion;
+    bool pending = false;
+
+    portENTER_CRITICAL(&_flow_mux);
+    // a close in the meantime has already failed the frame and reset the accounting
+    pending = (frame->id == frame_id) && (frame->state == BT_TX_PENDING);
+    if(pending) {
+      _tx_submitted_bytes -= len - queued;
+      frame->end -= len - queued;
+      _finish_tx_frame(frame, false, frame->end - frame->length + queued, &completion);
+    }
+    portEXIT_CRITICAL(&_flow_mux);
+
+    LOG_W(LOG_MODULE_BT, "submit_frame: %d of %u bytes queued", written, len);
+    if(pending) {
+      _notify_tx_completions(&completion, 1);
+    }
+    return 0;
+  }
+  return frame_id;
+}
+
+/**
+ * Wait for the completion of a submitted frame.
+ * @param: uint32_t frame id
+ * @param: uint32_t timeout in milliseconds
+ * @return: boolean, true if the frame was written, false if it failed or the wait timed out
+ */
+bool Bluetooth::wait_for_frame(uint32_t frame_id, uint32_t timeout_ms) {
+  uint32_t started = millis();
+
+  for(;;) {
+    portENTER_CRITICAL(&_flow_mux);
+    const _bt_tx_frame_t * frame = &_tx_frames[frame_id % BT_TX_QUEUE_DEPTH];
+    // the slot is reused after BT_TX_QUEUE_DEPTH newer frames, the result is gone by then
+    uint8_t state = (frame_id != 0 && frame->id == frame_id) ? frame->state : (uint8_t)BT_TX_FREE;
+    portEXIT_CRITICAL(&_flow_mux);
+
+    if(state != BT_TX_PENDING) {
+      if(state == BT_TX_FREE) {
+        LOG_W(LOG_MODULE_BT, "wait_for_frame: unknown frame %u", frame_id);
+      }
+      return state == BT_TX_DONE;
+    }
+
+    uint32_t elapsed = millis() - started;
+    if(elapsed >= timeout_ms) {
+      LOG_W(LOG_MODULE_BT, "wait_for_frame: timeout on frame %u", frame_id);
+      return false;
+    }
+
+    // woken by every write completion
+    xSemaphoreTake(_flow_semaphore, pdMS_TO_TICKS(timeout_ms - elapsed));
+  }
+}
+
+/*
+ * Send the data in the buffer to the output stream of Bluetooth
+ */
+int Bluetooth::bt_write_data(const uint8_t * buff, int len) {
+  if((buff != NULL) && (len > 0)){
+    // pass the data over to the output stream of Bluetooth
+    if(submit_frame(buff, len, NULL, NULL) != 0) {
+      return len;
+    }
+  }
+
+  // if not return failed status
+  LOG_E(LOG_MODULE_BT, "bt_write_data: failed");
+  return STATUS_NOT_OK;
+}
+
+/**
+ * Reconnect to the server.
+ */
+bool Bluetooth::bt_reconnect() {
+    if (_bt_serial.hasClient() == 0) {
+        // camera is not connected to any device
+        LOG_D(LOG_MODULE_BT, "bt_reconnect: reconnecting");
+        metrics_reconnect();
+        return connect_with_backoff(BT_CONNECT_DEADLINE_MS);     // whichever phone is around now
+    }
+    return true;
+}
+
+
+/**
+ * Get the Bluetooth connection status as string.
+ */
+const char * Bluetooth::_bluetooth_status_as_string(_bluetooth_status_ st) {
+    switch(st) {
+        case BLUETOOTH_NONE:
+            return "BLUETOOTH_NONE";
+        
+        case BLUETOOTH_CONNECTING: 
+            return "BLUETOOTH_CONNECTING";
+
+        case BLUETOOTH_CONNECTED:
+            return "BLUETOOTH_CONNECTED";
+
+        case BLUETOOTH_DISCONNECTED:
+            return "BLUETOOTH_DISCONNECTED";
+        
+        default:
+            return "UNKNOWN";
+    }
+}
+
+bool Bluetooth::take_rcv_data_semaphore() {
+    if(xSemaphoreTake(_receive_data_Semaphore, ( TickType_t ) 1000) == pdTRUE){
+        return true;
+    }
+
+    LOG_W(LOG_MODULE_BT, "take_rcv_data_semaphore: failed");
+    return false;
+}
+
+/**
+ * Release the receive data mutex.
+ */
+void Bluetooth::give_rcv_data_mutex(){
+    // debug("give_rcv_data_mutex");
+    xSemaphoreGive(_receive_data_mutex);
+}
+
+/**
+ * Copy the data received from the Bluetooth in the receive buffer.
+ * @param: const uint8_t * buff
+ * @param: uint8_t len
+ */
+void Bluetooth::copy_received_data(const uint8_t * buff, uint16_t len) {
+    // we may need mutex to protect the receive data buffer to be free before writing into it.
+    xSemaphoreTake(_receive_data_mutex, ( TickType_t ) 50);
+    // a frame never exceeds MAX_LENGTH, anything beyond is not ours to keep
+    if(len > MAX_LENGTH) {
+        LOG_W(LOG_MODULE_BT, "copy_received_data: %d bytes received, keeping %d", len, MAX_LENGTH);
+        len = MAX_LENGTH;
+    }
+    memcpy(_read_buffer, buff, len);
+    _receive_length = len;
+    xSemaphoreGive(_receive_data_mutex);
+
+    // give the Semaphore for any process waiting on the receive data.
+    xSemaphoreGive(_receive_data_Semaphore);
+    // debug("copy_received_data: mutex released, and semaphore given");
+}
+
+/**
+ * Get the first byte from the receive buffer.
+ * @return uint8_t
+ */
+uint8_t * Bluetooth::get_recv_buffer() {
+    xSemaphoreTake(_receive_data_mutex, ( TickType_t ) 5);
+    return _read_buffer;
+}
+
+/**
+ * Get the received data length on Bluetooth.
+ * @return uint16_t
+ */
+uint16_t Bluetooth::get_recv_buffer_length() {
+    return _receive_length;
+}
+
+/**
+ * Take the Bluetooth serial mutex. We need this for sequential operation of the Bluetooth.
+ * When one operation is going on with the Bluetooth, another operation must wait untils it finishes.
+ */
+void Bluetooth::take_bluetooth_serial_mutex() {
+    xSemaphoreTake(_bluetooth_serial_mutex, portMAX_DELAY);
+}
+
+/**
+ * Release the Bluetooth serial mutex.
+ */
+void Bluetooth::release_bluetooth_serial_mutex() {
+    xSemaphoreGive(_bluetooth_serial_mutex);
 }
\ No newline at end of file
@@ -1,146 +1,340 @@
-#ifndef __BLUETOOTH_H__
-#define __BLUETOOTH_H__
-
-#include "Arduino.h"
-
-#include "BluetoothSerial.h"
-#include "esp_bt.h"
-#include "esp_bt_main.h"
-#include "esp_gap_bt_api.h"
-#include "esp_bt_device.h"
-#include "esp_spp_api.h"
-
-#include <algorithm>
-#include <iterator>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
-typedef enum {
-    BLUETOOTH_NONE = 0,
-    BLUETOOTH_CONNECTING = 1,
-    BLUETOOTH_CONNECTED = 2,
-    BLUETOOTH_DISCONNECTED = 3
-}_bluetooth_status_;
-
-// maximum size of send packet is 1024
-const uint16_t MAX_LENGTH = 1024;
-
-class Bluetooth {
-    private:
-    BluetoothSerial _bt_serial;
-    String _bt_device_name;
-    uint8_t _bt_server_mac[6];
-    _bluetooth_status_ _bt_connection_flag;
-    
-    uint8_t _read_buffer[MAX_LENGTH];
-    uint16_t _receive_length;
-
-    SemaphoreHandle_t _receive_data_Semaphore = NULL;
-    SemaphoreHandle_t _receive_data_mutex = NULL;
-    SemaphoreHandle_t _bluetooth_serial_mutex = NULL;
-
-    const char * _bluetooth_status_as_string(_bluetooth_status_ st);
-
-    public:
-    Bluetooth();
-    ~Bluetooth();
-
-    /**
-     * Initialize the Bluetooth module
-     */
-    bool init_bluetooth(uint8_t mac[6]);
-
-    /**
-     * Set Bluetooth server MAC address.
-     */
-    bool set_server_mac(uint8_t mac[6]);
-
-    /**
-     * Get the Bluetooth device name for the camera.
-     */
-    String get_bt_device_name();
-
-    /**
-     * Get the Bluetooth connection status.
-     */
-    _bluetooth_status_ get_bt_connection_status();
-
-    /*
-    * Send the data in the buffer to the output stream of Bluetooth
-    */
-    int bt_write_data(const uint8_t * buff, int len);
-    
-    /**
-     * Register the Bluetooth status callback.
-     */
-    void set_status_callback(esp_spp_cb_t * callback);
-
-    /**
-     * Register the Bluetooth on data receive callback.
-     */
-    void set_on_receive_data_callback(BluetoothSerialDataCb callback);
-
-    /**
-     * Unregister the Bluetooth callbacks.
-     */
-    void un_set_callbacks();
-
-    /**
-     * Reconnect to the server.
-     */
-    void bt_reconnect();
-
-    /**
-    Reset the Bluetooth module.
-    */
-    void de_init_bluetooth();
-
-    /**
-     * Set the Bluetooth connection flag.
-     */
-    void set_bt_connection_status(_bluetooth_status_ status);
-
-    /**
-     * Take the receive data semaphore.
-     */
-    bool take_rcv_data_semaphore();
-    
-    /**
-     * Release the receive data mutex.
-     */
-    void give_rcv_data_mutex();
-
-    /**
-     * Copy the data received from the Bluetooth in the receive buffer.
-     * @param: const uint8_t * buff
-     * @param: uint16_t len
-     */
-    void copy_received_data(const uint8_t * buff, uint16_t len);
-
-    /**
-     * Get the pointer to receive buffer.
-     * @return uint8_t *
-     */
-    uint8_t * get_recv_buffer();
-    
-    /**
-     * Get the received data length on Bluetooth.
-     * @return uint16_t
-     */
-    uint16_t get_recv_buffer_length();
-
-    /**
-     * Take the Bluetooth serial mutex. We need this for sequential operation of the Bluetooth.
-     * When one operation is going on with the Bluetooth, another operation must wait untils it finishes.
-     */
-    void take_bluetooth_serial_mutex();
-
-    /**
-     * Release the Bluetooth serial mutex.
-     */
-    void release_bluetooth_serial_mutex();
-};
-
-
-#endif
+#ifndef __BLUETOOTH_H__
+#define __BLUETOOTH_H__
+
+#include "Arduino.h"
+
+#include "BluetoothSerial.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_bt_api.h"
+#include "esp_bt_device.h"
+#include "esp_spp_api.h"
+
+#include "bt_protocol.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef enum {
+    BLUETOOTH_NONE = 0,
+    BLUETOOTH_CONNECTING = 1,
+    BLUETOOTH_CONNECTED = 2,
+    BLUETOOTH_DISCONNECTED = 3
+}_bluetooth_status_;
+
+typedef enum {
+    BT_CONNECT_IDLE = 0,
+    BT_CONNECT_ATTEMPTING = 1,
+    BT_CONNECT_BACKOFF = 2,
+    BT_CONNECT_CONNECTED = 3,
+    BT_CONNECT_GAVE_UP = 4
+}_bt_connect_state_t;
+
+// maximum size of send packet is 1024
+const uint16_t MAX_LENGTH = BT_MAX_FRAME_LENGTH;
+
+// how long to wait for one phone to accept the connection before trying the next one. BluetoothSerial
+// connect() blocks until the link opens or closes, so this also sets the controller page timeout,
+// which bounds the page of an absent phone. A phone that answers the page but not the service
+// discovery can still hold connect() up to the core's own timeout.
+const uint32_t BT_PEER_CONNECT_TIMEOUT_MS = 4000;
+
+// page timeout unit of the controller, 0.625 ms slots
+const uint32_t BT_PAGE_SLOT_US = 625;
+
+// overall time to find a phone before giving up and going back to sleep
+const uint32_t BT_CONNECT_DEADLINE_MS = 20000;
+
+// pause after every phone of the peer table failed, doubled each round up to the maximum
+const uint32_t BT_BACKOFF_BASE_MS = 250;
+const uint32_t BT_BACKOFF_MAX_MS = 4000;
+
+// do not start an attempt that can not finish before the deadline
+const uint32_t BT_MIN_ATTEMPT_MS = 1000;
+
+// transmit window limits, the window is sized to keep about BT_TX_TARGET_DELAY_MS of data in flight
+const uint32_t BT_TX_MIN_WINDOW = MAX_LENGTH;
+const uint32_t BT_TX_MAX_WINDOW = 8 * MAX_LENGTH;
+const uint32_t BT_TX_TARGET_DELAY_MS = 100;
+
+// rate of the write completions is measured over intervals of at least this length
+const uint32_t BT_TX_RATE_INTERVAL_MS = 100;
+
+// longest wait for room in the transmit window
+const uint32_t BT_TX_WINDOW_TIMEOUT_MS = 2000;
+
+// number of frames that can be in flight at once
+const uint8_t BT_TX_QUEUE_DEPTH = 8;
+
+// longest wait for the completion of a submitted frame
+const uint32_t BT_TX_FRAME_TIMEOUT_MS = 2000;
+
+typedef enum {
+    BT_TX_FREE = 0,
+    BT_TX_PENDING = 1,
+    BT_TX_DONE = 2,
+    BT_TX_FAILED = 3
+}_bt_tx_state_t;
+
+/**
+ * Completion callback of a submitted frame. Called from the Bluetooth stack task, or from the
+ * submitting task when the frame fails before reaching the stack, so keep it short.
+ * @param: uint32_t frame id
+ * @param: uint32_t bytes written
+ * @param: boolean, true if the whole frame was written
+ * @param: void * context given to submit_frame
+ */
+typedef void (*bt_tx_complete_cb_t)(uint32_t frame_id, uint32_t length, bool success, void * context);
+
+typedef struct {
+    uint32_t id;
+    uint32_t length;
+    uint32_t end;                   // total submitted byte count at the last byte of the frame
+    bt_tx_complete_cb_t callback;
+    void * context;
+    uint8_t state;
+}_bt_tx_frame_t;
+
+class Bluetooth {
+    private:
+    BluetoothSerial _bt_serial;
+    String _bt_device_name;
+    uint8_t _bt_server_mac[6];
+    _bluetooth_status_ _bt_connection_flag;
+    _bt_connect_state_t _connect_state;
+    
+    uint8_t _read_buffer[MAX_LENGTH];
+    uint16_t _receive_length;
+
+    SemaphoreHandle_t _receive_data_Semaphore = NULL;
+    SemaphoreHandle_t _receive_data_mutex = NULL;
+    SemaphoreHandle_t _bluetooth_serial_mutex = NULL;
+    SemaphoreHandle_t _connection_event_semaphore = NULL;
+
+    // flow control state, updated from the SPP callback
+    portMUX_TYPE _flow_mux = portMUX_INITIALIZER_UNLOCKED;
+    SemaphoreHandle_t _flow_semaphore = NULL;
+    volatile bool _congested = false;
+    volatile uint32_t _tx_window = BT_TX_MIN_WINDOW;
+    uint32_t _rate_bytes = 0;
+    uint32_t _rate_started_ms = 0;
+
+    // transmit queue, frames complete in submission order as the stack reports written bytes
+    _bt_tx_frame_t _tx_frames[BT_TX_QUEUE_DEPTH];
+    uint32_t _tx_next_id = 1;
+    uint32_t _tx_oldest_id = 1;
+    volatile uint32_t _tx_submitted_bytes = 0;
+    volatile uint32_t _tx_completed_bytes = 0;
+
+    /**
+     * Wait until the stack is not congested, the frame fits in the transmit window and a queue slot is
+     * free, then reserve the slot.
+     * @param: uint32_t frame length
+     * @return: _bt_tx_frame_t * reserved slot, NULL on timeout
+     */
+    _bt_tx_frame_t * _reserve_tx_frame(uint32_t length);
+
+    /**
+     * Account a write completion, complete the frames it finishes and resize the transmit window from
+     * the completion rate.
+     * @param: uint32_t bytes completed
+     * @param: boolean, false if the stack reported a failed write
+     */
+    void _on_write_complete(uint32_t length, bool success);
+
+    /**
+     * Forget the flow control state of the last connection and fail the frames still in flight.
+     */
+    void _reset_flow_control();
+
+    const char * _bluetooth_status_as_string(_bluetooth_status_ st);
+
+    public:
+    Bluetooth();
+    ~Bluetooth();
+
+    /**
+     * Initialize the Bluetooth module and connect to the best available phone of the peer table.
+     */
+    bool init_bluetooth();
+
+    /**
+     * Connect to one phone, waiting at most timeout_ms for the connection.
+     * @param: uint8_t phone MAC address
+     * @param: uint32_t timeout in milliseconds
+     * @return: boolean
+     */
+    bool connect_peer(const uint8_t mac[6], uint32_t timeout_ms);
+
+    /**
+     * Connection state machine. Tries the phones of the peer table in order of expected upload rate,
+     * backs off exponentially after each round and gives up at the deadline, so a missing phone costs
+     * a bounded amount of radio time. Open and close events from the SPP callback end the waits early.
+     * @param: uint32_t deadline in milliseconds from now
+     * @return: boolean, false means give up and sleep
+     */
+    bool connect_with_backoff(uint32_t deadline_ms);
+
+    /**
+     * Get the state of the connection state machine.
+     * @return: _bt_connect_state_t
+     */
+    _bt_connect_state_t get_connect_state();
+
+    /**
+     * Feed an SPP event from the status callback into the connection state machine and the flow control.
+     * @param: esp_spp_cb_event_t event
+     * @param: esp_spp_cb_param_t * event parameters
+     */
+    void on_spp_event(esp_spp_cb_event_t event, esp_spp_cb_param_t * param);
+
+    /**
+     * Get the SPP congestion state.
+     * @return: boolean
+     */
+    bool is_congested();
+
+    /**
+     * Get the number of bytes handed to the stack and not yet written.
+     * @return: uint32_t
+     */
+    uint32_t get_outstanding_bytes();
+
+    /**
+     * Get the number of submitted frames waiting for their completion.
+     * @return: uint8_t
+     */
+    uint8_t get_frames_in_flight();
+
+    /**
+     * Get the current transmit window.
+     * @return: uint32_t bytes
+     */
+    uint32_t get_tx_window();
+
+    /**
+     * Get the MAC address of the phone the camera is connected or connecting to.
+     * @return: const uint8_t *
+     */
+    const uint8_t * get_server_mac();
+
+    /**
+     * Set Bluetooth server MAC address.
+     */
+    bool set_server_mac(const uint8_t mac[6]);
+
+    /**
+     * Get the Bluetooth device name for the camera.
+     */
+    String get_bt_device_name();
+
+    /**
+     * Get the Bluetooth connection status.
+     */
+    _bluetooth_status_ get_bt_connection_status();
+
+    /**
+     * Queue a frame for transmission without waiting for it to be written. The data is copied into the
+     * stack, so the buffer can be reused on return. Waits while the stack is congested, the transmit
+     * window is full or BT_TX_QUEUE_DEPTH frames are in flight. The ESP_SPP_WRITE_EVT completions are
+     * matched to the frames in submission order; the callback, if any, reports the written length and
+     * the status, also when the connection closes first.
+     * @param: const uint8_t * frame
+     * @param: uint32_t frame length
+     * @param: bt_tx_complete_cb_t completion callback, may be NULL
+     * @param: void * callback context
+     * @return: uint32_t frame id, 0 if the frame was not queued
+     */
+    uint32_t submit_frame(const uint8_t * buff, uint32_t len, bt_tx_complete_cb_t callback, void * context);
+
+    /**
+     * Wait for the completion of a submitted frame.
+     * @param: uint32_t frame id
+     * @param: uint32_t timeout in milliseconds
+     * @return: boolean, true if the frame was written, false if it failed or the wait timed out
+     */
+    bool wait_for_frame(uint32_t frame_id, uint32_t timeout_ms);
+
+    /*
+    * Send the data in the buffer to the output stream of Bluetooth. Waits while the stack is congested
+    * or the transmit window is full.
+    */
+    int bt_write_data(const uint8_t * buff, int len);
+    
+    /**
+     * Register the Bluetooth status callback.
+     */
+    void set_status_callback(esp_spp_cb_t * callback);
+
+    /**
+     * Register the Bluetooth on data receive callback.
+     */
+    void set_on_receive_data_callback(BluetoothSerialDataCb callback);
+
+    /**
+     * Unregister the Bluetooth callbacks.
+     */
+    void un_set_callbacks();
+
+    /**
+     * Reconnect to the server.
+     * @return: boolean, false if no phone could be reached before the deadline
+     */
+    bool bt_reconnect();
+
+    /**
+    Reset the Bluetooth module.
+    */
+    void de_init_bluetooth();
+
+    /**
+     * Set the Bluetooth connection flag.
+     */
+    void set_bt_connection_status(_bluetooth_status_ status);
+
+    /**
+     * Take the receive data semaphore.
+     */
+    bool take_rcv_data_semaphore();
+    
+    /**
+     * Release the receive data mutex.
+     */
+    void give_rcv_data_mutex();
+
+    /**
+     * Copy the data received from the Bluetooth in the receive buffer.
+     * @param: const uint8_t * buff
+     * @param: uint16_t len
+     */
+    void copy_received_data(const uint8_t * buff, uint16_t len);
+
+    /**
+     * Get the pointer to receive buffer.
+     * @return uint8_t *
+     */
+    uint8_t * get_recv_buffer();
+    
+    /**
+     * Get the received data length on Bluetooth.
+     * @return uint16_t
+     */
+    uint16_t get_recv_buffer_length();
+
+    /**
+     * Take the Bluetooth serial mutex. We need this for sequential operation of the Bluetooth.
+     * When one operation is going on with the Bluetooth, another operation must wait untils it finishes.
+     */
+    void take_bluetooth_serial_mutex();
+
+    /**
+     * Release the Bluetooth serial mutex.
+     */
+    void release_bluetooth_serial_mutex();
+};
+
+
+#endif
@@ -1,655 +1,880 @@
-/**
- * Handles the Bluetooth communication between the camera and phone.
- * 
- * Procedure for sending data to the phone.
- * 
- * * 1. Check if there is a Bluetooth connection.
- * * 2. If yes, create the data packet else return.
- * * 3. Send the data packet. 
- * * 4. Wait for the response from the phone. 
- * * 5. Repeat if necessary
- * 
- * Packet Details::
- * We can send upto 330 bytes of data at one time over Bluetooth.
- * 
- * * The first byte of the packet will indicate the data type. Possible 
- * values are 1) Image (0xA0), 2) General (0xB0). 
- * 
- * * The second byte is the payload length. 
- * 
- * * If the data type is image type the third byte will indicate the packet 
- * number since image data needs to be divided before transmission. 
- * 
- * The payload starts from 3rd-byte position or 4th-byte position if image data. 
- * 
- * The last byte will be an ending character indicating the end of current
- * transmission. We set it to '#'.
- * 
- * Phone and camera needs to send a response packet after reception of data. 
- * The response will contain the first byte, 1 for the second byte, third
- * byte if any, received data length as payload, and the ending character. 
- * 
- * Both phone and camera will wait for 5 seconds for response. 
- */
-
-#include "bluetooth_comm.h"
-#include "utils.h"
-#include "sd_card.h"
-#include "time_manager.h"
-
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
-
-// Constructor for the BluetoothCommuninication Class
-BluetoothCommunication::BluetoothCommunication(){
-    if(_data_written_semaphore == NULL){
-        _data_written_semaphore = xSemaphoreCreateBinary();
-        if(_data_written_semaphore == NULL) {
-            Serial.println("BluetoothCommunication: failed to create _data_written_semaphore");
-        }
-        xSemaphoreTake(_data_written_semaphore, 0);
-    }
-}
-
-// Destructor for the BluetoothCommuninication Class
-BluetoothCommunication::~BluetoothCommunication(){
-    vSemaphoreDelete(_data_written_semaphore);
-    _data_written_semaphore = NULL;
-}
-
-
-/**
- * Get response type name.
- * @param: uint8_t response_type_enum
- */
-const char * _get_response_type_name(uint8_t type) {
-    switch (type) {
-        case RESPONSE_FOR_TIME_REQUEST:
-            return "RESPONSE_FOR_TIME_REQUEST";
-            
-        case RESPONSE_FOR_IMAGE_INCOMING_REQUEST:
-            return "RESPONSE_FOR_IMAGE_INCOMING_REQUEST";
-        
-        case RESPONSE_FOR_ARE_YOU_READY_REQUEST:
-            return "RESPONSE_FOR_ARE_YOU_READY_REQUEST";
-
-        case RESPONSE_FOR_IMAGE_SENT_REQUEST:
-            return "RESPONSE_FOR_IMAGE_SENT_REQUEST";
-
-        case RESPONSE_FOR_IMAGE_DATA:
-            return "RESPONSE_FOR_IMAGE_DATA";
-
-        case RESPONSE_FOR_OTHER_DATA:
-            return "RESPONSE_FOR_OTHER_DATA";
-    }
-} 
-
-/**
- * Verify response of a Bluetooth communication.
- * @param: Bluetooth pointer 
- * @param: Expected Bluetooth communication type.
- * @param: Expected Bluetooth response type.
- * @return: Boolean
- */
-bool BluetoothCommunication::_verify_response(Bluetooth * my_bt, uint8_t comm_type, uint8_t check_category) {
-    bool status = false;
-    // we have received response.
-    uint8_t * rcv_data;
-    uint16_t rcv_length = my_bt->get_recv_buffer_length();
-    Serial.printf("_verify_response: response length: %d\n", rcv_length);
-
-    // allocate space to copy the response
-    rcv_data = (uint8_t *) malloc(rcv_length * sizeof(uint8_t));
-    
-    if (rcv_data == NULL) {
-        Serial.println("_verify_response: failed to allocate memory");
-        return status;
-    }
-
-    // copy the response
-    memcpy(rcv_data, my_bt->get_recv_buffer(), rcv_length);
-
-    // release the recived data buffer mutex
-    my_bt->give_rcv_data_mutex();
-
-    if(rcv_data[0] == comm_type && rcv_data[1] == check_category){
-        Serial.printf("_verify_response: response: %s\n", &rcv_data[_PREAMBLE_SIZE]);
-        status = true;
-    } else {
-        Serial.printf("_verify_response: response error for %s\n", _get_response_type_name(check_category));
-        status  = false;
-    }
-
-    // free the allocated space
-    if (rcv_data != NULL) {
-        free(rcv_data);
-    }
-
-    debug("\n\n");
-    return status;
-}
-
-/**
- * Wait for the response from the phone on Bluetooth and verfies the response.
- * @param: Bluetooth object pointer
- * @return: boolean
- */
-bool BluetoothCommunication::_wait_for_response(Bluetooth * my_bt) {
-    bool status = false;
-
-    // wait for the Semaphore for 50 ticks 
-    if(my_bt->take_rcv_data_semaphore()) {
-        debug("_wait_for_response: response received from phone");
-        status = true;
-    } else {
-        Serial.println("_wait_for_response: no response received");
-    }
-    return status;
-}
-
-/**
- * Send data over Bluetooth. All other send functions calls this function to send data. 
- * 
- * @param: Bluetooth object pointer (must use pointer otherwise the )
- * @param: Bluetooth communication type
- * @param: Bluetooth communication category
- * @param: uint8_t * pointer to payload
- * @param: uint16_t payload length
- * @param: bool whether to wait for response or not.
- */
-bool BluetoothCommunication::_send_data(Bluetooth * my_bt, _bluetooth_comm_type comm_type, uint8_t category,
-    const uint8_t * data_ptr, uint16_t data_length, bool response) {
-
-    bool status = false;
-    uint8_t tx_failed = 0;
-    
-    // create the data packet
-    _create_packet(comm_type, category, data_ptr, data_length);
-
-    // try three times if not successful
-    while(true){
-        // we have the data packet. send it over Bluetooth and wait for the response
-        if(my_bt->bt_write_data(_packet_buffer, _packet_length) == _packet_length) {
-            debug("_send_data: data sent succesully");
-            status = true;
-
-            // Do we wait for the response?
-            if(response) {
-                debug("_send_data: waiting for response");
-                status = _wait_for_response(my_bt);
-
-                if(!status) {
-                    Serial.println("_send_data: wait for response time out");
-                }
-            }
-            break;
-        } else {
-            Serial.printf("_send_data: failed to send data: %d\n", tx_failed);
-            tx_failed++;
-        }
-
-        // try 3 times
-        if(tx_failed == 3) {
-            // don't need to wait for the semaphore
-            return status;
-        }
-    }
-
-    // wait for the semaphore
-    debug("_send_data: waiting for data written semaphore");
-    if (_data_written_semaphore != NULL) {
-        if(xSemaphoreTake(_data_written_semaphore, ( TickType_t ) 10000) != pdTRUE){
-            Serial.println("_send_data: failed to obtain data written semaphore");
-        }
-    }
-    return status;
-}
-
-
-/**
- * Create the packet to be sent over Bluetooth.
- * @param: Bluetooth communication type
- * @param: uint8_t * pointer to payload
- * @param: uint16_t payload_len
- */
-void BluetoothCommunication::_create_packet(_bluetooth_comm_type comm_type, uint8_t category, 
-        const uint8_t * payload, uint16_t payload_len){
-
-    _packet_length = 0;
-
-    // is this request or data or response
-    *(_packet_buffer + _packet_length) = (uint8_t)comm_type;
-    _packet_length += 1;
-
-    // set the packet category
-    *(_packet_buffer + _packet_length) = (uint8_t)category;
-    _packet_length += 1;
-    
-    // set the payload length
-    // Serial.printf("_create_packet: payload length %d\n", payload_len);
-    // Serial.printf("_create_packet: payload length %d --- %d\n", (uint8_t)((payload_len >> 8) & 0xFF), (uint8_t)(payload_len & 0xFF));
-    // Serial.printf("_create_packet: payload length 0x%X --- 0x%X\n", (uint8_t)((payload_len >> 8) & 0xFF), (uint8_t)(payload_len & 0xFF));
-    *(_packet_buffer + _packet_length) = (uint8_t)(payload_len & 0xFF);
-    *(_packet_buffer + _packet_length + 1) = (uint8_t)((payload_len >> 8) & 0xFF);
-    // Serial.printf("_create_packet: 0x%X ------- 0x%X\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
-    // Serial.printf("_create_packet: %d ------- %d\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
-    _packet_length += 2;
-    
-    // packet_number is set by the calling function and is member of the class
-    // Serial.printf("_create_packet: packet number %d\n", _packet_number);
-    // Serial.printf("_create_packet: packet number %d --- %d\n", (uint8_t)((_packet_number >> 8) & 0xFF), (uint8_t)(_packet_number & 0xFF));
-    // Serial.printf("_create_packet: packet number 0x%X --- 0x%X\n", (uint8_t)((_packet_number >> 8) & 0xFF), (uint8_t)(_packet_number & 0xFF));
-    *(_packet_buffer + _packet_length) = (uint8_t)(_packet_number & 0xFF);
-    *(_packet_buffer + _packet_length + 1) = (uint8_t)((_packet_number >> 8) & 0xFF);
-    // Serial.printf("_create_packet: 0x%X ------- 0x%X\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
-    // Serial.printf("_create_packet: %d ------- %d\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
-    _packet_length += 2;
-        
-    // Payload is already in the buffer, just increment the payload length
-    if (payload != NULL) {
-        // copy only if payload pointer is not NULL, in some case we already have data in the _packet_buffer and pass NULL pointer
-        memcpy(_packet_buffer+_packet_length, payload, payload_len);
-    }
-    _packet_length += payload_len;
-    
-    // with this we have the packet, return back to the calling function.
-    Serial.printf("_create_packet: payload length: %d, packet number: %d, length: %d\n", payload_len, _packet_number, _packet_length);
-}
-
-
-/**
- * Send incoming image request and verify the response.
- * @param Bluetooth * pointer
- * @return boolean
- */
-bool BluetoothCommunication::_send_image_incoming_request(Bluetooth * my_bt) {
-    bool status = false;
-
-    // set the packet number
-    _packet_number = 1;
-    
-    // send the image incoming request and verify the response.
-    status = _send_data(my_bt, BT_REQUEST, IMAGE_INCOMING_REQUEST, (uint8_t *)_image_request, strlen(_image_request), true);
-    if(status) {
-        // request is sent, response is received, now verify the response.
-        status = _verify_response(my_bt, BT_RESPONSE, (uint8_t)RESPONSE_FOR_IMAGE_INCOMING_REQUEST);
-        if(!status) {
-             Serial.println("_send_image_incoming_request: invalid response");
-        }
-    } else {
-        Serial.println("_send_image_incoming_request: failed request");
-    }
-
-    return status;
-}
-
-/**
- * Send the are you ready request and verify the response.
- * @param: Bluetooth * pointer
- * @return Boolean
- */
-bool BluetoothCommunication::_send_are_you_ready_request(Bluetooth * my_bt){
-    bool status = false;
-
-    // set the packet number
-    _packet_number = 1;
-    
-    // send the are you ready request and verify the response.
-    status |= _send_data(my_bt, BT_REQUEST, ARE_YOU_READY_REQUEST, (uint8_t *)_u_ready_request, strlen(_u_ready_request), true);
-    if(status) {
-        // request is sent, response is received, now verify the response.
-        status = _verify_response(my_bt, BT_RESPONSE, (uint8_t)RESPONSE_FOR_ARE_YOU_READY_REQUEST);
-        if(!status) {
-             Serial.println("_send_are_you_ready_request: invalid response");
-        }
-
-    } else {
-        Serial.println("_send_are_you_ready_request: failed request");
-    }
-
-    return status;
-}
-
-/**
- * Send image sent request and verify the response. 
- * @param: Bluetooth * pointer
- * @return: Boolean
- */
-bool BluetoothCommunication::_send_image_sent_request(Bluetooth * my_bt, const char * file_name) {
-    bool status = false;
-
-    // set the packet number
-    _packet_number = 1;
-    
-    // send the are you ready request and verify the response.
-    status |= _send_data(my_bt, BT_REQUEST, IMAGE_SENT_REQUEST, (uint8_t *)file_name, strlen(file_name), true);
-    if(status) {
-        // request is sent, response is received, now verify the response.
-        status = _verify_response(my_bt, BT_RESPONSE, (uint8_t)RESPONSE_FOR_IMAGE_SENT_REQUEST);
-        if(!status) {
-             Serial.println("_send_image_sent_request: invalid response");
-        } 
-
-    } else {
-        Serial.println("_send_image_sent_request: failed request");
-    }
-
-    return status;
-}
-
-/**
- * This function completes the necessary steps required for image transfer. The procedure for image transfer are:
- *  1) Send the image incoming request.
- *  2) Wait for the response. On invalid response return false.
- *  3) Send are you ready request.
- *  4) Wait for the response. On invalid response return false.
- *  
- * @param Bluetooth object pointer
- * @return boolean True if all checks are passed else false.
- */
-bool BluetoothCommunication::_image_transfer_confirmation(Bluetooth * my_bt){
-    bool status  = false;
-
-    // check if the camera is connected to phone or not.
-    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
-        Serial.println("_image_transfer_confirmation: bt disconnected");
-        return status;
-    }
-
-    // send the image incoming request and verify the response.
-    status = _send_image_incoming_request(my_bt);
-    if(status) {
-        status = _send_are_you_ready_request(my_bt);
-        if(!status) {
-            Serial.println("_image_transfer_confirmation: failed at are you ready request");
-        }
-    } else {
-        Serial.println("_image_transfer_confirmation: failed at image incoming request");
-    }
-
-    return status;
-}
-
-
-/**
- * Give semaphore which indicates that queued data is transmitted. 
- */
-void BluetoothCommunication::give_data_semaphore(){
-    if (_data_written_semaphore != NULL) {
-        debug("give_data_semaphore: giving data written semaphore");
-        xSemaphoreGive(_data_written_semaphore);
-    }
-}
-
-/**
- * Send next image from the SD card to phone.
- * 
- * @param: Bluetooth object pointer
- * @param: FS object
- */
-bool BluetoothCommunication::send_next_image(Bluetooth * my_bt, fs::FS &fs){
-    bool status = false;
-
-    if (my_bt == NULL) {
-        Serial.println("send_next_image: null BT object");
-        return status;
-    }
-
-    // check if the camera is connected to phone or not.
-    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
-        Serial.println("send_next_image: bt disconnected");
-        return status;
-    }
-
-    // open the root SD card directory
-    File root_dir = fs.open("/");
-
-    // check whether root is open and a directory
-    if(root_dir == NULL || !root_dir.isDirectory()) { 
-        Serial.println("send_next_image: failed to open the SD card");    
-        return status;
-    }
-
-    // open the next file in the directory :: mechanism to check if there is any file or not.
-    File my_file = root_dir.openNextFile();
-
-    while(my_file){
-        if(!my_file.isDirectory()){
-            debug("send_next_image:  FILE: ");
-            Serial.println(my_file.name());
-            debug("send_next_image:  SIZE: ");
-            Serial.println(my_file.size());
-            break;
-        }
-        my_file = root_dir.openNextFile();
-    }
-
-    if(my_file.size() == 0) {
-        // no need to proceed, because there is no file in the SD card to send.
-        return status;
-    }
-
-    // now we have an image, start the Image transfer procedure.
-    if(_image_transfer_confirmation(my_bt)) {
-        debug("send_next_image: image transfer verified, sending image now...");
-        
-        // send the image file
-        status = send_data_file(my_bt, IMAGE_DATA, &my_file);
-        
-        // send the image sent request
-        if(status) {
-            delay(100);
-            status  = _send_image_sent_request(my_bt, my_file.name());
-        }
-        
-        if(status) {
-            // after the file is sent, delete it from SD card.
-            Serial.printf("send_next_image: image file: %s sent\n", my_file.name());
-            sd_delete_file(fs, my_file.name());
-        }
-    }
-
-    // close the file
-    my_file.close();
-    root_dir.close();
-
-    return status;
-}
-
-/**
- * Send the content of the file over Bluetooth. 
- * @param: Bluetooth object pointer
- * @param: Bluetooth data category
- * @param: FILE object pointer
- * 
- * @return: boolean
- */
-bool BluetoothCommunication::send_data_file(Bluetooth * my_bt, _bluetooth_data_type data_type, File * my_file) {
-    bool status = false;
-    uint8_t response_category = RESPONSE_FOR_IMAGE_DATA;
-    if (data_type == OTHER_DATA) {
-        response_category = RESPONSE_FOR_OTHER_DATA;
-    }
-
-    if (my_bt == NULL) {
-        Serial.println("send_data_file: null BT object");
-        return status;
-    }
-
-    if(my_file == NULL) {
-        Serial.println("send_data_file: null file pointer");
-        return status;
-    }
-
-    uint32_t file_size = my_file->size();
-    Serial.printf("send_data_file: file size %d\n", file_size);
-
-    // First we need to check if we have the connection
-    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
-        Serial.println("send_data_file: bt disconnected");
-        return status;
-    }
-
-    // set the packet number
-    _packet_number = 1;
-    uint16_t read_size = 0;
-    uint32_t total_bytes_sent = 0;
-
-    while(my_file->available()){
-        // read bytes from the file
-        read_size = my_file->read(_packet_buffer + _PREAMBLE_SIZE, _PAYLOAD_SPACE);
-        if(read_size == 0) {
-            Serial.println("send_data_file: error reading file");
-            break;
-        }
-
-        // send the read bytes to phone
-        Serial.printf("send_data_file: read %d bytes\n", read_size);
-        status = _send_data(my_bt, BT_DATA, (uint8_t)data_type, NULL, read_size, true);
-        if(!status) {
-            Serial.printf("send_data_file: tx failed, packet number %d\n", _packet_number);
-            break;
-        }
-
-        // verify response.
-        status = _verify_response(my_bt, BT_RESPONSE, response_category);
-        if(!status) {
-            Serial.println("send_data_file: invalid response");
-            break;
-        }
-
-        // increment the packet number and total bytes sent 
-        total_bytes_sent += read_size;
-        _packet_number += 1;
-    }
-
-    if(status) {
-        Serial.printf("send_data_file: out of %d bytes, %d sent\n", file_size, total_bytes_sent);
-    }
-    return status;
-}
-
-/**
- * Send the data over Bluetooth by creating a data packet and
- * receive the response.
- * 
- * @param Bluetooth object pointer
- * @param _bluetooth_comm_type communication type
- * @param category Communication category
- * @param uint8_t * pointer to the data array
- * @param uint16_t data length
- * 
- * @return boolean.
- */
-bool BluetoothCommunication::send_data(Bluetooth * my_bt, _bluetooth_comm_type comm_type, uint8_t category,
-    const uint8_t * data_ptr, uint16_t data_length) {
-
-    bool status = false;
-    uint16_t total_data_length = data_length;
-
-    // First we need to check if we have the connection
-    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
-        Serial.println("send_data: bt disconnected");
-        return status;
-    }
-
-    // set the packet number to zero
-    _packet_number = 255;
-
-    // check the length, send the data, and receive response
-    if (data_length > _PAYLOAD_SPACE) {
-        uint16_t start = 0;
-        uint16_t end = _PAYLOAD_SPACE;
-        uint16_t sending_bytes = 0;
-
-        // we need to divide data into several packets.
-        while(total_data_length != 0){
-            // keep sending until we reach the end of the data buffer
-            // Serial.printf("sending packet number %d\n", _packet_number);
-            sending_bytes = end - start;
-            // Serial.printf("start: %d, end: %d, # bytes %d\n", start, end, sending_bytes);
-
-            // copy the data into the buffer
-            memcpy(_packet_buffer + _PREAMBLE_SIZE, data_ptr + start, sending_bytes);
-            status = _send_data(my_bt, comm_type, category, NULL, sending_bytes, false);
-
-            if(status) {
-                total_data_length -= sending_bytes;
-                start += sending_bytes;
-                end += total_data_length < _PAYLOAD_SPACE ? total_data_length : _PAYLOAD_SPACE;
-                _packet_number += 1;
-            } else {
-                // failed to send data, break free.
-                Serial.printf("send_data: tx failed at packet number %d\n", _packet_number);
-               break;
-            }
-        }
-        Serial.printf("send_data: out of %d bytes, %d sent\n", data_length, end);
-
-    } else {
-        // copy the data into the buffer
-        memcpy(_packet_buffer + _PREAMBLE_SIZE, data_ptr, data_length);
-        status = _send_data(my_bt, comm_type, category, NULL, data_length, true);
-
-    }
-
-    return status;
-}
-
-
-/**
- * Send a Bluetooth request for current time. If response received, set the RTC time.
- * @param: Bluetooth object pointer
- * @return: boolean
- */
-bool BluetoothCommunication::request_for_time(Bluetooth * my_bt){
-    bool status = false;
-
-    show_current_rtc_time();
-    status = _send_data(my_bt, BT_REQUEST, TIME_REQUEST, (uint8_t *)_time_request, strlen(_time_request), true);
-    if(status) {    
-        uint8_t * rcv_data;
-        uint16_t rcv_length = my_bt->get_recv_buffer_length();
-        Serial.printf("request_for_time: response length: %d\n", rcv_length);
-
-        // allocate space to copy the response
-        rcv_data = (uint8_t *) malloc(rcv_length * sizeof(uint8_t));
-        if (rcv_data == NULL) {
-            Serial.println("request_for_time: failed to allocate memory");
-            return false;
-        }
-
-        // copy the response
-        memcpy(rcv_data, my_bt->get_recv_buffer(), rcv_length);
-
-        // release the recived data buffer mutex
-        my_bt->give_rcv_data_mutex();
-
-        if(rcv_data[0] == BT_RESPONSE && rcv_data[1] == RESPONSE_FOR_TIME_REQUEST){
-            // uint16_t data_length = (uint16_t)(rcv_data[2] | rcv_data[3] >> 8);
-            // Serial.printf("data length %d\n", data_length);
-
-            uint64_t time_in_millis;
-            memcpy(&time_in_millis, &rcv_data[_PREAMBLE_SIZE], 8);
-            Serial.printf("request_for_time: epoch time in millis: %llu\n", time_in_millis);
-            // Serial.printf("%d\n", time_in_millis);
-            
-            // set the current timestamp
-            set_rtc_time(time_in_millis);
-        } else {
-            Serial.println("request_for_time: invalid response");
-            status = false;
-        }
-        
-        // free the allocated space
-        if (rcv_data != NULL) {
-            free(rcv_data);
-        }
-
-        show_current_rtc_time();
-    }
-
-    return status;
-}
+/**
+ * Handles the Bluetooth communication between the camera and phone.
+ * 
+ * Procedure for sending data to the phone.
+ * 
+ * * 1. Check if there is a Bluetooth connection.
+ * * 2. If yes, create the data packet else return.
+ * * 3. Send the data packet. 
+ * * 4. Wait for the response from the phone. 
+ * * 5. Repeat if necessary
+ * 
+ * Packet Details::
+ * We can send upto 330 bytes of data at one time over Bluetooth.
+ * 
+ * * The first byte of the packet will indicate the data type. Possible 
+ * values are 1) Image (0xA0), 2) General (0xB0). 
+ * 
+ * * The second byte is the payload length. 
+ * 
+ * * If the data type is image type the third byte will indicate the packet 
+ * number since image data needs to be divided before transmission. 
+ * 
+ * The payload starts from 3rd-byte position or 4th-byte position if image data. 
+ * 
+ * The last byte will be an ending character indicating the end of current
+ * transmission. We set it to '#'.
+ * 
+ * Phone and camera needs to send a response packet after reception of data. 
+ * The response will contain the first byte, 1 for the second byte, third
+ * byte if any, received data length as payload, and the ending character. 
+ * 
+ * Both phone and camera will wait for 5 seconds for response. 
+ */
+
+#include "bluetooth_comm.h"
+#include "utils.h"
+#include "sd_card.h"
+#include "time_manager.h"
+#include "metrics.h"
+#include "image_index.h"
+#include "device_config.h"
+#include "peer_table.h"
+#include "compression.h"
+#include "sd_capacity.h"
+#include "mem_pool.h"
+#include "resource_monitor.h"
+#include "energy.h"
+#include "power.h"
+#include "wake_budget.h"
+
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static_assert(BT_COMPRESS_BUFFER_SIZE <= MEM_POOL_BULK_BLOCK_SIZE, "compression buffer does not fit a bulk pool block");
+static_assert(MEM_POOL_PACKET_BLOCK_SIZE == BT_MAX_FRAME_LENGTH, "responses are verified in frame sized packet blocks");
+
+
+// Constructor for the BluetoothCommuninication Class
+BluetoothCommunication::BluetoothCommunication(){
+}
+
+// Destructor for the BluetoothCommuninication Class
+BluetoothCommunication::~BluetoothCommunication(){
+}
+
+
+/**
+ * Get response type name.
+ * @param: uint8_t response_type_enum
+ */
+const char * _get_response_type_name(uint8_t type) {
+    switch (type) {
+        case RESPONSE_FOR_TIME_REQUEST:
+            return "RESPONSE_FOR_TIME_REQUEST";
+            
+        case RESPONSE_FOR_IMAGE_INCOMING_REQUEST:
+            return "RESPONSE_FOR_IMAGE_INCOMING_REQUEST";
+        
+        case RESPONSE_FOR_ARE_YOU_READY_REQUEST:
+            return "RESPONSE_FOR_ARE_YOU_READY_REQUEST";
+
+        case RESPONSE_FOR_IMAGE_SENT_REQUEST:
+            return "RESPONSE_FOR_IMAGE_SENT_REQUEST";
+
+        case RESPONSE_FOR_IMAGE_DATA:
+            return "RESPONSE_FOR_IMAGE_DATA";
+
+        case RESPONSE_FOR_OTHER_DATA:
+            return "RESPONSE_FOR_OTHER_DATA";
+
+        case RESPONSE_FOR_CONFIG_REQUEST:
+            return "RESPONSE_FOR_CONFIG_REQUEST";
+
+        case RESPONSE_FOR_CAPABILITY_REQUEST:
+            return "RESPONSE_FOR_CAPABILITY_REQUEST";
+
+        case RESPONSE_FOR_IMAGE_PREVIEW_DATA:
+            return "RESPONSE_FOR_IMAGE_PREVIEW_DATA";
+
+        default:
+            return "UNKNOWN";
+    }
+} 
+
+/**
+ * Verify response of a Bluetooth communication.
+ * @param: Bluetooth pointer 
+ * @param: Expected Bluetooth communication type.
+ * @param: Expected Bluetooth response type.
+ * @return: Boolean
+ */
+bool BluetoothCommunication::_verify_response(Bluetooth * my_bt, uint8_t comm_type, uint8_t check_category) {
+    bool status = false;
+
+    // the phone only answers with responses
+    if(comm_type != BT_RESPONSE) {
+        LOG_E(LOG_MODULE_COMM, "_verify_response: unexpected comm type %d", comm_type);
+        return status;
+    }
+
+    // take a packet block to copy the response payload
+    _mem_block_t * block = mem_pool_get(MEM_POOL_PACKET);
+    if (block == NULL) {
+        LOG_E(LOG_MODULE_COMM, "_verify_response: no packet buffer");
+        return status;
+    }
+
+    uint16_t payload_length = 0;
+    if(_read_response(my_bt, check_category, block->data, block->size, &payload_length)) {
+        LOG_D(LOG_MODULE_COMM, "_verify_response: response: %.*s", std::min((uint32_t)payload_length, block->size),
+            (const char *)block->data);
+        status = true;
+    } else {
+        LOG_E(LOG_MODULE_COMM, "_verify_response: response error for %s", _get_response_type_name(check_category));
+        status  = false;
+    }
+
+    mem_pool_put(block);
+
+    return status;
+}
+
+/**
+ * Parse the received response frame and copy its payload. The receive buffer mutex is released
+ * before returning.
+ * @param: Bluetooth pointer
+ * @param: uint8_t expected response category
+ * @param: uint8_t * payload buffer, may be NULL if payload_size is 0
+ * @param: uint16_t payload buffer size, a longer payload is cut to it
+ * @param: uint16_t * payload length declared in the frame
+ * @return: boolean, false if the frame is malformed or not the expected response
+ */
+bool BluetoothCommunication::_read_response(Bluetooth * my_bt, uint8_t category, uint8_t * payload,
+    uint16_t payload_size, uint16_t * payload_length) {
+
+    // take the receive buffer first, the length belongs to the buffer content
+    const uint8_t * rcv_data = my_bt->get_recv_buffer();
+    uint16_t rcv_length = std::min(my_bt->get_recv_buffer_length(), MAX_LENGTH);
+
+    _bt_frame_t frame;
+    _bt_frame_status_t parsed = bt_frame_read_response(rcv_data, rcv_length, BT_RESPONSE, category, payload,
+        payload_size, &frame);
+
+    // release the recived data buffer mutex
+    my_bt->give_rcv_data_mutex();
+
+    if(parsed == BT_FRAME_UNEXPECTED) {
+        LOG_E(LOG_MODULE_COMM, "_read_response: got 0x%02X/0x%02X, expected %s", frame.comm_type, frame.category,
+            _get_response_type_name(category));
+        return false;
+    }
+    if(parsed != BT_FRAME_OK) {
+        LOG_E(LOG_MODULE_COMM, "_read_response: malformed frame of %d bytes, %s", rcv_length,
+            bt_frame_status_name(parsed));
+        return false;
+    }
+
+    *payload_length = frame.payload_length;
+    return true;
+}
+
+/**
+ * Wait for the response from the phone on Bluetooth and verfies the response.
+ * @param: Bluetooth object pointer
+ * @return: boolean
+ */
+bool BluetoothCommunication::_wait_for_response(Bluetooth * my_bt) {
+    bool status = false;
+
+    // wait for the Semaphore for 50 ticks 
+    if(my_bt->take_rcv_data_semaphore()) {
+        LOG_D(LOG_MODULE_COMM, "_wait_for_response: response received from phone");
+        status = true;
+    } else {
+        LOG_W(LOG_MODULE_COMM, "_wait_for_response: no response received");
+    }
+    return status;
+}
+
+/**
+ * Send data over Bluetooth. All other send functions calls this function to send data. 
+ * 
+ * @param: Bluetooth object pointer (must use pointer otherwise the )
+ * @param: Bluetooth communication type
+ * @param: Bluetooth communication category
+ * @param: uint8_t * pointer to payload
+ * @param: uint16_t payload length
+ * @param: bool whether to wait for response or not.
+ */
+bool BluetoothCommunication::_send_data(Bluetooth * my_bt, _bluetooth_comm_type comm_type, uint8_t category,
+    const uint8_t * data_ptr, uint16_t data_length, bool response) {
+
+    bool status = false;
+    uint8_t tx_failed = 0;
+    
+    // create the data packet
+    _create_packet(comm_type, category, data_ptr, data_length);
+
+    // try three times if not successful
+    while(true){
+        // we have the data packet. send it over Bluetooth and wait for the response
+        uint32_t sent_at = millis();
+        uint32_t frame_id = my_bt->submit_frame(_packet_buffer, _packet_length, NULL, NULL);
+        if(frame_id != 0) {
+            LOG_D(LOG_MODULE_COMM, "_send_data: data sent succesully");
+            _last_frame_id = frame_id;
+            metrics_bytes_sent(_packet_length);
+            status = true;
+
+            // Do we wait for the response?
+            if(response) {
+                LOG_D(LOG_MODULE_COMM, "_send_data: waiting for response");
+                status = _wait_for_response(my_bt);
+
+                if(status) {
+                    metrics_ack_latency(millis() - sent_at);
+                } else {
+                    LOG_W(LOG_MODULE_COMM, "_send_data: wait for response time out");
+                }
+            }
+            break;
+        } else {
+            LOG_W(LOG_MODULE_COMM, "_send_data: failed to send data: %d", tx_failed);
+            tx_failed++;
+            metrics_retransmit();
+        }
+
+        // try 3 times
+        if(tx_failed == 3) {
+            return status;
+        }
+    }
+
+    // the frame is queued, not necessarily written. Write completions are tracked by the Bluetooth
+    // transmit queue, the next frame waits only if the stack is congested or the queue is full.
+    return status;
+}
+
+
+/**
+ * Create the packet to be sent over Bluetooth.
+ * @param: Bluetooth communication type
+ * @param: uint8_t * pointer to payload
+ * @param: uint16_t payload_len
+ */
+void BluetoothCommunication::_create_packet(_bluetooth_comm_type comm_type, uint8_t category, 
+        const uint8_t * payload, uint16_t payload_len){
+
+    _packet_length = 0;
+
+    // is this request or data or response
+    *(_packet_buffer + _packet_length) = (uint8_t)comm_type;
+    _packet_length += 1;
+
+    // set the packet category
+    *(_packet_buffer + _packet_length) = (uint8_t)category;
+    _packet_length += 1;
+    
+    // set the payload length
+    // Serial.printf("_create_packet: payload length %d\n", payload_len);
+    // Serial.printf("_create_packet: payload length %d --- %d\n", (uint8_t)((payload_len >> 8) & 0xFF), (uint8_t)(payload_len & 0xFF));
+    // Serial.printf("_create_packet: payload length 0x%X --- 0x%X\n", (uint8_t)((payload_len >> 8) & 0xFF), (uint8_t)(payload_len & 0xFF));
+    *(_packet_buffer + _packet_length) = (uint8_t)(payload_len & 0xFF);
+    *(_packet_buffer + _packet_length + 1) = (uint8_t)((payload_len >> 8) & 0xFF);
+    // Serial.printf("_create_packet: 0x%X ------- 0x%X\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
+    // Serial.printf("_create_packet: %d ------- %d\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
+    _packet_length += 2;
+    
+    // packet_number is set by the calling function and is member of the class
+    // Serial.printf("_create_packet: packet number %d\n", _packet_number);
+    // Serial.printf("_create_packet: packet number %d --- %d\n", (uint8_t)((_packet_number >> 8) & 0xFF), (uint8_t)(_packet_number & 0xFF));
+    // Serial.printf("_create_packet: packet number 0x%X --- 0x%X\n", (uint8_t)((_packet_number >> 8) & 0xFF), (uint8_t)(_packet_number & 0xFF));
+    *(_packet_buffer + _packet_length) = (uint8_t)(_packet_number & 0xFF);
+    *(_packet_buffer + _packet_length + 1) = (uint8_t)((_packet_number >> 8) & 0xFF);
+    // Serial.printf("_create_packet: 0x%X ------- 0x%X\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
+    // Serial.printf("_create_packet: %d ------- %d\n", *(_packet_buffer + _packet_length), *(_packet_buffer + _packet_length + 1));
+    _packet_length += 2;
+        
+    // Payload is already in the buffer, just increment the payload length
+    if (payload != NULL) {
+        // copy only if payload pointer is not NULL, in some case we already have data in the _packet_buffer and pass NULL pointer
+        memcpy(_packet_buffer+_packet_length, payload, payload_len);
+    }
+    _packet_length += payload_len;
+    
+    // with this we have the packet, return back to the calling function.
+    LOG_D(LOG_MODULE_COMM, "_create_packet: payload length: %d, packet number: %d, length: %d", payload_len, _packet_number, _packet_length);
+}
+
+
+/**
+ * Send incoming image request and verify the response.
+ * @param Bluetooth * pointer
+ * @param const _image_index_entry_t * image to transfer
+ * @param bool * set if the phone already has the image
+ * @return boolean
+ */
+bool BluetoothCommunication::_send_image_incoming_request(Bluetooth * my_bt, const _image_index_entry_t * entry,
+    bool * already_received) {
+    bool status = false;
+    *already_received = false;
+
+    // set the packet number
+    _packet_number = 1;
+
+    // the content id lets the phone tell whether it already has this image
+    if(_session_capabilities & BT_CAPABILITY_CONTENT_ID) {
+        uint8_t content_id[BT_CONTENT_ID_SIZE];
+        for(int i = 0; i < 4; ++i) {
+            content_id[i] = (uint8_t)((entry->id >> (8 * i)) & 0xFF);
+            content_id[4 + i] = (uint8_t)((entry->hash >> (8 * i)) & 0xFF);
+            content_id[8 + i] = (uint8_t)((entry->size >> (8 * i)) & 0xFF);
+        }
+        status = _send_data(my_bt, BT_REQUEST, IMAGE_INCOMING_REQUEST, content_id, sizeof(content_id), true);
+    } else {
+        status = _send_data(my_bt, BT_REQUEST, IMAGE_INCOMING_REQUEST, (uint8_t *)_image_request, strlen(_image_request), true);
+    }
+    if(!status) {
+        LOG_E(LOG_MODULE_COMM, "_send_image_incoming_request: failed request");
+        return status;
+    }
+
+    // request is sent, response is received, now verify the response.
+    uint8_t payload[BT_IMAGE_INCOMING_RESPONSE_SIZE];
+    uint16_t payload_length = 0;
+    if(!_read_response(my_bt, RESPONSE_FOR_IMAGE_INCOMING_REQUEST, payload, sizeof(payload), &payload_length)) {
+        LOG_E(LOG_MODULE_COMM, "_send_image_incoming_request: invalid response");
+        return false;
+    }
+
+    // a payload longer than the buffer is cut, and then no longer matches the text
+    if(bt_frame_payload_is(payload, std::min(payload_length, (uint16_t)sizeof(payload)), _image_received_response)) {
+        LOG_I(LOG_MODULE_COMM, "_send_image_incoming_request: phone already has image %u", entry->id);
+        *already_received = true;
+    }
+    return true;
+}
+
+/**
+ * Send the are you ready request and verify the response.
+ * @param: Bluetooth * pointer
+ * @return Boolean
+ */
+bool BluetoothCommunication::_send_are_you_ready_request(Bluetooth * my_bt){
+    bool status = false;
+
+    // set the packet number
+    _packet_number = 1;
+    
+    // send the are you ready request and verify the response.
+    status |= _send_data(my_bt, BT_REQUEST, ARE_YOU_READY_REQUEST, (uint8_t *)_u_ready_request, strlen(_u_ready_request), true);
+    if(status) {
+        // request is sent, response is received, now verify the response.
+        status = _verify_response(my_bt, BT_RESPONSE, (uint8_t)RESPONSE_FOR_ARE_YOU_READY_REQUEST);
+        if(!status) {
+             LOG_E(LOG_MODULE_COMM, "_send_are_you_ready_request: invalid response");
+        }
+
+    } else {
+        LOG_E(LOG_MODULE_COMM, "_send_are_you_ready_request: failed request");
+    }
+
+    return status;
+}
+
+/**
+ * Send image sent request and verify the response. 
+ * @param: Bluetooth * pointer
+ * @return: Boolean
+ */
+bool BluetoothCommunication::_send_image_sent_request(Bluetooth * my_bt, const char * file_name) {
+    bool status = false;
+
+    // set the packet number
+    _packet_number = 1;
+    
+    // send the are you ready request and verify the response.
+    status |= _send_data(my_bt, BT_REQUEST, IMAGE_SENT_REQUEST, (uint8_t *)file_name, strlen(file_name), true);
+    if(status) {
+        // request is sent, response is received, now verify the response.
+        status = _verify_response(my_bt, BT_RESPONSE, (uint8_t)RESPONSE_FOR_IMAGE_SENT_REQUEST);
+        if(!status) {
+             LOG_E(LOG_MODULE_COMM, "_send_image_sent_request: invalid response");
+        } 
+
+    } else {
+        LOG_E(LOG_MODULE_COMM, "_send_image_sent_request: failed request");
+    }
+
+    return status;
+}
+
+/**
+ * This function completes the necessary steps required for image transfer. The procedure for image transfer are:
+ *  1) Send the image incoming request.
+ *  2) Wait for the response. On invalid response return false.
+ *  3) Send are you ready request.
+ *  4) Wait for the response. On invalid response return false.
+ * If the phone answers the image incoming request with "image received" the procedure stops there.
+ *  
+ * @param Bluetooth object pointer
+ * @param const _image_index_entry_t * image to transfer
+ * @param bool * set if the phone already has the image
+ * @return boolean True if all checks are passed else false.
+ */
+bool BluetoothCommunication::_image_transfer_confirmation(Bluetooth * my_bt, const _image_index_entry_t * entry,
+    bool * already_received){
+    bool status  = false;
+
+    // check if the camera is connected to phone or not.
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "_image_transfer_confirmation: bt disconnected");
+        return status;
+    }
+
+    // send the image incoming request and verify the response.
+    status = _send_image_incoming_request(my_bt, entry, already_received);
+    if(status && *already_received) {
+        // nothing to transfer
+        return status;
+    }
+    if(status) {
+        status = _send_are_you_ready_request(my_bt);
+        if(!status) {
+            LOG_E(LOG_MODULE_COMM, "_image_transfer_confirmation: failed at are you ready request");
+        }
+    } else {
+        LOG_E(LOG_MODULE_COMM, "_image_transfer_confirmation: failed at image incoming request");
+    }
+
+    return status;
+}
+
+
+/**
+ * Send next image from the SD card to phone.
+ * 
+ * @param: Bluetooth object pointer
+ * @param: FS object
+ */
+bool BluetoothCommunication::send_next_image(Bluetooth * my_bt, fs::FS &fs){
+    bool status = false;
+
+    if (my_bt == NULL) {
+        LOG_E(LOG_MODULE_COMM, "send_next_image: null BT object");
+        return status;
+    }
+
+    // check if the camera is connected to phone or not.
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "send_next_image: bt disconnected");
+        return status;
+    }
+
+    // the oldest committed image, incomplete images never reach the index as committed
+    _image_index_entry_t entry;
+    if(!image_index_next(&entry)) {
+        // no need to proceed, because there is no file in the SD card to send.
+        LOG_I(LOG_MODULE_COMM, "send_next_image: no image to send");
+        return status;
+    }
+
+    // an upload the wake can not afford waits for a later wake, the image stays committed. The first
+    // upload of the session always goes, it refreshes the estimate that would otherwise block it forever.
+    if(_session_uploads > 0 && !energy_upload_affordable(entry.size)) {
+        energy_upload_deferred();
+        return status;
+    }
+
+    // and so does one that can not finish before the upload deadline at the expected rate. An image
+    // longer than the whole window would never fit, it only needs the window, and the deferral moves
+    // the rate back toward the default so a slow session does not hold the queue.
+    uint32_t expected_ms = (uint32_t)((uint64_t)entry.size * 1000 / peer_table_expected_rate(my_bt->get_server_mac()));
+    expected_ms = std::min(expected_ms, (uint32_t)WAKE_UPLOAD_WINDOW_MS);
+    if(_session_uploads > 0 && expected_ms > wake_budget_remaining_ms(WAKE_PHASE_UPLOAD)) {
+        LOG_I(LOG_MODULE_COMM, "send_next_image: image %u needs about %u ms, left for the next wake", entry.id, expected_ms);
+        peer_table_upload_deferred(my_bt->get_server_mac());
+        return status;
+    }
+    _session_uploads++;
+
+    char image_path[24];
+    image_index_image_path(entry.id, image_path, sizeof(image_path));
+    File my_file = fs.open(image_path, FILE_READ);
+    if(!my_file || my_file.size() == 0) {
+        LOG_E(LOG_MODULE_COMM, "send_next_image: failed to open %s", image_path);
+        image_index_set_state(fs, entry.id, IMAGE_REMOVED);
+        return status;
+    }
+    LOG_I(LOG_MODULE_COMM, "send_next_image: file: %s, size: %d", image_path, my_file.size());
+
+    // now we have an image, start the Image transfer procedure.
+    bool already_received = false;
+    bool confirmed = _image_transfer_confirmation(my_bt, &entry, &already_received);
+    if(confirmed && already_received) {
+        // an earlier upload reached the phone but its image sent request did not, just delete the image
+        status = true;
+    } else if(confirmed) {
+        LOG_D(LOG_MODULE_COMM, "send_next_image: image transfer verified, sending image now...");
+
+        // the preview goes first so the phone has something to show early, the image is sent without it
+        if(_session_capabilities & BT_CAPABILITY_PREVIEW) {
+            _send_preview(my_bt, fs, entry.id);
+        }
+
+        // send the image file, and measure the upload rate to this phone
+        uint32_t upload_started = millis();
+        status = send_data_file(my_bt, IMAGE_DATA, &my_file);
+        if(status) {
+            peer_table_record_throughput(my_bt->get_server_mac(), entry.size, millis() - upload_started);
+        } else if(wake_budget_expired(WAKE_PHASE_UPLOAD)) {
+            // the image starts over in the next wake, after a few cut off uploads it goes behind the others
+            uint8_t aborts = image_index_upload_aborted(entry.id);
+            LOG_W(LOG_MODULE_COMM, "send_next_image: upload of image %u cut off by the deadline, %u times", entry.id,
+                aborts);
+        }
+        
+        // send the image sent request
+        if(status) {
+            delay(100);
+            status  = _send_image_sent_request(my_bt, image_path);
+        }
+    }
+
+    // close the file
+    my_file.close();
+
+    if(status) {
+        // the phone has the image, record it before deleting so a power loss can't cause a re-upload.
+        LOG_I(LOG_MODULE_COMM, "send_next_image: image file: %s sent", image_path);
+        image_index_set_state(fs, entry.id, IMAGE_UPLOADED);
+        sd_delete_file(fs, image_path);
+        sd_capacity_remove(entry.size);
+        sd_capacity_remove(image_index_remove_preview(fs, entry.id));
+        image_index_set_state(fs, entry.id, IMAGE_REMOVED);
+        metrics_image_uploaded();
+    }
+
+    return status;
+}
+
+/**
+ * Send the preview of an image, if it has one. A failed preview does not stop the image upload.
+ * @param: Bluetooth object pointer
+ * @param: FS object
+ * @param: uint32_t image id
+ * @return: boolean, true if a preview was sent
+ */
+bool BluetoothCommunication::_send_preview(Bluetooth * my_bt, fs::FS &fs, uint32_t image_id) {
+    char preview_path[24];
+    image_index_preview_path(image_id, preview_path, sizeof(preview_path), false);
+    if(!fs.exists(preview_path)) {
+        return false;
+    }
+
+    File preview = fs.open(preview_path, FILE_READ);
+    if(!preview || preview.size() == 0) {
+        return false;
+    }
+
+    bool status = send_data_file(my_bt, IMAGE_PREVIEW_DATA, &preview);
+    LOG_I(LOG_MODULE_COMM, "_send_preview: %s, %d bytes, %s", preview_path, preview.size(), status ? "sent" : "failed");
+    preview.close();
+    return status;
+}
+
+/**
+ * Send the content of the file over Bluetooth. 
+ * @param: Bluetooth object pointer
+ * @param: Bluetooth data category
+ * @param: FILE object pointer
+ * 
+ * @return: boolean
+ */
+bool BluetoothCommunication::send_data_file(Bluetooth * my_bt, _bluetooth_data_type data_type, File * my_file) {
+    bool status = false;
+    uint8_t response_category = RESPONSE_FOR_IMAGE_DATA;
+    if (data_type == OTHER_DATA) {
+        response_category = RESPONSE_FOR_OTHER_DATA;
+    } else if (data_type == IMAGE_PREVIEW_DATA) {
+        response_category = RESPONSE_FOR_IMAGE_PREVIEW_DATA;
+    }
+
+    if (my_bt == NULL) {
+        LOG_E(LOG_MODULE_COMM, "send_data_file: null BT object");
+        return status;
+    }
+
+    if(my_file == NULL) {
+        LOG_E(LOG_MODULE_COMM, "send_data_file: null file pointer");
+        return status;
+    }
+
+    uint32_t file_size = my_file->size();
+    LOG_D(LOG_MODULE_COMM, "send_data_file: file size %d", file_size);
+
+    // First we need to check if we have the connection
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "send_data_file: bt disconnected");
+        return status;
+    }
+
+    // set the packet number
+    _packet_number = 1;
+    uint16_t read_size = 0;
+    uint32_t total_bytes_sent = 0;
+
+    while(my_file->available()){
+        // stop between two packets at the deadline, the image stays committed and is sent again later
+        if(wake_budget_expired(WAKE_PHASE_UPLOAD)) {
+            LOG_W(LOG_MODULE_COMM, "send_data_file: upload deadline reached after %u bytes", total_bytes_sent);
+            status = false;
+            break;
+        }
+
+        // read bytes from the file
+        read_size = my_file->read(_packet_buffer + _PREAMBLE_SIZE, _PAYLOAD_SPACE);
+        if(read_size == 0) {
+            LOG_E(LOG_MODULE_COMM, "send_data_file: error reading file");
+            break;
+        }
+
+        // send the read bytes to phone
+        LOG_D(LOG_MODULE_COMM, "send_data_file: read %d bytes", read_size);
+        status = _send_data(my_bt, BT_DATA, (uint8_t)data_type, NULL, read_size, true);
+        if(!status) {
+            LOG_E(LOG_MODULE_COMM, "send_data_file: tx failed, packet number %d", _packet_number);
+            break;
+        }
+
+        // verify response.
+        status = _verify_response(my_bt, BT_RESPONSE, response_category);
+        if(!status) {
+            LOG_E(LOG_MODULE_COMM, "send_data_file: invalid response");
+            break;
+        }
+
+        // increment the packet number and total bytes sent 
+        total_bytes_sent += read_size;
+        _packet_number += 1;
+
+        // long transfers are where the stack and heap run low
+        if(_packet_number % RESOURCE_SAMPLE_PACKETS == 0) {
+            resource_monitor_sample(RESOURCE_POINT_PACKETS);
+        }
+    }
+
+    if(status) {
+        LOG_I(LOG_MODULE_COMM, "send_data_file: out of %d bytes, %d sent", file_size, total_bytes_sent);
+    }
+    return status;
+}
+
+/**
+ * Send the data over Bluetooth by creating a data packet and
+ * receive the response.
+ * 
+ * @param Bluetooth object pointer
+ * @param _bluetooth_comm_type communication type
+ * @param category Communication category
+ * @param uint8_t * pointer to the data array
+ * @param uint16_t data length
+ * 
+ * @return boolean.
+ */
+bool BluetoothCommunication::send_data(Bluetooth * my_bt, _bluetooth_comm_type comm_type, uint8_t category,
+    const uint8_t * data_ptr, uint16_t data_length) {
+
+    bool status = false;
+    uint16_t total_data_length = data_length;
+
+    // First we need to check if we have the connection
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "send_data: bt disconnected");
+        return status;
+    }
+
+    // logs and metrics compress well, images are already compressed
+    _mem_block_t * compressed_block = NULL;
+    if(comm_type == BT_DATA && category == OTHER_DATA && (_session_capabilities & BT_CAPABILITY_LZSS) && data_length > 0) {
+        compressed_block = mem_pool_get(MEM_POOL_BULK);
+    }
+    if(compressed_block != NULL) {
+        uint8_t * compressed_payload = compressed_block->data;
+        uint32_t started = micros();
+        // only worth it if the result is smaller
+        size_t output_size = std::min((size_t)BT_COMPRESS_BUFFER_SIZE, (size_t)data_length - 1);
+        power_acquire_performance();
+        size_t compressed_length = lzss_compress(data_ptr, data_length, compressed_payload, output_size);
+        power_release_performance();
+        if(compressed_length > 0) {
+            LOG_D(LOG_MODULE_COMM, "send_data: compressed %d to %d bytes in %u us", data_length, compressed_length,
+                micros() - started);
+            data_ptr = compressed_payload;
+            data_length = compressed_length;
+            total_data_length = compressed_length;
+            category = OTHER_DATA_LZSS;
+        }
+    }
+
+    // set the packet number to zero
+    _packet_number = 255;
+
+    // check the length, send the data, and receive response
+    if (data_length > _PAYLOAD_SPACE) {
+        uint16_t start = 0;
+        uint16_t end = _PAYLOAD_SPACE;
+        uint16_t sending_bytes = 0;
+
+        // we need to divide data into several packets.
+        while(total_data_length != 0){
+            // keep sending until we reach the end of the data buffer
+            // Serial.printf("sending packet number %d\n", _packet_number);
+            sending_bytes = end - start;
+            // Serial.printf("start: %d, end: %d, # bytes %d\n", start, end, sending_bytes);
+
+            // copy the data into the buffer
+            memcpy(_packet_buffer + _PREAMBLE_SIZE, data_ptr + start, sending_bytes);
+            status = _send_data(my_bt, comm_type, category, NULL, sending_bytes, false);
+
+            if(status) {
+                total_data_length -= sending_bytes;
+                start += sending_bytes;
+                end += total_data_length < _PAYLOAD_SPACE ? total_data_length : _PAYLOAD_SPACE;
+                _packet_number += 1;
+            } else {
+                // failed to send data, break free.
+                LOG_E(LOG_MODULE_COMM, "send_data: tx failed at packet number %d", _packet_number);
+               break;
+            }
+        }
+        // the packets were only queued, report success once the last one is written
+        if(status) {
+            status = my_bt->wait_for_frame(_last_frame_id, BT_TX_FRAME_TIMEOUT_MS);
+        }
+        LOG_I(LOG_MODULE_COMM, "send_data: out of %d bytes, %d sent", data_length, end);
+
+    } else {
+        // copy the data into the buffer
+        memcpy(_packet_buffer + _PREAMBLE_SIZE, data_ptr, data_length);
+        status = _send_data(my_bt, comm_type, category, NULL, data_length, true);
+
+    }
+
+    mem_pool_put(compressed_block);
+    return status;
+}
+
+
+/**
+ * Send a Bluetooth request for current time. If response received, set the RTC time.
+ * @param: Bluetooth object pointer
+ * @return: boolean
+ */
+bool BluetoothCommunication::request_for_time(Bluetooth * my_bt){
+    bool status = false;
+
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "request_for_time: bt disconnected");
+        return status;
+    }
+
+    show_current_rtc_time();
+    status = _send_data(my_bt, BT_REQUEST, TIME_REQUEST, (uint8_t *)_time_request, strlen(_time_request), true);
+    if(status) {    
+        // the response payload is the epoch time in milliseconds
+        uint8_t payload[BT_TIME_RESPONSE_SIZE];
+        uint16_t payload_length = 0;
+        status = _read_response(my_bt, RESPONSE_FOR_TIME_REQUEST, payload, sizeof(payload), &payload_length);
+
+        uint64_t time_in_millis;
+        if(status && bt_frame_decode_time(payload, std::min(payload_length, (uint16_t)sizeof(payload)), &time_in_millis)){
+            LOG_I(LOG_MODULE_COMM, "request_for_time: epoch time in millis: %llu", time_in_millis);
+            // Serial.printf("%d\n", time_in_millis);
+            
+            // set the current timestamp
+            set_rtc_time(time_in_millis);
+        } else {
+            LOG_E(LOG_MODULE_COMM, "request_for_time: invalid response");
+            status = false;
+        }
+
+        show_current_rtc_time();
+    }
+
+    return status;
+}
+
+
+/**
+ * Send a request for the camera configuration to the phone. A configuration in the response is
+ * validated and stored for the next wake. An empty response means no change.
+ * @param: Bluetooth object pointer
+ * @return: boolean
+ */
+bool BluetoothCommunication::request_for_config(Bluetooth * my_bt) {
+    bool status = false;
+
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "request_for_config: bt disconnected");
+        return status;
+    }
+
+    _packet_number = 1;
+    status = _send_data(my_bt, BT_REQUEST, CONFIG_REQUEST, (uint8_t *)_config_request, strlen(_config_request), true);
+    if(!status) {
+        LOG_E(LOG_MODULE_COMM, "request_for_config: failed request");
+        return status;
+    }
+
+    uint8_t blob[CONFIG_BLOB_SIZE];
+    uint16_t payload_length = 0;
+    if(!_read_response(my_bt, RESPONSE_FOR_CONFIG_REQUEST, blob, sizeof(blob), &payload_length)) {
+        LOG_E(LOG_MODULE_COMM, "request_for_config: invalid response");
+        return false;
+    }
+
+    if(payload_length == 0) {
+        LOG_I(LOG_MODULE_COMM, "request_for_config: no configuration change");
+        return true;
+    }
+
+    // a longer blob comes from a newer phone app, the known fields are at the start
+    return device_config_store_blob(blob, std::min(payload_length, (uint16_t)sizeof(blob)));
+}
+
+/**
+ * Negotiate the capabilities of the session with the phone. Call once after connecting.
+ * @param: Bluetooth object pointer
+ * @return: uint8_t capabilities supported by both sides
+ */
+uint8_t BluetoothCommunication::negotiate_capabilities(Bluetooth * my_bt) {
+    _session_capabilities = 0;
+    _session_uploads = 0;
+
+    if(my_bt->get_bt_connection_status() != BLUETOOTH_CONNECTED) {
+        LOG_W(LOG_MODULE_COMM, "negotiate_capabilities: bt disconnected");
+        return _session_capabilities;
+    }
+
+    uint8_t capabilities = BT_CAMERA_CAPABILITIES;
+    _packet_number = 1;
+    if(!_send_data(my_bt, BT_REQUEST, CAPABILITY_REQUEST, &capabilities, sizeof(capabilities), true)) {
+        LOG_I(LOG_MODULE_COMM, "negotiate_capabilities: no answer, using none");
+        return _session_capabilities;
+    }
+
+    uint8_t phone_capabilities[BT_CAPABILITY_RESPONSE_SIZE];
+    uint16_t payload_length = 0;
+    if(!_read_response(my_bt, RESPONSE_FOR_CAPABILITY_REQUEST, phone_capabilities, sizeof(phone_capabilities),
+        &payload_length) || !bt_frame_decode_capabilities(phone_capabilities,
+        std::min(payload_length, (uint16_t)sizeof(phone_capabilities)), BT_CAMERA_CAPABILITIES, &_session_capabilities)) {
+        LOG_E(LOG_MODULE_COMM, "negotiate_capabilities: invalid response");
+        return _session_capabilities;
+    }
+
+    LOG_I(LOG_MODULE_COMM, "negotiate_capabilities: session capabilities 0x%02X", _session_capabilities);
+    return _session_capabilities;
+}
@@ -0,0 +1,128 @@
+#include "bt_frame.h"
+
+#include <string.h>
+
+/**
+ * Parse a received frame.
+ * @param: const uint8_t * received bytes
+ * @param: size_t number of received bytes
+ * @param: _bt_frame_t * frame to fill, only valid if BT_FRAME_OK is returned
+ * @return: _bt_frame_status_t
+ */
+_bt_frame_status_t bt_frame_parse(const uint8_t * data, size_t length, _bt_frame_t * frame) {
+  if(data == NULL || frame == NULL || length < BT_FRAME_PREAMBLE_SIZE) {
+    return BT_FRAME_TOO_SHORT;
+  }
+
+  uint16_t payload_length = (uint16_t)(data[2] | (data[3] << 8));
+  if(payload_length > length - BT_FRAME_PREAMBLE_SIZE) {
+    return BT_FRAME_TRUNCATED;
+  }
+
+  frame->comm_type = data[0];
+  frame->category = data[1];
+  frame->payload_length = payload_length;
+  frame->packet_number = (uint16_t)(data[4] | (data[5] << 8));
+  frame->payload = data + BT_FRAME_PREAMBLE_SIZE;
+  return BT_FRAME_OK;
+}
+
+/**
+ * Parse a received response and copy its payload, the checks every response handler starts with.
+ * @param: const uint8_t * received bytes
+ * @param: size_t number of received bytes
+ * @param: uint8_t expected comm type
+ * @param: uint8_t expected category
+ * @param: uint8_t * payload buffer, may be NULL if payload_size is 0
+ * @param: uint16_t payload buffer size, a longer payload is cut to it
+ * @param: _bt_frame_t * frame to fill, valid for BT_FRAME_OK and BT_FRAME_UNEXPECTED
+ * @return: _bt_frame_status_t
+ */
+_bt_frame_status_t bt_frame_read_response(const uint8_t * data, size_t length, uint8_t comm_type, uint8_t category,
+  uint8_t * payload, uint16_t payload_size, _bt_frame_t * frame) {
+  _bt_frame_status_t status = bt_frame_parse(data, length, frame);
+  if(status != BT_FRAME_OK) {
+    return status;
+  }
+  if(frame->comm_type != comm_type || frame->category != category) {
+    return BT_FRAME_UNEXPECTED;
+  }
+
+  if(payload != NULL) {
+    memcpy(payload, frame->payload, frame->payload_length < payload_size ? frame->payload_length : payload_size);
+  }
+  return BT_FRAME_OK;
+}
+
+/**
+ * Decode the payload of a time response, the epoch time in milliseconds.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload bytes available
+ * @param: uint64_t * epoch time in milliseconds
+ * @return: boolean, false if the payload is shorter than 8 bytes
+ */
+bool bt_frame_decode_time(const uint8_t * payload, uint16_t length, uint64_t * epoch_ms) {
+  if(payload == NULL || length < 8) {
+    return false;
+  }
+
+  *epoch_ms = 0;
+  for(int i = 0; i < 8; ++i) {
+    *epoch_ms |= (uint64_t)payload[i] << (8 * i);
+  }
+  return true;
+}
+
+/**
+ * Decode the payload of a capability response.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload bytes available
+ * @param: uint8_t capabilities offered by the camera
+ * @param: uint8_t * capabilities supported by both sides
+ * @return: boolean, false if the payload is empty
+ */
+bool bt_frame_decode_capabilities(const uint8_t * payload, uint16_t length, uint8_t offered, uint8_t * session) {
+  if(payload == NULL || length < 1) {
+    return false;
+  }
+
+  // a newer phone may answer with more bytes, only the first one is defined
+  *session = payload[0] & offered;
+  return true;
+}
+
+/**
+ * Check if a payload is exactly a text, e.g. the "image received" answer.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload length
+ * @param: const char * text without the terminating zero in the payload
+ * @return: boolean
+ */
+bool bt_frame_payload_is(const uint8_t * payload, uint16_t length, const char * text) {
+  if(payload == NULL || text == NULL) {
+    return false;
+  }
+
+  size_t text_length = strlen(text);
+  return length == text_length && memcmp(payload, text, text_length) == 0;
+}
+
+/**
+ * Get the name of a parse status for logging.
+ * @param: _bt_frame_status_t status
+ * @return: const char *
+ */
+const char * bt_frame_status_name(_bt_frame_status_t status) {
+  switch(status) {
+    case BT_FRAME_OK:
+      return "ok";
+    case BT_FRAME_TOO_SHORT:
+      return "too short";
+    case BT_FRAME_TRUNCATED:
+      return "truncated";
+    case BT_FRAME_UNEXPECTED:
+      return "unexpected response";
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef __BT_FRAME_H__
+#define __BT_FRAME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Parser of the frames received from the phone. It only reads the given bytes and has no Arduino or
+ * Bluetooth dependency, so every frame handler goes through the same bounds checks and the parser
+ * can be built on a host to replay recorded sessions. The payload decoders of the responses live here
+ * for the same reason, the fuzz and replay harness in extras/fuzz calls them like bluetooth_comm.
+ *
+ * Frame layout (little endian):
+ * -------------------------------------------------------------------------------------
+ * | COMM TYPE (1) | CATEGORY (1) | PAYLOAD LENGTH (2) | PACKET NUMBER (2) | PAYLOAD (n) |
+ * -------------------------------------------------------------------------------------
+ * A frame is valid if the received bytes hold the whole preamble and the whole declared payload.
+ * Bytes after the declared payload are ignored.
+ */
+
+#define BT_FRAME_PREAMBLE_SIZE 6
+
+typedef enum {
+    BT_FRAME_OK = 0,
+    BT_FRAME_TOO_SHORT = 1,          // less than the preamble
+    BT_FRAME_TRUNCATED = 2,          // declared payload longer than the received bytes
+    BT_FRAME_UNEXPECTED = 3          // valid frame, but not the expected comm type and category
+}_bt_frame_status_t;
+
+typedef struct {
+    uint8_t comm_type;
+    uint8_t category;
+    uint16_t packet_number;
+    uint16_t payload_length;
+    const uint8_t * payload;         // points into the parsed buffer
+}_bt_frame_t;
+
+/**
+ * Parse a received frame.
+ * @param: const uint8_t * received bytes
+ * @param: size_t number of received bytes
+ * @param: _bt_frame_t * frame to fill, only valid if BT_FRAME_OK is returned
+ * @return: _bt_frame_status_t
+ */
+_bt_frame_status_t bt_frame_parse(const uint8_t * data, size_t length, _bt_frame_t * frame);
+
+/**
+ * Parse a received response and copy its payload, the checks every response handler starts with.
+ * @param: const uint8_t * received bytes
+ * @param: size_t number of received bytes
+ * @param: uint8_t expected comm type
+ * @param: uint8_t expected category
+ * @param: uint8_t * payload buffer, may be NULL if payload_size is 0
+ * @param: uint16_t payload buffer size, a longer payload is cut to it
+ * @param: _bt_frame_t * frame to fill, valid for BT_FRAME_OK and BT_FRAME_UNEXPECTED
+ * @return: _bt_frame_status_t
+ */
+_bt_frame_status_t bt_frame_read_response(const uint8_t * data, size_t length, uint8_t comm_type, uint8_t category,
+  uint8_t * payload, uint16_t payload_size, _bt_frame_t * frame);
+
+/**
+ * Decode the payload of a time response, the epoch time in milliseconds.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload bytes available
+ * @param: uint64_t * epoch time in milliseconds
+ * @return: boolean, false if the payload is shorter than 8 bytes
+ */
+bool bt_frame_decode_time(const uint8_t * payload, uint16_t length, uint64_t * epoch_ms);
+
+/**
+ * Decode the payload of a capability response.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload bytes available
+ * @param: uint8_t capabilities offered by the camera
+ * @param: uint8_t * capabilities supported by both sides
+ * @return: boolean, false if the payload is empty
+ */
+bool bt_frame_decode_capabilities(const uint8_t * payload, uint16_t length, uint8_t offered, uint8_t * session);
+
+/**
+ * Check if a payload is exactly a text, e.g. the "image received" answer.
+ * @param: const uint8_t * payload
+ * @param: uint16_t payload length
+ * @param: const char * text without the terminating zero in the payload
+ * @return: boolean
+ */
+bool bt_frame_payload_is(const uint8_t * payload, uint16_t length, const char * text);
+
+/**
+ * Get the name of a parse status for logging.
+ * @param: _bt_frame_status_t status
+ * @return: const char *
+ */
+const char * bt_frame_status_name(_bt_frame_status_t status);
+
+#endif
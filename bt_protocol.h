@@ -0,0 +1,118 @@
+#ifndef __BT_PROTOCOL_H__
+#define __BT_PROTOCOL_H__
+
+#include <stdint.h>
+
+/**
+ * Values of the camera Bluetooth protocol shared by the firmware and the host programs in extras/, so
+ * the reference receiver and the fuzz harness can not drift from what the camera sends and expects.
+ * Only plain constants live here, no Arduino or Bluetooth dependency.
+ */
+
+// largest frame, preamble and payload, either side sends
+#define BT_MAX_FRAME_LENGTH 1024
+
+// payload buffers of the camera response handlers, a longer response payload is cut to them
+#define BT_TIME_RESPONSE_SIZE 8
+#define BT_IMAGE_INCOMING_RESPONSE_SIZE 16
+#define BT_CAPABILITY_RESPONSE_SIZE 1
+
+// configuration blob of the CONFIG_REQUEST response, the layout is described in device_config.h
+#define CONFIG_BLOB_VERSION 0x03
+#define CONFIG_BLOB_V1_SIZE 14
+#define CONFIG_BLOB_V2_SIZE 22
+#define CONFIG_MAX_EXTRA_PHONES 3
+#define CONFIG_BLOB_SIZE (CONFIG_BLOB_V2_SIZE + 1 + 6 * CONFIG_MAX_EXTRA_PHONES)
+
+/**
+ * Bluetooth data is sent and received in packets, with each packet having header information and data payload.
+ * The first byte tells whether this transmission is a BLUETOOTH_REQUEST, DATA_TRANSFER, or a RESPONSE_PACKET.
+ * The second byte futher distills the request, data, or reponse into different categories.
+ * The next two bytes carries the length of the payload.
+ * The next two bytes carries the packet number for the data payload.
+ * Remaining bytes carries the data payload.
+ * 
+ * -----------------------------------------------------------------------------------------------------------------
+ * | BLUETOOTH_REQUEST or DATA_TRANSFER or RESPONSE_PACKET | CATEGORIES | PAYLOAD LENGTH | PACKET NUMBER | PAYLOAD |
+ * -----------------------------------------------------------------------------------------------------------------
+ * 
+ */
+
+typedef enum {
+    BT_REQUEST = 0x0A,
+    BT_DATA = 0x0B,
+    BT_RESPONSE = 0x0C
+}_bluetooth_comm_type;
+
+typedef enum {
+    TIME_REQUEST = 0x00,
+    IMAGE_INCOMING_REQUEST = 0x01,
+    ARE_YOU_READY_REQUEST = 0x02,
+    IMAGE_SENT_REQUEST = 0x03,
+    CONFIG_REQUEST = 0x04,
+    CAPABILITY_REQUEST = 0x05
+}_bluetooth_request_type;
+
+typedef enum {
+    IMAGE_DATA = 0x00,
+    OTHER_DATA = 0x01,
+    OTHER_DATA_LZSS = 0x02,
+    IMAGE_PREVIEW_DATA = 0x03
+}_bluetooth_data_type;
+
+typedef enum {
+    RESPONSE_FOR_TIME_REQUEST = 0x00,
+    RESPONSE_FOR_IMAGE_INCOMING_REQUEST = 0x01,
+    RESPONSE_FOR_ARE_YOU_READY_REQUEST = 0x02,
+    RESPONSE_FOR_IMAGE_SENT_REQUEST = 0x03,
+    RESPONSE_FOR_IMAGE_DATA = 0x04,
+    RESPONSE_FOR_OTHER_DATA = 0x05,
+    RESPONSE_FOR_CONFIG_REQUEST = 0x06,
+    RESPONSE_FOR_CAPABILITY_REQUEST = 0x07,
+    RESPONSE_FOR_IMAGE_PREVIEW_DATA = 0x08
+}_bluetooth_response_type;
+
+/**
+ * Capabilities negotiated once per session. The CAPABILITY_REQUEST payload is one byte with the
+ * capabilities of the camera, the phone answers with the ones it supports. A phone that does not know
+ * the request does not answer, and the session uses none of them.
+ *
+ * BT_CAPABILITY_LZSS: OTHER_DATA payloads may be sent LZSS compressed (see compression.h) with the
+ * OTHER_DATA_LZSS category. Image data is never compressed.
+ *
+ * BT_CAPABILITY_PREVIEW: between the ARE_YOU_READY response and the image data the camera may send a
+ * low resolution JPEG preview of the same image as IMAGE_PREVIEW_DATA, packet numbers start again
+ * at 1 for the image data. The phone can show the preview while the full image is still arriving.
+ *
+ * BT_CAPABILITY_CONTENT_ID: the IMAGE_INCOMING_REQUEST payload is the content id of the image instead
+ * of the request text, and the phone answers "image received" if it already has that image. The
+ * camera then skips the upload and deletes the image, so an image whose IMAGE_SENT_REQUEST failed is
+ * not uploaded twice.
+ *
+ * Content id (12 bytes, little endian):
+ * -------------------------------------------------
+ * | IMAGE ID (4) | CONTENT HASH (4) | SIZE (4) |
+ * -------------------------------------------------
+ * The image id is the capture time and the hash the CRC-32 of the JPEG, 0 if unknown.
+ */
+#define BT_CAPABILITY_LZSS (1 << 0)
+#define BT_CAPABILITY_PREVIEW (1 << 1)
+#define BT_CAPABILITY_CONTENT_ID (1 << 2)
+#define BT_CAMERA_CAPABILITIES (BT_CAPABILITY_LZSS | BT_CAPABILITY_PREVIEW | BT_CAPABILITY_CONTENT_ID)
+#define BT_CONTENT_ID_SIZE 12
+
+// largest compressed OTHER_DATA message, larger results are sent uncompressed as OTHER_DATA
+#define BT_COMPRESS_BUFFER_SIZE 2048
+
+
+static const char * const _time_request = "time please";
+static const char * const _image_request = "image incoming";
+static const char * const _u_ready_request = "are you ready";
+static const char * const _image_sent_request = "image sent";
+static const char * const _config_request = "config please";
+
+static const char * const _am_ready_response = "i am ready";
+static const char * const _ok_response = "ok";
+static const char * const _image_received_response = "image received";
+
+#endif
@@ -1,80 +1,178 @@
-#include "camera.h"
-#include "utils.h"
-
-/**
- * Initialize the camera module.
- */
-esp_err_t init_camera() {
-  // configure the camera module
-  camera_config_t config;
-
-  config.ledc_channel = LEDC_CHANNEL_0;
-  config.ledc_timer = LEDC_TIMER_0;
-  config.pin_d0 = Y2_GPIO_NUM;
-  config.pin_d1 = Y3_GPIO_NUM;
-  config.pin_d2 = Y4_GPIO_NUM;
-  config.pin_d3 = Y5_GPIO_NUM;
-  config.pin_d4 = Y6_GPIO_NUM;
-  config.pin_d5 = Y7_GPIO_NUM;
-  config.pin_d6 = Y8_GPIO_NUM;
-  config.pin_d7 = Y9_GPIO_NUM;
-  config.pin_xclk = XCLK_GPIO_NUM;
-  config.pin_pclk = PCLK_GPIO_NUM;
-  config.pin_vsync = VSYNC_GPIO_NUM;
-  config.pin_href = HREF_GPIO_NUM;
-  config.pin_sscb_sda = SIOD_GPIO_NUM;
-  config.pin_sscb_scl = SIOC_GPIO_NUM;
-  config.pin_pwdn = PWDN_GPIO_NUM;
-  config.pin_reset = RESET_GPIO_NUM;
-  config.xclk_freq_hz = 20000000;
-  config.pixel_format = PIXFORMAT_JPEG; 
-
-  // set the frame size and picture quality
-  if(psramFound()){
-    debug("init_camera: frame size UXGA, quality 12");
-    config.frame_size = FRAMESIZE_UXGA; // FRAMESIZE_ + QVGA|CIF|VGA|SVGA|XGA|SXGA|UXGA
-    config.jpeg_quality = 10;
-    config.fb_count = 2;
-  } else {
-    debug("init_camera: frame size SVGA, quality 12");
-    config.frame_size = FRAMESIZE_SVGA;
-    config.jpeg_quality = 12;
-    config.fb_count = 1;
-  }
-  
-  debug("init_camera: starting camera");
-  return esp_camera_init(&config);
-}
-
-
-/**
- * Take a picture and return the pointer to camera buffer.
- */
-camera_fb_t * take_picture() {
-  // pointer to camera frame buffer object
-  camera_fb_t * fb = NULL;
-
-  // get the pointer to the camera frame buffer which has the content of latest photo
-  fb = esp_camera_fb_get();  
-    if(!fb) {
-      Serial.println("take_picture: failed, trying again");
-      fb = esp_camera_fb_get();
-      if(!fb) {
-        Serial.println("take_picture: capture failed again");
-        return NULL;
-      }
-  }
-  return fb;
-}
-
-
-/**
- * Turn off the camer flash.
- */
-void turn_off_camera_flash(){
-  pinMode(4, OUTPUT);
-  digitalWrite(4, LOW);
-  rtc_gpio_hold_en(GPIO_NUM_4);
-  gpio_deep_sleep_hold_en();
-}
-
+#include "camera.h"
+#include "utils.h"
+
+/**
+ * Initialize the camera module.
+ * @param: framesize_t frame size, limited to SVGA without PSRAM
+ * @param: int JPEG quality (lower is better)
+ */
+esp_err_t init_camera(framesize_t frame_size, int jpeg_quality) {
+  // configure the camera module
+  camera_config_t config;
+
+  config.ledc_channel = LEDC_CHANNEL_0;
+  config.ledc_timer = LEDC_TIMER_0;
+  config.pin_d0 = Y2_GPIO_NUM;
+  config.pin_d1 = Y3_GPIO_NUM;
+  config.pin_d2 = Y4_GPIO_NUM;
+  config.pin_d3 = Y5_GPIO_NUM;
+  config.pin_d4 = Y6_GPIO_NUM;
+  config.pin_d5 = Y7_GPIO_NUM;
+  config.pin_d6 = Y8_GPIO_NUM;
+  config.pin_d7 = Y9_GPIO_NUM;
+  config.pin_xclk = XCLK_GPIO_NUM;
+  config.pin_pclk = PCLK_GPIO_NUM;
+  config.pin_vsync = VSYNC_GPIO_NUM;
+  config.pin_href = HREF_GPIO_NUM;
+  config.pin_sscb_sda = SIOD_GPIO_NUM;
+  config.pin_sscb_scl = SIOC_GPIO_NUM;
+  config.pin_pwdn = PWDN_GPIO_NUM;
+  config.pin_reset = RESET_GPIO_NUM;
+  config.xclk_freq_hz = 20000000;
+  config.pixel_format = PIXFORMAT_JPEG; 
+
+  // set the frame size and picture quality
+  config.frame_size = frame_size; // FRAMESIZE_ + QVGA|CIF|VGA|SVGA|XGA|SXGA|UXGA
+  config.jpeg_quality = jpeg_quality;
+  if(psramFound()){
+    config.fb_count = 2;
+  } else {
+    // without PSRAM only one frame up to SVGA fits in the internal memory
+    if(config.frame_size > FRAMESIZE_SVGA) {
+      config.frame_size = FRAMESIZE_SVGA;
+    }
+    config.fb_count = 1;
+  }
+  LOG_I(LOG_MODULE_CAMERA, "init_camera: frame size %d, quality %d", config.frame_size, config.jpeg_quality);
+  
+  LOG_D(LOG_MODULE_CAMERA, "init_camera: starting camera");
+  return esp_camera_init(&config);
+}
+
+
+/**
+ * Limit the captured frames to a region of interest. The sensor reads out only the window, so the
+ * JPEG, the SD card write and the upload shrink with the region. The output is the window at full
+ * resolution, scaled down only if it is larger than the configured frame size.
+ * @param: uint16_t left edge in sensor pixels
+ * @param: uint16_t top edge in sensor pixels
+ * @param: uint16_t width in sensor pixels
+ * @param: uint16_t height in sensor pixels
+ * @param: framesize_t frame size the camera was initialized with
+ * @return: boolean
+ */
+bool camera_set_roi(uint16_t x, uint16_t y, uint16_t width, uint16_t height, framesize_t frame_size) {
+  sensor_t * sensor = esp_camera_sensor_get();
+  if(sensor == NULL || frame_size >= FRAMESIZE_INVALID) {
+    return false;
+  }
+
+  // the frame buffers are sized for the frame size, keep the output inside it with the aspect ratio
+  if(!psramFound() && frame_size > FRAMESIZE_SVGA) {
+    frame_size = FRAMESIZE_SVGA;
+  }
+  uint32_t output_width = width;
+  uint32_t output_height = height;
+  uint16_t max_width = resolution[frame_size].width;
+  uint16_t max_height = resolution[frame_size].height;
+  if(output_width > max_width || output_height > max_height) {
+    if(output_width * max_height > output_height * max_width) {
+      output_height = output_height * max_width / output_width;
+      output_width = max_width;
+    } else {
+      output_width = output_width * max_height / output_height;
+      output_height = max_height;
+    }
+  }
+  output_width &= ~(CAMERA_ROI_ALIGN - 1);
+  output_height &= ~(CAMERA_ROI_ALIGN - 1);
+
+  // for the OV2640 the first argument selects the UXGA sensor mode and the window is given by the
+  // offset, total and output sizes; the other arguments are not used
+  if(sensor->set_res_raw(sensor, 0, 0, 0, 0, x, y, width, height, output_width, output_height, false, false) != 0) {
+    LOG_E(LOG_MODULE_CAMERA, "camera_set_roi: failed to set the window");
+    return false;
+  }
+
+  LOG_I(LOG_MODULE_CAMERA, "camera_set_roi: %d,%d %dx%d, output %ux%u", x, y, width, height, output_width, output_height);
+  return true;
+}
+
+/**
+ * Take a picture and return the pointer to camera buffer.
+ */
+camera_fb_t * take_picture() {
+  // pointer to camera frame buffer object
+  camera_fb_t * fb = NULL;
+
+  // get the pointer to the camera frame buffer which has the content of latest photo
+  fb = esp_camera_fb_get();  
+    if(!fb) {
+      Serial.println("take_picture: failed, trying again");
+      fb = esp_camera_fb_get();
+      if(!fb) {
+        Serial.println("take_picture: capture failed again");
+        return NULL;
+      }
+  }
+  return fb;
+}
+
+
+/**
+ * Take a picture right after the camera init. The first CAMERA_SETTLE_FRAMES frames are dropped, they
+ * were captured while the exposure and the white balance were still adjusting.
+ * @return: camera_fb_t * frame, NULL on failure
+ */
+camera_fb_t * take_settled_picture() {
+  for(int i = 0; i < CAMERA_SETTLE_FRAMES; ++i) {
+    camera_fb_t * fb = esp_camera_fb_get();
+    if(fb != NULL) {
+      esp_camera_fb_return(fb);
+    }
+  }
+  return take_picture();
+}
+
+
+/**
+ * Take a low resolution preview of the scene. This switches the sensor to the preview frame size,
+ * so call it after the full size picture has been taken and its buffer returned.
+ * @return: camera_fb_t * preview frame, NULL on failure
+ */
+camera_fb_t * take_preview() {
+  sensor_t * sensor = esp_camera_sensor_get();
+  if(sensor == NULL || sensor->set_framesize(sensor, CAMERA_PREVIEW_FRAME_SIZE) != 0) {
+    LOG_W(LOG_MODULE_CAMERA, "take_preview: failed to set the preview frame size");
+    return NULL;
+  }
+  sensor->set_quality(sensor, CAMERA_PREVIEW_JPEG_QUALITY);
+
+  // skip the frames that were captured before the frame size change
+  for(int i = 0; i < CAMERA_PREVIEW_MAX_FRAMES; ++i) {
+    camera_fb_t * fb = esp_camera_fb_get();
+    if(fb == NULL) {
+      continue;
+    }
+    if(fb->width == resolution[CAMERA_PREVIEW_FRAME_SIZE].width) {
+      LOG_D(LOG_MODULE_CAMERA, "take_preview: %d x %d, %d bytes", fb->width, fb->height, fb->len);
+      return fb;
+    }
+    esp_camera_fb_return(fb);
+  }
+
+  LOG_W(LOG_MODULE_CAMERA, "take_preview: no preview frame");
+  return NULL;
+}
+
+
+/**
+ * Turn off the camer flash.
+ */
+void turn_off_camera_flash(){
+  pinMode(4, OUTPUT);
+  digitalWrite(4, LOW);
+  rtc_gpio_hold_en(GPIO_NUM_4);
+  gpio_deep_sleep_hold_en();
+}
+
@@ -1,43 +1,90 @@
-#ifndef __CAMERA_H__
-#define __CAMERA_H__
-
-#include "Arduino.h"
-#include "esp_camera.h"
-#include "driver/rtc_io.h"
-
-// Pin definition for CAMERA_MODEL_AI_THINKER
-#define PWDN_GPIO_NUM     32
-#define RESET_GPIO_NUM    -1
-#define XCLK_GPIO_NUM      0
-#define SIOD_GPIO_NUM     26
-#define SIOC_GPIO_NUM     27
-
-#define Y9_GPIO_NUM       35
-#define Y8_GPIO_NUM       34
-#define Y7_GPIO_NUM       39
-#define Y6_GPIO_NUM       36
-#define Y5_GPIO_NUM       21
-#define Y4_GPIO_NUM       19
-#define Y3_GPIO_NUM       18
-#define Y2_GPIO_NUM        5
-#define VSYNC_GPIO_NUM    25
-#define HREF_GPIO_NUM     23
-#define PCLK_GPIO_NUM     22
-
-
-/**
- * Initialize the camera module
- */
-esp_err_t init_camera();
-
-/**
- * Take a picture and return the pointer to camera buffer.
- */
-camera_fb_t * take_picture();
-
-/**
- * Turn off the camer flash.
- */
-void turn_off_camera_flash();
-
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "driver/rtc_io.h"
+
+// Pin definition for CAMERA_MODEL_AI_THINKER
+#define PWDN_GPIO_NUM     32
+#define RESET_GPIO_NUM    -1
+#define XCLK_GPIO_NUM      0
+#define SIOD_GPIO_NUM     26
+#define SIOC_GPIO_NUM     27
+
+#define Y9_GPIO_NUM       35
+#define Y8_GPIO_NUM       34
+#define Y7_GPIO_NUM       39
+#define Y6_GPIO_NUM       36
+#define Y5_GPIO_NUM       21
+#define Y4_GPIO_NUM       19
+#define Y3_GPIO_NUM       18
+#define Y2_GPIO_NUM        5
+#define VSYNC_GPIO_NUM    25
+#define HREF_GPIO_NUM     23
+#define PCLK_GPIO_NUM     22
+
+// full sensor resolution (UXGA), region of interest coordinates are in this resolution
+#define CAMERA_SENSOR_WIDTH 1600
+#define CAMERA_SENSOR_HEIGHT 1200
+
+// smallest region of interest, regions are aligned to CAMERA_ROI_ALIGN pixels
+#define CAMERA_ROI_MIN_SIZE 64
+#define CAMERA_ROI_ALIGN 4
+
+// low resolution preview stored next to every image and sent to the phone before the full image
+#define CAMERA_PREVIEW_ENABLED 1
+#define CAMERA_PREVIEW_FRAME_SIZE FRAMESIZE_QVGA
+#define CAMERA_PREVIEW_JPEG_QUALITY 20
+
+// frames captured at the old frame size may still be queued in the driver after a frame size change
+#define CAMERA_PREVIEW_MAX_FRAMES 3
+
+// frames queued right after the init, taken before the automatic exposure and white balance settled
+#define CAMERA_SETTLE_FRAMES 2
+
+/**
+ * Initialize the camera module
+ * @param: framesize_t frame size, limited to SVGA without PSRAM
+ * @param: int JPEG quality (lower is better)
+ */
+esp_err_t init_camera(framesize_t frame_size, int jpeg_quality);
+
+/**
+ * Limit the captured frames to a region of interest. The sensor reads out only the window, so the
+ * JPEG, the SD card write and the upload shrink with the region. The output is the window at full
+ * resolution, scaled down only if it is larger than the configured frame size.
+ * @param: uint16_t left edge in sensor pixels
+ * @param: uint16_t top edge in sensor pixels
+ * @param: uint16_t width in sensor pixels
+ * @param: uint16_t height in sensor pixels
+ * @param: framesize_t frame size the camera was initialized with
+ * @return: boolean
+ */
+bool camera_set_roi(uint16_t x, uint16_t y, uint16_t width, uint16_t height, framesize_t frame_size);
+
+/**
+ * Take a picture and return the pointer to camera buffer.
+ */
+camera_fb_t * take_picture();
+
+/**
+ * Take a picture right after the camera init. The first CAMERA_SETTLE_FRAMES frames are dropped, they
+ * were captured while the exposure and the white balance were still adjusting.
+ * @return: camera_fb_t * frame, NULL on failure
+ */
+camera_fb_t * take_settled_picture();
+
+/**
+ * Take a low resolution preview of the scene. This switches the sensor to the preview frame size,
+ * so call it after the full size picture has been taken and its buffer returned.
+ * @return: camera_fb_t * preview frame, NULL on failure
+ */
+camera_fb_t * take_preview();
+
+/**
+ * Turn off the camer flash.
+ */
+void turn_off_camera_flash();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "compression.h"
+
+#include <string.h>
+#include <algorithm>
+
+#define LZSS_NO_POSITION 0xFFFF
+
+// last position of every hashed three byte sequence
+static uint16_t _hash_head[LZSS_HASH_SIZE];
+
+/**
+ * Hash of the next LZSS_MIN_MATCH bytes.
+ */
+static inline uint16_t _hash(const uint8_t * data) {
+  uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+  return (uint16_t)((value * 2654435761u) >> (32 - LZSS_HASH_BITS));
+}
+
+/**
+ * Compress a buffer.
+ * @param: const uint8_t * input
+ * @param: uint16_t input length
+ * @param: uint8_t * output buffer
+ * @param: size_t output buffer size
+ * @return: size_t compressed length, 0 if the output does not fit, callers then send the input as is
+ */
+size_t lzss_compress(const uint8_t * input, uint16_t input_length, uint8_t * output, size_t output_size) {
+  if(input == NULL || output == NULL || output_size < LZSS_HEADER_SIZE) {
+    return 0;
+  }
+
+  memset(_hash_head, 0xFF, sizeof(_hash_head));
+  output[0] = input_length & 0xFF;
+  output[1] = (input_length >> 8) & 0xFF;
+
+  size_t out = LZSS_HEADER_SIZE;
+  size_t flags_at = 0;
+  uint8_t item = 8;
+  size_t in = 0;
+
+  while(in < input_length) {
+    if(item == 8) {
+      if(out >= output_size) {
+        return 0;
+      }
+      flags_at = out++;
+      output[flags_at] = 0;
+      item = 0;
+    }
+
+    size_t match_length = 0;
+    size_t distance = 0;
+    if(in + LZSS_MIN_MATCH <= input_length) {
+      uint16_t hash = _hash(&input[in]);
+      uint16_t candidate = _hash_head[hash];
+      _hash_head[hash] = in;
+
+      if(candidate != LZSS_NO_POSITION && in - candidate <= LZSS_WINDOW_SIZE) {
+        size_t longest = std::min((size_t)LZSS_MAX_MATCH, (size_t)(input_length - in));
+        while(match_length < longest && input[candidate + match_length] == input[in + match_length]) {
+          match_length++;
+        }
+        distance = in - candidate;
+      }
+    }
+
+    if(match_length >= LZSS_MIN_MATCH) {
+      if(out + 2 > output_size) {
+        return 0;
+      }
+      output[flags_at] |= (1 << item);
+      output[out++] = (distance - 1) & 0xFF;
+      output[out++] = (((distance - 1) >> 4) & 0xF0) | (match_length - LZSS_MIN_MATCH);
+
+      // the positions inside the match are candidates for later matches
+      for(size_t i = 1; i < match_length && in + i + LZSS_MIN_MATCH <= input_length; ++i) {
+        _hash_head[_hash(&input[in + i])] = in + i;
+      }
+      in += match_length;
+    } else {
+      if(out >= output_size) {
+        return 0;
+      }
+      output[out++] = input[in++];
+    }
+    item++;
+  }
+
+  return out;
+}
+
+/**
+ * Decompress a buffer produced by lzss_compress.
+ * @param: const uint8_t * input
+ * @param: size_t input length
+ * @param: uint8_t * output buffer
+ * @param: size_t output buffer size
+ * @return: size_t decompressed length, 0 if the input is malformed or does not fit
+ */
+size_t lzss_decompress(const uint8_t * input, size_t input_length, uint8_t * output, size_t output_size) {
+  if(input == NULL || output == NULL || input_length < LZSS_HEADER_SIZE) {
+    return 0;
+  }
+
+  size_t total = input[0] | (input[1] << 8);
+  if(total > output_size) {
+    return 0;
+  }
+
+  size_t in = LZSS_HEADER_SIZE;
+  size_t out = 0;
+  while(out < total) {
+    if(in >= input_length) {
+      return 0;
+    }
+    uint8_t flags = input[in++];
+
+    for(uint8_t item = 0; item < 8 && out < total; ++item) {
+      if(flags & (1 << item)) {
+        if(in + 2 > input_length) {
+          return 0;
+        }
+        size_t distance = (input[in] | ((input[in + 1] & 0xF0) << 4)) + 1;
+        size_t length = (input[in + 1] & 0x0F) + LZSS_MIN_MATCH;
+        in += 2;
+        if(distance > out || out + length > total) {
+          return 0;
+        }
+        // byte by byte, a match may overlap the bytes it produces
+        for(size_t i = 0; i < length; ++i, ++out) {
+          output[out] = output[out - distance];
+        }
+      } else {
+        if(in >= input_length) {
+          return 0;
+        }
+        output[out++] = input[in++];
+      }
+    }
+  }
+  return out;
+}
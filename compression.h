@@ -0,0 +1,52 @@
+#ifndef __COMPRESSION_H__
+#define __COMPRESSION_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Small window LZSS compression for logs, metrics and other non-image payloads. JPEG data is
+ * already compressed and is never passed through here.
+ *
+ * The compressor uses fixed static memory (a hash table of LZSS_HASH_SIZE positions, no heap), finds
+ * one match candidate per position and runs in a single pass, so its cost is linear in the payload.
+ * It is not reentrant, only the Bluetooth task compresses. It has no Arduino dependency, the
+ * reference receiver in extras/ builds the same code on a host.
+ *
+ * Compressed stream:
+ * ------------------------------------------------------------------------------
+ * | ORIGINAL LENGTH (2, little endian) | FLAGS (1) | 8 ITEMS | FLAGS (1) | ... |
+ * ------------------------------------------------------------------------------
+ * Bit n of a flag byte, lowest bit first, describes item n: 0 is a literal byte, 1 is a match of two
+ * bytes, the 12 bit distance minus one (low 8 bits, then the high 4 bits in the upper nibble of the
+ * second byte) and the match length minus LZSS_MIN_MATCH in the lower nibble.
+ */
+
+#define LZSS_WINDOW_SIZE 4096
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 15)
+#define LZSS_HASH_BITS 10
+#define LZSS_HASH_SIZE (1 << LZSS_HASH_BITS)
+#define LZSS_HEADER_SIZE 2
+
+/**
+ * Compress a buffer.
+ * @param: const uint8_t * input
+ * @param: uint16_t input length
+ * @param: uint8_t * output buffer
+ * @param: size_t output buffer size
+ * @return: size_t compressed length, 0 if the output does not fit, callers then send the input as is
+ */
+size_t lzss_compress(const uint8_t * input, uint16_t input_length, uint8_t * output, size_t output_size);
+
+/**
+ * Decompress a buffer produced by lzss_compress.
+ * @param: const uint8_t * input
+ * @param: size_t input length
+ * @param: uint8_t * output buffer
+ * @param: size_t output buffer size
+ * @return: size_t decompressed length, 0 if the input is malformed or does not fit
+ */
+size_t lzss_decompress(const uint8_t * input, size_t input_length, uint8_t * output, size_t output_size);
+
+#endif
@@ -0,0 +1,248 @@
+#include "device_config.h"
+#include "camera.h"
+#include "kv_store.h"
+#include "utils.h"
+
+// configuration stored by firmware without the region of interest
+typedef struct {
+    uint32_t sleep_seconds;
+    uint8_t frame_size;
+    uint8_t jpeg_quality;
+    uint8_t phone_mac[6];
+}_device_config_v1_t;
+
+// configuration stored by firmware without the phone list
+typedef struct {
+    uint32_t sleep_seconds;
+    uint8_t frame_size;
+    uint8_t jpeg_quality;
+    uint8_t phone_mac[6];
+    uint16_t roi_x;
+    uint16_t roi_y;
+    uint16_t roi_width;
+    uint16_t roi_height;
+}_device_config_v2_t;
+
+// Phone Bluetooth MAC address used until the phone sends one
+static const uint8_t _default_phone_mac[6] = {0x18, 0x4e, 0x16, 0x81, 0x8a, 0x4f};
+
+static _device_config_t _config;
+
+/**
+ * Fill the configuration with the compile time defaults.
+ */
+static void _set_defaults(_device_config_t * config) {
+  config->sleep_seconds = CONFIG_DEFAULT_SLEEP_SECONDS;
+  config->frame_size = FRAMESIZE_UXGA;
+  config->jpeg_quality = 10;
+  memcpy(config->phone_mac, _default_phone_mac, 6);
+  config->roi_x = 0;
+  config->roi_y = 0;
+  config->roi_width = 0;
+  config->roi_height = 0;
+  config->extra_phone_count = 0;
+  memset(config->extra_phones, 0, sizeof(config->extra_phones));
+}
+
+/**
+ * All zero or broadcast addresses can not be a phone.
+ */
+static bool _is_valid_mac(const uint8_t * mac) {
+  bool all_zero = true;
+  bool all_ones = true;
+  for(int i = 0; i < 6; ++i) {
+    all_zero &= (mac[i] == 0x00);
+    all_ones &= (mac[i] == 0xFF);
+  }
+  return !all_zero && !all_ones;
+}
+
+/**
+ * Check every field of a configuration.
+ */
+static bool _is_valid(const _device_config_t * config) {
+  if(config->sleep_seconds < CONFIG_MIN_SLEEP_SECONDS || config->sleep_seconds > CONFIG_MAX_SLEEP_SECONDS) {
+    LOG_W(LOG_MODULE_MAIN, "device_config: invalid sleep time %u", config->sleep_seconds);
+    return false;
+  }
+
+  if(config->frame_size > FRAMESIZE_UXGA) {
+    LOG_W(LOG_MODULE_MAIN, "device_config: invalid frame size %d", config->frame_size);
+    return false;
+  }
+
+  if(config->jpeg_quality < CONFIG_MIN_JPEG_QUALITY || config->jpeg_quality > CONFIG_MAX_JPEG_QUALITY) {
+    LOG_W(LOG_MODULE_MAIN, "device_config: invalid jpeg quality %d", config->jpeg_quality);
+    return false;
+  }
+
+  if(!_is_valid_mac(config->phone_mac)) {
+    LOG_W(LOG_MODULE_MAIN, "device_config: invalid phone MAC");
+    return false;
+  }
+
+  if(config->extra_phone_count > CONFIG_MAX_EXTRA_PHONES) {
+    LOG_W(LOG_MODULE_MAIN, "device_config: too many phones %d", config->extra_phone_count);
+    return false;
+  }
+  for(int i = 0; i < config->extra_phone_count; ++i) {
+    if(!_is_valid_mac(config->extra_phones[i])) {
+      LOG_W(LOG_MODULE_MAIN, "device_config: invalid MAC of phone %d", i);
+      return false;
+    }
+  }
+
+  if(config->roi_width != 0) {
+    bool aligned = ((config->roi_x | config->roi_y | config->roi_width | config->roi_height) % CAMERA_ROI_ALIGN) == 0;
+    bool inside = (uint32_t)config->roi_x + config->roi_width <= CAMERA_SENSOR_WIDTH &&
+      (uint32_t)config->roi_y + config->roi_height <= CAMERA_SENSOR_HEIGHT;
+    if(!aligned || !inside || config->roi_width < CAMERA_ROI_MIN_SIZE || config->roi_height < CAMERA_ROI_MIN_SIZE) {
+      LOG_W(LOG_MODULE_MAIN, "device_config: invalid region of interest %d,%d %dx%d", config->roi_x, config->roi_y,
+        config->roi_width, config->roi_height);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Load the configuration from the key-value store, or the defaults if there is none.
+ */
+void device_config_load() {
+  _device_config_t stored;
+  _device_config_v2_t stored_v2;
+  _device_config_v1_t stored_v1;
+  _set_defaults(&_config);
+  if(kv_get(CONFIG_KV_KEY, &stored, sizeof(stored))) {
+    if(_is_valid(&stored)) {
+      _config = stored;
+    }
+  } else if(kv_get(CONFIG_KV_KEY, &stored_v2, sizeof(stored_v2))) {
+    // keep the settings of the older firmware, without other phones
+    _set_defaults(&stored);
+    stored.sleep_seconds = stored_v2.sleep_seconds;
+    stored.frame_size = stored_v2.frame_size;
+    stored.jpeg_quality = stored_v2.jpeg_quality;
+    memcpy(stored.phone_mac, stored_v2.phone_mac, 6);
+    stored.roi_x = stored_v2.roi_x;
+    stored.roi_y = stored_v2.roi_y;
+    stored.roi_width = stored_v2.roi_width;
+    stored.roi_height = stored_v2.roi_height;
+    if(_is_valid(&stored)) {
+      _config = stored;
+    }
+  } else if(kv_get(CONFIG_KV_KEY, &stored_v1, sizeof(stored_v1))) {
+    // keep the settings of the older firmware, the full frame is captured
+    _set_defaults(&stored);
+    stored.sleep_seconds = stored_v1.sleep_seconds;
+    stored.frame_size = stored_v1.frame_size;
+    stored.jpeg_quality = stored_v1.jpeg_quality;
+    memcpy(stored.phone_mac, stored_v1.phone_mac, 6);
+    if(_is_valid(&stored)) {
+      _config = stored;
+    }
+  } else {
+    LOG_D(LOG_MODULE_MAIN, "device_config_load: using defaults");
+  }
+}
+
+/**
+ * Get the configuration of the current wake.
+ * @return: const _device_config_t *
+ */
+const _device_config_t * device_config_get() {
+  return &_config;
+}
+
+/**
+ * Validate a configuration blob from the phone and store it for the next wake.
+ * @param: const uint8_t * blob
+ * @param: uint16_t blob length
+ * @return: boolean, false if the blob is invalid
+ */
+bool device_config_store_blob(const uint8_t * blob, uint16_t length) {
+  if(blob == NULL || length < CONFIG_BLOB_V1_SIZE) {
+    LOG_W(LOG_MODULE_MAIN, "device_config_store_blob: blob too short %d", length);
+    return false;
+  }
+
+  uint8_t version = blob[0];
+  if(version < 0x01 || version > CONFIG_BLOB_VERSION) {
+    LOG_W(LOG_MODULE_MAIN, "device_config_store_blob: unsupported version %d", version);
+    return false;
+  }
+
+  // version 3 blobs are CONFIG_BLOB_V2_SIZE bytes, the phone count and the listed phones
+  uint16_t expected = version == 0x01 ? CONFIG_BLOB_V1_SIZE : CONFIG_BLOB_V2_SIZE;
+  if(version == CONFIG_BLOB_VERSION && length > CONFIG_BLOB_V2_SIZE) {
+    expected = CONFIG_BLOB_V2_SIZE + 1 + 6 * blob[CONFIG_BLOB_V2_SIZE];
+  } else if(version == CONFIG_BLOB_VERSION) {
+    expected = CONFIG_BLOB_V2_SIZE + 1;
+  }
+  if(length < expected) {
+    LOG_W(LOG_MODULE_MAIN, "device_config_store_blob: blob too short %d", length);
+    return false;
+  }
+
+  // start from the stored configuration, the phone only sends the fields it changes
+  _device_config_t updated = _config;
+  uint8_t fields = blob[1];
+
+  if(fields & CONFIG_FIELD_SLEEP) {
+    updated.sleep_seconds = blob[2] | (blob[3] << 8) | (blob[4] << 16) | ((uint32_t)blob[5] << 24);
+  }
+  if(fields & CONFIG_FIELD_FRAME_SIZE) {
+    updated.frame_size = blob[6];
+  }
+  if(fields & CONFIG_FIELD_JPEG_QUALITY) {
+    updated.jpeg_quality = blob[7];
+  }
+  if(fields & CONFIG_FIELD_PHONE_MAC) {
+    memcpy(updated.phone_mac, &blob[8], 6);
+  }
+  if(version >= 0x02 && (fields & CONFIG_FIELD_ROI)) {
+    updated.roi_x = blob[14] | (blob[15] << 8);
+    updated.roi_y = blob[16] | (blob[17] << 8);
+    updated.roi_width = blob[18] | (blob[19] << 8);
+    updated.roi_height = blob[20] | (blob[21] << 8);
+  }
+  if(version == CONFIG_BLOB_VERSION && (fields & CONFIG_FIELD_PHONES)) {
+    updated.extra_phone_count = blob[CONFIG_BLOB_V2_SIZE];
+    if(updated.extra_phone_count <= CONFIG_MAX_EXTRA_PHONES) {
+      memset(updated.extra_phones, 0, sizeof(updated.extra_phones));
+      memcpy(updated.extra_phones, &blob[CONFIG_BLOB_V2_SIZE + 1], 6 * updated.extra_phone_count);
+    }
+  }
+
+  if(!_is_valid(&updated)) {
+    LOG_W(LOG_MODULE_MAIN, "device_config_store_blob: configuration rejected");
+    return false;
+  }
+
+  // applied on the next wake, the camera and Bluetooth are already set up for this one
+  if(!kv_set(CONFIG_KV_KEY, &updated, sizeof(updated))) {
+    LOG_E(LOG_MODULE_MAIN, "device_config_store_blob: failed to store configuration");
+    return false;
+  }
+
+  LOG_I(LOG_MODULE_MAIN, "device_config_store_blob: configuration stored for next wake");
+  return true;
+}
+
+/**
+ * Print the configuration to Serial.
+ */
+void device_config_print() {
+  Serial.printf("config: sleep %u s, frame size %d, quality %d, phone %02x:%02x:%02x:%02x:%02x:%02x\n",
+    _config.sleep_seconds, _config.frame_size, _config.jpeg_quality,
+    _config.phone_mac[0], _config.phone_mac[1], _config.phone_mac[2],
+    _config.phone_mac[3], _config.phone_mac[4], _config.phone_mac[5]);
+  if(_config.roi_width != 0) {
+    Serial.printf("config: region of interest %d,%d %dx%d\n", _config.roi_x, _config.roi_y,
+      _config.roi_width, _config.roi_height);
+  }
+  for(int i = 0; i < _config.extra_phone_count; ++i) {
+    const uint8_t * mac = _config.extra_phones[i];
+    Serial.printf("config: phone %02x:%02x:%02x:%02x:%02x:%02x\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef __DEVICE_CONFIG_H__
+#define __DEVICE_CONFIG_H__
+
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "bt_protocol.h"
+#include <stdint.h>
+
+/**
+ * Runtime configuration of the camera. The phone sends a configuration blob in response to the
+ * CONFIG_REQUEST, the blob is validated, stored in the key-value store and used from the next wake,
+ * so capture rate, image size and the phone address can be tuned without a firmware rebuild.
+ *
+ * Configuration blob (little endian), FIELDS is a bit mask of the fields the phone wants to change,
+ * the other fields are ignored:
+ * -------------------------------------------------------------------------------------------------
+ * | VERSION (1) | FIELDS (1) | SLEEP SECONDS (4) | FRAME SIZE (1) | JPEG QUALITY (1) | PHONE MAC (6) |
+ * -------------------------------------------------------------------------------------------------
+ * | ROI X (2) | ROI Y (2) | ROI WIDTH (2) | ROI HEIGHT (2) |      (version 2 and 3)
+ * ---------------------------------------------------------
+ * | PHONE COUNT (1) | PHONE MAC (6) * PHONE COUNT |              (version 3 only)
+ * -------------------------------------------------
+ *
+ * The region of interest is in sensor pixels (see camera.h), a width of 0 captures the full frame.
+ * The phone list names up to CONFIG_MAX_EXTRA_PHONES phones besides PHONE MAC that the camera may
+ * upload to, a count of 0 clears the list. Every phone enters the peer table on the next wake.
+ * Version 1 and 2 blobs are still accepted.
+ */
+
+#define CONFIG_FIELD_SLEEP (1 << 0)
+#define CONFIG_FIELD_FRAME_SIZE (1 << 1)
+#define CONFIG_FIELD_JPEG_QUALITY (1 << 2)
+#define CONFIG_FIELD_PHONE_MAC (1 << 3)
+#define CONFIG_FIELD_ROI (1 << 4)
+#define CONFIG_FIELD_PHONES (1 << 5)
+
+#define CONFIG_DEFAULT_SLEEP_SECONDS (5 * 60)   /* Time ESP32 will go to sleep (in seconds) */
+#define CONFIG_MIN_SLEEP_SECONDS 10
+#define CONFIG_MAX_SLEEP_SECONDS (24 * 60 * 60)
+#define CONFIG_MIN_JPEG_QUALITY 4
+#define CONFIG_MAX_JPEG_QUALITY 63
+
+// key of the configuration in the key-value store
+#define CONFIG_KV_KEY "config"
+
+typedef struct {
+    uint32_t sleep_seconds;
+    uint8_t frame_size;
+    uint8_t jpeg_quality;
+    uint8_t phone_mac[6];
+    uint16_t roi_x;
+    uint16_t roi_y;
+    uint16_t roi_width;          // 0 for the full frame
+    uint16_t roi_height;
+    uint8_t extra_phone_count;
+    uint8_t extra_phones[CONFIG_MAX_EXTRA_PHONES][6];
+}_device_config_t;
+
+/**
+ * Load the configuration from the key-value store, or the defaults if there is none.
+ */
+void device_config_load();
+
+/**
+ * Get the configuration of the current wake.
+ * @return: const _device_config_t *
+ */
+const _device_config_t * device_config_get();
+
+/**
+ * Validate a configuration blob from the phone and store it for the next wake.
+ * @param: const uint8_t * blob
+ * @param: uint16_t blob length
+ * @return: boolean, false if the blob is invalid
+ */
+bool device_config_store_blob(const uint8_t * blob, uint16_t length);
+
+/**
+ * Print the configuration to Serial.
+ */
+void device_config_print();
+
+#endif
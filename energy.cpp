@@ -0,0 +1,159 @@
+#include "energy.h"
+#include "metrics.h"
+#include "peer_table.h"
+#include "utils.h"
+
+#include "freertos/FreeRTOS.h"
+
+// totals persist across deep sleep, they are cleared on power-on reset.
+RTC_DATA_ATTR static _energy_totals_t _totals;
+
+// active time of each component in this wake, and when the active ones started
+static uint64_t _active_us[ENERGY_COMPONENT_COUNT];
+static uint32_t _started_us[ENERGY_COMPONENT_COUNT];
+static bool _active[ENERGY_COMPONENT_COUNT];
+
+// metrics at the start of the wake, the difference at the end is the work of this wake
+static uint32_t _images_at_begin;
+static uint32_t _bytes_at_begin;
+
+// camera and Bluetooth tasks run on different cores, protect the updates.
+static portMUX_TYPE _energy_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Active time of a component in this wake, including the running period. Call with the lock held.
+ */
+static uint64_t _component_us(int component) {
+  uint64_t active = _active_us[component];
+  if(_active[component]) {
+    active += (uint32_t)(micros() - _started_us[component]);
+  }
+  return active;
+}
+
+/**
+ * Active time of every component in this wake.
+ */
+static void _active_times(uint64_t * active_us) {
+  portENTER_CRITICAL(&_energy_mux);
+  for(int i = 0; i < ENERGY_COMPONENT_COUNT; ++i) {
+    active_us[i] = _component_us(i);
+  }
+  portEXIT_CRITICAL(&_energy_mux);
+}
+
+/**
+ * Start of a wake cycle, charges the deep sleep before it. Call once from setup().
+ */
+void energy_begin_wake() {
+  energy_model_begin_wake(&_totals);
+
+  _images_at_begin = metrics_get()->images_captured;
+  _bytes_at_begin = metrics_get()->bytes_sent;
+}
+
+/**
+ * A component becomes active.
+ * @param: _energy_component_t component
+ */
+void energy_begin(_energy_component_t component) {
+  if(component >= ENERGY_COMPONENT_COUNT) {
+    return;
+  }
+
+  portENTER_CRITICAL(&_energy_mux);
+  if(!_active[component]) {
+    _active[component] = true;
+    _started_us[component] = micros();
+  }
+  portEXIT_CRITICAL(&_energy_mux);
+}
+
+/**
+ * A component becomes idle, its active time is added to the wake.
+ * @param: _energy_component_t component
+ */
+void energy_end(_energy_component_t component) {
+  if(component >= ENERGY_COMPONENT_COUNT) {
+    return;
+  }
+
+  portENTER_CRITICAL(&_energy_mux);
+  if(_active[component]) {
+    _active[component] = false;
+    _active_us[component] += (uint32_t)(micros() - _started_us[component]);
+  }
+  portEXIT_CRITICAL(&_energy_mux);
+}
+
+/**
+ * Get the energy used so far in this wake.
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_wake_mj() {
+  uint64_t active_us[ENERGY_COMPONENT_COUNT];
+  _active_times(active_us);
+  uint64_t energy = energy_model_uj(ENERGY_AWAKE_MA, (uint64_t)millis() * 1000);
+  for(int i = 0; i < ENERGY_COMPONENT_COUNT; ++i) {
+    energy += energy_model_component_uj((_energy_component_t)i, active_us[i]);
+  }
+  return (uint32_t)(energy / 1000);
+}
+
+/**
+ * End of a wake cycle. Closes the active components, updates the totals and the per image and per KB
+ * averages. Call right before deep sleep.
+ * @param: uint32_t planned deep sleep in seconds
+ */
+void energy_end_wake(uint32_t sleep_seconds) {
+  for(int i = 0; i < ENERGY_COMPONENT_COUNT; ++i) {
+    energy_end((_energy_component_t)i);
+  }
+
+  energy_model_end_wake(&_totals, (uint64_t)millis() * 1000, _active_us,
+    metrics_get()->images_captured - _images_at_begin, metrics_get()->bytes_sent - _bytes_at_begin, sleep_seconds);
+}
+
+/**
+ * Get the expected energy of an upload from the radio cost per KB of the previous wakes.
+ * @param: uint32_t bytes to upload
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_upload_cost_mj(uint32_t bytes) {
+  return energy_model_upload_cost_mj(&_totals, bytes);
+}
+
+/**
+ * Check if an upload fits in what is left of the upload budget of this wake.
+ * @param: uint32_t bytes to upload
+ * @return: boolean
+ */
+bool energy_upload_affordable(uint32_t bytes) {
+  uint64_t active_us[ENERGY_COMPONENT_COUNT];
+  _active_times(active_us);
+  bool affordable = energy_model_upload_affordable(&_totals, active_us, bytes);
+  if(!affordable) {
+    LOG_I(LOG_MODULE_METRICS, "energy: upload of %u bytes (%u mJ) exceeds the wake budget", bytes,
+      energy_upload_cost_mj(bytes));
+  }
+  return affordable;
+}
+
+/**
+ * An upload was deferred by its expected cost. Decays the per KB average toward the cost at the
+ * default upload rate, so one expensive wake can not hold back the uploads for good.
+ */
+void energy_upload_deferred() {
+  energy_model_upload_deferred(&_totals, PEER_DEFAULT_THROUGHPUT);
+}
+
+/**
+ * Print the energy of the last wake and the averages to Serial.
+ */
+void energy_print() {
+  Serial.printf("energy: wake %u mJ, total %llu mJ, %u mJ per image, %u uJ per KB sent\n",
+    _totals.last_wake_uj / 1000, _totals.total_uj / 1000, _totals.mj_per_image, _totals.uj_per_kb);
+  for(int i = 0; i < ENERGY_COMPONENT_COUNT; ++i) {
+    LOG_D(LOG_MODULE_METRICS, "energy: component %d active %llu ms", i, _active_us[i] / 1000);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef __ENERGY_H__
+#define __ENERGY_H__
+
+#include "Arduino.h"
+#include "energy_model.h"
+#include <stdint.h>
+
+/**
+ * Energy estimate of the camera module. The board draws ENERGY_AWAKE_MA whenever it is awake, the
+ * radio, the camera and the SD card add their own current while they are active. Each component
+ * accumulates its active time, the two tasks run on separate cores so components overlap and their
+ * currents add up. Deep sleep is charged at the start of the next wake for the planned sleep time.
+ *
+ * The totals live in RTC memory until a power-on reset. At the end of each wake the energy of the
+ * capture (camera and SD card) per image and of the radio per KB sent update moving averages,
+ * which give the expected cost of an upload to the upload scheduler. The per KB figure counts only
+ * the connected radio time, connecting is a fixed cost of the wake that is spent before any upload.
+ *
+ * The arithmetic lives in energy_model.h, together with the current figures of the board. This file
+ * keeps the timers, the RTC copy of the totals and the locking.
+ */
+
+/**
+ * Start of a wake cycle, charges the deep sleep before it. Call once from setup().
+ */
+void energy_begin_wake();
+
+/**
+ * A component becomes active.
+ * @param: _energy_component_t component
+ */
+void energy_begin(_energy_component_t component);
+
+/**
+ * A component becomes idle, its active time is added to the wake.
+ * @param: _energy_component_t component
+ */
+void energy_end(_energy_component_t component);
+
+/**
+ * End of a wake cycle. Closes the active components, updates the totals and the per image and per KB
+ * averages. Call right before deep sleep.
+ * @param: uint32_t planned deep sleep in seconds
+ */
+void energy_end_wake(uint32_t sleep_seconds);
+
+/**
+ * Get the energy used so far in this wake.
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_wake_mj();
+
+/**
+ * Get the expected energy of an upload from the radio cost per KB of the previous wakes.
+ * @param: uint32_t bytes to upload
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_upload_cost_mj(uint32_t bytes);
+
+/**
+ * Check if an upload fits in what is left of the upload budget of this wake.
+ * @param: uint32_t bytes to upload
+ * @return: boolean
+ */
+bool energy_upload_affordable(uint32_t bytes);
+
+/**
+ * An upload was deferred by its expected cost. Decays the per KB average toward the cost at the
+ * default upload rate, so one expensive wake can not hold back the uploads for good.
+ */
+void energy_upload_deferred();
+
+/**
+ * Print the energy of the last wake and the averages to Serial.
+ */
+void energy_print();
+
+#endif
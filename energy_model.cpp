@@ -0,0 +1,145 @@
+#include "energy_model.h"
+
+#include <string.h>
+
+static const uint16_t _component_ma[ENERGY_COMPONENT_COUNT] = {
+    ENERGY_RADIO_CONNECTING_MA, ENERGY_RADIO_TRANSFER_MA, ENERGY_CAMERA_MA, ENERGY_SD_WRITE_MA
+};
+
+/**
+ * Energy of a current over a time.
+ * @param: uint32_t current in mA
+ * @param: uint64_t duration in microseconds
+ * @return: uint64_t microjoules
+ */
+uint64_t energy_model_uj(uint32_t current_ma, uint64_t duration_us) {
+  return (uint64_t)current_ma * ENERGY_SUPPLY_MV * duration_us / 1000000;
+}
+
+/**
+ * Energy of a component over its active time.
+ * @param: _energy_component_t component
+ * @param: uint64_t active time in microseconds
+ * @return: uint64_t microjoules
+ */
+uint64_t energy_model_component_uj(_energy_component_t component, uint64_t active_us) {
+  if(component >= ENERGY_COMPONENT_COUNT) {
+    return 0;
+  }
+  return energy_model_uj(_component_ma[component], active_us);
+}
+
+/**
+ * Moving average of the per image and per KB figures, a zero average takes the sample.
+ * @param: uint32_t average
+ * @param: uint32_t sample
+ * @return: uint32_t
+ */
+uint32_t energy_model_average(uint32_t average, uint32_t sample) {
+  if(average == 0) {
+    return sample;
+  }
+  return (uint32_t)(((uint64_t)average * (8 - ENERGY_AVERAGE_WEIGHT) + (uint64_t)sample * ENERGY_AVERAGE_WEIGHT) / 8);
+}
+
+/**
+ * Radio energy per KB sent at an upload rate.
+ * @param: uint32_t upload rate in bytes per second
+ * @return: uint32_t microjoules
+ */
+uint32_t energy_model_uj_per_kb(uint32_t bytes_per_second) {
+  if(bytes_per_second == 0) {
+    return UINT32_MAX;
+  }
+  return (uint32_t)((uint64_t)ENERGY_RADIO_TRANSFER_MA * ENERGY_SUPPLY_MV * 1024 / bytes_per_second);
+}
+
+/**
+ * Start of a wake: resets totals without a valid magic and charges the planned deep sleep.
+ * @param: _energy_totals_t * totals
+ */
+void energy_model_begin_wake(_energy_totals_t * totals) {
+  if(totals->magic != ENERGY_RTC_MAGIC) {
+    memset(totals, 0, sizeof(*totals));
+    totals->magic = ENERGY_RTC_MAGIC;
+  }
+
+  totals->total_uj += energy_model_uj(ENERGY_SLEEP_MA, (uint64_t)totals->planned_sleep_seconds * 1000000);
+  totals->planned_sleep_seconds = 0;
+}
+
+/**
+ * End of a wake: adds the wake to the totals and updates the per image and per KB averages.
+ * @param: _energy_totals_t * totals
+ * @param: uint64_t awake time in microseconds
+ * @param: const uint64_t * active time of every component in microseconds, ENERGY_COMPONENT_COUNT entries
+ * @param: uint32_t images captured in the wake
+ * @param: uint32_t bytes sent in the wake
+ * @param: uint32_t planned deep sleep in seconds
+ */
+void energy_model_end_wake(_energy_totals_t * totals, uint64_t awake_us, const uint64_t * active_us,
+  uint32_t images, uint32_t bytes_sent, uint32_t sleep_seconds) {
+  uint64_t wake_uj = energy_model_uj(ENERGY_AWAKE_MA, awake_us);
+  uint64_t component_uj[ENERGY_COMPONENT_COUNT];
+  for(int i = 0; i < ENERGY_COMPONENT_COUNT; ++i) {
+    component_uj[i] = energy_model_component_uj((_energy_component_t)i, active_us[i]);
+    wake_uj += component_uj[i];
+  }
+
+  totals->total_uj += wake_uj;
+  totals->last_wake_uj = wake_uj < UINT32_MAX ? (uint32_t)wake_uj : UINT32_MAX;
+  totals->planned_sleep_seconds = sleep_seconds;
+
+  // the capture costs the camera and the SD card, the upload the radio
+  if(images > 0) {
+    uint64_t capture_uj = component_uj[ENERGY_CAMERA] + component_uj[ENERGY_SD_WRITE];
+    totals->mj_per_image = energy_model_average(totals->mj_per_image, (uint32_t)(capture_uj / 1000 / images));
+  }
+  // connecting is paid once per wake whatever is sent, only the connected time is charged per KB
+  uint32_t kilobytes = bytes_sent / 1024;
+  if(kilobytes > 0) {
+    uint64_t radio_uj = component_uj[ENERGY_RADIO_TRANSFER];
+    totals->uj_per_kb = energy_model_average(totals->uj_per_kb, (uint32_t)(radio_uj / kilobytes));
+  }
+}
+
+/**
+ * Expected energy of an upload from the radio cost per KB of the previous wakes.
+ * @param: const _energy_totals_t * totals
+ * @param: uint32_t bytes to upload
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_model_upload_cost_mj(const _energy_totals_t * totals, uint32_t bytes) {
+  return (uint32_t)((uint64_t)totals->uj_per_kb * (((uint64_t)bytes + 1023) / 1024) / 1000);
+}
+
+/**
+ * Check if an upload fits in what is left of the upload budget of the wake.
+ * @param: const _energy_totals_t * totals
+ * @param: const uint64_t * active time of every component so far in microseconds
+ * @param: uint32_t bytes to upload
+ * @return: boolean
+ */
+bool energy_model_upload_affordable(const _energy_totals_t * totals, const uint64_t * active_us, uint32_t bytes) {
+  if(ENERGY_WAKE_UPLOAD_BUDGET_MJ == 0) {
+    return true;
+  }
+
+  // the radio energy spent so far in this wake
+  uint64_t radio_uj = energy_model_component_uj(ENERGY_RADIO_CONNECTING, active_us[ENERGY_RADIO_CONNECTING]) +
+    energy_model_component_uj(ENERGY_RADIO_TRANSFER, active_us[ENERGY_RADIO_TRANSFER]);
+  return radio_uj / 1000 + energy_model_upload_cost_mj(totals, bytes) <= ENERGY_WAKE_UPLOAD_BUDGET_MJ;
+}
+
+/**
+ * An upload was deferred by its expected cost. Decays the per KB average toward the cost at the
+ * default upload rate, so one expensive wake can not hold back the uploads for good.
+ * @param: _energy_totals_t * totals
+ * @param: uint32_t default upload rate in bytes per second
+ */
+void energy_model_upload_deferred(_energy_totals_t * totals, uint32_t default_bytes_per_second) {
+  uint32_t default_uj_per_kb = energy_model_uj_per_kb(default_bytes_per_second);
+  if(totals->uj_per_kb > default_uj_per_kb) {
+    totals->uj_per_kb = energy_model_average(totals->uj_per_kb, default_uj_per_kb);
+  }
+}
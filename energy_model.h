@@ -0,0 +1,139 @@
+#ifndef __ENERGY_MODEL_H__
+#define __ENERGY_MODEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Arithmetic of the energy estimate (see energy.h). It works on the totals and the active times it is
+ * given and has no Arduino dependency, so the model of the upload scheduler can be checked on a host.
+ * energy.cpp keeps the timers, the RTC copy of the totals and the locking.
+ *
+ * The current figures are for the AI Thinker ESP32-CAM at ENERGY_SUPPLY_MV and can be overridden
+ * at build time with measurements of the actual board.
+ */
+
+#ifndef ENERGY_SUPPLY_MV
+#define ENERGY_SUPPLY_MV 3300
+#endif
+#ifndef ENERGY_SLEEP_MA
+#define ENERGY_SLEEP_MA 6                 // deep sleep, the board regulator and the SD card dominate
+#endif
+#ifndef ENERGY_AWAKE_MA
+#define ENERGY_AWAKE_MA 45                // both cores running, radio and camera idle
+#endif
+#ifndef ENERGY_RADIO_CONNECTING_MA
+#define ENERGY_RADIO_CONNECTING_MA 85     // paging and inquiry scans
+#endif
+#ifndef ENERGY_RADIO_TRANSFER_MA
+#define ENERGY_RADIO_TRANSFER_MA 110      // connected, sending and receiving
+#endif
+#ifndef ENERGY_CAMERA_MA
+#define ENERGY_CAMERA_MA 100              // sensor streaming and JPEG encoding
+#endif
+#ifndef ENERGY_SD_WRITE_MA
+#define ENERGY_SD_WRITE_MA 60
+#endif
+
+// energy an upload may use in one wake, the scheduler leaves the rest of the images for later. 0 disables
+#ifndef ENERGY_WAKE_UPLOAD_BUDGET_MJ
+#define ENERGY_WAKE_UPLOAD_BUDGET_MJ 20000
+#endif
+
+// weight of the last wake in the moving averages, in 1/8
+#define ENERGY_AVERAGE_WEIGHT 2
+
+#define ENERGY_RTC_MAGIC 0x454E5231   // 'ENR1'
+
+typedef enum {
+    ENERGY_RADIO_CONNECTING = 0,
+    ENERGY_RADIO_TRANSFER = 1,
+    ENERGY_CAMERA = 2,
+    ENERGY_SD_WRITE = 3,
+    ENERGY_COMPONENT_COUNT = 4
+}_energy_component_t;
+
+typedef struct {
+    uint32_t magic;
+    uint64_t total_uj;               // since power-on
+    uint32_t last_wake_uj;
+    uint32_t planned_sleep_seconds;  // charged at the start of the next wake
+    uint32_t mj_per_image;           // moving average of the capture energy per image
+    uint32_t uj_per_kb;              // moving average of the radio energy per KB sent
+}_energy_totals_t;
+
+/**
+ * Energy of a current over a time.
+ * @param: uint32_t current in mA
+ * @param: uint64_t duration in microseconds
+ * @return: uint64_t microjoules
+ */
+uint64_t energy_model_uj(uint32_t current_ma, uint64_t duration_us);
+
+/**
+ * Energy of a component over its active time.
+ * @param: _energy_component_t component
+ * @param: uint64_t active time in microseconds
+ * @return: uint64_t microjoules
+ */
+uint64_t energy_model_component_uj(_energy_component_t component, uint64_t active_us);
+
+/**
+ * Moving average of the per image and per KB figures, a zero average takes the sample.
+ * @param: uint32_t average
+ * @param: uint32_t sample
+ * @return: uint32_t
+ */
+uint32_t energy_model_average(uint32_t average, uint32_t sample);
+
+/**
+ * Radio energy per KB sent at an upload rate.
+ * @param: uint32_t upload rate in bytes per second
+ * @return: uint32_t microjoules
+ */
+uint32_t energy_model_uj_per_kb(uint32_t bytes_per_second);
+
+/**
+ * Start of a wake: resets totals without a valid magic and charges the planned deep sleep.
+ * @param: _energy_totals_t * totals
+ */
+void energy_model_begin_wake(_energy_totals_t * totals);
+
+/**
+ * End of a wake: adds the wake to the totals and updates the per image and per KB averages.
+ * @param: _energy_totals_t * totals
+ * @param: uint64_t awake time in microseconds
+ * @param: const uint64_t * active time of every component in microseconds, ENERGY_COMPONENT_COUNT entries
+ * @param: uint32_t images captured in the wake
+ * @param: uint32_t bytes sent in the wake
+ * @param: uint32_t planned deep sleep in seconds
+ */
+void energy_model_end_wake(_energy_totals_t * totals, uint64_t awake_us, const uint64_t * active_us,
+  uint32_t images, uint32_t bytes_sent, uint32_t sleep_seconds);
+
+/**
+ * Expected energy of an upload from the radio cost per KB of the previous wakes.
+ * @param: const _energy_totals_t * totals
+ * @param: uint32_t bytes to upload
+ * @return: uint32_t millijoules
+ */
+uint32_t energy_model_upload_cost_mj(const _energy_totals_t * totals, uint32_t bytes);
+
+/**
+ * Check if an upload fits in what is left of the upload budget of the wake.
+ * @param: const _energy_totals_t * totals
+ * @param: const uint64_t * active time of every component so far in microseconds
+ * @param: uint32_t bytes to upload
+ * @return: boolean
+ */
+bool energy_model_upload_affordable(const _energy_totals_t * totals, const uint64_t * active_us, uint32_t bytes);
+
+/**
+ * An upload was deferred by its expected cost. Decays the per KB average toward the cost at the
+ * default upload rate, so one expensive wake can not hold back the uploads for good.
+ * @param: _energy_totals_t * totals
+ * @param: uint32_t default upload rate in bytes per second
+ */
+void energy_model_upload_deferred(_energy_totals_t * totals, uint32_t default_bytes_per_second);
+
+#endif
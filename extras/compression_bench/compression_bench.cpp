@@ -0,0 +1,146 @@
+/**
+ * Host benchmark of the OTHER_DATA compression. Every input file is compressed with lzss_compress the
+ * way BluetoothCommunication::send_data does it: one call per message, the output limited to
+ * BT_COMPRESS_BUFFER_SIZE and to one byte less than the input, else the message goes uncompressed.
+ * Each message is decompressed again and compared, and the compression ratio and the CPU time of
+ * both directions are printed per file.
+ *
+ * Metrics and resource snapshots (first byte 'M' or 'R') are one message per file, these are the
+ * other_N.bin files the reference receiver writes. Any other file is taken as a log and split into
+ * messages of the payload size, e.g. a serial capture of a wake. Builds with any host compiler:
+ *   g++ -std=c++17 -O2 -Wall -Wextra -I. extras/compression_bench/compression_bench.cpp compression.cpp \
+ *     -o compression_bench
+ *   ./compression_bench received/other_*.bin wake.log
+ *
+ * Usage:
+ *   compression_bench [-p PAYLOAD_SIZE] [-n REPEAT] FILE...
+ */
+
+#include "compression.h"
+#include "bt_frame.h"
+#include "bt_protocol.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#define BENCH_METRICS_MAGIC 0x4D        // METRICS_MAGIC of metrics.h
+#define BENCH_RESOURCE_MAGIC 0x52       // RESOURCE_MAGIC of resource_monitor.h
+#define BENCH_DEFAULT_PAYLOAD (BT_MAX_FRAME_LENGTH - BT_FRAME_PREAMBLE_SIZE)
+#define BENCH_DEFAULT_REPEAT 1000
+
+static double _now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static bool _load_file(const char * path, std::vector<uint8_t> * content) {
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return false;
+    }
+    uint8_t chunk[4096];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        content->insert(content->end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return true;
+}
+
+static const char * _file_kind(const std::vector<uint8_t> & content) {
+    if(!content.empty() && content[0] == BENCH_METRICS_MAGIC) {
+        return "metrics";
+    }
+    if(!content.empty() && content[0] == BENCH_RESOURCE_MAGIC) {
+        return "resources";
+    }
+    return "log";
+}
+
+int main(int argc, char ** argv) {
+    size_t payload_size = BENCH_DEFAULT_PAYLOAD;
+    unsigned repeat = BENCH_DEFAULT_REPEAT;
+    int first_file = 1;
+    while(first_file + 1 < argc && argv[first_file][0] == '-') {
+        if(strcmp(argv[first_file], "-p") == 0) {
+            payload_size = strtoul(argv[first_file + 1], NULL, 0);
+        } else if(strcmp(argv[first_file], "-n") == 0) {
+            repeat = strtoul(argv[first_file + 1], NULL, 0);
+        } else {
+            break;
+        }
+        first_file += 2;
+    }
+    if(first_file >= argc || payload_size == 0 || payload_size > UINT16_MAX || repeat == 0) {
+        fprintf(stderr, "usage: %s [-p PAYLOAD_SIZE] [-n REPEAT] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %-9s %8s %8s %8s %9s %12s %12s\n", "file", "kind", "messages", "bytes", "sent", "ratio",
+        "compress us", "expand us");
+    static uint8_t compressed[BT_COMPRESS_BUFFER_SIZE];
+    static uint8_t expanded[UINT16_MAX];
+    int status = 0;
+    for(int i = first_file; i < argc; i++) {
+        std::vector<uint8_t> content;
+        if(!_load_file(argv[i], &content) || content.empty()) {
+            status = 1;
+            continue;
+        }
+        const char * kind = _file_kind(content);
+        size_t message_size = strcmp(kind, "log") == 0 ? payload_size : std::min(content.size(), (size_t)UINT16_MAX);
+
+        size_t messages = 0;
+        size_t sent = 0;
+        size_t uncompressed = 0;
+        double compress_ns = 0;
+        double expand_ns = 0;
+        for(size_t offset = 0; offset < content.size(); offset += message_size) {
+            const uint8_t * message = content.data() + offset;
+            uint16_t length = (uint16_t)std::min(message_size, content.size() - offset);
+            size_t output_size = std::min((size_t)BT_COMPRESS_BUFFER_SIZE, (size_t)length - 1);
+            messages++;
+
+            size_t compressed_length = 0;
+            double started = _now_ns();
+            for(unsigned r = 0; r < repeat; r++) {
+                compressed_length = lzss_compress(message, length, compressed, output_size);
+            }
+            compress_ns += (_now_ns() - started) / repeat;
+
+            if(compressed_length == 0) {
+                // sent as plain OTHER_DATA
+                sent += length;
+                uncompressed++;
+                continue;
+            }
+            sent += compressed_length;
+
+            size_t expanded_length = 0;
+            started = _now_ns();
+            for(unsigned r = 0; r < repeat; r++) {
+                expanded_length = lzss_decompress(compressed, compressed_length, expanded, sizeof(expanded));
+            }
+            expand_ns += (_now_ns() - started) / repeat;
+            if(expanded_length != length || memcmp(expanded, message, length) != 0) {
+                fprintf(stderr, "%s: round trip failed at offset %zu\n", argv[i], offset);
+                status = 1;
+            }
+        }
+
+        printf("%-32s %-9s %8zu %8zu %8zu %8.1f%% %12.2f %12.2f\n", argv[i], kind, messages, content.size(), sent,
+            100.0 * sent / content.size(), compress_ns / messages / 1e3, expand_ns / messages / 1e3);
+        if(uncompressed > 0) {
+            printf("%-32s %zu of %zu messages sent uncompressed\n", "", uncompressed, messages);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,29 @@
+/**
+ * libFuzzer target for the frames the camera receives from the phone. The input is a session, one or
+ * more frames one after the other, and every frame goes through bt_frame_parse and all the response
+ * handlers of the camera (see session.cpp), so the bounds checks of bt_frame and the payload decoders
+ * are fuzzed with the buffer sizes of the firmware.
+ *
+ * Build and run with clang from the sketch folder:
+ *   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -I. extras/fuzz/fuzz_bt_frame.cpp \
+ *     extras/fuzz/session.cpp bt_frame.cpp -o fuzz_bt_frame
+ *   mkdir -p corpus && ./fuzz_bt_frame -max_len=4096 corpus sessions
+ *
+ * Recorded sessions make a good seed directory. A crash file is a session too, extras/fuzz/replay.cpp
+ * replays it with a description of every frame.
+ *
+ * Coverage of the corpus:
+ *   clang++ -std=c++17 -O0 -fprofile-instr-generate -fcoverage-mapping -I. extras/fuzz/replay.cpp \
+ *     extras/fuzz/session.cpp bt_frame.cpp -o replay_coverage
+ *   find corpus -type f | LLVM_PROFILE_FILE=replay.profraw xargs ./replay_coverage
+ *   llvm-profdata merge -sparse replay.profraw -o replay.profdata
+ *   llvm-cov report ./replay_coverage -instr-profile=replay.profdata bt_frame.cpp extras/fuzz/session.cpp
+ *   llvm-cov show ./replay_coverage -instr-profile=replay.profdata bt_frame.cpp
+ */
+
+#include "session.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    session_replay(data, size, NULL);
+    return 0;
+}
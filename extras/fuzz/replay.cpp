@@ -0,0 +1,54 @@
+/**
+ * Replay driver for recorded sessions and fuzzer inputs. Every file is one session, its frames go
+ * through the response handlers of the camera (see session.cpp) and each frame is described on
+ * stdout. Builds with any host compiler, e.g. with the sanitizers:
+ *   g++ -std=c++17 -g -fsanitize=address,undefined -I. extras/fuzz/replay.cpp extras/fuzz/session.cpp \
+ *     bt_frame.cpp -o replay
+ *   ./replay session.bin crash-*
+ *
+ * Usage:
+ *   replay FILE...
+ */
+
+#include "session.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+static bool _load_file(const char * path, std::vector<uint8_t> * content) {
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return false;
+    }
+    uint8_t chunk[4096];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        content->insert(content->end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for(int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> session;
+        if(!_load_file(argv[i], &session)) {
+            status = 1;
+            continue;
+        }
+
+        printf("%s: %zu bytes\n", argv[i], session.size());
+        size_t frames = session_replay(session.data(), session.size(), stdout);
+        printf("%s: %zu frames\n", argv[i], frames);
+    }
+    return status;
+}
@@ -0,0 +1,175 @@
+/**
+ * The response handlers of bluetooth_comm.cpp without the Bluetooth, RTC and key-value store calls.
+ * Each one does what the firmware does with the received chunk: bt_frame_read_response into a payload
+ * buffer of the same size, then the same payload decoder. The protocol values and the buffer sizes
+ * come from bt_protocol.h, the header the firmware uses.
+ */
+
+#include "session.h"
+#include "bt_frame.h"
+#include "bt_protocol.h"
+
+#include <inttypes.h>
+
+typedef bool (*_handler_t)(const uint8_t * data, size_t length, uint8_t category, FILE * log);
+
+/**
+ * Common start of the handlers, _read_response of the firmware.
+ */
+static bool _read_response(const uint8_t * data, size_t length, uint8_t category, uint8_t * payload,
+    uint16_t payload_size, uint16_t * payload_length, FILE * log) {
+    _bt_frame_t frame;
+    _bt_frame_status_t parsed = bt_frame_read_response(data, length, BT_RESPONSE, category, payload, payload_size,
+        &frame);
+    if(parsed != BT_FRAME_OK) {
+        if(log != NULL) {
+            fprintf(log, "  rejected, %s\n", bt_frame_status_name(parsed));
+        }
+        return false;
+    }
+
+    *payload_length = frame.payload_length;
+    return true;
+}
+
+static uint16_t _min(uint16_t a, uint16_t b) {
+    return a < b ? a : b;
+}
+
+/**
+ * request_for_time
+ */
+static bool _handle_time(const uint8_t * data, size_t length, uint8_t category, FILE * log) {
+    uint8_t payload[BT_TIME_RESPONSE_SIZE];
+    uint16_t payload_length = 0;
+    uint64_t time_in_millis;
+    if(!_read_response(data, length, category, payload, sizeof(payload), &payload_length, log) ||
+        !bt_frame_decode_time(payload, _min(payload_length, sizeof(payload)), &time_in_millis)) {
+        return false;
+    }
+    if(log != NULL) {
+        fprintf(log, "  epoch time %" PRIu64 " ms\n", time_in_millis);
+    }
+    return true;
+}
+
+/**
+ * _send_image_incoming_request
+ */
+static bool _handle_image_incoming(const uint8_t * data, size_t length, uint8_t category, FILE * log) {
+    uint8_t payload[BT_IMAGE_INCOMING_RESPONSE_SIZE];
+    uint16_t payload_length = 0;
+    if(!_read_response(data, length, category, payload, sizeof(payload), &payload_length, log)) {
+        return false;
+    }
+    bool already_received = bt_frame_payload_is(payload, _min(payload_length, sizeof(payload)),
+        _image_received_response);
+    if(log != NULL) {
+        fprintf(log, "  %s\n", already_received ? "phone already has the image" : "upload the image");
+    }
+    return true;
+}
+
+/**
+ * _verify_response, the plain "ok" and "i am ready" answers
+ */
+static bool _handle_verify(const uint8_t * data, size_t length, uint8_t category, FILE * log) {
+    uint8_t block[BT_MAX_FRAME_LENGTH];
+    uint16_t payload_length = 0;
+    if(!_read_response(data, length, category, block, sizeof(block), &payload_length, log)) {
+        return false;
+    }
+    if(log != NULL) {
+        fprintf(log, "  response: %.*s\n", (int)_min(payload_length, sizeof(block)), (const char *)block);
+    }
+    return true;
+}
+
+/**
+ * request_for_config, the blob itself is validated by device_config_store_blob on the camera
+ */
+static bool _handle_config(const uint8_t * data, size_t length, uint8_t category, FILE * log) {
+    uint8_t blob[CONFIG_BLOB_SIZE];
+    uint16_t payload_length = 0;
+    if(!_read_response(data, length, category, blob, sizeof(blob), &payload_length, log)) {
+        return false;
+    }
+    if(log != NULL) {
+        if(payload_length == 0) {
+            fprintf(log, "  no configuration change\n");
+        } else {
+            fprintf(log, "  configuration blob of %u bytes, version %u\n", _min(payload_length, sizeof(blob)),
+                blob[0]);
+        }
+    }
+    return true;
+}
+
+/**
+ * negotiate_capabilities
+ */
+static bool _handle_capabilities(const uint8_t * data, size_t length, uint8_t category, FILE * log) {
+    uint8_t phone_capabilities[BT_CAPABILITY_RESPONSE_SIZE];
+    uint16_t payload_length = 0;
+    uint8_t session_capabilities = 0;
+    if(!_read_response(data, length, category, phone_capabilities, sizeof(phone_capabilities), &payload_length,
+        log) || !bt_frame_decode_capabilities(phone_capabilities, _min(payload_length, sizeof(phone_capabilities)),
+        BT_CAMERA_CAPABILITIES, &session_capabilities)) {
+        return false;
+    }
+    if(log != NULL) {
+        fprintf(log, "  session capabilities 0x%02X\n", session_capabilities);
+    }
+    return true;
+}
+
+// handler of each response category, indexed by category
+static const _handler_t _handlers[] = {
+    _handle_time,                  // RESPONSE_FOR_TIME_REQUEST
+    _handle_image_incoming,        // RESPONSE_FOR_IMAGE_INCOMING_REQUEST
+    _handle_verify,                // RESPONSE_FOR_ARE_YOU_READY_REQUEST
+    _handle_verify,                // RESPONSE_FOR_IMAGE_SENT_REQUEST
+    _handle_verify,                // RESPONSE_FOR_IMAGE_DATA
+    _handle_verify,                // RESPONSE_FOR_OTHER_DATA
+    _handle_config,                // RESPONSE_FOR_CONFIG_REQUEST
+    _handle_capabilities,          // RESPONSE_FOR_CAPABILITY_REQUEST
+    _handle_verify                 // RESPONSE_FOR_IMAGE_PREVIEW_DATA
+};
+#define HANDLER_COUNT (sizeof(_handlers) / sizeof(_handlers[0]))
+
+size_t session_replay(const uint8_t * data, size_t length, FILE * log) {
+    size_t frames = 0;
+    size_t offset = 0;
+    while(offset < length) {
+        // the camera keeps one received chunk per frame and its receive buffer holds one frame,
+        // the rest of a session that does not parse is given as one last chunk
+        size_t chunk = length - offset;
+        _bt_frame_t frame;
+        _bt_frame_status_t parsed = bt_frame_parse(data + offset, chunk, &frame);
+        if(parsed == BT_FRAME_OK) {
+            chunk = BT_FRAME_PREAMBLE_SIZE + frame.payload_length;
+        }
+        if(chunk > BT_MAX_FRAME_LENGTH) {
+            chunk = BT_MAX_FRAME_LENGTH;
+        }
+
+        if(log != NULL) {
+            if(parsed == BT_FRAME_OK) {
+                fprintf(log, "frame %zu: 0x%02X/0x%02X, packet %u, %u payload bytes\n", frames, frame.comm_type,
+                    frame.category, frame.packet_number, frame.payload_length);
+            } else {
+                fprintf(log, "frame %zu: %zu bytes, %s\n", frames, chunk, bt_frame_status_name(parsed));
+            }
+        }
+
+        // only the handler waiting for this category describes the frame
+        for(size_t category = 0; category < HANDLER_COUNT; ++category) {
+            bool expected = (parsed == BT_FRAME_OK && frame.category == category);
+            _handlers[category](data + offset, chunk, (uint8_t)category, expected ? log : NULL);
+        }
+
+        offset += chunk;
+        frames++;
+    }
+    return frames;
+}
@@ -0,0 +1,19 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Replay of a received session through the response handlers of the camera, shared by the fuzz
+ * target and the replay driver. A session is the frames the camera received one after the other.
+ * Each frame is given to every handler, as a handler expecting another response would see it.
+ * @param: const uint8_t * session bytes
+ * @param: size_t number of bytes
+ * @param: FILE * where to describe each frame and the result of its handler, NULL for none
+ * @return: size_t number of frames
+ */
+size_t session_replay(const uint8_t * data, size_t length, FILE * log);
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * Host benchmark of the key-value store commits. The cache of kv_cache.cpp runs on a file backend that
+ * appends every written value to a log file and syncs it on commit, the way NVS appends entries to its
+ * pages. For every batch size a round updates that many keys and commits, so the batch sizes around
+ * KV_COMMIT_THRESHOLD show the commits kv_set() issues by itself and what a batched commit costs.
+ *   g++ -std=c++17 -O2 -Wall -Wextra -I. extras/kv_bench/kv_bench.cpp kv_cache.cpp -o kv_bench
+ *   ./kv_bench /tmp/kv.log 200
+ *
+ * Usage:
+ *   kv_bench LOG_FILE [ROUNDS]
+ */
+
+#include "kv_cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define BENCH_DEFAULT_ROUNDS 200
+#define BENCH_VALUE_SIZE 16              // e.g. a transfer progress record
+#define BENCH_TOMBSTONE 0xFF
+
+typedef struct {
+    FILE * log;
+    std::map<std::string, std::vector<uint8_t>> values;
+    uint32_t writes;
+    uint32_t syncs;
+}_file_backend_state_t;
+
+static _file_backend_state_t _state;
+
+// log record: key length (1) | key | value length (1, BENCH_TOMBSTONE for an erase) | value
+static bool _file_append(const char * key, const void * value, uint8_t length) {
+    uint8_t key_length = (uint8_t)strnlen(key, KV_MAX_KEY_LENGTH);
+    bool ok = fwrite(&key_length, 1, 1, _state.log) == 1 && fwrite(key, 1, key_length, _state.log) == key_length
+        && fwrite(&length, 1, 1, _state.log) == 1;
+    if(ok && length != BENCH_TOMBSTONE) {
+        ok = fwrite(value, 1, length, _state.log) == length;
+    }
+    return ok;
+}
+
+static bool _file_read(const char * key, void * value, size_t * length) {
+    auto entry = _state.values.find(key);
+    if(entry == _state.values.end() || entry->second.size() > *length) {
+        return false;
+    }
+    memcpy(value, entry->second.data(), entry->second.size());
+    *length = entry->second.size();
+    return true;
+}
+
+static bool _file_write(const char * key, const void * value, size_t length) {
+    if(!_file_append(key, value, (uint8_t)length)) {
+        return false;
+    }
+    const uint8_t * bytes = (const uint8_t *)value;
+    _state.values[key].assign(bytes, bytes + length);
+    _state.writes++;
+    return true;
+}
+
+static bool _file_commit() {
+    _state.syncs++;
+    return fflush(_state.log) == 0 && fsync(fileno(_state.log)) == 0;
+}
+
+static bool _file_erase(const char * key) {
+    _state.values.erase(key);
+    return _file_append(key, NULL, BENCH_TOMBSTONE) && _file_commit();
+}
+
+static int64_t _file_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static const _kv_backend_t _file_backend = {
+    _file_read,
+    _file_write,
+    _file_erase,
+    _file_commit,
+    _file_now_us
+};
+
+int main(int argc, char ** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s LOG_FILE [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+    unsigned rounds = argc > 2 ? strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_ROUNDS;
+    if(rounds == 0) {
+        fprintf(stderr, "ROUNDS must be positive\n");
+        return 1;
+    }
+
+    const unsigned batches[] = { 1, 2, 4, KV_COMMIT_THRESHOLD - 1, KV_COMMIT_THRESHOLD, KV_COMMIT_THRESHOLD + 1,
+        KV_COMMIT_THRESHOLD + 4, KV_MAX_ENTRIES };
+
+    printf("%u rounds per batch size, %d byte values, commit threshold %d\n", rounds, BENCH_VALUE_SIZE,
+        KV_COMMIT_THRESHOLD);
+    printf("%6s %14s %12s %12s %14s %14s\n", "batch", "commits/round", "avg us", "max us", "us/update",
+        "writes/update");
+    for(unsigned batch : batches) {
+        _state.log = fopen(argv[1], "wb");
+        if(_state.log == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+        _state.values.clear();
+        _state.writes = 0;
+        _state.syncs = 0;
+
+        _kv_cache_t cache;
+        kv_cache_init(&cache, &_file_backend);
+        uint64_t commit_us = 0;
+        int64_t started = _file_now_us();
+        for(unsigned round = 0; round < rounds; round++) {
+            uint32_t commits = cache.commits;
+            for(unsigned i = 0; i < batch; i++) {
+                char key[KV_MAX_KEY_LENGTH + 1];
+                snprintf(key, sizeof(key), "key%u", i);
+                uint8_t value[BENCH_VALUE_SIZE];
+                memset(value, 0, sizeof(value));
+                memcpy(value, &round, sizeof(round));
+                // every threshold commit inside the batch is part of the cost
+                if(!kv_cache_set(&cache, key, value, sizeof(value))) {
+                    fprintf(stderr, "batch %u: set failed\n", batch);
+                    return 1;
+                }
+                if(cache.commits != commits) {
+                    commit_us += cache.last_commit_us;
+                    commits = cache.commits;
+                }
+            }
+            if(!kv_cache_commit(&cache)) {
+                fprintf(stderr, "batch %u: commit failed\n", batch);
+                return 1;
+            }
+            if(cache.commits != commits) {
+                commit_us += cache.last_commit_us;
+            }
+        }
+        double elapsed = (double)(_file_now_us() - started);
+        fclose(_state.log);
+
+        double updates = (double)batch * rounds;
+        printf("%6u %14.2f %12.1f %12u %14.1f %14.2f\n", batch, (double)cache.commits / rounds,
+            cache.commits > 0 ? (double)commit_us / cache.commits : 0.0, cache.max_commit_us, elapsed / updates,
+            _state.writes / updates);
+    }
+    unlink(argv[1]);
+    return 0;
+}
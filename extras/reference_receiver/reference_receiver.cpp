@@ -0,0 +1,460 @@
+/**
+ * Reference receiver for the camera Bluetooth protocol (see bt_protocol.h). It plays the part of
+ * the phone: answers the time, capability, config, image incoming, are you ready and image sent
+ * requests, acknowledges every image and preview packet and writes the images to a directory. It is
+ * meant as a peer for throughput tests without the Android app and as the executable description of
+ * the phone side of the protocol.
+ *
+ * The receiver talks to a serial device, so it runs over RFCOMM on Linux after binding the camera
+ * with `rfcomm bind` (or `rfcomm listen` when the camera connects to the host), or over a pseudo
+ * terminal with --pty for a simulated camera.
+ *
+ * Build on the host from the sketch folder, the frame parser and the LZSS code are shared with the
+ * firmware:
+ *   g++ -std=c++17 -O2 -I. extras/reference_receiver/reference_receiver.cpp bt_frame.cpp compression.cpp -o receiver
+ *
+ * Usage:
+ *   receiver [--pty | DEVICE] [-o DIRECTORY] [--caps MASK] [--config BLOB_FILE] [--record FILE]
+ *
+ * --record appends every response frame to FILE, which is then the session as the camera received
+ * it and can be replayed through the camera's response handlers with extras/fuzz/replay.
+ */
+
+#include "bt_frame.h"
+#include "bt_protocol.h"
+#include "compression.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define PAYLOAD_SPACE (BT_MAX_FRAME_LENGTH - BT_FRAME_PREAMBLE_SIZE)
+
+// send_data numbers the packets of OTHER_DATA from 255 on
+#define OTHER_DATA_FIRST_PACKET 255
+
+typedef struct {
+    int fd;
+    std::string directory;
+    uint8_t capabilities;              // offered by the receiver
+    uint8_t session_capabilities;      // agreed with the camera
+    std::vector<uint8_t> config_blob;
+    FILE * record;                     // responses sent, NULL if not recording
+
+    // image in transfer
+    uint32_t image_id;
+    uint32_t image_hash;
+    uint32_t image_size;
+    FILE * image_file;
+    FILE * preview_file;
+    uint32_t image_bytes;
+    struct timespec image_started;
+
+    // OTHER_DATA split over several packets
+    std::vector<uint8_t> other_data;
+    uint8_t other_category;
+    uint32_t other_count;
+}_receiver_t;
+
+/**
+ * Read exactly length bytes.
+ * @return: boolean, false at the end of the stream
+ */
+static bool _read_exact(int fd, uint8_t * buffer, size_t length) {
+    size_t done = 0;
+    while(done < length) {
+        ssize_t n = read(fd, buffer + done, length - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/**
+ * Send a response frame. The camera keeps one received chunk as one frame, so it goes in one write.
+ */
+static bool _send_response(_receiver_t * rx, uint8_t category, const void * payload, uint16_t length) {
+    uint8_t frame[BT_MAX_FRAME_LENGTH];
+    if(length > PAYLOAD_SPACE) {
+        return false;
+    }
+
+    frame[0] = BT_RESPONSE;
+    frame[1] = category;
+    frame[2] = (uint8_t)(length & 0xFF);
+    frame[3] = (uint8_t)((length >> 8) & 0xFF);
+    frame[4] = 1;
+    frame[5] = 0;
+    if(length > 0) {
+        memcpy(frame + BT_FRAME_PREAMBLE_SIZE, payload, length);
+    }
+
+    size_t total = BT_FRAME_PREAMBLE_SIZE + length;
+    if(rx->record != NULL) {
+        fwrite(frame, 1, total, rx->record);
+        fflush(rx->record);
+    }
+    return write(rx->fd, frame, total) == (ssize_t)total;
+}
+
+static bool _send_text(_receiver_t * rx, uint8_t category, const char * text) {
+    return _send_response(rx, category, text, (uint16_t)strlen(text));
+}
+
+static uint32_t _get_uint32(const uint8_t * data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * CRC-32 as computed by crc32_le of the ESP32 ROM with an initial value of 0.
+ */
+static uint32_t _crc32(uint32_t crc, const uint8_t * data, size_t length) {
+    crc = ~crc;
+    for(size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * Check if an image with this content id is already in the output directory.
+ */
+static bool _have_image(_receiver_t * rx, uint32_t id, uint32_t hash, uint32_t size) {
+    std::string path = rx->directory + "/" + std::to_string(id) + ".jpg";
+    FILE * file = fopen(path.c_str(), "rb");
+    if(file == NULL) {
+        return false;
+    }
+
+    std::vector<uint8_t> content;
+    uint8_t chunk[4096];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        content.insert(content.end(), chunk, chunk + n);
+    }
+    fclose(file);
+
+    if(content.size() != size) {
+        return false;
+    }
+    return hash == 0 || _crc32(0, content.data(), content.size()) == hash;
+}
+
+static double _elapsed_seconds(const struct timespec * since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void _close_transfer(_receiver_t * rx) {
+    if(rx->image_file != NULL) {
+        fclose(rx->image_file);
+        rx->image_file = NULL;
+    }
+    if(rx->preview_file != NULL) {
+        fclose(rx->preview_file);
+        rx->preview_file = NULL;
+    }
+}
+
+static void _handle_request(_receiver_t * rx, const _bt_frame_t * frame) {
+    switch(frame->category) {
+        case TIME_REQUEST: {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            uint64_t millis = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            uint8_t payload[8];
+            for(int i = 0; i < 8; ++i) {
+                payload[i] = (uint8_t)((millis >> (8 * i)) & 0xFF);
+            }
+            _send_response(rx, RESPONSE_FOR_TIME_REQUEST, payload, sizeof(payload));
+            printf("time request, sent %llu\n", (unsigned long long)millis);
+            break;
+        }
+
+        case CAPABILITY_REQUEST: {
+            uint8_t camera = frame->payload_length > 0 ? frame->payload[0] : 0;
+            rx->session_capabilities = camera & rx->capabilities;
+            _send_response(rx, RESPONSE_FOR_CAPABILITY_REQUEST, &rx->session_capabilities, 1);
+            printf("capabilities camera 0x%02X, session 0x%02X\n", camera, rx->session_capabilities);
+            break;
+        }
+
+        case CONFIG_REQUEST:
+            // an empty response keeps the configuration of the camera
+            _send_response(rx, RESPONSE_FOR_CONFIG_REQUEST, rx->config_blob.data(), (uint16_t)rx->config_blob.size());
+            printf("config request, sent %zu bytes\n", rx->config_blob.size());
+            break;
+
+        case IMAGE_INCOMING_REQUEST:
+            _close_transfer(rx);
+            rx->image_id = 0;
+            rx->image_hash = 0;
+            rx->image_size = 0;
+            if((rx->session_capabilities & BT_CAPABILITY_CONTENT_ID) && frame->payload_length >= BT_CONTENT_ID_SIZE) {
+                rx->image_id = _get_uint32(frame->payload);
+                rx->image_hash = _get_uint32(frame->payload + 4);
+                rx->image_size = _get_uint32(frame->payload + 8);
+                if(_have_image(rx, rx->image_id, rx->image_hash, rx->image_size)) {
+                    _send_text(rx, RESPONSE_FOR_IMAGE_INCOMING_REQUEST, _image_received_response);
+                    printf("image %u already received\n", rx->image_id);
+                    break;
+                }
+            }
+            _send_text(rx, RESPONSE_FOR_IMAGE_INCOMING_REQUEST, _ok_response);
+            printf("image incoming, id %u, %u bytes\n", rx->image_id, rx->image_size);
+            break;
+
+        case ARE_YOU_READY_REQUEST: {
+            std::string part = rx->directory + "/incoming.part";
+            rx->image_file = fopen(part.c_str(), "wb");
+            rx->image_bytes = 0;
+            clock_gettime(CLOCK_MONOTONIC, &rx->image_started);
+            _send_text(rx, RESPONSE_FOR_ARE_YOU_READY_REQUEST, _am_ready_response);
+            break;
+        }
+
+        case IMAGE_SENT_REQUEST: {
+            // the payload is the SD card path of the image, "/<id>.jpg"
+            std::string path((const char *)frame->payload, frame->payload_length);
+            size_t slash = path.find_last_of('/');
+            std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+            if(name.empty() || name.find("..") != std::string::npos) {
+                name = std::to_string(rx->image_id) + ".jpg";
+            }
+
+            double seconds = _elapsed_seconds(&rx->image_started);
+            _close_transfer(rx);
+            std::string part = rx->directory + "/incoming.part";
+            std::string final_path = rx->directory + "/" + name;
+            rename(part.c_str(), final_path.c_str());
+            _send_text(rx, RESPONSE_FOR_IMAGE_SENT_REQUEST, _ok_response);
+            printf("image %s, %u bytes in %.2f s, %.0f bytes/s\n", final_path.c_str(), rx->image_bytes, seconds,
+                seconds > 0 ? rx->image_bytes / seconds : 0.0);
+            break;
+        }
+
+        default:
+            fprintf(stderr, "unknown request 0x%02X\n", frame->category);
+            break;
+    }
+}
+
+/**
+ * Store a complete OTHER_DATA message, metrics and resource snapshots among them.
+ */
+static void _store_other_data(_receiver_t * rx) {
+    std::vector<uint8_t> data = rx->other_data;
+    if(rx->other_category == OTHER_DATA_LZSS) {
+        uint8_t output[UINT16_MAX];
+        size_t length = lzss_decompress(data.data(), data.size(), output, sizeof(output));
+        if(length == 0) {
+            fprintf(stderr, "malformed compressed data of %zu bytes\n", data.size());
+            return;
+        }
+        data.assign(output, output + length);
+    }
+
+    std::string path = rx->directory + "/other_" + std::to_string(rx->other_count++) + ".bin";
+    FILE * file = fopen(path.c_str(), "wb");
+    if(file != NULL) {
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+    }
+    printf("other data %s, %zu bytes, magic 0x%02X\n", path.c_str(), data.size(), data.empty() ? 0 : data[0]);
+    rx->other_data.clear();
+}
+
+static void _handle_data(_receiver_t * rx, const _bt_frame_t * frame) {
+    switch(frame->category) {
+        case IMAGE_DATA:
+            if(rx->image_file != NULL) {
+                fwrite(frame->payload, 1, frame->payload_length, rx->image_file);
+            }
+            rx->image_bytes += frame->payload_length;
+            _send_text(rx, RESPONSE_FOR_IMAGE_DATA, _ok_response);
+            break;
+
+        case IMAGE_PREVIEW_DATA:
+            if(rx->preview_file == NULL && frame->packet_number == 1) {
+                std::string path = rx->directory + "/" + std::to_string(rx->image_id) + ".prv.jpg";
+                rx->preview_file = fopen(path.c_str(), "wb");
+            }
+            if(rx->preview_file != NULL) {
+                fwrite(frame->payload, 1, frame->payload_length, rx->preview_file);
+            }
+            _send_text(rx, RESPONSE_FOR_IMAGE_PREVIEW_DATA, _ok_response);
+            break;
+
+        case OTHER_DATA:
+        case OTHER_DATA_LZSS:
+            // a message of more than one packet is sent without waiting for responses, only a single
+            // packet message waits for one. A full first packet can not be told apart from a single
+            // packet of exactly PAYLOAD_SPACE bytes, the camera then times out waiting.
+            if(frame->packet_number == OTHER_DATA_FIRST_PACKET) {
+                rx->other_data.clear();
+                rx->other_category = frame->category;
+            }
+            rx->other_data.insert(rx->other_data.end(), frame->payload, frame->payload + frame->payload_length);
+            if(frame->payload_length < PAYLOAD_SPACE) {
+                if(frame->packet_number == OTHER_DATA_FIRST_PACKET) {
+                    _send_text(rx, RESPONSE_FOR_OTHER_DATA, _ok_response);
+                }
+                _store_other_data(rx);
+            }
+            break;
+
+        default:
+            fprintf(stderr, "unknown data type 0x%02X\n", frame->category);
+            break;
+    }
+}
+
+/**
+ * Open a pseudo terminal for a simulated camera and print the name of its device.
+ */
+static int _open_pty() {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    printf("camera side: %s\n", ptsname(fd));
+    fflush(stdout);
+    return fd;
+}
+
+/**
+ * Open a serial device, /dev/rfcomm0 for example, in raw mode.
+ */
+static int _open_device(const char * path) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct termios tty;
+    if(tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    return fd;
+}
+
+static bool _load_file(const char * path, std::vector<uint8_t> * content) {
+    FILE * file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return false;
+    }
+    uint8_t chunk[256];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        content->insert(content->end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    _receiver_t rx = {};
+    rx.directory = ".";
+    rx.capabilities = BT_CAMERA_CAPABILITIES;
+    rx.fd = -1;
+
+    const char * device = NULL;
+    bool pty = false;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--pty") == 0) {
+            pty = true;
+        } else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            rx.directory = argv[++i];
+        } else if(strcmp(argv[i], "--caps") == 0 && i + 1 < argc) {
+            rx.capabilities = (uint8_t)strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            if(!_load_file(argv[++i], &rx.config_blob)) {
+                return 1;
+            }
+        } else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            rx.record = fopen(argv[++i], "ab");
+            if(rx.record == NULL) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else if(argv[i][0] != '-') {
+            device = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--pty | DEVICE] [-o DIRECTORY] [--caps MASK] [--config BLOB_FILE] "
+                "[--record FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    mkdir(rx.directory.c_str(), 0755);
+    if(pty) {
+        rx.fd = _open_pty();
+    } else if(device != NULL) {
+        rx.fd = _open_device(device);
+    } else {
+        fprintf(stderr, "no device given\n");
+        return 1;
+    }
+    if(rx.fd < 0) {
+        return 1;
+    }
+
+    // frames arrive as a byte stream, read the preamble and then the declared payload
+    uint8_t buffer[BT_MAX_FRAME_LENGTH];
+    while(_read_exact(rx.fd, buffer, BT_FRAME_PREAMBLE_SIZE)) {
+        uint16_t payload_length = buffer[2] | (buffer[3] << 8);
+        if(payload_length > PAYLOAD_SPACE) {
+            fprintf(stderr, "frame too long, %u bytes, dropping the connection\n", payload_length);
+            break;
+        }
+        if(!_read_exact(rx.fd, buffer + BT_FRAME_PREAMBLE_SIZE, payload_length)) {
+            break;
+        }
+
+        _bt_frame_t frame;
+        _bt_frame_status_t parsed = bt_frame_parse(buffer, BT_FRAME_PREAMBLE_SIZE + payload_length, &frame);
+        if(parsed != BT_FRAME_OK) {
+            fprintf(stderr, "malformed frame, %s\n", bt_frame_status_name(parsed));
+            continue;
+        }
+
+        if(frame.comm_type == BT_REQUEST) {
+            _handle_request(&rx, &frame);
+        } else if(frame.comm_type == BT_DATA) {
+            _handle_data(&rx, &frame);
+        } else {
+            fprintf(stderr, "unexpected comm type 0x%02X\n", frame.comm_type);
+        }
+        fflush(stdout);
+    }
+
+    _close_transfer(&rx);
+    if(rx.record != NULL) {
+        fclose(rx.record);
+    }
+    close(rx.fd);
+    return 0;
+}
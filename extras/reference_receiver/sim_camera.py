@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+Scripted camera for the reference receiver. It starts the receiver on a pseudo terminal and plays one
+session the way the firmware does: capability negotiation, time and config requests, an image upload
+announced by its content id, the same image again (the receiver must answer "image received") and a
+metrics snapshot as OTHER_DATA. Every response is checked, the exit status is 0 if the session passed.
+
+The protocol values are read from bt_protocol.h, so the script follows the firmware without a copy.
+Run it from the sketch folder after building the receiver:
+  g++ -std=c++17 -O2 -I. extras/reference_receiver/reference_receiver.cpp bt_frame.cpp compression.cpp -o receiver
+  python3 extras/reference_receiver/sim_camera.py --receiver ./receiver -o /tmp/received --record session.bin
+
+The recorded session can then be replayed through the camera's response handlers with extras/fuzz/replay.
+"""
+
+import argparse
+import os
+import re
+import struct
+import subprocess
+import sys
+import tty
+import zlib
+
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'bt_protocol.h')
+PREAMBLE_SIZE = 6           # BT_FRAME_PREAMBLE_SIZE of bt_frame.h
+OTHER_DATA_FIRST_PACKET = 255
+
+
+def load_protocol(path):
+    """Read the enum values, the numeric defines and the request and response strings of bt_protocol.h."""
+    text = open(path).read()
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    text = re.sub(r'//[^\n]*', '', text)
+    values = {}
+    for body in re.findall(r'typedef enum\s*{(.*?)}', text, flags=re.S):
+        for name, value in re.findall(r'(\w+)\s*=\s*(\w+)', body):
+            values[name] = int(value, 0)
+    for name, expression in re.findall(r'#define[ \t]+(\w+)[ \t]+([^\n]+)', text):
+        try:
+            values[name] = eval(expression, {}, dict(values))
+        except (NameError, SyntaxError):
+            pass
+    strings = dict(re.findall(r'static const char \* const (\w+) = "([^"]*)";', text))
+    return values, strings
+
+
+class Camera:
+    def __init__(self, fd, protocol, strings):
+        self.fd = fd
+        self.p = protocol
+        self.s = strings
+
+    def send(self, comm_type, category, payload, packet_number=1):
+        frame = bytes([comm_type, category]) + struct.pack('<HH', len(payload), packet_number) + payload
+        os.write(self.fd, frame)
+
+    def read_exact(self, length):
+        data = b''
+        while len(data) < length:
+            chunk = os.read(self.fd, length - len(data))
+            if not chunk:
+                raise EOFError('receiver closed the connection')
+            data += chunk
+        return data
+
+    def response(self, category):
+        header = self.read_exact(PREAMBLE_SIZE)
+        payload = self.read_exact(header[2] | (header[3] << 8))
+        if header[0] != self.p['BT_RESPONSE'] or header[1] != category:
+            raise AssertionError('expected response 0x%02X, got 0x%02X/0x%02X' % (category, header[0], header[1]))
+        return payload
+
+    def request(self, name, payload):
+        self.send(self.p['BT_REQUEST'], self.p[name], payload)
+        return self.response(self.p['RESPONSE_FOR_' + name])
+
+    def expect_text(self, payload, string_name):
+        if payload != self.s[string_name].encode():
+            raise AssertionError('expected "%s", got %r' % (self.s[string_name], payload))
+
+
+def run_session(camera, directory):
+    p = camera.p
+
+    session = camera.request('CAPABILITY_REQUEST', bytes([p['BT_CAMERA_CAPABILITIES']]))
+    if len(session) != p['BT_CAPABILITY_RESPONSE_SIZE']:
+        raise AssertionError('capability response of %d bytes' % len(session))
+    capabilities = session[0]
+    print('capabilities 0x%02X' % capabilities)
+
+    millis = camera.request('TIME_REQUEST', camera.s['_time_request'].encode())
+    if len(millis) != p['BT_TIME_RESPONSE_SIZE']:
+        raise AssertionError('time response of %d bytes' % len(millis))
+    print('time %d ms' % struct.unpack('<Q', millis)[0])
+
+    blob = camera.request('CONFIG_REQUEST', camera.s['_config_request'].encode())
+    print('config blob of %d bytes%s' % (len(blob), ', version %d' % blob[0] if blob else ''))
+
+    image = os.urandom(3000)
+    image_id = 1760780000
+    content_id = struct.pack('<III', image_id, zlib.crc32(image), len(image))
+    assert len(content_id) == p['BT_CONTENT_ID_SIZE']
+    announce = content_id if capabilities & p['BT_CAPABILITY_CONTENT_ID'] else camera.s['_image_request'].encode()
+    camera.expect_text(camera.request('IMAGE_INCOMING_REQUEST', announce), '_ok_response')
+    camera.expect_text(camera.request('ARE_YOU_READY_REQUEST', camera.s['_u_ready_request'].encode()),
+                       '_am_ready_response')
+
+    payload_space = p['BT_MAX_FRAME_LENGTH'] - PREAMBLE_SIZE
+    for packet, offset in enumerate(range(0, len(image), payload_space), 1):
+        camera.send(p['BT_DATA'], p['IMAGE_DATA'], image[offset:offset + payload_space], packet)
+        camera.expect_text(camera.response(p['RESPONSE_FOR_IMAGE_DATA']), '_ok_response')
+    path = '/%d.jpg' % image_id
+    camera.expect_text(camera.request('IMAGE_SENT_REQUEST', path.encode()), '_ok_response')
+    with open(os.path.join(directory, path.lstrip('/')), 'rb') as received:
+        if received.read() != image:
+            raise AssertionError('received image differs')
+    print('image %s, %d bytes' % (path, len(image)))
+
+    if capabilities & p['BT_CAPABILITY_CONTENT_ID']:
+        camera.expect_text(camera.request('IMAGE_INCOMING_REQUEST', content_id), '_image_received_response')
+        print('duplicate image recognized')
+
+    # metrics snapshot of metrics.h, version 2 with zero counters
+    snapshot = bytes([0x4D, 0x02]) + bytes(10 * 4 + 3 * 12 * 2)
+    camera.send(p['BT_DATA'], p['OTHER_DATA'], snapshot, OTHER_DATA_FIRST_PACKET)
+    camera.expect_text(camera.response(p['RESPONSE_FOR_OTHER_DATA']), '_ok_response')
+    print('metrics snapshot, %d bytes' % len(snapshot))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='scripted camera session against the reference receiver')
+    parser.add_argument('--receiver', default='./receiver', help='receiver executable')
+    parser.add_argument('-o', dest='directory', default='received', help='receiver output directory')
+    parser.add_argument('--config', help='configuration blob file the receiver sends')
+    parser.add_argument('--record', help='file the receiver records its responses to')
+    args = parser.parse_args()
+
+    protocol, strings = load_protocol(HEADER)
+    os.makedirs(args.directory, exist_ok=True)
+    command = [args.receiver, '--pty', '-o', args.directory]
+    if args.config:
+        command += ['--config', args.config]
+    if args.record:
+        command += ['--record', args.record]
+
+    receiver = subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+    line = receiver.stdout.readline()
+    if not line.startswith('camera side: '):
+        print('receiver did not open a pseudo terminal', file=sys.stderr)
+        return 1
+    fd = os.open(line.split(': ', 1)[1].strip(), os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+
+    status = 0
+    try:
+        run_session(Camera(fd, protocol, strings), args.directory)
+        print('session passed')
+    except (AssertionError, EOFError, OSError) as error:
+        print('session failed: %s' % error, file=sys.stderr)
+        status = 1
+    finally:
+        os.close(fd)
+        receiver.terminate()
+        output, _ = receiver.communicate()
+        sys.stdout.write(output)
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
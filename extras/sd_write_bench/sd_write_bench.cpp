@@ -0,0 +1,121 @@
+/**
+ * Host benchmark of the SD write strategies of sd_writer.cpp. Every round writes one file per strategy
+ * into DIR with the same code path as sd_write_buffer, syncs it so the time includes the block device,
+ * and deletes it again. The strategies run interleaved so they see the same state of the file system.
+ *
+ * To get the allocation behaviour of the camera, run it on a FAT file system in a file-backed image:
+ *   truncate -s 256M sd.img && mkfs.vfat -F 32 sd.img
+ *   mkdir -p sd && sudo mount -o loop,uid=$(id -u) sd.img sd
+ *   g++ -std=c++17 -O2 -Wall -Wextra -I. extras/sd_write_bench/sd_write_bench.cpp sd_writer.cpp -o sd_write_bench
+ *   ./sd_write_bench sd 98304 200
+ *
+ * Usage:
+ *   sd_write_bench DIR [FILE_SIZE] [ROUNDS]
+ */
+
+#include "sd_writer.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define BENCH_DEFAULT_FILE_SIZE (96 * 1024)   // a UXGA JPEG at the default quality
+#define BENCH_DEFAULT_ROUNDS 100
+
+typedef struct {
+    const char * name;
+    _sd_write_strategy_t strategy;
+    double total_us;
+    double min_us;
+    double max_us;
+    uint32_t chunks;
+    uint32_t preallocated;
+}_bench_case_t;
+
+static double _now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static bool _write_file(const char * path, const std::vector<uint8_t> & data, _bench_case_t * bench) {
+    double started = _now_us();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        perror(path);
+        return false;
+    }
+    _sd_writer_result_t result;
+    bool ok = sd_writer_write(fd, data.data(), data.size(), &bench->strategy, &result);
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    double elapsed = _now_us() - started;
+    unlink(path);
+    if(!ok) {
+        fprintf(stderr, "%s: write failed at offset %zu\n", bench->name, result.failed_offset);
+        return false;
+    }
+
+    bench->total_us += elapsed;
+    bench->min_us = bench->min_us == 0 || elapsed < bench->min_us ? elapsed : bench->min_us;
+    bench->max_us = elapsed > bench->max_us ? elapsed : bench->max_us;
+    bench->chunks = result.chunks;
+    bench->preallocated += result.preallocated ? 1 : 0;
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s DIR [FILE_SIZE] [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+    const char * dir = argv[1];
+    size_t file_size = argc > 2 ? strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_FILE_SIZE;
+    unsigned rounds = argc > 3 ? strtoul(argv[3], NULL, 0) : BENCH_DEFAULT_ROUNDS;
+    if(file_size == 0 || rounds == 0) {
+        fprintf(stderr, "FILE_SIZE and ROUNDS must be positive\n");
+        return 1;
+    }
+
+    std::vector<uint8_t> data(file_size);
+    uint32_t seed = 0x2545F491;
+    for(size_t i = 0; i < data.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    static uint8_t bounce[SD_WRITE_CHUNK_SIZE];
+
+    // the first case is the single file.write of the old save_image_to_sd_card, the last one sd_write_buffer
+    _bench_case_t benches[] = {
+        { "single write", { 0, false, NULL, 0 }, 0, 0, 0, 0, 0 },
+        { "8 KB chunks", { SD_WRITE_CHUNK_SIZE, false, bounce, sizeof(bounce) }, 0, 0, 0, 0, 0 },
+        { "preallocated single write", { 0, true, NULL, 0 }, 0, 0, 0, 0, 0 },
+        { "preallocated 8 KB chunks", sd_writer_default_strategy(bounce, sizeof(bounce)), 0, 0, 0, 0, 0 },
+    };
+    const size_t bench_count = sizeof(benches) / sizeof(benches[0]);
+
+    char path[512];
+    for(unsigned round = 0; round < rounds; round++) {
+        for(size_t i = 0; i < bench_count; i++) {
+            snprintf(path, sizeof(path), "%s/bench_%u_%zu.jpg", dir, round, i);
+            if(!_write_file(path, data, &benches[i])) {
+                return 1;
+            }
+        }
+    }
+
+    printf("%zu bytes, %u files per strategy in %s\n", file_size, rounds, dir);
+    printf("%-28s %8s %12s %10s %10s %10s\n", "strategy", "chunks", "preallocated", "MB/s", "min ms", "max ms");
+    for(size_t i = 0; i < bench_count; i++) {
+        const _bench_case_t * bench = &benches[i];
+        // bytes per microsecond is MB/s
+        printf("%-28s %8u %8u/%-3u %10.2f %10.3f %10.3f\n", bench->name, bench->chunks, bench->preallocated, rounds,
+            (double)file_size * rounds / bench->total_us, bench->min_us / 1e3, bench->max_us / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,660 @@
+#include "image_index.h"
+#include "utils.h"
+
+// live images, everything not yet in the IMAGE_REMOVED state
+static _image_index_entry_t _entries[IMAGE_INDEX_MAX_ENTRIES];
+static uint16_t _entry_count = 0;
+
+// number of records in the index file, used to decide when to compact it
+static uint32_t _record_count = 0;
+
+// largest image id seen, new ids are kept above it so the ids stay unique and ordered by age
+static uint32_t _max_id = 0;
+
+// magic of the records in the index file, older firmware used other layouts until it is rewritten
+static uint8_t _record_magic = IMAGE_INDEX_RECORD_MAGIC;
+
+static _image_upload_policy_t _upload_policy = IMAGE_UPLOAD_POLICY;
+
+#define IMAGE_INDEX_ABORT_MAGIC 0x41425431   // 'ABT1'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t ids[IMAGE_INDEX_ABORT_SLOTS];
+    uint8_t counts[IMAGE_INDEX_ABORT_SLOTS];
+}_image_aborts_t;
+
+// uploads cut off by the upload deadline, kept across deep sleep and cleared by a power-on reset
+RTC_DATA_ATTR static _image_aborts_t _aborts;
+
+/**
+ * Get the SD card path of a committed image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ */
+void image_index_image_path(uint32_t id, char * buffer, size_t length) {
+  snprintf(buffer, length, "/%u.jpg", id);
+}
+
+/**
+ * Get the SD card path of the temporary file of an image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ */
+void image_index_temp_path(uint32_t id, char * buffer, size_t length) {
+  snprintf(buffer, length, "/%u.tmp", id);
+}
+
+/**
+ * Get the SD card path of the preview of an image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ * @param: boolean, true for the temporary file the preview is written to
+ */
+void image_index_preview_path(uint32_t id, char * buffer, size_t length, bool temporary) {
+  snprintf(buffer, length, temporary ? "/%u.pvt" : "/%u.prv", id);
+}
+
+/**
+ * Delete the preview files of an image, if any.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @return: uint32_t bytes deleted
+ */
+uint32_t image_index_remove_preview(fs::FS &fs, uint32_t id) {
+  char path[24];
+  uint32_t removed = 0;
+  for(int temporary = 0; temporary < 2; ++temporary) {
+    image_index_preview_path(id, path, sizeof(path), temporary);
+    if(!fs.exists(path)) {
+      continue;
+    }
+    File preview = fs.open(path, FILE_READ);
+    if(!preview) {
+      continue;
+    }
+    uint32_t size = preview.size();
+    preview.close();
+    if(fs.remove(path)) {
+      removed += size;
+    }
+  }
+  return removed;
+}
+
+/**
+ * Size of the records in the index file, the legacy layout until an old index has been rewritten.
+ */
+static size_t _record_size() {
+  return _record_magic == IMAGE_INDEX_LEGACY_RECORD_MAGIC ? IMAGE_INDEX_LEGACY_RECORD_SIZE : IMAGE_INDEX_RECORD_SIZE;
+}
+
+/**
+ * Fletcher-16 checksum over the record, skipping the checksum bytes.
+ */
+static uint16_t _record_checksum(const uint8_t * record) {
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+  for(size_t i = 0; i < _record_size(); ++i) {
+    if(i == 2 || i == 3) {
+      continue;
+    }
+    sum1 = (sum1 + record[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+/**
+ * Serialize one index record.
+ */
+static void _encode_record(uint8_t * record, uint32_t id, uint8_t state, uint32_t size, uint32_t hash,
+  uint8_t priority) {
+  record[0] = _record_magic;
+  record[1] = _record_magic == IMAGE_INDEX_LEGACY_RECORD_MAGIC ? state : (state | (priority << 4));
+  for(int i = 0; i < 4; ++i) {
+    record[4 + i] = (uint8_t)((id >> (8 * i)) & 0xFF);
+    record[8 + i] = (uint8_t)((size >> (8 * i)) & 0xFF);
+    if(_record_magic != IMAGE_INDEX_LEGACY_RECORD_MAGIC) {
+      record[12 + i] = (uint8_t)((hash >> (8 * i)) & 0xFF);
+    }
+  }
+
+  uint16_t checksum = _record_checksum(record);
+  record[2] = (uint8_t)(checksum & 0xFF);
+  record[3] = (uint8_t)((checksum >> 8) & 0xFF);
+}
+
+/**
+ * Parse one index record.
+ * @return: boolean, false for a torn or corrupt record
+ */
+static bool _decode_record(const uint8_t * record, uint32_t * id, uint8_t * state, uint32_t * size, uint32_t * hash,
+  uint8_t * priority) {
+  uint16_t checksum = record[2] | (record[3] << 8);
+  if(record[0] != _record_magic || checksum != _record_checksum(record)) {
+    return false;
+  }
+
+  // legacy records have no priority class, in hash records a 0 may be a missing class
+  *state = record[1] & 0x0F;
+  *priority = record[1] >> 4;
+  if(_record_magic == IMAGE_INDEX_LEGACY_RECORD_MAGIC ||
+    (_record_magic == IMAGE_INDEX_HASH_RECORD_MAGIC && *priority == IMAGE_PRIORITY_LOW)) {
+    *priority = IMAGE_PRIORITY_NORMAL;
+  }
+  *id = 0;
+  *size = 0;
+  *hash = 0;
+  for(int i = 0; i < 4; ++i) {
+    *id |= (uint32_t)record[4 + i] << (8 * i);
+    *size |= (uint32_t)record[8 + i] << (8 * i);
+    if(_record_magic != IMAGE_INDEX_LEGACY_RECORD_MAGIC) {
+      *hash |= (uint32_t)record[12 + i] << (8 * i);
+    }
+  }
+  return (*state >= IMAGE_PENDING && *state <= IMAGE_REMOVED);
+}
+
+/**
+ * Find the entry of an image.
+ * @return: int index in the entry table, -1 if not found
+ */
+static int _find_entry(uint32_t id) {
+  for(int i = 0; i < _entry_count; ++i) {
+    if(_entries[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Priority class of an image, every record of an image repeats the class of its first record.
+ */
+static uint8_t _priority_of(uint32_t id) {
+  int position = _find_entry(id);
+  return position >= 0 ? _entries[position].priority : IMAGE_PRIORITY_NORMAL;
+}
+
+/**
+ * Whether the upload deadline cut off enough uploads of an image to send it after all others.
+ */
+static bool _upload_demoted(uint32_t id) {
+  if(_aborts.magic != IMAGE_INDEX_ABORT_MAGIC) {
+    return false;
+  }
+  for(int i = 0; i < IMAGE_INDEX_ABORT_SLOTS; ++i) {
+    if(_aborts.ids[i] == id && _aborts.counts[i] != 0) {
+      return _aborts.counts[i] >= IMAGE_UPLOAD_MAX_ABORTS;
+    }
+  }
+  return false;
+}
+
+/**
+ * Whether an image is uploaded before another one.
+ */
+static bool _upload_before(const _image_index_entry_t * a, const _image_index_entry_t * b) {
+  bool a_demoted = _upload_demoted(a->id);
+  if(a_demoted != _upload_demoted(b->id)) {
+    return !a_demoted;
+  }
+  if(a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  return _upload_policy == IMAGE_UPLOAD_NEWEST_FIRST ? a->id > b->id : a->id < b->id;
+}
+
+/**
+ * Apply a state change to the in memory table.
+ */
+static bool _apply(uint32_t id, uint8_t state, uint32_t size, uint32_t hash, uint8_t priority) {
+  int position = _find_entry(id);
+
+  if(id > _max_id) {
+    _max_id = id;
+  }
+
+  if(state == IMAGE_REMOVED) {
+    if(position >= 0) {
+      _entries[position] = _entries[_entry_count - 1];
+      _entry_count--;
+    }
+    return true;
+  }
+
+  if(position < 0) {
+    if(_entry_count == IMAGE_INDEX_MAX_ENTRIES) {
+      Serial.println("image_index: index full");
+      return false;
+    }
+    position = _entry_count++;
+    _entries[position].id = id;
+    _entries[position].size = 0;
+    _entries[position].hash = 0;
+  }
+
+  _entries[position].state = state;
+  _entries[position].priority = priority;
+  if(size != 0) {
+    _entries[position].size = size;
+  }
+  if(hash != 0) {
+    _entries[position].hash = hash;
+  }
+  return true;
+}
+
+/**
+ * Append a record to the index file and apply it to the table.
+ */
+static bool _append_record(fs::FS &fs, uint32_t id, uint8_t state, uint32_t size, uint32_t hash,
+  uint8_t priority) {
+  uint8_t record[IMAGE_INDEX_RECORD_SIZE];
+  _encode_record(record, id, state, size, hash, priority);
+
+  File index_file = fs.open(IMAGE_INDEX_PATH, FILE_APPEND);
+  if(!index_file) {
+    Serial.println("image_index: failed to open index");
+    return false;
+  }
+
+  size_t written = index_file.write(record, _record_size());
+  index_file.close();
+  if(written != _record_size()) {
+    Serial.println("image_index: failed to append record");
+    return false;
+  }
+
+  _record_count++;
+  return _apply(id, state, size, hash, priority);
+}
+
+/**
+ * Rewrite the index with one record per live image. The new index is written next to the old one and
+ * renamed over it, image_index_init picks up either file if power is lost in between.
+ */
+static bool _compact(fs::FS &fs) {
+  File compact_file = fs.open(IMAGE_INDEX_COMPACT_PATH, FILE_WRITE);
+  if(!compact_file) {
+    Serial.println("image_index: failed to create compacted index");
+    return false;
+  }
+
+  uint8_t record[IMAGE_INDEX_RECORD_SIZE];
+  for(int i = 0; i < _entry_count; ++i) {
+    _encode_record(record, _entries[i].id, _entries[i].state, _entries[i].size, _entries[i].hash,
+      _entries[i].priority);
+    if(compact_file.write(record, _record_size()) != _record_size()) {
+      Serial.println("image_index: failed to write compacted index");
+      compact_file.close();
+      fs.remove(IMAGE_INDEX_COMPACT_PATH);
+      return false;
+    }
+  }
+  compact_file.close();
+
+  // FAT rename does not replace an existing file
+  fs.remove(IMAGE_INDEX_PATH);
+  if(!fs.rename(IMAGE_INDEX_COMPACT_PATH, IMAGE_INDEX_PATH)) {
+    Serial.println("image_index: failed to rename compacted index");
+    return false;
+  }
+
+  _record_count = _entry_count;
+  LOG_I(LOG_MODULE_SD, "image_index: compacted to %d records", _entry_count);
+  return true;
+}
+
+/**
+ * Parse the image id from a file name like "/1650000000.jpg".
+ * @return: boolean, true if the name is an image or temporary file
+ */
+static bool _parse_file_name(const char * name, uint32_t * id, bool * temporary) {
+  if(name[0] == '/') {
+    name++;
+  }
+
+  char * end = NULL;
+  unsigned long value = strtoul(name, &end, 10);
+  if(end == name) {
+    return false;
+  }
+
+  if(strcmp(end, ".jpg") == 0) {
+    *temporary = false;
+  } else if(strcmp(end, ".tmp") == 0) {
+    *temporary = true;
+  } else {
+    return false;
+  }
+  *id = (uint32_t)value;
+  return true;
+}
+
+/**
+ * Build the index from the files in the root directory. Only needed when there is no index file.
+ */
+static bool _rebuild_from_directory(fs::FS &fs) {
+  Serial.println("image_index: no index, scanning the SD card");
+
+  File root = fs.open("/");
+  if(!root || !root.isDirectory()) {
+    Serial.println("image_index: failed to open the root directory");
+    return false;
+  }
+
+  char path[24];
+  File file = root.openNextFile();
+  while(file) {
+    uint32_t id;
+    bool temporary;
+    if(!file.isDirectory() && _parse_file_name(file.name(), &id, &temporary)) {
+      if(temporary) {
+        // an image that was never completed
+        image_index_temp_path(id, path, sizeof(path));
+        file.close();
+        fs.remove(path);
+      } else if(file.size() > 0) {
+        _apply(id, IMAGE_COMMITTED, file.size(), 0, IMAGE_PRIORITY_NORMAL);
+      }
+    }
+    file = root.openNextFile();
+  }
+  root.close();
+
+  return _compact(fs);
+}
+
+/**
+ * Load the index from the SD card and finish or roll back the operations interrupted by a power loss.
+ * @param: FS object
+ * @return: boolean
+ */
+bool image_index_init(fs::FS &fs) {
+  _entry_count = 0;
+  _record_count = 0;
+  _max_id = 0;
+  _record_magic = IMAGE_INDEX_RECORD_MAGIC;
+
+  // a compaction was interrupted, the compacted file is complete only if the old index is gone
+  if(fs.exists(IMAGE_INDEX_COMPACT_PATH)) {
+    if(fs.exists(IMAGE_INDEX_PATH)) {
+      fs.remove(IMAGE_INDEX_COMPACT_PATH);
+    } else {
+      fs.rename(IMAGE_INDEX_COMPACT_PATH, IMAGE_INDEX_PATH);
+    }
+  }
+
+  if(!fs.exists(IMAGE_INDEX_PATH)) {
+    return _rebuild_from_directory(fs);
+  }
+
+  File index_file = fs.open(IMAGE_INDEX_PATH, FILE_READ);
+  if(!index_file) {
+    Serial.println("image_index_init: failed to open index");
+    return false;
+  }
+
+  // an index of older firmware is replayed in its own layout and rewritten below
+  int magic = index_file.peek();
+  if(magic == IMAGE_INDEX_LEGACY_RECORD_MAGIC || magic == IMAGE_INDEX_HASH_RECORD_MAGIC) {
+    _record_magic = (uint8_t)magic;
+  }
+
+  // replay the records, a torn record at the end is the append interrupted by the power loss
+  bool needs_compaction = false;
+  uint8_t record[IMAGE_INDEX_RECORD_SIZE];
+  while(index_file.read(record, _record_size()) == _record_size()) {
+    uint32_t id;
+    uint8_t state;
+    uint32_t size;
+    uint32_t hash;
+    uint8_t priority;
+    if(!_decode_record(record, &id, &state, &size, &hash, &priority)) {
+      Serial.printf("image_index_init: corrupt record %d, dropping the rest\n", _record_count);
+      needs_compaction = true;
+      break;
+    }
+    _apply(id, state, size, hash, priority);
+    _record_count++;
+  }
+  index_file.close();
+
+  // finish or roll back the unfinished images, only the files named in the index are touched.
+  char path[24];
+  int i = 0;
+  while(i < _entry_count) {
+    _image_index_entry_t * entry = &_entries[i];
+
+    if(entry->state == IMAGE_PENDING) {
+      // the temporary file is closed before the rename, so an existing image is complete.
+      image_index_image_path(entry->id, path, sizeof(path));
+      File image = fs.open(path, FILE_READ);
+      if(image && image.size() > 0) {
+        entry->state = IMAGE_COMMITTED;
+        entry->size = image.size();
+        image.close();
+        Serial.printf("image_index_init: recovered image %u\n", entry->id);
+      } else {
+        if(image) {
+          image.close();
+        }
+        image_index_temp_path(entry->id, path, sizeof(path));
+        fs.remove(path);
+        image_index_remove_preview(fs, entry->id);
+        Serial.printf("image_index_init: dropped incomplete image %u\n", entry->id);
+        _apply(entry->id, IMAGE_REMOVED, 0, 0, entry->priority);
+        needs_compaction = true;
+        continue;
+      }
+      needs_compaction = true;
+    } else if(entry->state == IMAGE_UPLOADED) {
+      // the phone has the image, finish the delete
+      image_index_image_path(entry->id, path, sizeof(path));
+      fs.remove(path);
+      image_index_remove_preview(fs, entry->id);
+      _apply(entry->id, IMAGE_REMOVED, 0, 0, entry->priority);
+      needs_compaction = true;
+      continue;
+    }
+    i++;
+  }
+
+  // keep the index, and so the next startup, proportional to the number of live images
+  uint8_t magic_on_card = _record_magic;
+  _record_magic = IMAGE_INDEX_RECORD_MAGIC;
+  if(magic_on_card != IMAGE_INDEX_RECORD_MAGIC || needs_compaction ||
+    _record_count > 2 * (uint32_t)_entry_count + 64) {
+    if(!_compact(fs)) {
+      // the old index is still in place, keep appending in its layout
+      _record_magic = magic_on_card;
+    }
+  }
+
+  Serial.printf("image_index_init: %d images waiting for upload\n", image_index_pending_uploads());
+  return true;
+}
+
+/**
+ * Get an unused image id for a new image, the RTC epoch time unless it is already taken.
+ * @param: uint32_t preferred id
+ * @return: uint32_t
+ */
+uint32_t image_index_new_id(uint32_t preferred_id) {
+  if(preferred_id <= _max_id) {
+    return _max_id + 1;
+  }
+  return preferred_id;
+}
+
+/**
+ * Record that a new image is being written to its temporary file.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: _image_priority_t priority class of the image
+ * @return: boolean
+ */
+bool image_index_begin(fs::FS &fs, uint32_t id, _image_priority_t priority) {
+  return _append_record(fs, id, IMAGE_PENDING, 0, 0, priority);
+}
+
+/**
+ * Record that the image file is complete and renamed to its final name.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: uint32_t image size in bytes
+ * @param: uint32_t content hash, 0 if unknown
+ * @return: boolean
+ */
+bool image_index_commit(fs::FS &fs, uint32_t id, uint32_t size, uint32_t hash) {
+  return _append_record(fs, id, IMAGE_COMMITTED, size, hash, _priority_of(id));
+}
+
+/**
+ * Record that an image is no longer wanted, either uploaded or written incompletely.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: _image_state_t IMAGE_UPLOADED or IMAGE_REMOVED
+ * @return: boolean
+ */
+bool image_index_set_state(fs::FS &fs, uint32_t id, _image_state_t state) {
+  return _append_record(fs, id, state, 0, 0, _priority_of(id));
+}
+
+/**
+ * Get the committed image to upload next: the highest priority class first, and within a class the
+ * oldest or the newest image depending on the upload policy.
+ * @param: pointer to the entry to fill
+ * @return: boolean, false if there is no image to upload
+ */
+bool image_index_next(_image_index_entry_t * entry) {
+  int next = -1;
+  for(int i = 0; i < _entry_count; ++i) {
+    if(_entries[i].state != IMAGE_COMMITTED) {
+      continue;
+    }
+    if(next < 0 || _upload_before(&_entries[i], &_entries[next])) {
+      next = i;
+    }
+  }
+
+  if(next < 0) {
+    return false;
+  }
+  *entry = _entries[next];
+  return true;
+}
+
+/**
+ * Record that the upload deadline cut off the upload of an image. The count starts over after a
+ * power-on reset.
+ * @param: uint32_t image id
+ * @return: uint8_t cut off uploads of the image so far
+ */
+uint8_t image_index_upload_aborted(uint32_t id) {
+  if(_aborts.magic != IMAGE_INDEX_ABORT_MAGIC) {
+    memset(&_aborts, 0, sizeof(_aborts));
+    _aborts.magic = IMAGE_INDEX_ABORT_MAGIC;
+  }
+
+  // the slot of the image, else one of an image that is gone, else the one with the fewest aborts
+  int slot = -1;
+  for(int i = 0; i < IMAGE_INDEX_ABORT_SLOTS && slot < 0; ++i) {
+    if(_aborts.counts[i] != 0 && _aborts.ids[i] == id) {
+      slot = i;
+    }
+  }
+  for(int i = 0; i < IMAGE_INDEX_ABORT_SLOTS && slot < 0; ++i) {
+    if(_aborts.counts[i] == 0 || _find_entry(_aborts.ids[i]) < 0) {
+      slot = i;
+      _aborts.counts[i] = 0;
+    }
+  }
+  if(slot < 0) {
+    slot = 0;
+    for(int i = 1; i < IMAGE_INDEX_ABORT_SLOTS; ++i) {
+      if(_aborts.counts[i] < _aborts.counts[slot]) {
+        slot = i;
+      }
+    }
+    _aborts.counts[slot] = 0;
+  }
+
+  _aborts.ids[slot] = id;
+  if(_aborts.counts[slot] < UINT8_MAX) {
+    _aborts.counts[slot]++;
+  }
+  return _aborts.counts[slot];
+}
+
+/**
+ * Get the committed image to give up first when the card is full: the oldest image, or the oldest
+ * image of the lowest priority class.
+ * @param: boolean, true to evict by priority class first
+ * @param: pointer to the entry to fill
+ * @return: boolean, false if there is no image to evict
+ */
+bool image_index_eviction_candidate(bool by_priority, _image_index_entry_t * entry) {
+  int victim = -1;
+  for(int i = 0; i < _entry_count; ++i) {
+    if(_entries[i].state != IMAGE_COMMITTED) {
+      continue;
+    }
+    if(victim < 0) {
+      victim = i;
+      continue;
+    }
+
+    const _image_index_entry_t * candidate = &_entries[i];
+    const _image_index_entry_t * current = &_entries[victim];
+    if(by_priority && candidate->priority != current->priority) {
+      if(candidate->priority < current->priority) {
+        victim = i;
+      }
+    } else if(candidate->id < current->id) {
+      victim = i;
+    }
+  }
+
+  if(victim < 0) {
+    return false;
+  }
+  *entry = _entries[victim];
+  return true;
+}
+
+/**
+ * Set the order of the images within a priority class.
+ * @param: _image_upload_policy_t
+ */
+void image_index_set_upload_policy(_image_upload_policy_t policy) {
+  _upload_policy = policy;
+}
+
+/**
+ * Get the number of committed images waiting for upload.
+ * @return: uint16_t
+ */
+uint16_t image_index_pending_uploads() {
+  uint16_t count = 0;
+  for(int i = 0; i < _entry_count; ++i) {
+    if(_entries[i].state == IMAGE_COMMITTED) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Get the size of the index file. A compaction writes IMAGE_INDEX_COMPACT_PATH next to it, at most as
+ * large, before replacing it.
+ * @return: uint32_t bytes
+ */
+uint32_t image_index_file_size() {
+  return _record_count * _record_size();
+}
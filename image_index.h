@@ -0,0 +1,204 @@
+#ifndef __IMAGE_INDEX_H__
+#define __IMAGE_INDEX_H__
+
+#include "Arduino.h"
+#include "FS.h"
+#include <stdint.h>
+
+/**
+ * Index of the images stored in the SD card. Every state change of an image is appended to
+ * IMAGE_INDEX_PATH as a fixed size record before or after the matching file operation, so after a
+ * power loss the last record of each image tells what the card holds:
+ *
+ *  IMAGE_PENDING   -> /<id>.tmp is being written, /<id>.jpg exists only if the rename completed.
+ *  IMAGE_COMMITTED -> /<id>.jpg is complete and waiting for upload.
+ *  IMAGE_UPLOADED  -> the phone has the image, /<id>.jpg may still have to be deleted.
+ *  IMAGE_REMOVED   -> nothing left on the card.
+ *
+ * A committed image may have a low resolution preview /<id>.prv, written through /<id>.pvt. The
+ * preview is optional and is deleted together with its image.
+ *
+ * Recovery at startup replays the index and only touches files named by unfinished records, so its
+ * cost depends on the number of live images and not on the directory size. A full directory walk is
+ * only done when the index is missing, e.g. the first boot with this firmware.
+ *
+ * Record layout (16 bytes, little endian):
+ * -------------------------------------------------------------------------------------
+ * | MAGIC (1) | STATE (1) | CHECKSUM (2) | IMAGE ID (4) | SIZE (4) | CONTENT HASH (4) |
+ * -------------------------------------------------------------------------------------
+ *
+ * The low nibble of STATE is the image state and the high nibble its priority class.
+ * Records with magic 0xA6 have the same layout but may come from firmware without priority classes,
+ * which left the high nibble 0, so a 0 there is read as NORMAL and not LOW.
+ * The content hash is the CRC-32 of the JPEG data, 0 if unknown. Together with the image id, which is
+ * the capture time, and the size it identifies an image to the phone across retransmissions.
+ * An index written by older firmware has 12 byte records without the hash and is rewritten in the
+ * current layout at startup.
+ *
+ * All functions must be called with the SD card mutex held.
+ */
+
+#define IMAGE_INDEX_PATH "/images.idx"
+#define IMAGE_INDEX_COMPACT_PATH "/images.new"
+#define IMAGE_INDEX_MAX_ENTRIES 512
+#define IMAGE_INDEX_RECORD_SIZE 16
+#define IMAGE_INDEX_RECORD_MAGIC 0xA7
+#define IMAGE_INDEX_HASH_RECORD_MAGIC 0xA6
+#define IMAGE_INDEX_LEGACY_RECORD_SIZE 12
+#define IMAGE_INDEX_LEGACY_RECORD_MAGIC 0xA5
+
+typedef enum {
+    IMAGE_PENDING = 0x01,
+    IMAGE_COMMITTED = 0x02,
+    IMAGE_UPLOADED = 0x03,
+    IMAGE_REMOVED = 0x04
+}_image_state_t;
+
+typedef enum {
+    IMAGE_PRIORITY_LOW = 0,
+    IMAGE_PRIORITY_NORMAL = 1,
+    IMAGE_PRIORITY_HIGH = 2         // e.g. pictures triggered by an event
+}_image_priority_t;
+
+typedef enum {
+    IMAGE_UPLOAD_OLDEST_FIRST = 0,  // complete history, the phone gets the images in capture order
+    IMAGE_UPLOAD_NEWEST_FIRST = 1   // freshest view first when the link time is short
+}_image_upload_policy_t;
+
+// order of the images within a priority class until image_index_set_upload_policy is called
+#define IMAGE_UPLOAD_POLICY IMAGE_UPLOAD_OLDEST_FIRST
+
+// an image whose upload the upload deadline cut off this many times goes behind all other images, so an
+// image longer than the upload window can not take every window. The counts are kept in RTC memory.
+#define IMAGE_UPLOAD_MAX_ABORTS 2
+#define IMAGE_INDEX_ABORT_SLOTS 8
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+    uint32_t hash;
+    uint8_t state;
+    uint8_t priority;
+}_image_index_entry_t;
+
+/**
+ * Load the index from the SD card and finish or roll back the operations interrupted by a power loss.
+ * @param: FS object
+ * @return: boolean
+ */
+bool image_index_init(fs::FS &fs);
+
+/**
+ * Get an unused image id for a new image, the RTC epoch time unless it is already taken.
+ * @param: uint32_t preferred id
+ * @return: uint32_t
+ */
+uint32_t image_index_new_id(uint32_t preferred_id);
+
+/**
+ * Record that a new image is being written to its temporary file.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: _image_priority_t priority class of the image
+ * @return: boolean
+ */
+bool image_index_begin(fs::FS &fs, uint32_t id, _image_priority_t priority);
+
+/**
+ * Record that the image file is complete and renamed to its final name.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: uint32_t image size in bytes
+ * @param: uint32_t content hash, 0 if unknown
+ * @return: boolean
+ */
+bool image_index_commit(fs::FS &fs, uint32_t id, uint32_t size, uint32_t hash);
+
+/**
+ * Record that an image is no longer wanted, either uploaded or written incompletely.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: _image_state_t IMAGE_UPLOADED or IMAGE_REMOVED
+ * @return: boolean
+ */
+bool image_index_set_state(fs::FS &fs, uint32_t id, _image_state_t state);
+
+/**
+ * Get the committed image to upload next: the highest priority class first, and within a class the
+ * oldest or the newest image depending on the upload policy. Images with IMAGE_UPLOAD_MAX_ABORTS cut off
+ * uploads come after all others.
+ * @param: pointer to the entry to fill
+ * @return: boolean, false if there is no image to upload
+ */
+bool image_index_next(_image_index_entry_t * entry);
+
+/**
+ * Record that the upload deadline cut off the upload of an image. The count starts over after a
+ * power-on reset.
+ * @param: uint32_t image id
+ * @return: uint8_t cut off uploads of the image so far
+ */
+uint8_t image_index_upload_aborted(uint32_t id);
+
+/**
+ * Get the committed image to give up first when the card is full: the oldest image, or the oldest
+ * image of the lowest priority class.
+ * @param: boolean, true to evict by priority class first
+ * @param: pointer to the entry to fill
+ * @return: boolean, false if there is no image to evict
+ */
+bool image_index_eviction_candidate(bool by_priority, _image_index_entry_t * entry);
+
+/**
+ * Set the order of the images within a priority class.
+ * @param: _image_upload_policy_t
+ */
+void image_index_set_upload_policy(_image_upload_policy_t policy);
+
+/**
+ * Get the number of committed images waiting for upload.
+ * @return: uint16_t
+ */
+uint16_t image_index_pending_uploads();
+
+/**
+ * Get the size of the index file. A compaction writes IMAGE_INDEX_COMPACT_PATH next to it, at most as
+ * large, before replacing it.
+ * @return: uint32_t bytes
+ */
+uint32_t image_index_file_size();
+
+/**
+ * Get the SD card path of a committed image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ */
+void image_index_image_path(uint32_t id, char * buffer, size_t length);
+
+/**
+ * Get the SD card path of the temporary file of an image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ */
+void image_index_temp_path(uint32_t id, char * buffer, size_t length);
+
+/**
+ * Get the SD card path of the preview of an image.
+ * @param: uint32_t image id
+ * @param: char * buffer of at least 16 bytes
+ * @param: size_t buffer length
+ * @param: boolean, true for the temporary file the preview is written to
+ */
+void image_index_preview_path(uint32_t id, char * buffer, size_t length, bool temporary);
+
+/**
+ * Delete the preview files of an image, if any.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @return: uint32_t bytes deleted
+ */
+uint32_t image_index_remove_preview(fs::FS &fs, uint32_t id);
+
+#endif
@@ -0,0 +1,210 @@
+#include "kv_cache.h"
+
+#include <string.h>
+
+/**
+ * Find the cache entry of a key.
+ * @return: int index in the cache, -1 if not cached
+ */
+static int _find_entry(const _kv_cache_t * cache, const char * key) {
+  for(int i = 0; i < cache->count; ++i) {
+    if(strncmp(cache->entries[i].key, key, KV_MAX_KEY_LENGTH) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Get a cache entry for a new key, evicting a clean entry when the cache is full.
+ * @return: int index in the cache, -1 if every entry is dirty
+ */
+static int _new_entry(_kv_cache_t * cache, const char * key) {
+  int position = -1;
+  if(cache->count < KV_MAX_ENTRIES) {
+    position = cache->count++;
+  } else {
+    for(int i = 0; i < KV_MAX_ENTRIES; ++i) {
+      if(!cache->entries[i].dirty) {
+        position = i;
+        break;
+      }
+    }
+  }
+
+  if(position >= 0) {
+    _kv_entry_t * entry = &cache->entries[position];
+    strncpy(entry->key, key, KV_MAX_KEY_LENGTH);
+    entry->key[KV_MAX_KEY_LENGTH] = '\0';
+    entry->length = 0;
+    entry->dirty = false;
+  }
+  return position;
+}
+
+/**
+ * Reset a cache and attach it to a backend.
+ * @param: _kv_cache_t * cache
+ * @param: const _kv_backend_t * backend
+ */
+void kv_cache_init(_kv_cache_t * cache, const _kv_backend_t * backend) {
+  memset(cache, 0, sizeof(*cache));
+  cache->backend = backend;
+}
+
+/**
+ * Count the values waiting for a commit.
+ * @param: const _kv_cache_t * cache
+ * @return: uint8_t
+ */
+uint8_t kv_cache_dirty_count(const _kv_cache_t * cache) {
+  uint8_t count = 0;
+  for(int i = 0; i < cache->count; ++i) {
+    if(cache->entries[i].dirty) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Write every dirty value to the backend and commit it once.
+ * @param: _kv_cache_t * cache
+ * @return: boolean
+ */
+bool kv_cache_commit(_kv_cache_t * cache) {
+  if(kv_cache_dirty_count(cache) == 0) {
+    return true;
+  }
+
+  const _kv_backend_t * backend = cache->backend;
+  int64_t started = backend->now_us();
+  bool status = true;
+  for(int i = 0; i < cache->count; ++i) {
+    _kv_entry_t * entry = &cache->entries[i];
+    if(!entry->dirty) {
+      continue;
+    }
+    if(!backend->write(entry->key, entry->value, entry->length)) {
+      // stays dirty for the next commit
+      status = false;
+      continue;
+    }
+    entry->dirty = false;
+  }
+
+  if(!backend->commit()) {
+    status = false;
+  }
+
+  cache->commits++;
+  cache->last_commit_us = (uint32_t)(backend->now_us() - started);
+  if(cache->last_commit_us > cache->max_commit_us) {
+    cache->max_commit_us = cache->last_commit_us;
+  }
+  return status;
+}
+
+/**
+ * Read a value, from the cache if present, else from the backend into the cache.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @param: void * value buffer
+ * @param: size_t expected value length
+ * @return: boolean, false if the key does not exist or the length differs
+ */
+bool kv_cache_get(_kv_cache_t * cache, const char * key, void * value, size_t length) {
+  if(key == NULL || value == NULL || length > KV_MAX_VALUE_SIZE) {
+    return false;
+  }
+
+  int position = _find_entry(cache, key);
+  if(position < 0) {
+    // load from the backend into the cache
+    uint8_t buffer[KV_MAX_VALUE_SIZE];
+    size_t stored_length = sizeof(buffer);
+    if(!cache->backend->read(key, buffer, &stored_length)) {
+      return false;
+    }
+    position = _new_entry(cache, key);
+    if(position < 0) {
+      // cache full of dirty values, serve the value without caching it
+      if(stored_length != length) {
+        return false;
+      }
+      memcpy(value, buffer, length);
+      return true;
+    }
+    memcpy(cache->entries[position].value, buffer, stored_length);
+    cache->entries[position].length = stored_length;
+  }
+
+  if(cache->entries[position].length != length) {
+    return false;
+  }
+  memcpy(value, cache->entries[position].value, length);
+  return true;
+}
+
+/**
+ * Update a value in the cache. An unchanged value is not marked dirty, and the cache is committed once
+ * KV_COMMIT_THRESHOLD values are dirty or when a new key finds every entry dirty.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @param: const void * value
+ * @param: size_t value length, at most KV_MAX_VALUE_SIZE
+ * @return: boolean
+ */
+bool kv_cache_set(_kv_cache_t * cache, const char * key, const void * value, size_t length) {
+  if(key == NULL || value == NULL || length == 0 || length > KV_MAX_VALUE_SIZE) {
+    return false;
+  }
+
+  // load the stored value first, an unchanged value must not cost a flash write
+  uint8_t current[KV_MAX_VALUE_SIZE];
+  if(kv_cache_get(cache, key, current, length) && memcmp(current, value, length) == 0) {
+    return true;
+  }
+
+  int position = _find_entry(cache, key);
+  if(position < 0) {
+    position = _new_entry(cache, key);
+  }
+  if(position < 0) {
+    // every cached value is waiting for a commit, make room
+    kv_cache_commit(cache);
+    position = _new_entry(cache, key);
+  }
+  if(position < 0) {
+    return false;
+  }
+
+  _kv_entry_t * entry = &cache->entries[position];
+  memcpy(entry->value, value, length);
+  entry->length = length;
+  entry->dirty = true;
+
+  if(kv_cache_dirty_count(cache) >= KV_COMMIT_THRESHOLD) {
+    return kv_cache_commit(cache);
+  }
+  return true;
+}
+
+/**
+ * Remove a key from the cache and from the backend.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @return: boolean
+ */
+bool kv_cache_erase(_kv_cache_t * cache, const char * key) {
+  if(key == NULL) {
+    return false;
+  }
+
+  int position = _find_entry(cache, key);
+  if(position >= 0) {
+    cache->entries[position] = cache->entries[cache->count - 1];
+    cache->count--;
+  }
+  return cache->backend->erase(key);
+}
@@ -0,0 +1,104 @@
+#ifndef __KV_CACHE_H__
+#define __KV_CACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Write back cache of the key-value store. It keeps the values in RAM and writes them to a backend
+ * only on commit, a burst of updates then costs one backend write per changed key and a single
+ * backend commit. The cache has no Arduino dependency and no locking: kv_store.cpp serializes the
+ * calls and plugs in the NVS backend, the host benchmark in extras/kv_bench plugs in a file backend.
+ *
+ * Keys follow the NVS limit of 15 characters.
+ */
+
+#define KV_MAX_KEY_LENGTH 15
+#define KV_MAX_VALUE_SIZE 96
+#define KV_MAX_ENTRIES 16
+#define KV_COMMIT_THRESHOLD 8
+
+/**
+ * Persistent storage below the cache. Every function returns false on failure.
+ */
+typedef struct {
+    // read a value, the length is the buffer size on input and the stored length on output
+    bool (*read)(const char * key, void * value, size_t * length);
+    // stage a value, it is only durable after commit
+    bool (*write)(const char * key, const void * value, size_t length);
+    // remove a value and make the removal durable, a missing key is not an error
+    bool (*erase)(const char * key);
+    // make the staged values durable
+    bool (*commit)();
+    // monotonic time used for the commit statistics
+    int64_t (*now_us)();
+}_kv_backend_t;
+
+typedef struct {
+    char key[KV_MAX_KEY_LENGTH + 1];
+    uint8_t value[KV_MAX_VALUE_SIZE];
+    uint8_t length;
+    bool dirty;
+}_kv_entry_t;
+
+typedef struct {
+    const _kv_backend_t * backend;
+    _kv_entry_t entries[KV_MAX_ENTRIES];
+    uint8_t count;
+    uint32_t commits;                // commits which wrote to the backend
+    uint32_t last_commit_us;
+    uint32_t max_commit_us;
+}_kv_cache_t;
+
+/**
+ * Reset a cache and attach it to a backend.
+ * @param: _kv_cache_t * cache
+ * @param: const _kv_backend_t * backend
+ */
+void kv_cache_init(_kv_cache_t * cache, const _kv_backend_t * backend);
+
+/**
+ * Read a value, from the cache if present, else from the backend into the cache.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @param: void * value buffer
+ * @param: size_t expected value length
+ * @return: boolean, false if the key does not exist or the length differs
+ */
+bool kv_cache_get(_kv_cache_t * cache, const char * key, void * value, size_t length);
+
+/**
+ * Update a value in the cache. An unchanged value is not marked dirty, and the cache is committed once
+ * KV_COMMIT_THRESHOLD values are dirty or when a new key finds every entry dirty.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @param: const void * value
+ * @param: size_t value length, at most KV_MAX_VALUE_SIZE
+ * @return: boolean
+ */
+bool kv_cache_set(_kv_cache_t * cache, const char * key, const void * value, size_t length);
+
+/**
+ * Remove a key from the cache and from the backend.
+ * @param: _kv_cache_t * cache
+ * @param: const char * key
+ * @return: boolean
+ */
+bool kv_cache_erase(_kv_cache_t * cache, const char * key);
+
+/**
+ * Write every dirty value to the backend and commit it once.
+ * @param: _kv_cache_t * cache
+ * @return: boolean
+ */
+bool kv_cache_commit(_kv_cache_t * cache);
+
+/**
+ * Count the values waiting for a commit.
+ * @param: const _kv_cache_t * cache
+ * @return: uint8_t
+ */
+uint8_t kv_cache_dirty_count(const _kv_cache_t * cache);
+
+#endif
@@ -0,0 +1,213 @@
+#include "kv_store.h"
+#include "utils.h"
+
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_timer.h"
+
+static _kv_cache_t _cache;
+
+static nvs_handle_t _nvs_handle = 0;
+static bool _kv_open = false;
+static SemaphoreHandle_t _kv_mutex = NULL;
+
+// NVS backend of the cache, the store keeps every key in its own namespace
+static bool _nvs_read(const char * key, void * value, size_t * length) {
+  return nvs_get_blob(_nvs_handle, key, value, length) == ESP_OK;
+}
+
+static bool _nvs_write(const char * key, const void * value, size_t length) {
+  esp_err_t err = nvs_set_blob(_nvs_handle, key, value, length);
+  if(err != ESP_OK) {
+    LOG_E(LOG_MODULE_MAIN, "kv_commit: failed to write %s: %s", key, esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+static bool _nvs_erase(const char * key) {
+  esp_err_t err = nvs_erase_key(_nvs_handle, key);
+  if(err == ESP_OK) {
+    nvs_commit(_nvs_handle);
+  }
+  return (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
+}
+
+static bool _nvs_commit() {
+  if(nvs_commit(_nvs_handle) != ESP_OK) {
+    LOG_E(LOG_MODULE_MAIN, "kv_commit: nvs commit failed");
+    return false;
+  }
+  return true;
+}
+
+static int64_t _nvs_now_us() {
+  return esp_timer_get_time();
+}
+
+static const _kv_backend_t _nvs_backend = {
+  _nvs_read,
+  _nvs_write,
+  _nvs_erase,
+  _nvs_commit,
+  _nvs_now_us
+};
+
+/**
+ * Commit the cache, must be called with the mutex held.
+ */
+static bool _commit_locked() {
+  uint32_t commits = _cache.commits;
+  bool status = kv_cache_commit(&_cache);
+  if(_cache.commits != commits) {
+    LOG_D(LOG_MODULE_MAIN, "kv_commit: %u us", _cache.last_commit_us);
+  }
+  return status;
+}
+
+/**
+ * Open the NVS namespace of the store.
+ * @return: boolean
+ */
+bool kv_init() {
+  if(_kv_mutex == NULL) {
+    _kv_mutex = xSemaphoreCreateMutex();
+  }
+
+  if(_kv_open) {
+    return true;
+  }
+
+  esp_err_t err = nvs_open(KV_NAMESPACE, NVS_READWRITE, &_nvs_handle);
+  if(err != ESP_OK) {
+    // the NVS partition may not be initialized yet, Arduino does it for WiFi and Bluetooth only.
+    if(nvs_flash_init() == ESP_OK) {
+      err = nvs_open(KV_NAMESPACE, NVS_READWRITE, &_nvs_handle);
+    }
+  }
+
+  if(err != ESP_OK) {
+    LOG_E(LOG_MODULE_MAIN, "kv_init: failed to open nvs: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  kv_cache_init(&_cache, &_nvs_backend);
+  _kv_open = true;
+  return true;
+}
+
+/**
+ * Read a value, from the cache if present.
+ * @param: const char * key
+ * @param: void * value buffer
+ * @param: size_t expected value length
+ * @return: boolean, false if the key does not exist or the length differs
+ */
+bool kv_get(const char * key, void * value, size_t length) {
+  if(!_kv_open) {
+    return false;
+  }
+
+  xSemaphoreTake(_kv_mutex, portMAX_DELAY);
+  bool status = kv_cache_get(&_cache, key, value, length);
+  xSemaphoreGive(_kv_mutex);
+  return status;
+}
+
+/**
+ * Update a value in the cache. The value is written to flash by the next kv_commit().
+ * @param: const char * key
+ * @param: const void * value
+ * @param: size_t value length, at most KV_MAX_VALUE_SIZE
+ * @return: boolean
+ */
+bool kv_set(const char * key, const void * value, size_t length) {
+  if(key == NULL || value == NULL || length == 0 || length > KV_MAX_VALUE_SIZE || !_kv_open) {
+    LOG_E(LOG_MODULE_MAIN, "kv_set: invalid argument");
+    return false;
+  }
+
+  xSemaphoreTake(_kv_mutex, portMAX_DELAY);
+  uint32_t commits = _cache.commits;
+  bool status = kv_cache_set(&_cache, key, value, length);
+  if(_cache.commits != commits) {
+    LOG_D(LOG_MODULE_MAIN, "kv_commit: %u us", _cache.last_commit_us);
+  }
+  xSemaphoreGive(_kv_mutex);
+
+  if(!status) {
+    LOG_E(LOG_MODULE_MAIN, "kv_set: failed to store %s", key);
+  }
+  return status;
+}
+
+/**
+ * Read a 32 bit value.
+ * @param: const char * key
+ * @param: uint32_t default value if the key does not exist
+ * @return: uint32_t
+ */
+uint32_t kv_get_u32(const char * key, uint32_t default_value) {
+  uint32_t value;
+  if(kv_get(key, &value, sizeof(value))) {
+    return value;
+  }
+  return default_value;
+}
+
+/**
+ * Update a 32 bit value.
+ * @param: const char * key
+ * @param: uint32_t value
+ * @return: boolean
+ */
+bool kv_set_u32(const char * key, uint32_t value) {
+  return kv_set(key, &value, sizeof(value));
+}
+
+/**
+ * Remove a key from the cache and from flash.
+ * @param: const char * key
+ * @return: boolean
+ */
+bool kv_erase(const char * key) {
+  if(key == NULL || !_kv_open) {
+    return false;
+  }
+
+  xSemaphoreTake(_kv_mutex, portMAX_DELAY);
+  bool status = kv_cache_erase(&_cache, key);
+  xSemaphoreGive(_kv_mutex);
+  return status;
+}
+
+/**
+ * Write every changed value to flash with a single NVS commit.
+ * @return: boolean
+ */
+bool kv_commit() {
+  if(!_kv_open) {
+    return false;
+  }
+
+  xSemaphoreTake(_kv_mutex, portMAX_DELAY);
+  bool status = _commit_locked();
+  xSemaphoreGive(_kv_mutex);
+  return status;
+}
+
+/**
+ * Get the duration of the last commit which wrote to flash.
+ * @return: uint32_t microseconds
+ */
+uint32_t kv_last_commit_us() {
+  return _cache.last_commit_us;
+}
+
+/**
+ * Get the longest commit since startup.
+ * @return: uint32_t microseconds
+ */
+uint32_t kv_max_commit_us() {
+  return _cache.max_commit_us;
+}
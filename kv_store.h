@@ -0,0 +1,86 @@
+#ifndef __KV_STORE_H__
+#define __KV_STORE_H__
+
+#include "Arduino.h"
+#include "kv_cache.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Persistent key-value store for counters, sequence numbers, configuration and transfer progress.
+ *
+ * Values are kept in the RAM cache of kv_cache.h and written to NVS only by kv_commit(), so a burst
+ * of updates costs one flash write per changed key and a single nvs_commit instead of a write per
+ * update. NVS itself appends entries to log structured pages and rotates pages, which spreads the
+ * erases over the whole partition. kv_commit() is called before deep sleep, and by kv_set() once
+ * KV_COMMIT_THRESHOLD keys are dirty. This file only adds the NVS backend and the locking.
+ */
+
+#define KV_NAMESPACE "camera"
+
+/**
+ * Open the NVS namespace of the store.
+ * @return: boolean
+ */
+bool kv_init();
+
+/**
+ * Read a value, from the cache if present.
+ * @param: const char * key
+ * @param: void * value buffer
+ * @param: size_t expected value length
+ * @return: boolean, false if the key does not exist or the length differs
+ */
+bool kv_get(const char * key, void * value, size_t length);
+
+/**
+ * Update a value in the cache. The value is written to flash by the next kv_commit().
+ * @param: const char * key
+ * @param: const void * value
+ * @param: size_t value length, at most KV_MAX_VALUE_SIZE
+ * @return: boolean
+ */
+bool kv_set(const char * key, const void * value, size_t length);
+
+/**
+ * Read a 32 bit value.
+ * @param: const char * key
+ * @param: uint32_t default value if the key does not exist
+ * @return: uint32_t
+ */
+uint32_t kv_get_u32(const char * key, uint32_t default_value);
+
+/**
+ * Update a 32 bit value.
+ * @param: const char * key
+ * @param: uint32_t value
+ * @return: boolean
+ */
+bool kv_set_u32(const char * key, uint32_t value);
+
+/**
+ * Remove a key from the cache and from flash.
+ * @param: const char * key
+ * @return: boolean
+ */
+bool kv_erase(const char * key);
+
+/**
+ * Write every changed value to flash with a single NVS commit.
+ * @return: boolean
+ */
+bool kv_commit();
+
+/**
+ * Get the duration of the last commit which wrote to flash.
+ * @return: uint32_t microseconds
+ */
+uint32_t kv_last_commit_us();
+
+/**
+ * Get the longest commit since startup.
+ * @return: uint32_t microseconds
+ */
+uint32_t kv_max_commit_us();
+
+#endif
@@ -0,0 +1,85 @@
+#include "logger.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+// binary log record, the format string stays in flash and is only read by the drain task
+typedef struct {
+  uint32_t timestamp_ms;
+  const char * fmt;
+  uint32_t a;
+  uint32_t b;
+}_log_record_t;
+
+static QueueHandle_t _log_queue = NULL;
+static volatile uint32_t _log_dropped = 0;
+
+/**
+ * Print a log event directly to Serial.
+ * @param: const char * format string
+ * @param: uint32_t first argument
+ * @param: uint32_t second argument
+ */
+void log_event_print(const char * fmt, uint32_t a, uint32_t b) {
+  Serial.printf(fmt, a, b);
+  Serial.println();
+}
+
+/**
+ * Task which drains the deferred log queue to Serial.
+ */
+static void _log_drain_task(void * params) {
+  _log_record_t record;
+
+  for(;;) {
+    if(xQueueReceive(_log_queue, &record, portMAX_DELAY) == pdTRUE) {
+      Serial.printf("[%u] ", record.timestamp_ms);
+      log_event_print(record.fmt, record.a, record.b);
+    }
+  }
+}
+
+/**
+ * Start the deferred log task. Does nothing unless LOG_DEFERRED is set.
+ */
+void log_init() {
+  if(!LOG_DEFERRED || _log_queue != NULL) {
+    return;
+  }
+
+  _log_queue = xQueueCreate(LOG_DEFERRED_QUEUE_LENGTH, sizeof(_log_record_t));
+  if(_log_queue == NULL) {
+    Serial.println("log_init: failed to create log queue");
+    return;
+  }
+
+  // lowest priority, the log is only printed when nothing else wants the CPU
+  xTaskCreate(_log_drain_task, "drain deferred log", 2048, NULL, 0, NULL);
+}
+
+/**
+ * Queue a log record for the deferred log task. Never blocks, the record is dropped if the queue is full.
+ * @param: const char * format string, must be a string literal
+ * @param: uint32_t first argument
+ * @param: uint32_t second argument
+ */
+void log_deferred(const char * fmt, uint32_t a, uint32_t b) {
+  if(_log_queue == NULL) {
+    _log_dropped++;
+    return;
+  }
+
+  _log_record_t record = { (uint32_t)millis(), fmt, a, b };
+  if(xQueueSend(_log_queue, &record, 0) != pdTRUE) {
+    _log_dropped++;
+  }
+}
+
+/**
+ * Get the number of deferred records dropped because the queue was full.
+ * @return: uint32_t
+ */
+uint32_t log_dropped_records() {
+  return _log_dropped;
+}
@@ -0,0 +1,95 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Compile time logging. The log level and the module mask are preprocessor constants, so a
+ * disabled log statement is a constant false branch and the compiler removes it together with
+ * its arguments and format string. Override the defaults with build flags, e.g.
+ * -DLOG_LEVEL=LOG_LEVEL_NONE for release builds or -DLOG_MODULES=LOG_MODULE_COMM to only see
+ * the Bluetooth protocol.
+ *
+ * LOG_EVENT is meant for the Bluetooth callbacks and the per-packet path. With LOG_DEFERRED set
+ * it only pushes the format pointer and two integer arguments into a queue which a low priority
+ * task prints, so the caller never waits on the serial port.
+ */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MODULE_MAIN    (1UL << 0)
+#define LOG_MODULE_BT      (1UL << 1)
+#define LOG_MODULE_COMM    (1UL << 2)
+#define LOG_MODULE_CAMERA  (1UL << 3)
+#define LOG_MODULE_SD      (1UL << 4)
+#define LOG_MODULE_TIME    (1UL << 5)
+#define LOG_MODULE_METRICS (1UL << 6)
+#define LOG_MODULE_ALL     0xFFFFFFFFUL
+
+#ifndef LOG_MODULES
+#define LOG_MODULES LOG_MODULE_ALL
+#endif
+
+// deferred logging for LOG_EVENT, 0 prints directly
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 0
+#endif
+
+// number of records the deferred log queue can hold
+#define LOG_DEFERRED_QUEUE_LENGTH 64
+
+#define LOG_ENABLED(module, level) (((level) <= LOG_LEVEL) && (((LOG_MODULES) & (module)) != 0))
+
+#define LOG_PRINT(module, level, fmt, ...) \
+    do { if(LOG_ENABLED(module, level)) { Serial.printf(fmt "\n", ##__VA_ARGS__); } } while(0)
+
+#define LOG_E(module, fmt, ...) LOG_PRINT(module, LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_W(module, fmt, ...) LOG_PRINT(module, LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_I(module, fmt, ...) LOG_PRINT(module, LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_D(module, fmt, ...) LOG_PRINT(module, LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+#if LOG_DEFERRED
+#define LOG_EVENT(module, level, fmt, a, b) \
+    do { if(LOG_ENABLED(module, level)) { log_deferred(fmt, (uint32_t)(a), (uint32_t)(b)); } } while(0)
+#else
+#define LOG_EVENT(module, level, fmt, a, b) \
+    do { if(LOG_ENABLED(module, level)) { log_event_print(fmt, (uint32_t)(a), (uint32_t)(b)); } } while(0)
+#endif
+
+/**
+ * Start the deferred log task. Does nothing unless LOG_DEFERRED is set.
+ */
+void log_init();
+
+/**
+ * Queue a log record for the deferred log task. Never blocks, the record is dropped if the queue is full.
+ * @param: const char * format string, must be a string literal
+ * @param: uint32_t first argument
+ * @param: uint32_t second argument
+ */
+void log_deferred(const char * fmt, uint32_t a, uint32_t b);
+
+/**
+ * Print a log event directly to Serial.
+ * @param: const char * format string
+ * @param: uint32_t first argument
+ * @param: uint32_t second argument
+ */
+void log_event_print(const char * fmt, uint32_t a, uint32_t b);
+
+/**
+ * Get the number of deferred records dropped because the queue was full.
+ * @return: uint32_t
+ */
+uint32_t log_dropped_records();
+
+#endif
@@ -0,0 +1,147 @@
+#include "mem_pool.h"
+#include "utils.h"
+#include "esp_heap_caps.h"
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    const char * name;
+    uint32_t block_size;
+    uint8_t block_count;
+    uint32_t caps;
+}_mem_pool_config_t;
+
+typedef struct {
+    uint8_t * memory;
+    uint32_t free_mask;
+    _mem_block_t blocks[MEM_POOL_MAX_BLOCKS];
+    _mem_pool_stats_t stats;
+}_mem_pool_t;
+
+static const _mem_pool_config_t _pool_config[MEM_POOL_COUNT] = {
+    {"dma", MEM_POOL_DMA_BLOCK_SIZE, MEM_POOL_DMA_BLOCKS, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL},
+    {"packet", MEM_POOL_PACKET_BLOCK_SIZE, MEM_POOL_PACKET_BLOCKS, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+    {"bulk", MEM_POOL_BULK_BLOCK_SIZE, MEM_POOL_BULK_BLOCKS, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT},
+};
+
+static _mem_pool_t _pools[MEM_POOL_COUNT];
+
+// blocks are taken and returned by the camera and Bluetooth tasks on different cores
+static portMUX_TYPE _pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Allocate the memory of every pool. Call once at startup.
+ * @return: boolean, false if a pool could not be allocated
+ */
+bool mem_pool_init() {
+  bool status = true;
+
+  for(int id = 0; id < MEM_POOL_COUNT; ++id) {
+    const _mem_pool_config_t * config = &_pool_config[id];
+    _mem_pool_t * pool = &_pools[id];
+    if(pool->memory != NULL) {
+      continue;
+    }
+
+    uint32_t caps = config->caps;
+    if((caps & MALLOC_CAP_SPIRAM) && !psramFound()) {
+      // without PSRAM the bulk pool lives in internal RAM
+      caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    }
+
+    pool->memory = (uint8_t *) heap_caps_malloc(config->block_size * config->block_count, caps);
+    if(pool->memory == NULL) {
+      Serial.printf("mem_pool_init: failed to allocate the %s pool\n", config->name);
+      status = false;
+      continue;
+    }
+
+    for(uint8_t i = 0; i < config->block_count; ++i) {
+      pool->blocks[i].data = pool->memory + i * config->block_size;
+      pool->blocks[i].size = config->block_size;
+      pool->blocks[i].pool = id;
+      pool->blocks[i].index = i;
+    }
+    pool->free_mask = (config->block_count == 32) ? UINT32_MAX : ((1u << config->block_count) - 1);
+    pool->stats.blocks = config->block_count;
+  }
+  return status;
+}
+
+/**
+ * Take a free block from a pool, without waiting.
+ * @param: _mem_pool_id_t pool
+ * @return: _mem_block_t * block, NULL if the pool is exhausted
+ */
+_mem_block_t * mem_pool_get(_mem_pool_id_t pool_id) {
+  if(pool_id >= MEM_POOL_COUNT) {
+    return NULL;
+  }
+
+  _mem_pool_t * pool = &_pools[pool_id];
+  _mem_block_t * block = NULL;
+
+  portENTER_CRITICAL(&_pool_mux);
+  if(pool->free_mask != 0) {
+    uint8_t index = __builtin_ctz(pool->free_mask);
+    pool->free_mask &= ~(1u << index);
+    block = &pool->blocks[index];
+    pool->stats.in_use++;
+    if(pool->stats.in_use > pool->stats.high_water) {
+      pool->stats.high_water = pool->stats.in_use;
+    }
+  } else {
+    pool->stats.failures++;
+  }
+  portEXIT_CRITICAL(&_pool_mux);
+
+  if(block == NULL) {
+    LOG_W(LOG_MODULE_MAIN, "mem_pool_get: %s pool exhausted", _pool_config[pool_id].name);
+  }
+  return block;
+}
+
+/**
+ * Give a block back to its pool.
+ * @param: _mem_block_t * block, NULL is ignored
+ */
+void mem_pool_put(_mem_block_t * block) {
+  if(block == NULL || block->pool >= MEM_POOL_COUNT) {
+    return;
+  }
+
+  _mem_pool_t * pool = &_pools[block->pool];
+  portENTER_CRITICAL(&_pool_mux);
+  if((pool->free_mask & (1u << block->index)) == 0) {
+    pool->free_mask |= (1u << block->index);
+    pool->stats.in_use--;
+  }
+  portEXIT_CRITICAL(&_pool_mux);
+}
+
+/**
+ * Get the usage of a pool.
+ * @param: _mem_pool_id_t pool
+ * @param: _mem_pool_stats_t * statistics to fill
+ */
+void mem_pool_get_stats(_mem_pool_id_t pool_id, _mem_pool_stats_t * stats) {
+  if(pool_id >= MEM_POOL_COUNT || stats == NULL) {
+    return;
+  }
+
+  portENTER_CRITICAL(&_pool_mux);
+  *stats = _pools[pool_id].stats;
+  portEXIT_CRITICAL(&_pool_mux);
+}
+
+/**
+ * Print the usage and high water mark of every pool to Serial.
+ */
+void mem_pool_print() {
+  for(int id = 0; id < MEM_POOL_COUNT; ++id) {
+    _mem_pool_stats_t stats;
+    mem_pool_get_stats((_mem_pool_id_t)id, &stats);
+    Serial.printf("mem_pool: %s %d x %u bytes, in use %d, high water %d, failures %u\n", _pool_config[id].name,
+      stats.blocks, _pool_config[id].block_size, stats.in_use, stats.high_water, stats.failures);
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef __MEM_POOL_H__
+#define __MEM_POOL_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Fixed block memory pools for the buffers between capture, storage and transfer. Every pool is
+ * allocated once by mem_pool_init(), blocks are then taken and returned without touching the heap,
+ * so the capture and upload loop does no heap allocation. Each pool keeps its high water mark and
+ * the number of requests it could not serve, to size the pools from field data.
+ *
+ *  MEM_POOL_DMA    -> internal DMA capable RAM, the SD card write bounce buffer.
+ *  MEM_POOL_PACKET -> internal RAM, copies of received packets.
+ *  MEM_POOL_BULK   -> PSRAM if present, larger work buffers such as compressed payloads.
+ *
+ * Camera frames stay in the frame buffers of the camera driver, which are allocated once at init.
+ */
+
+#define MEM_POOL_DMA_BLOCK_SIZE (16 * 512)
+#define MEM_POOL_DMA_BLOCKS 1
+#define MEM_POOL_PACKET_BLOCK_SIZE 1024
+#define MEM_POOL_PACKET_BLOCKS 2
+#define MEM_POOL_BULK_BLOCK_SIZE 4096
+#define MEM_POOL_BULK_BLOCKS 2
+
+// a pool has at most this many blocks, the free blocks are tracked in a 32 bit mask
+#define MEM_POOL_MAX_BLOCKS 32
+
+typedef enum {
+    MEM_POOL_DMA = 0,
+    MEM_POOL_PACKET = 1,
+    MEM_POOL_BULK = 2,
+    MEM_POOL_COUNT = 3
+}_mem_pool_id_t;
+
+/**
+ * Handle of a block taken from a pool. Give it back with mem_pool_put().
+ */
+typedef struct {
+    uint8_t * data;
+    uint32_t size;
+    uint8_t pool;
+    uint8_t index;
+}_mem_block_t;
+
+typedef struct {
+    uint8_t blocks;
+    uint8_t in_use;
+    uint8_t high_water;
+    uint32_t failures;
+}_mem_pool_stats_t;
+
+/**
+ * Allocate the memory of every pool. Call once at startup.
+ * @return: boolean, false if a pool could not be allocated
+ */
+bool mem_pool_init();
+
+/**
+ * Take a free block from a pool, without waiting.
+ * @param: _mem_pool_id_t pool
+ * @return: _mem_block_t * block, NULL if the pool is exhausted
+ */
+_mem_block_t * mem_pool_get(_mem_pool_id_t pool);
+
+/**
+ * Give a block back to its pool.
+ * @param: _mem_block_t * block, NULL is ignored
+ */
+void mem_pool_put(_mem_block_t * block);
+
+/**
+ * Get the usage of a pool.
+ * @param: _mem_pool_id_t pool
+ * @param: _mem_pool_stats_t * statistics to fill
+ */
+void mem_pool_get_stats(_mem_pool_id_t pool, _mem_pool_stats_t * stats);
+
+/**
+ * Print the usage and high water mark of every pool to Serial.
+ */
+void mem_pool_print();
+
+#endif
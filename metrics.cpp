@@ -0,0 +1,225 @@
+#include "metrics.h"
+#include "utils.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// metrics persist across deep sleep, they are cleared on power-on reset.
+RTC_DATA_ATTR static _metrics_t _metrics;
+
+// camera and Bluetooth tasks run on different cores, protect the read-modify-write updates.
+static portMUX_TYPE _metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Get the histogram bucket for a latency value.
+ * @param: uint32_t latency in milliseconds
+ * @return: uint8_t bucket index
+ */
+static uint8_t _histogram_bucket(uint32_t latency_ms) {
+  uint8_t bucket = 0;
+  while(latency_ms != 0 && bucket < METRICS_HIST_BUCKETS - 1) {
+    latency_ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/**
+ * Add one sample to the histogram, saturating the bucket count.
+ */
+static void _histogram_add(uint16_t * histogram, uint32_t latency_ms) {
+  uint8_t bucket = _histogram_bucket(latency_ms);
+  portENTER_CRITICAL(&_metrics_mux);
+  if(histogram[bucket] != UINT16_MAX) {
+    histogram[bucket]++;
+  }
+  portEXIT_CRITICAL(&_metrics_mux);
+}
+
+/**
+ * Add a value to a counter.
+ */
+static void _counter_add(uint32_t * counter, uint32_t value) {
+  portENTER_CRITICAL(&_metrics_mux);
+  *counter += value;
+  portEXIT_CRITICAL(&_metrics_mux);
+}
+
+/**
+ * Write a 32 bit value in little endian order.
+ */
+static uint16_t _put_uint32(uint8_t * buffer, uint16_t offset, uint32_t value) {
+  *(buffer + offset) = (uint8_t)(value & 0xFF);
+  *(buffer + offset + 1) = (uint8_t)((value >> 8) & 0xFF);
+  *(buffer + offset + 2) = (uint8_t)((value >> 16) & 0xFF);
+  *(buffer + offset + 3) = (uint8_t)((value >> 24) & 0xFF);
+  return offset + 4;
+}
+
+/**
+ * Write a 16 bit value in little endian order.
+ */
+static uint16_t _put_uint16(uint8_t * buffer, uint16_t offset, uint16_t value) {
+  *(buffer + offset) = (uint8_t)(value & 0xFF);
+  *(buffer + offset + 1) = (uint8_t)((value >> 8) & 0xFF);
+  return offset + 2;
+}
+
+/**
+ * Start of a wake cycle, call once from setup().
+ */
+void metrics_begin_wake() {
+  _counter_add(&_metrics.wake_count, 1);
+}
+
+/**
+ * End of a wake cycle, records the wake duration and heap low water. Call right before deep sleep.
+ */
+void metrics_end_wake() {
+  uint32_t wake_duration = millis();
+  uint32_t heap_low_water = esp_get_minimum_free_heap_size();
+
+  portENTER_CRITICAL(&_metrics_mux);
+  _metrics.last_wake_duration_ms = wake_duration;
+  if(wake_duration > _metrics.max_wake_duration_ms) {
+    _metrics.max_wake_duration_ms = wake_duration;
+  }
+  if(_metrics.heap_low_water == 0 || heap_low_water < _metrics.heap_low_water) {
+    _metrics.heap_low_water = heap_low_water;
+  }
+  portEXIT_CRITICAL(&_metrics_mux);
+}
+
+/**
+ * Record a captured image saved in the SD card.
+ */
+void metrics_image_captured() {
+  _counter_add(&_metrics.images_captured, 1);
+}
+
+/**
+ * Record an image which could not be captured or saved.
+ */
+void metrics_image_dropped() {
+  _counter_add(&_metrics.images_dropped, 1);
+}
+
+/**
+ * Record an image uploaded to the phone.
+ */
+void metrics_image_uploaded() {
+  _counter_add(&_metrics.images_uploaded, 1);
+}
+
+/**
+ * Record bytes written to the Bluetooth output stream.
+ * @param: uint32_t number of bytes
+ */
+void metrics_bytes_sent(uint32_t bytes) {
+  _counter_add(&_metrics.bytes_sent, bytes);
+}
+
+/**
+ * Record a packet retransmission.
+ */
+void metrics_retransmit() {
+  _counter_add(&_metrics.retransmits, 1);
+}
+
+/**
+ * Record a Bluetooth reconnection attempt.
+ */
+void metrics_reconnect() {
+  _counter_add(&_metrics.reconnects, 1);
+}
+
+/**
+ * Record the time between sending a packet and receiving the phone response.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_ack_latency(uint32_t latency_ms) {
+  _histogram_add(_metrics.ack_latency_hist, latency_ms);
+}
+
+/**
+ * Record the time taken to write an image in the SD card.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_sd_write_latency(uint32_t latency_ms) {
+  _histogram_add(_metrics.sd_write_latency_hist, latency_ms);
+}
+
+/**
+ * Record the time from the capture request until the image is saved in the SD card.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_capture_latency(uint32_t latency_ms) {
+  _histogram_add(_metrics.capture_latency_hist, latency_ms);
+}
+
+/**
+ * Get the read only pointer to the current metrics.
+ * @return: const _metrics_t *
+ */
+const _metrics_t * metrics_get() {
+  return &_metrics;
+}
+
+/**
+ * Serialize the metrics into the snapshot format.
+ * @param: uint8_t * buffer, at least METRICS_SNAPSHOT_SIZE bytes
+ * @param: uint16_t buffer length
+ * @return: uint16_t number of bytes written, 0 if the buffer is too small
+ */
+uint16_t metrics_serialize(uint8_t * buffer, uint16_t buffer_length) {
+  if(buffer == NULL || buffer_length < METRICS_SNAPSHOT_SIZE) {
+    Serial.println("metrics_serialize: buffer too small");
+    return 0;
+  }
+
+  // take a consistent copy so the snapshot is not torn by the other task
+  _metrics_t copy;
+  portENTER_CRITICAL(&_metrics_mux);
+  copy = _metrics;
+  portEXIT_CRITICAL(&_metrics_mux);
+
+  uint16_t offset = 0;
+  *(buffer + offset) = METRICS_MAGIC;
+  *(buffer + offset + 1) = METRICS_VERSION;
+  offset += 2;
+
+  offset = _put_uint32(buffer, offset, copy.wake_count);
+  offset = _put_uint32(buffer, offset, copy.images_captured);
+  offset = _put_uint32(buffer, offset, copy.images_uploaded);
+  offset = _put_uint32(buffer, offset, copy.images_dropped);
+  offset = _put_uint32(buffer, offset, copy.bytes_sent);
+  offset = _put_uint32(buffer, offset, copy.retransmits);
+  offset = _put_uint32(buffer, offset, copy.reconnects);
+  offset = _put_uint32(buffer, offset, copy.last_wake_duration_ms);
+  offset = _put_uint32(buffer, offset, copy.max_wake_duration_ms);
+  offset = _put_uint32(buffer, offset, copy.heap_low_water);
+
+  for(int i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+    offset = _put_uint16(buffer, offset, copy.ack_latency_hist[i]);
+  }
+  for(int i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+    offset = _put_uint16(buffer, offset, copy.sd_write_latency_hist[i]);
+  }
+  for(int i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+    offset = _put_uint16(buffer, offset, copy.capture_latency_hist[i]);
+  }
+
+  return offset;
+}
+
+/**
+ * Print the metrics to Serial.
+ */
+void metrics_print() {
+  Serial.printf("metrics: wakes %u, captured %u, uploaded %u, dropped %u\n", _metrics.wake_count,
+    _metrics.images_captured, _metrics.images_uploaded, _metrics.images_dropped);
+  Serial.printf("metrics: bytes sent %u, retransmits %u, reconnects %u\n", _metrics.bytes_sent,
+    _metrics.retransmits, _metrics.reconnects);
+  Serial.printf("metrics: last wake %u ms, max wake %u ms, heap low water %u\n", _metrics.last_wake_duration_ms,
+    _metrics.max_wake_duration_ms, _metrics.heap_low_water);
+}
@@ -0,0 +1,126 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Field metrics for the camera module. The counters live in RTC memory so they survive deep sleep
+ * and are only cleared by a power-on reset. Once per session a compact binary snapshot is sent to
+ * the phone as OTHER_DATA.
+ *
+ * Latency histograms use power-of-two millisecond buckets: bucket 0 holds samples below 1 ms,
+ * bucket i holds samples in [2^(i-1), 2^i) ms and the last bucket holds everything above.
+ *
+ * Snapshot layout (all multi-byte fields are little endian):
+ * -------------------------------------------------------------------------------------------
+ * | MAGIC (1) | VERSION (1) | 10 x uint32 counters | ACK HISTOGRAM (uint16 x 12) | SD HISTOGRAM (uint16 x 12) |
+ * -------------------------------------------------------------------------------------------
+ * | CAPTURE HISTOGRAM (uint16 x 12) |      (version 2 only)
+ * -----------------------------------
+ * Counter order: wake count, images captured, images uploaded, images dropped, bytes sent,
+ * retransmits, reconnects, last wake duration (ms), max wake duration (ms), heap low water (bytes).
+ * The capture histogram holds the time from the capture request until the image is in the SD card.
+ */
+
+#define METRICS_MAGIC 0x4D          // 'M'
+#define METRICS_VERSION 0x02
+#define METRICS_HIST_BUCKETS 12
+#define METRICS_COUNTERS 10
+#define METRICS_SNAPSHOT_SIZE (2 + METRICS_COUNTERS * 4 + 3 * METRICS_HIST_BUCKETS * 2)
+
+typedef struct {
+    uint32_t wake_count;
+    uint32_t images_captured;
+    uint32_t images_uploaded;
+    uint32_t images_dropped;
+    uint32_t bytes_sent;
+    uint32_t retransmits;
+    uint32_t reconnects;
+    uint32_t last_wake_duration_ms;
+    uint32_t max_wake_duration_ms;
+    uint32_t heap_low_water;
+    uint16_t ack_latency_hist[METRICS_HIST_BUCKETS];
+    uint16_t sd_write_latency_hist[METRICS_HIST_BUCKETS];
+    uint16_t capture_latency_hist[METRICS_HIST_BUCKETS];
+}_metrics_t;
+
+/**
+ * Start of a wake cycle, call once from setup().
+ */
+void metrics_begin_wake();
+
+/**
+ * End of a wake cycle, records the wake duration and heap low water. Call right before deep sleep.
+ */
+void metrics_end_wake();
+
+/**
+ * Record a captured image saved in the SD card.
+ */
+void metrics_image_captured();
+
+/**
+ * Record an image which could not be captured or saved.
+ */
+void metrics_image_dropped();
+
+/**
+ * Record an image uploaded to the phone.
+ */
+void metrics_image_uploaded();
+
+/**
+ * Record bytes written to the Bluetooth output stream.
+ * @param: uint32_t number of bytes
+ */
+void metrics_bytes_sent(uint32_t bytes);
+
+/**
+ * Record a packet retransmission.
+ */
+void metrics_retransmit();
+
+/**
+ * Record a Bluetooth reconnection attempt.
+ */
+void metrics_reconnect();
+
+/**
+ * Record the time between sending a packet and receiving the phone response.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_ack_latency(uint32_t latency_ms);
+
+/**
+ * Record the time taken to write an image in the SD card.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_sd_write_latency(uint32_t latency_ms);
+
+/**
+ * Record the time from the capture request until the image is saved in the SD card.
+ * @param: uint32_t latency in milliseconds
+ */
+void metrics_capture_latency(uint32_t latency_ms);
+
+/**
+ * Get the read only pointer to the current metrics.
+ * @return: const _metrics_t *
+ */
+const _metrics_t * metrics_get();
+
+/**
+ * Serialize the metrics into the snapshot format.
+ * @param: uint8_t * buffer, at least METRICS_SNAPSHOT_SIZE bytes
+ * @param: uint16_t buffer length
+ * @return: uint16_t number of bytes written, 0 if the buffer is too small
+ */
+uint16_t metrics_serialize(uint8_t * buffer, uint16_t buffer_length);
+
+/**
+ * Print the metrics to Serial.
+ */
+void metrics_print();
+
+#endif
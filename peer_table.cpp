@@ -0,0 +1,215 @@
+#include "peer_table.h"
+#include "kv_store.h"
+#include "time_manager.h"
+#include "utils.h"
+#include "bt_protocol.h"
+
+// the configured phone and the phone list of the configuration fit the table
+static_assert(1 + CONFIG_MAX_EXTRA_PHONES <= PEER_TABLE_MAX, "configured phones do not fit the peer table");
+
+static _peer_t _peers[PEER_TABLE_MAX];
+
+// bit per table position, set once a failed connection is counted in this wake. RAM is cleared by
+// deep sleep, so this starts empty on every wake.
+static uint8_t _failed_this_wake = 0;
+static_assert(PEER_TABLE_MAX <= 8, "peer table positions do not fit the failure mask");
+
+/**
+ * Find a phone in the table.
+ * @return: int table position, -1 if not found
+ */
+static int _find_peer(const uint8_t * mac) {
+  for(int i = 0; i < PEER_TABLE_MAX; ++i) {
+    if(_peers[i].in_use && memcmp(_peers[i].mac, mac, 6) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Expected upload rate of a phone, unknown rates use the default and failed attempts lower the rate.
+ */
+static uint32_t _expected_rate(const _peer_t * peer) {
+  uint32_t rate = peer->throughput != 0 ? peer->throughput : PEER_DEFAULT_THROUGHPUT;
+  return rate / (1 + peer->failures);
+}
+
+/**
+ * Load the peer table from the key-value store.
+ */
+void peer_table_load() {
+  if(!kv_get(PEER_TABLE_KV_KEY, _peers, sizeof(_peers))) {
+    LOG_D(LOG_MODULE_BT, "peer_table_load: no stored peers");
+    memset(_peers, 0, sizeof(_peers));
+  }
+}
+
+/**
+ * Store the peer table in the key-value store.
+ */
+void peer_table_save() {
+  if(!kv_set(PEER_TABLE_KV_KEY, _peers, sizeof(_peers))) {
+    Serial.println("peer_table_save: failed to store peers");
+  }
+}
+
+/**
+ * Add a phone to the table if it is not there yet, replacing the least recently seen phone when full.
+ * @param: const uint8_t * MAC address (6 bytes)
+ */
+void peer_table_add(const uint8_t * mac) {
+  if(mac == NULL || _find_peer(mac) >= 0) {
+    return;
+  }
+
+  int position = -1;
+  for(int i = 0; i < PEER_TABLE_MAX; ++i) {
+    if(!_peers[i].in_use) {
+      position = i;
+      break;
+    }
+    if(position < 0 || _peers[i].last_seen < _peers[position].last_seen) {
+      position = i;
+    }
+  }
+
+  memset(&_peers[position], 0, sizeof(_peer_t));
+  memcpy(_peers[position].mac, mac, 6);
+  _failed_this_wake &= ~(1 << position);
+  _peers[position].in_use = 1;
+  peer_table_save();
+}
+
+/**
+ * Get the phones in the order they should be tried, highest expected upload rate first.
+ * @param: uint8_t * array of PEER_TABLE_MAX table positions to fill
+ * @return: uint8_t number of phones
+ */
+uint8_t peer_table_connection_order(uint8_t * order) {
+  uint8_t count = 0;
+  for(int i = 0; i < PEER_TABLE_MAX; ++i) {
+    if(_peers[i].in_use) {
+      order[count++] = i;
+    }
+  }
+
+  // insertion sort, expected rate first and the most recently seen phone on a tie
+  for(int i = 1; i < count; ++i) {
+    uint8_t current = order[i];
+    int j = i - 1;
+    while(j >= 0) {
+      uint32_t rate_j = _expected_rate(&_peers[order[j]]);
+      uint32_t rate_current = _expected_rate(&_peers[current]);
+      bool before = rate_current > rate_j ||
+        (rate_current == rate_j && _peers[current].last_seen > _peers[order[j]].last_seen);
+      if(!before) {
+        break;
+      }
+      order[j + 1] = order[j];
+      j--;
+    }
+    order[j + 1] = current;
+  }
+  return count;
+}
+
+/**
+ * Get a phone of the table.
+ * @param: uint8_t table position
+ * @return: const _peer_t *
+ */
+const _peer_t * peer_table_get(uint8_t position) {
+  if(position >= PEER_TABLE_MAX) {
+    return NULL;
+  }
+  return &_peers[position];
+}
+
+/**
+ * Record a successful connection to a phone.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_connected(const uint8_t * mac) {
+  int position = _find_peer(mac);
+  if(position < 0) {
+    return;
+  }
+
+  _peers[position].failures = 0;
+  _peers[position].last_seen = (uint32_t)get_rtc_epoch_time();
+  peer_table_save();
+}
+
+/**
+ * Record a failed connection attempt to a phone, only the first one of a wake is counted.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_connect_failed(const uint8_t * mac) {
+  int position = _find_peer(mac);
+  if(position < 0 || (_failed_this_wake & (1 << position))) {
+    return;
+  }
+  _failed_this_wake |= (1 << position);
+
+  if(_peers[position].failures < UINT8_MAX) {
+    _peers[position].failures++;
+  }
+  peer_table_save();
+}
+
+/**
+ * Get the expected upload rate to a phone.
+ * @param: const uint8_t * MAC address
+ * @return: uint32_t bytes per second, PEER_DEFAULT_THROUGHPUT for an unknown phone
+ */
+uint32_t peer_table_expected_rate(const uint8_t * mac) {
+  int position = mac != NULL ? _find_peer(mac) : -1;
+  if(position < 0) {
+    return PEER_DEFAULT_THROUGHPUT;
+  }
+  return std::max(_expected_rate(&_peers[position]), (uint32_t)1);
+}
+
+/**
+ * Record a measured upload to a phone.
+ * @param: const uint8_t * MAC address
+ * @param: uint32_t bytes sent
+ * @param: uint32_t duration in milliseconds
+ */
+void peer_table_record_throughput(const uint8_t * mac, uint32_t bytes, uint32_t duration_ms) {
+  int position = _find_peer(mac);
+  if(position < 0 || duration_ms == 0) {
+    return;
+  }
+
+  uint32_t rate = (uint32_t)((uint64_t)bytes * 1000 / duration_ms);
+  _peer_t * peer = &_peers[position];
+  if(peer->throughput == 0) {
+    peer->throughput = rate;
+  } else {
+    peer->throughput = (peer->throughput * (8 - PEER_THROUGHPUT_WEIGHT) + rate * PEER_THROUGHPUT_WEIGHT) / 8;
+  }
+  LOG_I(LOG_MODULE_BT, "peer_table: %u bytes/s to %02x:%02x:%02x:%02x:%02x:%02x", peer->throughput,
+    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  peer_table_save();
+}
+
+/**
+ * An upload to a phone was deferred by its expected duration. Moves a measured rate below the
+ * default toward it, so one slow session can not hold back the uploads for good.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_upload_deferred(const uint8_t * mac) {
+  int position = mac != NULL ? _find_peer(mac) : -1;
+  if(position < 0) {
+    return;
+  }
+
+  _peer_t * peer = &_peers[position];
+  if(peer->throughput == 0 || peer->throughput >= PEER_DEFAULT_THROUGHPUT) {
+    return;
+  }
+  peer->throughput = (peer->throughput * (8 - PEER_THROUGHPUT_WEIGHT) + PEER_DEFAULT_THROUGHPUT * PEER_THROUGHPUT_WEIGHT) / 8;
+  peer_table_save();
+}
@@ -0,0 +1,103 @@
+#ifndef __PEER_TABLE_H__
+#define __PEER_TABLE_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Table of the phones the camera can upload to. Several phones rotate near a camera, so instead of
+ * one fixed MAC address the camera remembers up to PEER_TABLE_MAX phones with the time each was last
+ * seen and the upload rate measured to it, and tries them in order of expected upload rate.
+ * The table is stored in the key-value store.
+ *
+ * Phones enter the table from the configuration: setup adds device_config phone_mac and the phone
+ * list of the configuration blob on every wake, so a config push naming other phones registers them
+ * from the next wake on while the earlier phones stay until they are the least recently seen of a
+ * full table. The camera is the SPP initiator, phones never connect to it on their own.
+ *
+ * A phone is charged at most one failed connection per wake, the back off rounds of one wake retry the
+ * same absent phone and must not push it below the others for the following wakes.
+ */
+
+#define PEER_TABLE_MAX 4
+#define PEER_TABLE_KV_KEY "peers"
+
+// upload rate assumed for a phone that has not been measured yet, in bytes per second
+#define PEER_DEFAULT_THROUGHPUT 20000
+
+// weight of a new throughput measurement in the moving average, in 1/8
+#define PEER_THROUGHPUT_WEIGHT 2
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t in_use;
+    uint8_t failures;        // consecutive failed connection attempts
+    uint32_t last_seen;      // RTC epoch time of the last connection
+    uint32_t throughput;     // moving average of the upload rate in bytes per second, 0 if unknown
+}_peer_t;
+
+/**
+ * Load the peer table from the key-value store.
+ */
+void peer_table_load();
+
+/**
+ * Store the peer table in the key-value store.
+ */
+void peer_table_save();
+
+/**
+ * Add a phone to the table if it is not there yet, replacing the least recently seen phone when full.
+ * @param: const uint8_t * MAC address (6 bytes)
+ */
+void peer_table_add(const uint8_t * mac);
+
+/**
+ * Get the phones in the order they should be tried, highest expected upload rate first.
+ * @param: uint8_t * array of PEER_TABLE_MAX table positions to fill
+ * @return: uint8_t number of phones
+ */
+uint8_t peer_table_connection_order(uint8_t * order);
+
+/**
+ * Get a phone of the table.
+ * @param: uint8_t table position
+ * @return: const _peer_t *
+ */
+const _peer_t * peer_table_get(uint8_t position);
+
+/**
+ * Record a successful connection to a phone.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_connected(const uint8_t * mac);
+
+/**
+ * Record a failed connection attempt to a phone, only the first one of a wake is counted.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_connect_failed(const uint8_t * mac);
+
+/**
+ * Get the expected upload rate to a phone.
+ * @param: const uint8_t * MAC address
+ * @return: uint32_t bytes per second, PEER_DEFAULT_THROUGHPUT for an unknown phone
+ */
+uint32_t peer_table_expected_rate(const uint8_t * mac);
+
+/**
+ * Record a measured upload to a phone.
+ * @param: const uint8_t * MAC address
+ * @param: uint32_t bytes sent
+ * @param: uint32_t duration in milliseconds
+ */
+void peer_table_record_throughput(const uint8_t * mac, uint32_t bytes, uint32_t duration_ms);
+
+/**
+ * An upload to a phone was deferred by its expected duration. Moves a measured rate below the
+ * default toward it, so one slow session can not hold back the uploads for good.
+ * @param: const uint8_t * MAC address
+ */
+void peer_table_upload_deferred(const uint8_t * mac);
+
+#endif
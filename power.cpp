@@ -0,0 +1,76 @@
+#include "power.h"
+#include "utils.h"
+
+#include "esp_pm.h"
+#include "esp_bt.h"
+
+static esp_pm_lock_handle_t _performance_lock = NULL;
+
+/**
+ * Configure dynamic frequency scaling and automatic light sleep. Call once early in setup().
+ * @return: boolean, false if power management is not available in this build
+ */
+bool power_init() {
+#if POWER_MANAGEMENT_ENABLED
+  esp_pm_config_esp32_t config = {};
+  config.max_freq_mhz = POWER_MAX_FREQ_MHZ;
+  config.min_freq_mhz = POWER_MIN_FREQ_MHZ;
+  config.light_sleep_enable = true;
+
+  esp_err_t err = esp_pm_configure(&config);
+  if(err == ESP_ERR_NOT_SUPPORTED) {
+    // light sleep needs tickless idle in the sdkconfig, scale the frequency only
+    config.light_sleep_enable = false;
+    err = esp_pm_configure(&config);
+    LOG_I(LOG_MODULE_MAIN, "power_init: automatic light sleep not available in this build");
+  }
+  if(err != ESP_OK) {
+    Serial.printf("power_init: power management not available, 0x%x\n", err);
+    return false;
+  }
+
+  if(_performance_lock == NULL &&
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "performance", &_performance_lock) != ESP_OK) {
+    Serial.println("power_init: failed to create the performance lock");
+    _performance_lock = NULL;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Put the Bluetooth controller in modem sleep. Call after the Bluetooth stack is started.
+ * @return: boolean
+ */
+bool power_enable_bt_modem_sleep() {
+#if POWER_MANAGEMENT_ENABLED
+  esp_err_t err = esp_bt_sleep_enable();
+  if(err != ESP_OK) {
+    LOG_W(LOG_MODULE_BT, "power_enable_bt_modem_sleep: modem sleep not enabled, 0x%x", err);
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Run at the full clock until power_release_performance(). Calls nest.
+ */
+void power_acquire_performance() {
+  if(_performance_lock != NULL) {
+    esp_pm_lock_acquire(_performance_lock);
+  }
+}
+
+/**
+ * Release a power_acquire_performance().
+ */
+void power_release_performance() {
+  if(_performance_lock != NULL) {
+    esp_pm_lock_release(_performance_lock);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Power management while awake. Most of a wake is spent waiting: for phone responses, for the
+ * Bluetooth stack to write frames and, in the camera task, for the deep sleep semaphore. With power
+ * management the CPU clock drops to POWER_MIN_FREQ_MHZ whenever every task is blocked, and the chip
+ * enters automatic light sleep if the firmware was built with tickless idle. The Bluetooth controller
+ * is put in modem sleep so it does not keep the chip awake between connection events.
+ *
+ * POWER_MIN_FREQ_MHZ stays at 80 MHz so the APB clock, and with it the camera XCLK, the UART and the
+ * SDMMC clock, does not change. Capture, compression and SD writes hold a performance lock and run
+ * at POWER_MAX_FREQ_MHZ.
+ *
+ * Build with -DPOWER_MANAGEMENT_ENABLED=0 to run at full clock, and compare the upload rates in the
+ * peer table and the ack latency histogram of the metrics to measure the cost on the throughput.
+ */
+
+#ifndef POWER_MANAGEMENT_ENABLED
+#define POWER_MANAGEMENT_ENABLED 1
+#endif
+#define POWER_MAX_FREQ_MHZ 240
+#define POWER_MIN_FREQ_MHZ 80
+
+/**
+ * Configure dynamic frequency scaling and automatic light sleep. Call once early in setup().
+ * @return: boolean, false if power management is not available in this build
+ */
+bool power_init();
+
+/**
+ * Put the Bluetooth controller in modem sleep. Call after the Bluetooth stack is started.
+ * @return: boolean
+ */
+bool power_enable_bt_modem_sleep();
+
+/**
+ * Run at the full clock until power_release_performance(). Calls nest.
+ */
+void power_acquire_performance();
+
+/**
+ * Release a power_acquire_performance().
+ */
+void power_release_performance();
+
+#endif
@@ -0,0 +1,185 @@
+#include "resource_monitor.h"
+#include "utils.h"
+#include "esp_heap_caps.h"
+
+#include "freertos/task.h"
+
+#define RESOURCE_RTC_MAGIC 0x52534D31   // 'RSM1'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t samples;
+    uint32_t internal_free_min;
+    uint32_t internal_largest_min;
+    uint32_t psram_free_min;
+    uint32_t psram_total;
+    uint8_t worst_point;
+    uint32_t stack_size[RESOURCE_TASK_COUNT];
+    uint32_t stack_free_min[RESOURCE_TASK_COUNT];
+}_resource_marks_t;
+
+// the worst values persist across deep sleep, they are cleared on power-on reset.
+RTC_DATA_ATTR static _resource_marks_t _marks;
+
+// task handles are only valid for the current wake
+static TaskHandle_t _tasks[RESOURCE_TASK_COUNT];
+
+// camera and Bluetooth tasks run on different cores, protect the read-modify-write updates.
+static portMUX_TYPE _resource_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Start from empty marks after a power-on reset, RTC memory holds garbage then.
+ */
+static void _check_marks() {
+  if(_marks.magic == RESOURCE_RTC_MAGIC) {
+    return;
+  }
+  memset(&_marks, 0, sizeof(_marks));
+  _marks.magic = RESOURCE_RTC_MAGIC;
+  _marks.internal_free_min = UINT32_MAX;
+  _marks.internal_largest_min = UINT32_MAX;
+  _marks.psram_free_min = UINT32_MAX;
+  for(int i = 0; i < RESOURCE_TASK_COUNT; ++i) {
+    _marks.stack_free_min[i] = UINT32_MAX;
+  }
+}
+
+/**
+ * Write a byte, nothing is written past the buffer length but the offset still advances.
+ */
+static uint16_t _put_uint8(uint8_t * buffer, uint16_t buffer_length, uint16_t offset, uint8_t value) {
+  if(offset < buffer_length) {
+    *(buffer + offset) = value;
+  }
+  return offset + 1;
+}
+
+/**
+ * Write a 32 bit value in little endian order, bounded like _put_uint8.
+ */
+static uint16_t _put_uint32(uint8_t * buffer, uint16_t buffer_length, uint16_t offset, uint32_t value) {
+  for(int i = 0; i < 4; ++i) {
+    offset = _put_uint8(buffer, buffer_length, offset, (uint8_t)((value >> (8 * i)) & 0xFF));
+  }
+  return offset;
+}
+
+/**
+ * Register the calling task, its stack is then sampled with the heaps.
+ * @param: _resource_task_t task
+ * @param: uint32_t stack size given to xTaskCreate, in bytes
+ */
+void resource_monitor_register_task(_resource_task_t task, uint32_t stack_size) {
+  if(task >= RESOURCE_TASK_COUNT) {
+    return;
+  }
+
+  portENTER_CRITICAL(&_resource_mux);
+  _check_marks();
+  _tasks[task] = xTaskGetCurrentTaskHandle();
+  // a new stack size makes the old low water meaningless
+  if(_marks.stack_size[task] != stack_size) {
+    _marks.stack_size[task] = stack_size;
+    _marks.stack_free_min[task] = UINT32_MAX;
+  }
+  portEXIT_CRITICAL(&_resource_mux);
+}
+
+/**
+ * Sample the stack of the calling task, if registered, and the internal and PSRAM heaps.
+ * @param: _resource_point_t point of the wake
+ */
+void resource_monitor_sample(_resource_point_t point) {
+  // the heap queries take their own locks, read them before entering the critical section
+  TaskHandle_t current = xTaskGetCurrentTaskHandle();
+  uint32_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+  uint32_t internal_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  uint32_t internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+  uint32_t psram_free = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+  uint32_t psram_total = psramFound() ? heap_caps_get_total_size(MALLOC_CAP_SPIRAM) : 0;
+
+  portENTER_CRITICAL(&_resource_mux);
+  _check_marks();
+  _marks.samples++;
+  for(int i = 0; i < RESOURCE_TASK_COUNT; ++i) {
+    if(_tasks[i] == current && current != NULL && stack_free < _marks.stack_free_min[i]) {
+      _marks.stack_free_min[i] = stack_free;
+    }
+  }
+  if(internal_free < _marks.internal_free_min) {
+    _marks.internal_free_min = internal_free;
+    _marks.worst_point = (uint8_t)point;
+  }
+  if(internal_largest < _marks.internal_largest_min) {
+    _marks.internal_largest_min = internal_largest;
+  }
+  if(psram_total != 0 && psram_free < _marks.psram_free_min) {
+    _marks.psram_free_min = psram_free;
+  }
+  _marks.psram_total = psram_total;
+  portEXIT_CRITICAL(&_resource_mux);
+
+  LOG_D(LOG_MODULE_METRICS, "resource_monitor_sample: point %d, stack free %u, internal free %u, largest %u",
+    point, stack_free, internal_free, internal_largest);
+}
+
+/**
+ * Serialize the high water marks into the snapshot format.
+ * @param: uint8_t * buffer, at least RESOURCE_SNAPSHOT_SIZE bytes
+ * @param: uint16_t buffer length
+ * @return: uint16_t number of bytes written, 0 if the buffer is too small or the layout does not match
+ */
+uint16_t resource_monitor_serialize(uint8_t * buffer, uint16_t buffer_length) {
+  if(buffer == NULL || buffer_length < RESOURCE_SNAPSHOT_SIZE) {
+    return 0;
+  }
+
+  // take a consistent copy, the tasks may sample meanwhile
+  _resource_marks_t marks;
+  portENTER_CRITICAL(&_resource_mux);
+  _check_marks();
+  marks = _marks;
+  portEXIT_CRITICAL(&_resource_mux);
+
+  uint16_t offset = 0;
+  offset = _put_uint8(buffer, buffer_length, offset, RESOURCE_MAGIC);
+  offset = _put_uint8(buffer, buffer_length, offset, RESOURCE_VERSION);
+  offset = _put_uint32(buffer, buffer_length, offset, marks.samples);
+  offset = _put_uint32(buffer, buffer_length, offset, marks.internal_free_min);
+  offset = _put_uint32(buffer, buffer_length, offset, marks.internal_largest_min);
+  offset = _put_uint32(buffer, buffer_length, offset, marks.psram_free_min);
+  offset = _put_uint32(buffer, buffer_length, offset, marks.psram_total);
+  offset = _put_uint8(buffer, buffer_length, offset, marks.worst_point);
+  offset = _put_uint8(buffer, buffer_length, offset, RESOURCE_TASK_COUNT);
+  for(int i = 0; i < RESOURCE_TASK_COUNT; ++i) {
+    offset = _put_uint32(buffer, buffer_length, offset, marks.stack_size[i]);
+    offset = _put_uint32(buffer, buffer_length, offset, marks.stack_free_min[i]);
+  }
+
+  // the layout and RESOURCE_SNAPSHOT_SIZE must agree, never send a partial snapshot
+  if(offset != RESOURCE_SNAPSHOT_SIZE) {
+    Serial.printf("resource_monitor_serialize: wrote %u bytes, expected %u\n", offset, RESOURCE_SNAPSHOT_SIZE);
+    return 0;
+  }
+  return offset;
+}
+
+/**
+ * Print the high water marks to Serial.
+ */
+void resource_monitor_print() {
+  static const char * task_names[RESOURCE_TASK_COUNT] = {"setup", "camera", "bluetooth"};
+
+  _check_marks();
+  Serial.printf("resources: %u samples, internal free min %u, largest block min %u (worst at point %d)\n",
+    _marks.samples, _marks.internal_free_min, _marks.internal_largest_min, _marks.worst_point);
+  if(_marks.psram_total != 0) {
+    Serial.printf("resources: psram free min %u of %u\n", _marks.psram_free_min, _marks.psram_total);
+  }
+  for(int i = 0; i < RESOURCE_TASK_COUNT; ++i) {
+    if(_marks.stack_free_min[i] != UINT32_MAX) {
+      Serial.printf("resources: %s stack %u bytes, min free %u\n", task_names[i], _marks.stack_size[i],
+        _marks.stack_free_min[i]);
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef __RESOURCE_MONITOR_H__
+#define __RESOURCE_MONITOR_H__
+
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include <stdint.h>
+
+/**
+ * Stack and heap high water marks of the camera module. The tasks sample their own stack and the
+ * heaps at fixed points of the wake: after the capture, every RESOURCE_SAMPLE_PACKETS packets of a
+ * file transfer and before deep sleep. The worst values live in RTC memory so they add up over the
+ * wakes until a power-on reset, and are sent to the phone once per session as OTHER_DATA.
+ *
+ * Snapshot layout (all multi-byte fields are little endian):
+ * ------------------------------------------------------------------------------------------------
+ * | MAGIC (1) | VERSION (1) | SAMPLES (4) | INTERNAL FREE MIN (4) | INTERNAL LARGEST BLOCK MIN (4) |
+ * ------------------------------------------------------------------------------------------------
+ * | PSRAM FREE MIN (4) | PSRAM TOTAL (4) | WORST POINT (1) | TASKS (1) | per task: STACK SIZE (4), STACK FREE MIN (4) |
+ * ------------------------------------------------------------------------------------------------
+ * WORST POINT is the _resource_point_t where the internal heap was the lowest. A stack free minimum
+ * of UINT32_MAX means the task was never sampled.
+ */
+
+#define RESOURCE_MAGIC 0x52          // 'R'
+#define RESOURCE_VERSION 0x01
+
+// sample during a file transfer every this many packets
+#define RESOURCE_SAMPLE_PACKETS 32
+
+typedef enum {
+    RESOURCE_TASK_SETUP = 0,
+    RESOURCE_TASK_CAMERA = 1,
+    RESOURCE_TASK_BLUETOOTH = 2,
+    RESOURCE_TASK_COUNT = 3
+}_resource_task_t;
+
+typedef enum {
+    RESOURCE_POINT_SETUP = 0,
+    RESOURCE_POINT_AFTER_CAPTURE = 1,
+    RESOURCE_POINT_PACKETS = 2,
+    RESOURCE_POINT_BEFORE_SLEEP = 3
+}_resource_point_t;
+
+#define RESOURCE_SNAPSHOT_SIZE (2 + 5 * 4 + 2 + RESOURCE_TASK_COUNT * 8)
+
+/**
+ * Register the calling task, its stack is then sampled with the heaps.
+ * @param: _resource_task_t task
+ * @param: uint32_t stack size given to xTaskCreate, in bytes
+ */
+void resource_monitor_register_task(_resource_task_t task, uint32_t stack_size);
+
+/**
+ * Sample the stack of the calling task, if registered, and the internal and PSRAM heaps.
+ * @param: _resource_point_t point of the wake
+ */
+void resource_monitor_sample(_resource_point_t point);
+
+/**
+ * Serialize the high water marks into the snapshot format.
+ * @param: uint8_t * buffer, at least RESOURCE_SNAPSHOT_SIZE bytes
+ * @param: uint16_t buffer length
+ * @return: uint16_t number of bytes written, 0 if the buffer is too small or the layout does not match
+ */
+uint16_t resource_monitor_serialize(uint8_t * buffer, uint16_t buffer_length);
+
+/**
+ * Print the high water marks to Serial.
+ */
+void resource_monitor_print();
+
+#endif
@@ -0,0 +1,163 @@
+#include "sd_capacity.h"
+#include "SD_MMC.h"
+#include "image_index.h"
+#include "utils.h"
+
+#include "ff.h"
+
+#define SD_CAPACITY_MAGIC 0x53444332   // 'SDC2'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t wakes_since_sync;
+    uint32_t cluster_size;
+    uint64_t total_bytes;
+    uint64_t used_bytes;           // images, previews and other files, without the index file
+}_sd_capacity_t;
+
+// kept across deep sleep, cleared by a power-on reset
+RTC_DATA_ATTR static _sd_capacity_t _capacity;
+
+/**
+ * Space a file takes on the card.
+ */
+static uint64_t _allocated_size(uint32_t size) {
+  uint32_t cluster = _capacity.cluster_size != 0 ? _capacity.cluster_size : SD_CAPACITY_DEFAULT_CLUSTER_SIZE;
+  return ((uint64_t)size + cluster - 1) / cluster * cluster;
+}
+
+/**
+ * Space the index file needs: the index with its next record, and the compacted copy written next
+ * to it before the rename.
+ */
+static uint64_t _index_reserve() {
+  uint32_t index_size = image_index_file_size();
+  return _allocated_size(index_size + IMAGE_INDEX_RECORD_SIZE) + _allocated_size(index_size);
+}
+
+/**
+ * Measure the card and its cluster size. f_getfree is the FAT scan SD_MMC.usedBytes() does as well.
+ */
+static void _measure() {
+  FATFS * fatfs = NULL;
+  DWORD free_clusters = 0;
+  if(f_getfree(SD_CAPACITY_FATFS_DRIVE, &free_clusters, &fatfs) == FR_OK && fatfs != NULL && fatfs->csize > 0) {
+#if FF_MAX_SS != FF_MIN_SS
+    uint32_t sector_size = fatfs->ssize;
+#else
+    uint32_t sector_size = FF_MAX_SS;
+#endif
+    _capacity.cluster_size = fatfs->csize * sector_size;
+    _capacity.total_bytes = (uint64_t)(fatfs->n_fatent - 2) * _capacity.cluster_size;
+    _capacity.used_bytes = _capacity.total_bytes - (uint64_t)free_clusters * _capacity.cluster_size;
+  } else {
+    LOG_W(LOG_MODULE_SD, "sd_capacity: failed to query the file system, assuming %u byte clusters",
+      SD_CAPACITY_DEFAULT_CLUSTER_SIZE);
+    _capacity.cluster_size = SD_CAPACITY_DEFAULT_CLUSTER_SIZE;
+    _capacity.total_bytes = SD_MMC.totalBytes();
+    _capacity.used_bytes = SD_MMC.usedBytes();
+  }
+
+  // the index is accounted apart, see _index_reserve
+  uint64_t index_allocated = _allocated_size(image_index_file_size());
+  _capacity.used_bytes = index_allocated < _capacity.used_bytes ? _capacity.used_bytes - index_allocated : 0;
+}
+
+/**
+ * Used space above which an eviction starts, in bytes.
+ */
+static uint64_t _watermark(uint8_t percent) {
+  return _capacity.total_bytes / 100 * percent;
+}
+
+/**
+ * Load the cached space accounting, or measure the card if the cache is missing or too old.
+ * Call once after mounting the card and loading the image index.
+ */
+void sd_capacity_init() {
+  if(_capacity.magic == SD_CAPACITY_MAGIC && _capacity.wakes_since_sync < SD_CAPACITY_RESYNC_WAKES) {
+    _capacity.wakes_since_sync++;
+  } else {
+    // the only FAT scans, once after a power-on reset and then every SD_CAPACITY_RESYNC_WAKES wakes
+    _measure();
+    _capacity.wakes_since_sync = 0;
+    _capacity.magic = SD_CAPACITY_MAGIC;
+  }
+
+  LOG_I(LOG_MODULE_SD, "sd_capacity: %lluMB used of %lluMB, %u byte clusters", sd_capacity_used_bytes() / (1024 * 1024),
+    _capacity.total_bytes / (1024 * 1024), _capacity.cluster_size);
+}
+
+/**
+ * Account a file written to the card.
+ * @param: uint32_t file size in bytes
+ */
+void sd_capacity_add(uint32_t size) {
+  _capacity.used_bytes += _allocated_size(size);
+}
+
+/**
+ * Account a file deleted from the card.
+ * @param: uint32_t file size in bytes
+ */
+void sd_capacity_remove(uint32_t size) {
+  uint64_t allocated = _allocated_size(size);
+  _capacity.used_bytes = allocated < _capacity.used_bytes ? _capacity.used_bytes - allocated : 0;
+}
+
+/**
+ * Evict images until a new file of the given size fits below the high watermark.
+ * @param: FS object
+ * @param: uint32_t size of the file about to be written
+ * @return: boolean, false if the file does not fit even with every image evicted
+ */
+bool sd_capacity_make_room(fs::FS &fs, uint32_t size) {
+  uint64_t needed = _allocated_size(size) + _index_reserve();
+  if(_capacity.used_bytes + needed <= _watermark(SD_CAPACITY_HIGH_WATERMARK)) {
+    return true;
+  }
+
+  // evict down to the low watermark, so the next images do not each trigger an eviction
+  uint16_t evicted = 0;
+  _image_index_entry_t entry;
+  char path[24];
+  while(_capacity.used_bytes + needed > _watermark(SD_CAPACITY_LOW_WATERMARK) &&
+      image_index_eviction_candidate(SD_EVICT_POLICY == SD_EVICT_LOWEST_PRIORITY, &entry)) {
+    image_index_image_path(entry.id, path, sizeof(path));
+    fs.remove(path);
+    sd_capacity_remove(entry.size);
+    sd_capacity_remove(image_index_remove_preview(fs, entry.id));
+    image_index_set_state(fs, entry.id, IMAGE_REMOVED);
+    evicted++;
+  }
+
+  if(evicted > 0) {
+    LOG_W(LOG_MODULE_SD, "sd_capacity_make_room: evicted %d images, %lluMB used", evicted,
+      sd_capacity_used_bytes() / (1024 * 1024));
+  }
+  return _capacity.used_bytes + needed <= _capacity.total_bytes;
+}
+
+/**
+ * Get the total space of the card.
+ * @return: uint64_t bytes
+ */
+uint64_t sd_capacity_total_bytes() {
+  return _capacity.total_bytes;
+}
+
+/**
+ * Get the estimated used space of the card, the index file included.
+ * @return: uint64_t bytes
+ */
+uint64_t sd_capacity_used_bytes() {
+  return _capacity.used_bytes + _allocated_size(image_index_file_size());
+}
+
+/**
+ * Get the cluster size of the card.
+ * @return: uint32_t bytes
+ */
+uint32_t sd_capacity_cluster_size() {
+  return _capacity.cluster_size;
+}
@@ -0,0 +1,91 @@
+#ifndef __SD_CAPACITY_H__
+#define __SD_CAPACITY_H__
+
+#include "Arduino.h"
+#include "FS.h"
+#include <stdint.h>
+
+/**
+ * Space accounting and retention for the SD card.
+ *
+ * Measuring the free space scans the FAT on many cards, so the card is measured once after a power-on
+ * reset and every SD_CAPACITY_RESYNC_WAKES wakes. The measurement also reads the cluster size of the
+ * file system, 32 KB on most FAT32 cards but 128 KB on exFAT cards above 32 GB. In between, the used
+ * byte count is kept in RTC memory and updated for every image and preview written or deleted, rounded
+ * up to whole clusters.
+ *
+ * The image index file is accounted apart from the images: the space check reserves the index with its
+ * next record and the compacted copy that image_index writes next to it before replacing it.
+ *
+ * Before an image is written, images are evicted when the card would rise above the high watermark,
+ * until it is back below the low watermark. The eviction policy picks the victims from the image
+ * index, so capture never stalls on a full card.
+ *
+ * All functions must be called with the SD card mutex held.
+ */
+
+// allocation granularity assumed if the file system can not be queried, the exFAT cluster of SDXC cards
+#define SD_CAPACITY_DEFAULT_CLUSTER_SIZE (128 * 1024)
+
+// FatFs drive of the card, SD_MMC mounts the only FAT volume of the camera
+#define SD_CAPACITY_FATFS_DRIVE "0:"
+
+// used space in percent of the card that starts an eviction, and where it stops
+#define SD_CAPACITY_HIGH_WATERMARK 90
+#define SD_CAPACITY_LOW_WATERMARK 80
+
+// measure the card again after this many wakes to correct any drift of the estimate
+#define SD_CAPACITY_RESYNC_WAKES 256
+
+typedef enum {
+    SD_EVICT_OLDEST = 0,            // the oldest image, whatever its priority class
+    SD_EVICT_LOWEST_PRIORITY = 1    // the oldest image of the lowest priority class
+}_sd_evict_policy_t;
+
+#define SD_EVICT_POLICY SD_EVICT_LOWEST_PRIORITY
+
+/**
+ * Load the cached space accounting, or measure the card if the cache is missing or too old.
+ * Call once after mounting the card.
+ */
+void sd_capacity_init();
+
+/**
+ * Account a file written to the card.
+ * @param: uint32_t file size in bytes
+ */
+void sd_capacity_add(uint32_t size);
+
+/**
+ * Account a file deleted from the card.
+ * @param: uint32_t file size in bytes
+ */
+void sd_capacity_remove(uint32_t size);
+
+/**
+ * Evict images until a new file of the given size fits below the high watermark.
+ * @param: FS object
+ * @param: uint32_t size of the file about to be written
+ * @return: boolean, false if the file does not fit even with every image evicted
+ */
+bool sd_capacity_make_room(fs::FS &fs, uint32_t size);
+
+/**
+ * Get the total space of the card.
+ * @return: uint64_t bytes
+ */
+uint64_t sd_capacity_total_bytes();
+
+/**
+ * Get the estimated used space of the card, the index file included.
+ * @return: uint64_t bytes
+ */
+uint64_t sd_capacity_used_bytes();
+
+/**
+ * Get the cluster size of the card.
+ * @return: uint32_t bytes
+ */
+uint32_t sd_capacity_cluster_size();
+
+#endif
@@ -1,273 +1,418 @@
-#include "sd_card.h"
-#include "utils.h"
-#include "time_manager.h"
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
-// Data stored in RTC memory is not erased during deep sleep and only presit until reset.
-// Hence it it better to use EEPROM or flash memory to store the data.
-
-// use this variable to create unique picture name while saving in SD card
-// this variable will be stored in the RTC memory (8Kb) and persist after deep sleep
-// pay attention to the value because it can overflow. 
-//RTC_DATA_ATTR uint8_t pictureNumberSaving;
-//
-//// use this variable to keep track of picture(s) that has been sent to phone
-//RTC_DATA_ATTR uint8_t pictureNumberTransmitted = 0;
-
-static SemaphoreHandle_t _sd_mmc_mutex = NULL;
-
-/**
- * Initialize the SD card module.
- */
-bool init_sd_card() {
- // start SD card and verify for the card.
- // setting, true disable the FLASH LED connected to GPIO4
-  debug("init_sd_card: starting SD card");
-  if(!SD_MMC.begin("/sdcard", true)){
-    Serial.println("init_sd_card: sd card mount failed");
-    return false;
-  }
-  
-  uint8_t cardType = SD_MMC.cardType();
-  if(cardType == CARD_NONE){
-    Serial.println("init_sd_card: no sd card attached");
-    return false;
-  }
-
-  sd_total_space();
-  sd_used_space();
-  sd_free_space();
-  
-  // create the MUTEX for SD_MMC access. Errors when two processes uses SD_MMC at once.
-  if(_sd_mmc_mutex == NULL){
-    _sd_mmc_mutex = xSemaphoreCreateMutex();
-    // xSemaphoreGive(_sd_mmc_mutex);
-  }
-  return true;
-}
-
-/**
- * Get SD_MMC and lock the mutex.
- */
-void acquire_sd_mmc() {
-  xSemaphoreTake(_sd_mmc_mutex, portMAX_DELAY);
-}
-
-/**
- * Release the SD_MMC mutex.
- */
-void release_sd_mmc() {
-  xSemaphoreGive(_sd_mmc_mutex);
-}
-
-
-uint32_t get_4_bytes_eeprom(uint8_t start_address) {
-  uint32_t tp = 0;
-
-  tp = EEPROM.read(start_address);
-  tp |= EEPROM.read(start_address + 1) << 8;
-  tp |= EEPROM.read(start_address + 2) << 16;
-  tp |= EEPROM.read(start_address + 3) << 24;
-  return tp;
-}
-
-void set_4_bytes_eeprom(uint8_t start_address, uint32_t value) {
-  EEPROM.write(start_address, (uint8_t)(value & 0x000F));
-  EEPROM.write(start_address, (uint8_t)(value & 0x00F0));
-  EEPROM.write(start_address, (uint8_t)(value & 0x0F00));
-  EEPROM.write(start_address, (uint8_t)(value & 0xF000));
-  EEPROM.commit();
-}
-
-/**
- * Save the content of the camera buffer in the SD card.
- * @param: FS object
- * @param: Pointer to camera buffer structure.
- */
-bool save_image_to_sd_card(fs::FS &fs, camera_fb_t * fb) {
-  if (fb == NULL) {
-    Serial.println("save_image_to_sd_card: null image buffer");
-    return false;
-  }
-  
-  // Path where new picture will be saved in SD Card
-  show_current_rtc_time();
-  String path = "/" + String(get_rtc_epoch_time(), 10) +".jpg";
-  Serial.printf("save_image_to_sd_card: file name: %s\n", path.c_str());
-
-  // get the file object to write the image data to SD card 
-  File file = fs.open(path.c_str(), FILE_WRITE);
-  
-  if(!file){
-    Serial.println("save_image_to_sd_card: failed to open file");
-    return false;
-  }
-  else {
-    file.write(fb->buf, fb->len); // payload (image), payload length
-    Serial.println("save_image_to_sd_card: image saved");
-  }
-
-  // close the file
-  file.close();
-  return true;
-}
-
-
-/**
- * List the files and directory of the SD Card.
- * @param: FS object
- * @param: directory name (const char *)
- * @param: levels (uint8_t)
- * reference: https://github.com/espressif/arduino-esp32/blob/master/libraries/SD_MMC/examples/SDMMC_Test/SDMMC_Test.ino
- */
-void sd_list_dir(fs::FS &fs, const char * dirname, uint8_t levels){
-    Serial.printf("Listing directory: %s\n", dirname);
-
-    File root = fs.open(dirname);
-    if(!root){
-        Serial.println("Failed to open directory");
-        return;
-    }
-    if(!root.isDirectory()){
-        Serial.println("Not a directory");
-        return;
-    }
-
-    File file = root.openNextFile();
-    while(file){
-        if(file.isDirectory()){
-            Serial.print("  DIR : ");
-            Serial.println(file.name());
-            if(levels){
-                sd_list_dir(fs, file.name(), levels -1);
-            }
-        } else {
-            Serial.print("  FILE: ");
-            Serial.print(file.name());
-            Serial.print("  SIZE: ");
-            Serial.println(file.size());
-        }
-        file = root.openNextFile();
-    }
-}
-
-
-/**
- * Get the next file in the directory.
- * @param: FS object
- * @param: directory name (const char *)
- * @param: pointer to the FS File 
- * @return boolean
- */
-bool sd_get_next_file(fs::FS &fs, const char * dirname, File * my_file){
-  File root = fs.open(dirname);
-
-  if(!root){
-   debug("sd_get_next_file: failed to open directory");
-    return false;
-  }
-
-  if(!root.isDirectory()){
-    Serial.printf("sd_get_next_file: %s is not a directory\n", dirname);
-    return false;
-  }
-
-  // open the next file in the directory
-  File file = root.openNextFile();
-  while(file){
-    if(!file.isDirectory()){
-      Serial.print("  FILE: ");
-      Serial.print(file.name());
-      Serial.print("  SIZE: ");
-      Serial.println(file.size());
-      // Serial.printf("sd_get_next_file: current file address 0x%x, current file value 0x%x\n", &file, file);
-      *my_file = file;
-      // root.close();
-      return true;
-    }
-    file = root.openNextFile();
-  }
-}
-
-
-/**
- * Read file from SD card and echo it to Serial monitor.
- * @param: FS
- * @param: file path (const char *)
- */
-void sd_read_file(fs::FS &fs, const char * path){
-    Serial.printf("Reading file: %s\n", path);
-
-    File file = fs.open(path);
-    if(!file){
-        Serial.println("Failed to open file for reading");
-        return;
-    }
-
-    Serial.print("Read from file: ");
-    while(file.available()){
-        Serial.write(file.read());
-    }
-}
-
-/**
- * Delete a file from the SD card.
- * @param: FS object
- * @param: file path (const char *)
- */
-void sd_delete_file(fs::FS &fs, const char * path){
-    Serial.printf("sd_delete_file: deleting file: %s\n", path);
-    if(fs.remove(path)){
-        debug("File deleted");
-    } else {
-        Serial.println("sd_delete_file: delete failed");
-    }
-}
-
-
-/**
- * Get the used space of the sd card.
- * @return: uint64_t
- */
-uint64_t get_sd_used_space(){
-  return  SD_MMC.usedBytes() / (1024 * 1024);
-}
-
-/**
- * Print the used space of the SD card.
- */
-void sd_used_space(){
-  Serial.printf("SD used space: %lluMB\n", get_sd_used_space());
-}
-
-/**
- * Get total space of the sd card. 
- * @return uint64_t
- */
-uint64_t get_sd_total_space(){
-  return SD_MMC.totalBytes() / (1024 * 1024);
-}
-
-/** 
- * Print the total space of the SD Card. 
- */
-void sd_total_space(){
-  Serial.printf("SD total space: %lluMB\n", get_sd_total_space());
-}
-
-/**
- * Get free space of the sd card. 
- * @return uint64_t
- */
-uint64_t get_sd_free_space(){
-  return get_sd_total_space() - get_sd_used_space();
-}
-
-/**
- * Print the free space of the SD card.
- */
-void sd_free_space(){
-  Serial.printf("SD free space: %lluMB\n", get_sd_free_space());
-}
+#include "sd_card.h"
+#include "utils.h"
+#include "time_manager.h"
+#include "metrics.h"
+#include "image_index.h"
+#include "sd_capacity.h"
+#include "mem_pool.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "rom/crc.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Data stored in RTC memory is not erased during deep sleep and only presit until reset.
+// Hence it it better to use EEPROM or flash memory to store the data.
+
+// use this variable to create unique picture name while saving in SD card
+// this variable will be stored in the RTC memory (8Kb) and persist after deep sleep
+// pay attention to the value because it can overflow. 
+//RTC_DATA_ATTR uint8_t pictureNumberSaving;
+//
+//// use this variable to keep track of picture(s) that has been sent to phone
+//RTC_DATA_ATTR uint8_t pictureNumberTransmitted = 0;
+
+static SemaphoreHandle_t _sd_mmc_mutex = NULL;
+
+// bounce buffer in internal DMA capable RAM, frame buffers in PSRAM cannot be used by the SDMMC DMA
+static _mem_block_t * _sd_dma_block = NULL;
+static_assert(SD_WRITE_CHUNK_SIZE <= MEM_POOL_DMA_BLOCK_SIZE, "SD write chunk does not fit a DMA pool block");
+
+/**
+ * Initialize the SD card module.
+ */
+bool init_sd_card() {
+ // start SD card and verify for the card.
+ // setting, true disable the FLASH LED connected to GPIO4
+  LOG_D(LOG_MODULE_SD, "init_sd_card: starting SD card");
+  if(!SD_MMC.begin(SD_MOUNT_POINT, true)){
+    Serial.println("init_sd_card: sd card mount failed");
+    return false;
+  }
+  
+  uint8_t cardType = SD_MMC.cardType();
+  if(cardType == CARD_NONE){
+    Serial.println("init_sd_card: no sd card attached");
+    return false;
+  }
+
+  // replay the image index and clean up after an interrupted write or upload
+  if(!image_index_init(SD_MMC)) {
+    Serial.println("init_sd_card: image index init failed");
+  }
+
+  // the cached space accounting, the card is only measured after a power-on reset or a long time.
+  // After the index, which is accounted apart and may delete unfinished files first.
+  sd_capacity_init();
+  
+  // create the MUTEX for SD_MMC access. Errors when two processes uses SD_MMC at once.
+  if(_sd_mmc_mutex == NULL){
+    _sd_mmc_mutex = xSemaphoreCreateMutex();
+    // xSemaphoreGive(_sd_mmc_mutex);
+  }
+
+  // keep the write bounce buffer for the whole wake, sd_write_buffer falls back to unaligned writes without it
+  if(_sd_dma_block == NULL) {
+    _sd_dma_block = mem_pool_get(MEM_POOL_DMA);
+    if(_sd_dma_block == NULL) {
+      Serial.println("init_sd_card: no DMA write buffer");
+    }
+  }
+  return true;
+}
+
+/**
+ * Get SD_MMC and lock the mutex.
+ */
+void acquire_sd_mmc() {
+  xSemaphoreTake(_sd_mmc_mutex, portMAX_DELAY);
+}
+
+/**
+ * Get SD_MMC and lock the mutex, waiting at most timeout_ms.
+ * @param: uint32_t timeout in milliseconds
+ * @return: boolean, false if the mutex is still held by another task
+ */
+bool acquire_sd_mmc_timeout(uint32_t timeout_ms) {
+  // the card was never initialized, there is no file operation to wait for
+  if(_sd_mmc_mutex == NULL) {
+    return true;
+  }
+  return xSemaphoreTake(_sd_mmc_mutex, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+/**
+ * Release the SD_MMC mutex.
+ */
+void release_sd_mmc() {
+  xSemaphoreGive(_sd_mmc_mutex);
+}
+
+
+/**
+ * Save the content of the camera buffer in the SD card.
+ * @param: FS object
+ * @param: Pointer to camera buffer structure.
+ * @param: _image_priority_t upload priority class of the image
+ * @param: uint32_t * id of the saved image, can be NULL
+ */
+bool save_image_to_sd_card(fs::FS &fs, camera_fb_t * fb, _image_priority_t priority, uint32_t * image_id) {
+  if (fb == NULL) {
+    Serial.println("save_image_to_sd_card: null image buffer");
+    return false;
+  }
+  
+  // Path where new picture will be saved in SD Card
+  show_current_rtc_time();
+  uint32_t id = image_index_new_id(get_rtc_epoch_time());
+  char temp_path[24];
+  char image_path[24];
+  image_index_temp_path(id, temp_path, sizeof(temp_path));
+  image_index_image_path(id, image_path, sizeof(image_path));
+  Serial.printf("save_image_to_sd_card: file name: %s\n", image_path);
+
+  // never let a full card stop the capture, old or low priority images give way to the new one
+  if(!sd_capacity_make_room(fs, fb->len)) {
+    Serial.println("save_image_to_sd_card: card full");
+    return false;
+  }
+
+  // the index knows about the image before any data is written, so recovery can clean up after a power loss
+  if(!image_index_begin(fs, id, priority)) {
+    Serial.println("save_image_to_sd_card: failed to update the index");
+    return false;
+  }
+
+  // write under the temporary name, the image only gets its final name once it is complete
+  _sd_write_stats_t stats;
+  if(!sd_write_buffer(temp_path, fb->buf, fb->len, &stats)) {
+    Serial.println("save_image_to_sd_card: failed to write image");
+    image_index_set_state(fs, id, IMAGE_REMOVED);
+    return false;
+  }
+  metrics_sd_write_latency(stats.elapsed_us / 1000);
+
+  if(!fs.rename(temp_path, image_path)) {
+    Serial.println("save_image_to_sd_card: failed to rename image");
+    fs.remove(temp_path);
+    image_index_set_state(fs, id, IMAGE_REMOVED);
+    return false;
+  }
+
+  sd_capacity_add(fb->len);
+
+  // without the commit record the image is still recovered at the next startup
+  // the content hash lets the phone recognize an image it already has after a failed handshake
+  uint32_t hash = crc32_le(0, fb->buf, fb->len);
+  if(!image_index_commit(fs, id, fb->len, hash)) {
+    Serial.println("save_image_to_sd_card: failed to commit image, recovered at next start");
+  }
+
+  Serial.println("save_image_to_sd_card: image saved");
+  if(image_id != NULL) {
+    *image_id = id;
+  }
+  return true;
+}
+
+/**
+ * Save the preview of a committed image in the SD card.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: Pointer to the preview camera buffer.
+ */
+bool save_preview_to_sd_card(fs::FS &fs, uint32_t image_id, camera_fb_t * fb) {
+  if (fb == NULL) {
+    Serial.println("save_preview_to_sd_card: null preview buffer");
+    return false;
+  }
+
+  char temp_path[24];
+  char preview_path[24];
+  image_index_preview_path(image_id, temp_path, sizeof(temp_path), true);
+  image_index_preview_path(image_id, preview_path, sizeof(preview_path), false);
+
+  // like the image, a preview only gets its final name once it is complete
+  if(!sd_write_buffer(temp_path, fb->buf, fb->len, NULL)) {
+    Serial.println("save_preview_to_sd_card: failed to write preview");
+    return false;
+  }
+
+  if(!fs.rename(temp_path, preview_path)) {
+    Serial.println("save_preview_to_sd_card: failed to rename preview");
+    fs.remove(temp_path);
+    return false;
+  }
+
+  sd_capacity_add(fb->len);
+  LOG_D(LOG_MODULE_SD, "save_preview_to_sd_card: %s, %d bytes", preview_path, fb->len);
+  return true;
+}
+
+
+/**
+ * Write a buffer to a new file in the SD card with the strategy of sd_writer.h: the file size is
+ * preallocated and the data goes through a DMA capable bounce buffer in SD_WRITE_CHUNK_SIZE chunks.
+ * @param: file path relative to the SD card root (const char *)
+ * @param: pointer to the data (const uint8_t *)
+ * @param: data length (size_t)
+ * @param: pointer to the write statistics, can be NULL
+ * @return: boolean
+ */
+bool sd_write_buffer(const char * path, const uint8_t * data, size_t length, _sd_write_stats_t * stats) {
+  if(path == NULL || data == NULL) {
+    LOG_E(LOG_MODULE_SD, "sd_write_buffer: null path or data");
+    return false;
+  }
+
+  char vfs_path[64];
+  snprintf(vfs_path, sizeof(vfs_path), "%s%s", SD_MOUNT_POINT, path);
+
+  int64_t started = esp_timer_get_time();
+  int fd = open(vfs_path, O_WRONLY | O_CREAT | O_TRUNC);
+  if(fd < 0) {
+    LOG_E(LOG_MODULE_SD, "sd_write_buffer: failed to open %s", vfs_path);
+    return false;
+  }
+
+  _sd_write_strategy_t strategy = sd_writer_default_strategy(
+    _sd_dma_block != NULL ? _sd_dma_block->data : NULL, MEM_POOL_DMA_BLOCK_SIZE);
+  _sd_writer_result_t result;
+  if(!sd_writer_write(fd, data, length, &strategy, &result)) {
+    LOG_E(LOG_MODULE_SD, "sd_write_buffer: write failed at offset %d", result.failed_offset);
+    close(fd);
+    unlink(vfs_path);
+    return false;
+  }
+  if(!result.preallocated) {
+    LOG_W(LOG_MODULE_SD, "sd_write_buffer: preallocation failed, written without it");
+  }
+
+  if(close(fd) != 0) {
+    LOG_E(LOG_MODULE_SD, "sd_write_buffer: failed to close %s", vfs_path);
+    unlink(vfs_path);
+    return false;
+  }
+
+  uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - started);
+  if(stats != NULL) {
+    stats->bytes_written = length;
+    stats->chunks = result.chunks;
+    stats->elapsed_us = elapsed_us;
+  }
+
+  // bytes per microsecond is MB/s
+  LOG_I(LOG_MODULE_SD, "sd_write_buffer: %d bytes in %d chunks, %.2f MB/s", length, result.chunks,
+    elapsed_us > 0 ? (float)length / elapsed_us : 0.0f);
+  return true;
+}
+
+/**
+ * List the files and directory of the SD Card.
+ * @param: FS object
+ * @param: directory name (const char *)
+ * @param: levels (uint8_t)
+ * reference: https://github.com/espressif/arduino-esp32/blob/master/libraries/SD_MMC/examples/SDMMC_Test/SDMMC_Test.ino
+ */
+void sd_list_dir(fs::FS &fs, const char * dirname, uint8_t levels){
+    Serial.printf("Listing directory: %s\n", dirname);
+
+    File root = fs.open(dirname);
+    if(!root){
+        Serial.println("Failed to open directory");
+        return;
+    }
+    if(!root.isDirectory()){
+        Serial.println("Not a directory");
+        return;
+    }
+
+    File file = root.openNextFile();
+    while(file){
+        if(file.isDirectory()){
+            Serial.print("  DIR : ");
+            Serial.println(file.name());
+            if(levels){
+                sd_list_dir(fs, file.name(), levels -1);
+            }
+        } else {
+            Serial.print("  FILE: ");
+            Serial.print(file.name());
+            Serial.print("  SIZE: ");
+            Serial.println(file.size());
+        }
+        file = root.openNextFile();
+    }
+}
+
+
+/**
+ * Get the next file in the directory.
+ * @param: FS object
+ * @param: directory name (const char *)
+ * @param: pointer to the FS File 
+ * @return boolean
+ */
+bool sd_get_next_file(fs::FS &fs, const char * dirname, File * my_file){
+  File root = fs.open(dirname);
+
+  if(!root){
+   LOG_D(LOG_MODULE_SD, "sd_get_next_file: failed to open directory");
+    return false;
+  }
+
+  if(!root.isDirectory()){
+    Serial.printf("sd_get_next_file: %s is not a directory\n", dirname);
+    return false;
+  }
+
+  // open the next file in the directory
+  File file = root.openNextFile();
+  while(file){
+    if(!file.isDirectory()){
+      Serial.print("  FILE: ");
+      Serial.print(file.name());
+      Serial.print("  SIZE: ");
+      Serial.println(file.size());
+      // Serial.printf("sd_get_next_file: current file address 0x%x, current file value 0x%x\n", &file, file);
+      *my_file = file;
+      // root.close();
+      return true;
+    }
+    file = root.openNextFile();
+  }
+}
+
+
+/**
+ * Read file from SD card and echo it to Serial monitor.
+ * @param: FS
+ * @param: file path (const char *)
+ */
+void sd_read_file(fs::FS &fs, const char * path){
+    Serial.printf("Reading file: %s\n", path);
+
+    File file = fs.open(path);
+    if(!file){
+        Serial.println("Failed to open file for reading");
+        return;
+    }
+
+    Serial.print("Read from file: ");
+    while(file.available()){
+        Serial.write(file.read());
+    }
+}
+
+/**
+ * Delete a file from the SD card.
+ * @param: FS object
+ * @param: file path (const char *)
+ */
+void sd_delete_file(fs::FS &fs, const char * path){
+    Serial.printf("sd_delete_file: deleting file: %s\n", path);
+    if(fs.remove(path)){
+        LOG_D(LOG_MODULE_SD, "File deleted");
+    } else {
+        Serial.println("sd_delete_file: delete failed");
+    }
+}
+
+
+/**
+ * Get the used space of the sd card.
+ * @return: uint64_t
+ */
+uint64_t get_sd_used_space(){
+  return sd_capacity_used_bytes() / (1024 * 1024);
+}
+
+/**
+ * Print the used space of the SD card.
+ */
+void sd_used_space(){
+  Serial.printf("SD used space: %lluMB\n", get_sd_used_space());
+}
+
+/**
+ * Get total space of the sd card. 
+ * @return uint64_t
+ */
+uint64_t get_sd_total_space(){
+  return sd_capacity_total_bytes() / (1024 * 1024);
+}
+
+/** 
+ * Print the total space of the SD Card. 
+ */
+void sd_total_space(){
+  Serial.printf("SD total space: %lluMB\n", get_sd_total_space());
+}
+
+/**
+ * Get free space of the sd card. 
+ * @return uint64_t
+ */
+uint64_t get_sd_free_space(){
+  return get_sd_total_space() - get_sd_used_space();
+}
+
+/**
+ * Print the free space of the SD card.
+ */
+void sd_free_space(){
+  Serial.printf("SD free space: %lluMB\n", get_sd_free_space());
+}
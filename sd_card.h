@@ -1,101 +1,136 @@
-#ifndef __SD_CARD_H__
-#define __SD_CARD_H__
-
-#include "Arduino.h"
-#include "FS.h"                // SD Card ESP32
-#include "SD_MMC.h"            // SD Card ESP32
-#include <EEPROM.h>            // read and write from flash memory
-#include "esp_camera.h"
-
-// define the number of bytes you want to access
-#define EEPROM_SIZE 4
-
-/**
- * Initialize the SD card module.
- */
-bool init_sd_card();
-
-/**
- * Save the content of the camera buffer in the SD card.
- * @param: FS object
- * @param: Pointer to camera buffer structure.
- */
-bool save_image_to_sd_card(fs::FS &fs, camera_fb_t * fb);
-
-/**
- * List the files and directory of the SD Card.
- * @param: FS object
- * @param: directory name (const char *)
- * @param: levels (uint8_t)
- * reference: https://github.com/espressif/arduino-esp32/blob/master/libraries/SD_MMC/examples/SDMMC_Test/SDMMC_Test.ino
- */
-void sd_list_dir(fs::FS &fs, const char * dirname, uint8_t levels);
-
-
-/**
- * Read file from SD card and echo it to Serial monitor.
- * @param: FS
- * @param: file path (const char *)
- */
-void sd_read_file(fs::FS &fs, const char * path);
-
-/**
- * Delete a file from the SD card.
- * @param: FS object
- * @param: file path (const char *)
- */
-void sd_delete_file(fs::FS &fs, const char * path);
-
-/**
- * Get the used space of the sd card.
- * @return: uint64_t
- */
-uint64_t get_sd_used_space();
-
-/**
- * Print the used space of the SD card.
- */
-void sd_used_space();
-
-/**
- * Get total space of the sd card. 
- * @return uint64_t
- */
-uint64_t get_sd_total_space();
-
-/** 
- * Print the total space of the SD Card. 
- */
-void sd_total_space();
-
-/**
- * Get free space of the sd card. 
- * @return uint64_t
- */
-uint64_t get_sd_free_space();
-
-/**
- * Print the free space of the SD card.
- */
-void sd_free_space();
-
-/**
- * Get the next file in the directory.
- * @param: FS object
- * @param: directory name (const char *)
- * @param: pointer to the FS:File 
- * @return boolean
- */
-bool sd_get_next_file(fs::FS &fs, const char * dirname, File * my_file);
-
-/**
- * Get SD_MMC and lock the mutex.
- */
-void acquire_sd_mmc();
-
-/**
- * Release the SD_MMC mutex.
- */
-void release_sd_mmc();
-
-#endif
+#ifndef __SD_CARD_H__
+#define __SD_CARD_H__
+
+#include "Arduino.h"
+#include "FS.h"                // SD Card ESP32
+#include "SD_MMC.h"            // SD Card ESP32
+#include "esp_camera.h"
+#include "image_index.h"
+#include "sd_writer.h"
+
+// VFS mount point of the SD card
+#define SD_MOUNT_POINT "/sdcard"
+
+typedef struct {
+    uint32_t bytes_written;
+    uint32_t chunks;
+    uint32_t elapsed_us;
+}_sd_write_stats_t;
+
+/**
+ * Initialize the SD card module.
+ */
+bool init_sd_card();
+
+/**
+ * Save the content of the camera buffer in the SD card.
+ * @param: FS object
+ * @param: Pointer to camera buffer structure.
+ * @param: _image_priority_t upload priority class of the image
+ * @param: uint32_t * id of the saved image, can be NULL
+ */
+bool save_image_to_sd_card(fs::FS &fs, camera_fb_t * fb, _image_priority_t priority, uint32_t * image_id);
+
+/**
+ * Save the preview of a committed image in the SD card.
+ * @param: FS object
+ * @param: uint32_t image id
+ * @param: Pointer to the preview camera buffer.
+ */
+bool save_preview_to_sd_card(fs::FS &fs, uint32_t image_id, camera_fb_t * fb);
+
+/**
+ * Write a buffer to a new file in the SD card with the strategy of sd_writer.h: the file size is
+ * preallocated and the data goes through a DMA capable bounce buffer in SD_WRITE_CHUNK_SIZE chunks.
+ * @param: file path relative to the SD card root (const char *)
+ * @param: pointer to the data (const uint8_t *)
+ * @param: data length (size_t)
+ * @param: pointer to the write statistics, can be NULL
+ * @return: boolean
+ */
+bool sd_write_buffer(const char * path, const uint8_t * data, size_t length, _sd_write_stats_t * stats);
+
+/**
+ * List the files and directory of the SD Card.
+ * @param: FS object
+ * @param: directory name (const char *)
+ * @param: levels (uint8_t)
+ * reference: https://github.com/espressif/arduino-esp32/blob/master/libraries/SD_MMC/examples/SDMMC_Test/SDMMC_Test.ino
+ */
+void sd_list_dir(fs::FS &fs, const char * dirname, uint8_t levels);
+
+
+/**
+ * Read file from SD card and echo it to Serial monitor.
+ * @param: FS
+ * @param: file path (const char *)
+ */
+void sd_read_file(fs::FS &fs, const char * path);
+
+/**
+ * Delete a file from the SD card.
+ * @param: FS object
+ * @param: file path (const char *)
+ */
+void sd_delete_file(fs::FS &fs, const char * path);
+
+/**
+ * Get the used space of the sd card.
+ * @return: uint64_t
+ */
+uint64_t get_sd_used_space();
+
+/**
+ * Print the used space of the SD card.
+ */
+void sd_used_space();
+
+/**
+ * Get total space of the sd card. 
+ * @return uint64_t
+ */
+uint64_t get_sd_total_space();
+
+/** 
+ * Print the total space of the SD Card. 
+ */
+void sd_total_space();
+
+/**
+ * Get free space of the sd card. 
+ * @return uint64_t
+ */
+uint64_t get_sd_free_space();
+
+/**
+ * Print the free space of the SD card.
+ */
+void sd_free_space();
+
+/**
+ * Get the next file in the directory.
+ * @param: FS object
+ * @param: directory name (const char *)
+ * @param: pointer to the FS:File 
+ * @return boolean
+ */
+bool sd_get_next_file(fs::FS &fs, const char * dirname, File * my_file);
+
+/**
+ * Get SD_MMC and lock the mutex.
+ */
+void acquire_sd_mmc();
+
+/**
+ * Get SD_MMC and lock the mutex, waiting at most timeout_ms.
+ * @param: uint32_t timeout in milliseconds
+ * @return: boolean, false if the mutex is still held by another task
+ */
+bool acquire_sd_mmc_timeout(uint32_t timeout_ms);
+
+/**
+ * Release the SD_MMC mutex.
+ */
+void release_sd_mmc();
+
+#endif
@@ -0,0 +1,89 @@
+#include "sd_writer.h"
+
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Strategy used by sd_write_buffer: preallocation and SD_WRITE_CHUNK_SIZE chunks.
+ * @param: uint8_t * bounce buffer, can be NULL
+ * @param: size_t bounce buffer size
+ * @return: _sd_write_strategy_t
+ */
+_sd_write_strategy_t sd_writer_default_strategy(uint8_t * bounce, size_t bounce_size) {
+  _sd_write_strategy_t strategy;
+  strategy.chunk_size = SD_WRITE_CHUNK_SIZE;
+  strategy.preallocate = true;
+  strategy.bounce = bounce;
+  strategy.bounce_size = bounce_size;
+  return strategy;
+}
+
+/**
+ * Size of the chunks written with a strategy for a buffer of the given length.
+ * @param: const _sd_write_strategy_t * strategy
+ * @param: size_t data length
+ * @return: size_t chunk size, whole sectors unless the whole buffer is written at once
+ */
+size_t sd_writer_chunk_size(const _sd_write_strategy_t * strategy, size_t length) {
+  if(strategy->chunk_size == 0 || strategy->chunk_size >= length) {
+    return length;
+  }
+  size_t chunk = strategy->chunk_size - strategy->chunk_size % SD_SECTOR_SIZE;
+  return chunk > 0 ? chunk : SD_SECTOR_SIZE;
+}
+
+/**
+ * Write a buffer at the start of an open, empty file. A failed preallocation is not an error, the
+ * data is then written without it and result->preallocated is false.
+ * @param: int file descriptor opened for writing
+ * @param: const uint8_t * data
+ * @param: size_t data length
+ * @param: const _sd_write_strategy_t * strategy
+ * @param: _sd_writer_result_t * result, can be NULL
+ * @return: boolean, false if a write call failed
+ */
+bool sd_writer_write(int fd, const uint8_t * data, size_t length, const _sd_write_strategy_t * strategy,
+  _sd_writer_result_t * result) {
+  _sd_writer_result_t local;
+  if(result == NULL) {
+    result = &local;
+  }
+  result->chunks = 0;
+  result->preallocated = false;
+  result->failed_offset = 0;
+
+  // seeking past the end in write mode expands the file, FAT allocates the whole cluster chain now
+  // instead of one cluster at a time during the writes.
+  if(strategy->preallocate && length > 0) {
+    result->preallocated = lseek(fd, length, SEEK_SET) == (off_t)length && lseek(fd, 0, SEEK_SET) == 0;
+    if(!result->preallocated) {
+      lseek(fd, 0, SEEK_SET);
+    }
+  }
+
+  size_t chunk_size = sd_writer_chunk_size(strategy, length);
+  bool bounce = strategy->bounce != NULL && strategy->bounce_size >= chunk_size;
+  size_t offset = 0;
+  while(offset < length) {
+    size_t chunk = length - offset;
+    if(chunk > chunk_size) {
+      chunk = chunk_size;
+    }
+
+    const uint8_t * source = data + offset;
+    if(bounce) {
+      memcpy(strategy->bounce, source, chunk);
+      source = strategy->bounce;
+    }
+
+    ssize_t written = write(fd, source, chunk);
+    if(written != (ssize_t)chunk) {
+      result->failed_offset = offset;
+      return false;
+    }
+    offset += chunk;
+    result->chunks++;
+  }
+  return true;
+}
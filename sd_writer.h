@@ -0,0 +1,67 @@
+#ifndef __SD_WRITER_H__
+#define __SD_WRITER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Write strategy of the SD card files. It only uses the POSIX file calls that the ESP-IDF VFS maps to
+ * FatFs, and has no Arduino dependency, so the same code writes the images on the camera and runs in
+ * the host benchmark of extras/sd_write_bench against a file-backed image.
+ *
+ * A file is written by expanding it to its final size first, FAT then allocates the whole cluster chain
+ * at once instead of one cluster per write, and by writing the data in chunks that are a whole number
+ * of sectors. Every chunk but the last one starts and ends on a sector boundary, FatFs hands them to
+ * the SDMMC driver as multi block transfers without going through its sector buffer.
+ */
+
+// FatFs writes whole sectors straight to the card when the file offset and length are sector aligned
+#define SD_SECTOR_SIZE 512
+
+// bytes handed to the SDMMC driver per write, a multi block transfer of 16 sectors
+#define SD_WRITE_CHUNK_SIZE (16 * SD_SECTOR_SIZE)
+
+typedef struct {
+    size_t chunk_size;               // bytes per write call, rounded down to whole sectors, 0 writes the buffer at once
+    bool preallocate;                // expand the file to its final size before writing
+    uint8_t * bounce;                // every chunk is copied through it if not NULL, e.g. DMA capable RAM
+    size_t bounce_size;              // must hold a whole chunk, the bounce buffer is skipped otherwise
+}_sd_write_strategy_t;
+
+typedef struct {
+    uint32_t chunks;                 // write calls issued
+    bool preallocated;               // the file was expanded before writing
+    size_t failed_offset;            // offset of the failing chunk, only valid if the write failed
+}_sd_writer_result_t;
+
+/**
+ * Strategy used by sd_write_buffer: preallocation and SD_WRITE_CHUNK_SIZE chunks.
+ * @param: uint8_t * bounce buffer, can be NULL
+ * @param: size_t bounce buffer size
+ * @return: _sd_write_strategy_t
+ */
+_sd_write_strategy_t sd_writer_default_strategy(uint8_t * bounce, size_t bounce_size);
+
+/**
+ * Size of the chunks written with a strategy for a buffer of the given length.
+ * @param: const _sd_write_strategy_t * strategy
+ * @param: size_t data length
+ * @return: size_t chunk size, whole sectors unless the whole buffer is written at once
+ */
+size_t sd_writer_chunk_size(const _sd_write_strategy_t * strategy, size_t length);
+
+/**
+ * Write a buffer at the start of an open, empty file. A failed preallocation is not an error, the
+ * data is then written without it and result->preallocated is false.
+ * @param: int file descriptor opened for writing
+ * @param: const uint8_t * data
+ * @param: size_t data length
+ * @param: const _sd_write_strategy_t * strategy
+ * @param: _sd_writer_result_t * result, can be NULL
+ * @return: boolean, false if a write call failed
+ */
+bool sd_writer_write(int fd, const uint8_t * data, size_t length, const _sd_write_strategy_t * strategy,
+  _sd_writer_result_t * result);
+
+#endif
@@ -1,41 +1,39 @@
-#include "utils.h"
-
-/*
- * This is our debug function that spits out messages and errors 
- * to the serial monitor
- */
-void debug(const char * message){
-  if (DEBUG) {
-    Serial.println(message);
-  }
-}
-
-// void debug(const char * format, ...) {
-//     va_list arg;
-
-//     /* Write the error message */
-//     va_start(arg, format);
-//     Serial.printf(format, arg);
-//     va_end(arg);
-// }
-
-
-/**
- * Put's the ESP32 to deep sleep.
- */
-void go_to_deep_sleep(long sleep_time_seconds) {
-  Serial.println("go_to_deep_sleep");
-  
-  // configure the timer to wake up
-  esp_sleep_enable_timer_wakeup(sleep_time_seconds * uS_TO_S_FACTOR);
-
-  // go to sleep 
-  esp_deep_sleep_start();
-}
-
-/**
- * Delay function, takes milliseconds argument for delay and calss VTaskDelay
- */
-void delay_ms(uint32_t ms){
-  vTaskDelay(ms / portTICK_PERIOD_MS); 
-}
+#include "utils.h"
+#include "metrics.h"
+#include "kv_store.h"
+#include "mem_pool.h"
+#include "resource_monitor.h"
+#include "energy.h"
+#include "wake_source.h"
+
+/**
+ * Put's the ESP32 to deep sleep.
+ */
+void go_to_deep_sleep(long sleep_time_seconds) {
+  Serial.println("go_to_deep_sleep");
+
+  // close the wake cycle in the metrics before the RTC memory is retained
+  metrics_end_wake();
+  energy_end_wake(sleep_time_seconds);
+  energy_print();
+
+  // the high water marks show if the pools and task stacks are sized right
+  mem_pool_print();
+  resource_monitor_print();
+
+  // write the batched key-value updates to flash
+  kv_commit();
+  
+  // configure the timer and the external triggers to wake up
+  wake_source_arm(sleep_time_seconds);
+
+  // go to sleep 
+  esp_deep_sleep_start();
+}
+
+/**
+ * Delay function, takes milliseconds argument for delay and calss VTaskDelay
+ */
+void delay_ms(uint32_t ms){
+  vTaskDelay(ms / portTICK_PERIOD_MS); 
+}
@@ -0,0 +1,74 @@
+#include "wake_budget.h"
+#include "sd_card.h"
+#include "utils.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const uint32_t _deadlines_ms[WAKE_PHASE_COUNT] = {
+    WAKE_CAPTURE_DEADLINE_MS, WAKE_SYNC_DEADLINE_MS, WAKE_UPLOAD_DEADLINE_MS, WAKE_HOUSEKEEPING_DEADLINE_MS
+};
+
+static uint32_t _sleep_seconds = 0;
+static TaskHandle_t _guard_task = NULL;
+
+/**
+ * Guard task, puts the camera to sleep at the housekeeping deadline if the wake has not ended.
+ */
+static void _wake_guard_task(void * params) {
+  uint32_t remaining = wake_budget_remaining_ms(WAKE_PHASE_HOUSEKEEPING);
+  if(remaining > 0) {
+    vTaskDelay(remaining / portTICK_PERIOD_MS);
+  }
+
+  Serial.printf("wake_guard: wake budget of %u ms used up, going to sleep\n", WAKE_HOUSEKEEPING_DEADLINE_MS);
+
+  // let a file or index update finish, the holder inherits the guard priority meanwhile. The mutex is
+  // kept so no task starts another update before the sleep.
+  if(!acquire_sd_mmc_timeout(WAKE_GUARD_SD_TIMEOUT_MS)) {
+    Serial.println("wake_guard: SD card still busy, going to sleep anyway");
+  }
+  go_to_deep_sleep(_sleep_seconds);
+  vTaskDelete(NULL);
+}
+
+/**
+ * Start the guard task which ends the wake at the housekeeping deadline. Call once from setup().
+ * @param: uint32_t deep sleep time in seconds after a forced end of the wake
+ */
+void wake_budget_start(uint32_t sleep_seconds) {
+  _sleep_seconds = sleep_seconds;
+  if(_guard_task != NULL) {
+    return;
+  }
+
+  // above the camera and Bluetooth tasks so a busy task can not hold off the end of the wake
+  if(xTaskCreate(_wake_guard_task, "wake guard", WAKE_GUARD_STACK_SIZE, NULL, configMAX_PRIORITIES - 2,
+    &_guard_task) != pdPASS) {
+    Serial.println("wake_budget_start: failed to create the guard task");
+    _guard_task = NULL;
+  }
+}
+
+/**
+ * Get the time left until the deadline of a phase.
+ * @param: _wake_phase_t phase
+ * @return: uint32_t milliseconds, 0 once the deadline has passed
+ */
+uint32_t wake_budget_remaining_ms(_wake_phase_t phase) {
+  if(phase >= WAKE_PHASE_COUNT) {
+    return 0;
+  }
+
+  uint32_t now = millis();
+  return now < _deadlines_ms[phase] ? _deadlines_ms[phase] - now : 0;
+}
+
+/**
+ * Check if the deadline of a phase has passed.
+ * @param: _wake_phase_t phase
+ * @return: boolean
+ */
+bool wake_budget_expired(_wake_phase_t phase) {
+  return wake_budget_remaining_ms(phase) == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef __WAKE_BUDGET_H__
+#define __WAKE_BUDGET_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+
+/**
+ * Time budget of a wake. Every phase of the wake has a deadline in milliseconds from boot:
+ *
+ *  WAKE_PHASE_CAPTURE      -> the picture is taken and saved, the time sync before it is skipped after
+ *  WAKE_PHASE_SYNC         -> capabilities, metrics and configuration are exchanged with the phone
+ *  WAKE_PHASE_UPLOAD       -> images are uploaded, one after the other, until the queue is empty or the
+ *                             next image can not finish before the deadline. The first image of the
+ *                             session is always started. A transfer still running at the deadline is
+ *                             stopped between two packets.
+ *  WAKE_PHASE_HOUSEKEEPING -> the key-value store is committed and the camera goes to deep sleep
+ *
+ * The index keeps a stopped image committed, so it is uploaded again from the start in a later wake
+ * and nothing is lost. A guard task puts the camera to deep sleep at the housekeeping deadline
+ * whatever the other tasks are doing, which bounds the awake time of every wake. It first takes the
+ * SD card mutex so a FAT or index update in progress can finish, waiting at most
+ * WAKE_GUARD_SD_TIMEOUT_MS for it.
+ */
+
+#define WAKE_CAPTURE_DEADLINE_MS 30000
+#define WAKE_SYNC_DEADLINE_MS 35000
+#define WAKE_UPLOAD_DEADLINE_MS 110000
+#define WAKE_HOUSEKEEPING_DEADLINE_MS 120000
+
+// longest an upload can be given, an image expected to take longer only needs a full window
+#define WAKE_UPLOAD_WINDOW_MS (WAKE_UPLOAD_DEADLINE_MS - WAKE_SYNC_DEADLINE_MS)
+
+#define WAKE_GUARD_STACK_SIZE 4096
+#define WAKE_GUARD_SD_TIMEOUT_MS 5000
+
+typedef enum {
+    WAKE_PHASE_CAPTURE = 0,
+    WAKE_PHASE_SYNC = 1,
+    WAKE_PHASE_UPLOAD = 2,
+    WAKE_PHASE_HOUSEKEEPING = 3,
+    WAKE_PHASE_COUNT = 4
+}_wake_phase_t;
+
+/**
+ * Start the guard task which ends the wake at the housekeeping deadline. Call once from setup().
+ * @param: uint32_t deep sleep time in seconds after a forced end of the wake
+ */
+void wake_budget_start(uint32_t sleep_seconds);
+
+/**
+ * Get the time left until the deadline of a phase.
+ * @param: _wake_phase_t phase
+ * @return: uint32_t milliseconds, 0 once the deadline has passed
+ */
+uint32_t wake_budget_remaining_ms(_wake_phase_t phase);
+
+/**
+ * Check if the deadline of a phase has passed.
+ * @param: _wake_phase_t phase
+ * @return: boolean
+ */
+bool wake_budget_expired(_wake_phase_t phase);
+
+#endif
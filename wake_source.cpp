@@ -0,0 +1,110 @@
+#include "wake_source.h"
+#include "utils.h"
+#include "esp_sleep.h"
+
+#define WAKE_RTC_MAGIC 0x57414B31   // 'WAK1'
+
+typedef struct {
+    uint32_t magic;
+    uint32_t counts[WAKE_SOURCE_COUNT];
+    uint64_t last_ext1_pins;
+}_wake_history_t;
+
+// the counts persist across deep sleep, they are cleared on power-on reset.
+RTC_DATA_ATTR static _wake_history_t _history;
+
+static _wake_source_t _source = WAKE_SOURCE_POWER_ON;
+
+static const char * _source_names[WAKE_SOURCE_COUNT] = {"power on", "timer", "ext0", "ext1", "other"};
+
+/**
+ * Read and record the cause of this wake. Call first thing in setup().
+ * @return: _wake_source_t
+ */
+_wake_source_t wake_source_init() {
+  if(_history.magic != WAKE_RTC_MAGIC) {
+    memset(&_history, 0, sizeof(_history));
+    _history.magic = WAKE_RTC_MAGIC;
+  }
+
+  switch(esp_sleep_get_wakeup_cause()) {
+    case ESP_SLEEP_WAKEUP_UNDEFINED:
+      _source = WAKE_SOURCE_POWER_ON;
+      break;
+    case ESP_SLEEP_WAKEUP_TIMER:
+      _source = WAKE_SOURCE_TIMER;
+      break;
+    case ESP_SLEEP_WAKEUP_EXT0:
+      _source = WAKE_SOURCE_EXT0;
+      break;
+    case ESP_SLEEP_WAKEUP_EXT1:
+      _source = WAKE_SOURCE_EXT1;
+      _history.last_ext1_pins = esp_sleep_get_ext1_wakeup_status();
+      break;
+    default:
+      _source = WAKE_SOURCE_OTHER;
+      break;
+  }
+
+  _history.counts[_source]++;
+  return _source;
+}
+
+/**
+ * Get the cause of this wake.
+ * @return: _wake_source_t
+ */
+_wake_source_t wake_source_get() {
+  return _source;
+}
+
+/**
+ * Check if an external trigger woke the camera.
+ * @return: boolean
+ */
+bool wake_source_is_event() {
+  return _source == WAKE_SOURCE_EXT0 || _source == WAKE_SOURCE_EXT1;
+}
+
+/**
+ * Arm the timer and the external triggers for the next deep sleep.
+ * @param: uint32_t sleep time in seconds
+ */
+void wake_source_arm(uint32_t sleep_seconds) {
+  esp_sleep_enable_timer_wakeup((uint64_t)sleep_seconds * uS_TO_S_FACTOR);
+
+#if WAKE_EXT0_ENABLED
+  rtc_gpio_init(WAKE_EXT0_GPIO);
+  rtc_gpio_set_direction(WAKE_EXT0_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
+  if(WAKE_EXT0_LEVEL) {
+    rtc_gpio_pullup_dis(WAKE_EXT0_GPIO);
+    rtc_gpio_pulldown_en(WAKE_EXT0_GPIO);
+  } else {
+    rtc_gpio_pulldown_dis(WAKE_EXT0_GPIO);
+    rtc_gpio_pullup_en(WAKE_EXT0_GPIO);
+  }
+
+  // a trigger still active would wake the camera right away
+  if(rtc_gpio_get_level(WAKE_EXT0_GPIO) == WAKE_EXT0_LEVEL) {
+    LOG_I(LOG_MODULE_MAIN, "wake_source_arm: trigger on GPIO %d still active, timer only", WAKE_EXT0_GPIO);
+  } else if(esp_sleep_enable_ext0_wakeup(WAKE_EXT0_GPIO, WAKE_EXT0_LEVEL) != ESP_OK) {
+    LOG_W(LOG_MODULE_MAIN, "wake_source_arm: failed to arm ext0");
+  }
+#endif
+
+  if(WAKE_EXT1_MASK != 0 && esp_sleep_enable_ext1_wakeup(WAKE_EXT1_MASK, WAKE_EXT1_MODE) != ESP_OK) {
+    LOG_W(LOG_MODULE_MAIN, "wake_source_arm: failed to arm ext1");
+  }
+}
+
+/**
+ * Print the cause of this wake and the wake counts to Serial.
+ */
+void wake_source_print() {
+  Serial.printf("wake: %s, timer %u, ext0 %u, ext1 %u, power on %u\n", _source_names[_source],
+    _history.counts[WAKE_SOURCE_TIMER], _history.counts[WAKE_SOURCE_EXT0], _history.counts[WAKE_SOURCE_EXT1],
+    _history.counts[WAKE_SOURCE_POWER_ON]);
+  if(_source == WAKE_SOURCE_EXT1) {
+    Serial.printf("wake: ext1 pins 0x%llx\n", _history.last_ext1_pins);
+  }
+}
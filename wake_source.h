@@ -0,0 +1,69 @@
+#ifndef __WAKE_SOURCE_H__
+#define __WAKE_SOURCE_H__
+
+#include "Arduino.h"
+#include "driver/rtc_io.h"
+#include <stdint.h>
+
+/**
+ * Wake sources of the camera. Besides the timer the camera wakes on an external trigger, a PIR
+ * sensor for example, on one pin through ext0 and on a set of pins through ext1. The cause of each
+ * wake is recorded, and a wake by a trigger takes the picture right after boot, before Bluetooth,
+ * the SD card and the rest are started, and saves it with high priority.
+ *
+ * The SD card runs in 1 bit mode, which leaves GPIO 12 and 13 free. Only RTC GPIOs can wake the chip.
+ * A trigger that is still active when the camera goes to sleep is not armed for that sleep, so a
+ * long PIR pulse does not wake the camera again right away.
+ */
+
+#ifndef WAKE_EXT0_ENABLED
+#define WAKE_EXT0_ENABLED 1
+#endif
+#define WAKE_EXT0_GPIO GPIO_NUM_13
+#define WAKE_EXT0_LEVEL 1                 // PIR output is active high, the pin is pulled down
+
+// pins of the ext1 wake, 0 disables it
+#ifndef WAKE_EXT1_MASK
+#define WAKE_EXT1_MASK 0ULL
+#endif
+#define WAKE_EXT1_MODE ESP_EXT1_WAKEUP_ANY_HIGH
+
+typedef enum {
+    WAKE_SOURCE_POWER_ON = 0,            // reset or power on, not a deep sleep wake
+    WAKE_SOURCE_TIMER = 1,
+    WAKE_SOURCE_EXT0 = 2,
+    WAKE_SOURCE_EXT1 = 3,
+    WAKE_SOURCE_OTHER = 4,
+    WAKE_SOURCE_COUNT = 5
+}_wake_source_t;
+
+/**
+ * Read and record the cause of this wake. Call first thing in setup().
+ * @return: _wake_source_t
+ */
+_wake_source_t wake_source_init();
+
+/**
+ * Get the cause of this wake.
+ * @return: _wake_source_t
+ */
+_wake_source_t wake_source_get();
+
+/**
+ * Check if an external trigger woke the camera.
+ * @return: boolean
+ */
+bool wake_source_is_event();
+
+/**
+ * Arm the timer and the external triggers for the next deep sleep.
+ * @param: uint32_t sleep time in seconds
+ */
+void wake_source_arm(uint32_t sleep_seconds);
+
+/**
+ * Print the cause of this wake and the wake counts to Serial.
+ */
+void wake_source_print();
+
+#endif